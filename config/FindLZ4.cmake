@@ -0,0 +1,17 @@
+# - Find LZ4
+# Find the LZ4 compression library includes and library.
+#
+# Once done this will define
+#
+#  LZ4_INCLUDE_DIR    - where to find lz4.h
+#  LZ4_LIBRARY        - the lz4 library
+#  LZ4_FOUND          - True if lz4 was found.
+#
+
+find_path(LZ4_INCLUDE_DIR NAMES lz4.h)
+find_library(LZ4_LIBRARY NAMES lz4 liblz4)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4 REQUIRED_VARS LZ4_LIBRARY LZ4_INCLUDE_DIR)
+
+mark_as_advanced(LZ4_LIBRARY LZ4_INCLUDE_DIR)
@@ -0,0 +1,17 @@
+# - Find zstd
+# Find the Zstandard compression library includes and library.
+#
+# Once done this will define
+#
+#  ZSTD_INCLUDE_DIR    - where to find zstd.h
+#  ZSTD_LIBRARY        - the zstd library
+#  ZSTD_FOUND          - True if zstd was found.
+#
+
+find_path(ZSTD_INCLUDE_DIR NAMES zstd.h)
+find_library(ZSTD_LIBRARY NAMES zstd libzstd)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd REQUIRED_VARS ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+
+mark_as_advanced(ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
@@ -210,6 +210,7 @@ bool AclFilter::filterMessage(const protocol::Message &msg)
 		return !((isImagesLocked() && !isOpUser) || isLayerLockedFor(static_cast<const FillRect&>(msg).layer(), msg.contextId()));
 
 	case MSG_PEN_MOVE:
+	case MSG_PEN_MOVE_DELTA:
 		return !isLayerLockedFor(m_userLayers[msg.contextId()], msg.contextId());
 
 	case MSG_ANNOTATION_CREATE: {
@@ -21,6 +21,7 @@
 #include "usercursormodel.h"
 #include "lasertrailmodel.h"
 #include "statetracker.h"
+#include "strokepreview.h"
 #include "layerlist.h"
 #include "userlist.h"
 #include "aclfilter.h"
@@ -55,6 +56,8 @@ CanvasModel::CanvasModel(int localUserId, QObject *parent)
 
 	m_layerstack = new paintcore::LayerStack(this);
 	m_statetracker = new StateTracker(m_layerstack, m_layerlist, localUserId, this);
+	m_strokepreview = new StrokePreview(m_layerstack, this);
+	m_statetracker->setStrokePreview(m_strokepreview);
 	m_usercursors = new UserCursorModel(this);
 	m_lasers = new LaserTrailModel(this);
 
@@ -114,12 +117,28 @@ void CanvasModel::endPlayback()
 }
 
 void CanvasModel::handleCommand(protocol::MessagePtr cmd)
+{
+	if(dispatchCommand(cmd))
+		emit canvasModified();
+}
+
+void CanvasModel::handleCommands(const QList<protocol::MessagePtr> &cmds)
+{
+	bool modified = false;
+	for(const protocol::MessagePtr &cmd : cmds)
+		modified |= dispatchCommand(cmd);
+
+	if(modified)
+		emit canvasModified();
+}
+
+bool CanvasModel::dispatchCommand(protocol::MessagePtr cmd)
 {
 	using namespace protocol;
 
 	if(cmd->type() == protocol::MSG_INTERNAL) {
 		m_statetracker->receiveQueuedCommand(cmd);
-		return;
+		return false;
 	}
 
 	// Apply ACL filter
@@ -127,7 +146,7 @@ void CanvasModel::handleCommand(protocol::MessagePtr cmd)
 		qWarning("Filtered %s message from %d", qPrintable(cmd->messageName()), cmd->contextId());
 		if(m_recorder)
 			m_recorder->recordMessage(cmd->asFiltered());
-		return;
+		return false;
 
 	} else if(m_recorder) {
 		m_recorder->recordMessage(cmd);
@@ -174,11 +193,13 @@ void CanvasModel::handleCommand(protocol::MessagePtr cmd)
 	} else if(cmd->isCommand()) {
 		// The state tracker handles all drawing commands
 		m_statetracker->receiveQueuedCommand(cmd);
-		emit canvasModified();
+		return true;
 
 	} else {
 		qWarning("CanvasModel::handleDrawingCommand: command %d is neither Meta nor Command type!", cmd->type());
 	}
+
+	return false;
 }
 
 void CanvasModel::handleLocalCommand(protocol::MessagePtr cmd)
@@ -317,14 +338,15 @@ QImage CanvasModel::selectionToImage(int layerId) const
 	QImage img;
 
 	paintcore::Layer *layer = m_layerstack->getLayer(layerId);
-	if(layer)
-		img = layer->toImage();
-	else
-		img = toImage();
-
 
 	if(m_selection) {
-		img = img.copy(m_selection->boundingRect().intersected(QRect(0, 0, img.width(), img.height())));
+		const QRect rect = m_selection->boundingRect().intersected(QRect(0, 0, m_layerstack->width(), m_layerstack->height()));
+
+		// Only the tiles under the selection need to be read from a single layer
+		if(layer)
+			img = layer->regionImage(rect);
+		else
+			img = toImage().copy(rect);
 
 		if(!m_selection->isAxisAlignedRectangle()) {
 			// Mask out pixels outside the selection
@@ -336,6 +358,12 @@ QImage CanvasModel::selectionToImage(int layerId) const
 
 			mp.drawImage(qMin(0, maskBounds.left()), qMin(0, maskBounds.top()), mask);
 		}
+
+	} else if(layer) {
+		img = layer->toImage();
+
+	} else {
+		img = toImage();
 	}
 
 	return img;
@@ -45,6 +45,7 @@ namespace protocol {
 namespace canvas {
 
 class StateTracker;
+class StrokePreview;
 class AclFilter;
 class UserListModel;
 class LayerListModel;
@@ -115,6 +116,14 @@ public slots:
 	//! Handle a meta/command message received from the server
 	void handleCommand(protocol::MessagePtr cmd);
 
+	/**
+	 * @brief Handle a sequence of meta/command messages
+	 *
+	 * The messages are queued for execution together and canvasModified
+	 * is emitted at most once.
+	 */
+	void handleCommands(const QList<protocol::MessagePtr> &cmds);
+
 	//! Handle a local drawing command (will be put in the local fork)
 	void handleLocalCommand(protocol::MessagePtr cmd);
 
@@ -150,6 +159,8 @@ private slots:
 	void onCanvasResize(int xoffset, int yoffset, const QSize &oldsize);
 
 private:
+	bool dispatchCommand(protocol::MessagePtr cmd);
+
 	void metaUserJoin(const protocol::UserJoin &msg);
 	void metaUserLeave(const protocol::UserLeave &msg);
 	void metaChatMessage(protocol::MessagePtr msg);
@@ -164,6 +175,7 @@ private:
 
 	paintcore::LayerStack *m_layerstack;
 	StateTracker *m_statetracker;
+	StrokePreview *m_strokepreview;
 	UserCursorModel *m_usercursors;
 	LaserTrailModel *m_lasers;
 	Selection *m_selection;
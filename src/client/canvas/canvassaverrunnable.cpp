@@ -27,7 +27,8 @@ namespace canvas {
 CanvasSaverRunnable::CanvasSaverRunnable(const CanvasModel *canvas, const QString &filename, QObject *parent)
 	: QObject(parent),
 	  m_layerstack(canvas->layerStack()->clone(this)),
-	  m_filename(filename)
+	  m_filename(filename),
+	  m_fastCompression(false)
 {
 }
 
@@ -38,7 +39,12 @@ void CanvasSaverRunnable::run()
 
 	if(m_filename.endsWith(".ora", Qt::CaseInsensitive)) {
 		// Special case: Save as OpenRaster with all the layers intact.
-		ok = openraster::saveOpenRaster(m_filename, m_layerstack, &errorMessage);
+		ok = openraster::saveOpenRaster(
+			m_filename,
+			m_layerstack,
+			&errorMessage,
+			m_fastCompression ? openraster::Compression::Fast : openraster::Compression::Normal
+			);
 
 	} else {
 		// Regular image formats: flatten the image first.
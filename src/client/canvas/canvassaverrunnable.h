@@ -41,6 +41,14 @@ class CanvasSaverRunnable : public QObject, public QRunnable
 public:
 	CanvasSaverRunnable(const CanvasModel *canvas, const QString &filename, QObject *parent = nullptr);
 
+	/**
+	 * @brief Trade file size for speed
+	 *
+	 * This is useful for autosaving, where the file is rewritten often.
+	 * Only affects formats that support it (currently OpenRaster)
+	 */
+	void setFastCompression(bool fast) { m_fastCompression = fast; }
+
 	void run() override;
 
 signals:
@@ -53,6 +61,7 @@ signals:
 private:
 	paintcore::LayerStack *m_layerstack;
 	QString m_filename;
+	bool m_fastCompression;
 };
 
 }
@@ -94,6 +94,8 @@ void LaserTrailModel::timerEvent(QTimerEvent *e)
 			++idx;
 		}
 	}
+
+	updateOpenTrails();
 }
 
 void LaserTrailModel::startTrail(int ctxId, const QColor &color, int persistence)
@@ -105,14 +107,12 @@ void LaserTrailModel::startTrail(int ctxId, const QColor &color, int persistence
 
 	// Only one open trail per user is allowed, so starting a new trail
 	// automatically closes the previous trail if it exists.
-	for(int i=0;i<m_lasers.size();++i) {
-		if(m_lasers.at(i).ctxid == ctxId && m_lasers.at(i).open) {
-			m_lasers[i].open = false;
-			break;
-		}
-	}
+	const int prev = m_openTrails.value(ctxId, -1);
+	if(prev >= 0)
+		m_lasers[prev].open = false;
 
 	beginInsertRows(QModelIndex(), m_lasers.size(), m_lasers.size());
+	m_openTrails[ctxId] = m_lasers.size();
 	m_lasers.append(LaserTrail {
 		ctxId,
 		++m_lastId,
@@ -128,35 +128,33 @@ void LaserTrailModel::startTrail(int ctxId, const QColor &color, int persistence
 
 void LaserTrailModel::addPoint(int ctxId, const QPointF &point)
 {
-	for(int i=0;i<m_lasers.size();++i) {
-		if(m_lasers.at(i).ctxid == ctxId && m_lasers.at(i).open) {
-			m_lasers[i].points << point;
-			m_lasers[i].expiration = QDateTime::currentMSecsSinceEpoch() + m_lasers[i].persistence * 1000;
-			QModelIndex idx = index(i);
-			emit dataChanged(idx, idx, QVector<int>() << PointsRole);
-			break;
-		}
+	const int i = m_openTrails.value(ctxId, -1);
+	if(i >= 0) {
+		m_lasers[i].points << point;
+		m_lasers[i].expiration = QDateTime::currentMSecsSinceEpoch() + m_lasers[i].persistence * 1000;
+		QModelIndex idx = index(i);
+		emit dataChanged(idx, idx, QVector<int>() << PointsRole);
 	}
 }
 
 void LaserTrailModel::endTrail(int ctxId)
 {
-	for(int i=0;i<m_lasers.size();++i) {
-		if(m_lasers.at(i).ctxid == ctxId && m_lasers.at(i).open) {
-			m_lasers[i].open = false;
-
-			// any given context ID can have only one open trail at a time
-			break;
-		}
+	// any given context ID can have only one open trail at a time
+	const int i = m_openTrails.value(ctxId, -1);
+	if(i >= 0) {
+		m_lasers[i].open = false;
+		m_openTrails.remove(ctxId);
 	}
 }
 
-bool LaserTrailModel::isOpenTrail(int ctxId)
+//! Rebuild the open trail index after rows have been removed or closed
+void LaserTrailModel::updateOpenTrails()
 {
-	for(int i=0;i<m_lasers.size();++i)
-		if(m_lasers.at(i).ctxid == ctxId && m_lasers.at(i).open)
-			return true;
-	return false;
+	m_openTrails.clear();
+	for(int i=0;i<m_lasers.size();++i) {
+		if(m_lasers.at(i).open)
+			m_openTrails[m_lasers.at(i).ctxid] = i;
+	}
 }
 
 }
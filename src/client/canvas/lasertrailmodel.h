@@ -66,8 +66,10 @@ protected:
 	void timerEvent(QTimerEvent *e);
 
 private:
-	bool isOpenTrail(int ctxId);
+	void updateOpenTrails();
+
 	QList<LaserTrail> m_lasers;
+	QHash<int, int> m_openTrails; // context ID -> row of the open trail
 	int m_timerId;
 	int m_lastId;
 };
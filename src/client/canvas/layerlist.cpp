@@ -30,7 +30,8 @@
 namespace canvas {
 
 LayerListModel::LayerListModel(QObject *parent)
-	: QAbstractListModel(parent), m_defaultLayer(0), m_myId(1)
+	: QAbstractListModel(parent), m_defaultLayer(0), m_myId(1),
+	  m_batchDepth(0), m_batchChanged(false), m_batchReordered(false)
 {
 }
 	
@@ -194,8 +195,7 @@ void LayerListModel::changeLayer(int id, float opacity, paintcore::BlendMode::Mo
 	LayerListItem &item = m_items[row];
 	item.opacity = opacity;
 	item.blend = blend;
-	const QModelIndex qmi = index(row);
-	emit dataChanged(qmi, qmi);
+	layerChanged(row);
 }
 
 void LayerListModel::retitleLayer(int id, const QString &title)
@@ -206,8 +206,7 @@ void LayerListModel::retitleLayer(int id, const QString &title)
 
 	LayerListItem &item = m_items[row];
 	item.title = title;
-	const QModelIndex qmi = index(row);
-	emit dataChanged(qmi, qmi);
+	layerChanged(row);
 }
 
 void LayerListModel::setLayerHidden(int id, bool hidden)
@@ -218,8 +217,7 @@ void LayerListModel::setLayerHidden(int id, bool hidden)
 
 	LayerListItem &item = m_items[row];
 	item.hidden = hidden;
-	const QModelIndex qmi = index(row);
-	emit dataChanged(qmi, qmi);
+	layerChanged(row);
 }
 
 void LayerListModel::updateLayerAcl(int id, bool locked, QList<uint8_t> exclusive)
@@ -266,8 +264,39 @@ void LayerListModel::reorderLayers(QList<uint16_t> neworder)
 		}
 	}
 	m_items = newitems;
-	emit dataChanged(index(0), index(m_items.size()-1));
-	emit layersReordered();
+
+	if(m_batchDepth > 0) {
+		m_batchReordered = true;
+	} else {
+		emit dataChanged(index(0), index(m_items.size()-1));
+		emit layersReordered();
+	}
+}
+
+void LayerListModel::layerChanged(int row)
+{
+	if(m_batchDepth > 0) {
+		m_batchChanged = true;
+	} else {
+		const QModelIndex qmi = index(row);
+		emit dataChanged(qmi, qmi);
+	}
+}
+
+void LayerListModel::endBatch()
+{
+	Q_ASSERT(m_batchDepth>0);
+	if(--m_batchDepth > 0)
+		return;
+
+	if((m_batchChanged || m_batchReordered) && !m_items.isEmpty())
+		emit dataChanged(index(0), index(m_items.size()-1));
+
+	if(m_batchReordered)
+		emit layersReordered();
+
+	m_batchChanged = false;
+	m_batchReordered = false;
 }
 
 void LayerListModel::setLayers(const QVector<LayerListItem> &items)
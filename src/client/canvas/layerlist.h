@@ -105,6 +105,16 @@ public:
 	void reorderLayers(QList<uint16_t> neworder);
 	void unlockAll();
 
+	/**
+	 * @brief Start a batch of layer changes
+	 *
+	 * Attribute changes and reorderings made during the batch are
+	 * announced with a single dataChanged signal when the batch ends.
+	 * Layer creation and deletion are still announced immediately.
+	 */
+	void beginBatch() { ++m_batchDepth; }
+	void endBatch();
+
 	bool isLayerLockedFor(int layerId, int contextId) const;
 	
 	QVector<LayerListItem> getLayers() const { return m_items; }
@@ -152,6 +162,7 @@ signals:
 
 private:
 	void handleMoveLayer(int idx, int afterIdx);
+	void layerChanged(int row);
 
 	int indexOf(int id) const;
 
@@ -169,6 +180,10 @@ private:
 	GetLayerFunction m_getlayerfn;
 	int m_defaultLayer;
 	int m_myId;
+
+	int m_batchDepth;
+	bool m_batchChanged;
+	bool m_batchReordered;
 };
 
 /**
@@ -18,6 +18,7 @@
 */
 
 #include "retcon.h"
+#include "../../shared/net/pen.h"
 
 using protocol::MessagePtr;
 
@@ -49,6 +50,33 @@ void LocalFork::addLocalMessage(MessagePtr msg, const AffectedArea &area)
 	m_areas.append(area);
 }
 
+int LocalFork::mergedPenMoveCount(const protocol::PenMove &pm) const
+{
+	const protocol::PenPointVector &points = pm.points();
+	int offset = 0;
+	int count = 0;
+
+	while(count < m_messages.size() && offset < points.size()) {
+		const MessagePtr &local = m_messages.at(count);
+		if(!protocol::isPenMove(local->type()) || local->contextId() != pm.contextId())
+			return 0;
+
+		const protocol::PenPointVector &lp = local.cast<protocol::PenMove>().points();
+		if(offset + lp.size() > points.size())
+			return 0;
+
+		for(int i=0;i<lp.size();++i) {
+			if(lp.at(i) != points.at(offset+i))
+				return 0;
+		}
+
+		offset += lp.size();
+		++count;
+	}
+
+	return offset == points.size() ? count : 0;
+}
+
 void LocalFork::clear()
 {
 	m_fallenBehind = 0;
@@ -66,9 +94,17 @@ LocalFork::MessageAction LocalFork::handleReceivedMessage(MessagePtr msg, const
 
 	// Check if this is our own message that has finished its roundtrip
 	if(msg->contextId() == m_messages.first()->contextId()) {
-		if(msg.equals(m_messages.first())) {
-			m_messages.removeFirst();
-			m_areas.removeFirst();
+		int count = 0;
+		if(msg.equals(m_messages.first()))
+			count = 1;
+		else if(protocol::isPenMove(msg->type()))
+			count = mergedPenMoveCount(msg.cast<protocol::PenMove>());
+
+		if(count > 0) {
+			while(count-- > 0) {
+				m_messages.removeFirst();
+				m_areas.removeFirst();
+			}
 			if(m_messages.isEmpty())
 				m_fallenBehind = 0;
 			return ALREADYDONE;
@@ -25,6 +25,10 @@
 #include <QRect>
 #include <QList>
 
+namespace protocol {
+	class PenMove;
+}
+
 namespace canvas {
 
 /**
@@ -51,6 +55,10 @@ public:
 
 	bool isConcurrentWith(const AffectedArea &other) const;
 
+	Domain domain() const { return m_domain; }
+	int layer() const { return m_layer; }
+	QRect bounds() const { return m_bounds; }
+
 private:
 	Domain m_domain;
 	int m_layer;
@@ -101,6 +109,7 @@ public:
 	 *
 	 * Possible responses:
 	 * - our own message: the message is removed from the local fork
+	 * - our own pen moves merged into one message: the merged messages are removed
 	 * - our own message (out of order): local fork is cleared: need to roll back
 	 * - other user's message (concurrent): no need to do anything special
 	 * - other user's message (dependent): need to roll back
@@ -148,6 +157,9 @@ public:
 	void clear();
 
 private:
+	//! Number of local PenMoves at the start of the fork that add up to the given message
+	int mergedPenMoveCount(const protocol::PenMove &pm) const;
+
 	QList<protocol::MessagePtr> m_messages;
 	QList<AffectedArea> m_areas;
 	int m_offset;
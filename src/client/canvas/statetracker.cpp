@@ -20,6 +20,7 @@
 #include "statetracker.h"
 #include "layerlist.h"
 #include "loader.h"
+#include "strokepreview.h"
 
 #include "core/layerstack.h"
 #include "core/layer.h"
@@ -111,11 +112,7 @@ QImage StateSavepoint::thumbnail(const QSize &maxSize) const
 
 	paintcore::LayerStack stack;
 	stack.restoreSavepoint(m_data->canvas);
-	QImage img = stack.toFlatImage(true);
-	if(img.width() > maxSize.width() || img.height() > maxSize.height()) {
-		img = img.scaled(maxSize, Qt::KeepAspectRatio);
-	}
-	return img;
+	return stack.toFlatImageScaled(maxSize, true);
 }
 
 QList<protocol::MessagePtr> StateSavepoint::initCommands(uint8_t contextId, CanvasModel *canvas) const
@@ -166,7 +163,13 @@ StateTracker::StateTracker(paintcore::LayerStack *image, LayerListModel *layerli
 		_showallmarkers(false),
 		m_hasParticipated(false),
 		m_localPenDown(false),
-		m_isQueued(false)
+		m_isQueued(false),
+		m_preview(nullptr),
+		m_previewing(false),
+		m_batchDepth(0),
+		m_savepointPending(false),
+		m_catchupStart(0),
+		m_replayLayer(-1)
 {
 	connect(m_layerlist, &LayerListModel::layerOpacityPreview, this, &StateTracker::previewLayerOpacity);
 
@@ -178,6 +181,10 @@ StateTracker::StateTracker(paintcore::LayerStack *image, LayerListModel *layerli
 	m_queuetimer = new QTimer(this);
 	m_queuetimer->setSingleShot(true);
 	connect(m_queuetimer, &QTimer::timeout, this, &StateTracker::processQueuedCommands);
+
+	m_localtimer = new QTimer(this);
+	m_localtimer->setSingleShot(true);
+	connect(m_localtimer, &QTimer::timeout, this, &StateTracker::processLocalCommands);
 }
 
 StateTracker::~StateTracker()
@@ -192,6 +199,12 @@ void StateTracker::reset()
 	m_hasParticipated = false;
 	m_localPenDown = false;
 	m_msgqueue.clear();
+	m_localqueue.clear();
+	m_localtimer->stop();
+	if(m_previewing) {
+		m_previewing = false;
+		m_preview->clear();
+	}
 	m_localfork.clear();
 	m_layerlist->clear();
 	m_myLastLayer = _contexts[m_myId].tool.layer_id;
@@ -201,6 +214,72 @@ void StateTracker::reset()
 }
 
 void StateTracker::localCommand(protocol::MessagePtr msg)
+{
+	// Maximum time (ms) a previewed pen move may wait before it is drawn on the canvas
+	static const int PREVIEW_COMMIT_DELAY = 100;
+
+	// Pen moves are drawn on the canvas later, in batches, so the input
+	// events don't have to wait for each segment to be drawn.
+	// If the stroke can be previewed, the preview shows it in the meantime
+	// and the moves are drawn when the next command is received (typically
+	// the echo of these moves), when the stroke ends or after a short delay.
+	// Otherwise, they are drawn on the next event loop iteration.
+	if(protocol::isPenMove(msg->type())) {
+		if(m_localqueue.isEmpty())
+			m_previewing = beginStrokePreview(msg);
+
+		m_localqueue.append(msg);
+
+		if(m_previewing) {
+			m_preview->addPenMove(msg.cast<protocol::PenMove>());
+			if(!m_localtimer->isActive())
+				m_localtimer->start(PREVIEW_COMMIT_DELAY);
+		} else if(!m_localtimer->isActive()) {
+			m_localtimer->start(0);
+		}
+		return;
+	}
+
+	// Everything else must see the pending pen moves first
+	processLocalCommands();
+	executeLocalCommand(msg);
+}
+
+void StateTracker::processLocalCommands()
+{
+	m_localtimer->stop();
+	if(m_localqueue.isEmpty())
+		return;
+
+	beginBatch();
+	const QList<protocol::MessagePtr> queue = m_localqueue;
+	m_localqueue.clear();
+	for(const protocol::MessagePtr &msg : queue)
+		executeLocalCommand(msg);
+
+	// The canvas now has what the preview was showing
+	if(m_previewing) {
+		m_previewing = false;
+		m_preview->clear();
+	}
+	endBatch();
+}
+
+bool StateTracker::beginStrokePreview(const protocol::MessagePtr &msg)
+{
+	if(!m_preview)
+		return false;
+
+	const DrawingContext &ctx = _contexts[msg->contextId()];
+	const paintcore::Layer *layer = _image->getLayer(ctx.tool.layer_id);
+	if(!layer || !layer->isVisible() || !StrokePreview::canPreview(ctx.tool.brush))
+		return false;
+
+	m_preview->begin(ctx);
+	return true;
+}
+
+void StateTracker::executeLocalCommand(protocol::MessagePtr msg)
 {
 	// A fork is created at the end of the mainline history
 	if(m_localfork.isEmpty()) {
@@ -240,9 +319,11 @@ void StateTracker::processQueuedCommands()
 	QElapsedTimer elapsed;
 	elapsed.start();
 
+	beginBatch();
 	while(!m_msgqueue.isEmpty() && elapsed.elapsed() < 100) {
 		receiveCommand(m_msgqueue.takeFirst());
 	}
+	endBatch();
 
 	if(!m_msgqueue.isEmpty()) {
 		qDebug("Taking a breather. Still %d messages in the queue.", m_msgqueue.size());
@@ -253,14 +334,58 @@ void StateTracker::processQueuedCommands()
 	}
 }
 
+void StateTracker::beginBatch()
+{
+	if(m_batchDepth++ == 0) {
+		_image->beginBatch();
+		m_layerlist->beginBatch();
+	}
+}
+
+void StateTracker::endBatch()
+{
+	Q_ASSERT(m_batchDepth>0);
+	if(--m_batchDepth > 0)
+		return;
+
+	// Savepoints requested during the batch are coalesced into one
+	// taken at the end, when the canvas is in a consistent state again.
+	if(m_savepointPending) {
+		m_savepointPending = false;
+		makeSavepoint(m_history.end()-1);
+	}
+
+	m_layerlist->endBatch();
+	_image->endBatch();
+}
+
+void StateTracker::measureCatchup(int progress)
+{
+	if(progress < 100) {
+		if(!m_catchupTimer.isValid()) {
+			m_catchupTimer.start();
+			m_catchupStart = m_history.end();
+		}
+
+	} else if(m_catchupTimer.isValid()) {
+		qInfo("Caught up with %d messages in %lld ms", m_history.end() - m_catchupStart, m_catchupTimer.elapsed());
+		m_catchupTimer.invalidate();
+	}
+}
+
 void StateTracker::receiveCommand(protocol::MessagePtr msg)
 {
 	static const uint HISTORY_SIZE_LIMIT = 10 * 1024*1024;
 
+	// Pending local pen moves were sent before this message arrived
+	processLocalCommands();
+
 	if(msg->type() == protocol::MSG_INTERNAL) {
 		const auto &ci = msg.cast<protocol::ClientInternal>();
-		if(ci.internalType() == protocol::ClientInternal::Type::Catchup)
+		if(ci.internalType() == protocol::ClientInternal::Type::Catchup) {
+			measureCatchup(ci.value());
 			emit catchupProgress(ci.value());
+		}
 		else if(ci.internalType() == protocol::ClientInternal::Type::SequencePoint)
 			emit sequencePoint(ci.value());
 		return;
@@ -311,7 +436,8 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 	// Add command to history and execute it
 	m_history.append(msg);
 
-	LocalFork::MessageAction lfa = m_localfork.handleReceivedMessage(msg, affectedArea(msg));
+	const AffectedArea area = affectedArea(msg);
+	LocalFork::MessageAction lfa = m_localfork.handleReceivedMessage(msg, area);
 
 	// Undo messages are not handled locally (at the moment)
 	if(lfa == LocalFork::ALREADYDONE && (msg->type()==protocol::MSG_UNDO || msg->type()==protocol::MSG_UNDOPOINT))
@@ -319,31 +445,7 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 
 	if(lfa==LocalFork::ROLLBACK) {
 		// Uh oh! An inconsistency was detected: roll back the history and replay
-
-		// first, find the newest savepoint that precedes the fork
-		int savepoint = m_savepoints.size()-1;
-		while(savepoint>=0) {
-			if(m_savepoints.at(savepoint)->streampointer <= m_localfork.offset())
-				break;
-			--savepoint;
-		}
-
-		if(savepoint<0) {
-			// should never happen
-			qWarning("No savepoint for rolling back local fork at %d!", m_localfork.offset());
-
-		} else {
-			const StateSavepoint &sp = m_savepoints.at(savepoint);
-			qDebug("inconsistency at %d (local fork at %d). Rolling back to %d", m_history.end(), m_localfork.offset(), sp->streampointer);
-
-			// Avoid rollback churn by clearing the local fork, but not if
-			// local drawing is in progress. If we clear the fork then,
-			// we trigger a self-conflict feedback loop until the stroke finishes.
-			if(!m_localPenDown)
-				m_localfork.clear();
-
-			revertSavepointAndReplay(sp);
-		}
+		rollbackLocalFork(area);
 
 	} else if(lfa==LocalFork::CONCURRENT) {
 		// Concurrent operation: safe to execute
@@ -352,6 +454,57 @@ void StateTracker::receiveCommand(protocol::MessagePtr msg)
 	} // else ALREADYDONE
 }
 
+void StateTracker::rollbackLocalFork(const AffectedArea &area)
+{
+	// first, find the newest savepoint that precedes the fork
+	int savepoint = m_savepoints.size()-1;
+	while(savepoint>=0) {
+		if(m_savepoints.at(savepoint)->streampointer <= m_localfork.offset())
+			break;
+		--savepoint;
+	}
+
+	if(savepoint<0) {
+		// should never happen
+		qWarning("No savepoint for rolling back local fork at %d!", m_localfork.offset());
+		return;
+	}
+
+	const StateSavepoint &sp = m_savepoints.at(savepoint);
+	qDebug("inconsistency at %d (local fork at %d). Rolling back to %d", m_history.end(), m_localfork.offset(), sp->streampointer);
+
+	// Avoid rollback churn by clearing the local fork, but not if
+	// local drawing is in progress. If we clear the fork then,
+	// we trigger a self-conflict feedback loop until the stroke finishes.
+	// Note: the fork may already have been emptied if it got out of sync.
+	const bool keepFork = m_localPenDown;
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// If the conflict is limited to the content of a single layer, only that
+	// layer needs to be restored and only the messages touching it replayed.
+	// This is not possible if the local fork got out of sync, since its messages
+	// may be on any layer.
+	const bool partial = area.domain() == AffectedArea::PIXELS
+		&& !m_localfork.isEmpty()
+		&& canRevertLayer(sp, area.layer(), keepFork);
+
+	if(!keepFork)
+		m_localfork.clear();
+
+	int replayed;
+	if(partial)
+		replayed = revertLayerAndReplay(sp, area.layer());
+	else
+		replayed = revertSavepointAndReplay(sp);
+
+	const qint64 elapsed = timer.elapsed();
+	m_rollbackStats.add(partial, replayed, elapsed);
+	qDebug("%s rollback: replayed %d messages in %lld ms", partial ? "Layer" : "Full", replayed, elapsed);
+	emit localForkRolledBack(m_rollbackStats);
+}
+
 void StateTracker::handleCommand(protocol::MessagePtr msg, bool replay, int pos)
 {
 	switch(msg->type()) {
@@ -381,6 +534,7 @@ void StateTracker::handleCommand(protocol::MessagePtr msg, bool replay, int pos)
 			handleToolChange(msg.cast<ToolChange>());
 			break;
 		case MSG_PEN_MOVE:
+		case MSG_PEN_MOVE_DELTA:
 			handlePenMove(msg.cast<PenMove>());
 			break;
 		case MSG_PEN_UP:
@@ -424,6 +578,8 @@ void StateTracker::handleCommand(protocol::MessagePtr msg, bool replay, int pos)
  */
 void StateTracker::endRemoteContexts()
 {
+	processLocalCommands();
+
 	// Add local fork to the mainline history
 	QList<protocol::MessagePtr> localfork = m_localfork.messages();
 	m_localfork.clear();
@@ -614,20 +770,26 @@ void StateTracker::handlePenMove(const protocol::PenMove &cmd)
 		qWarning() << "penMove by user" << cmd.contextId() << "on non-existent layer" << ctx.tool.layer_id;
 		return;
 	}
+
+	// During a single layer replay, strokes on other layers are skipped.
+	// Their drawing contexts are restored afterwards.
+	const bool draw = m_replayLayer < 0 || m_replayLayer == ctx.tool.layer_id;
 	
 	for(const protocol::PenPoint &pp : cmd.points()) {
 		paintcore::Point p(pp.x / 4.0, pp.y / 4.0, pp.p/qreal(0xffff));
 		const int r = ctx.tool.brush.fsize(p.pressure())/2 + 1;
 
 		if(ctx.pendown) {
-			layer->drawLine(cmd.contextId(), ctx.tool.brush, ctx.lastpoint, p, ctx.stroke);
+			if(draw)
+				layer->drawLine(cmd.contextId(), ctx.tool.brush, ctx.lastpoint, p, ctx.stroke);
 			ctx.boundingRect |= QRect(p.x() - r, p.y() - r, r*2, r*2);
 
 		} else {
 			ctx.pendown = true;
 			ctx.stroke = paintcore::StrokeState(ctx.tool.brush);
 			ctx.boundingRect = QRect(p.x() - r, p.y() - r, r*2, r*2);
-			layer->dab(cmd.contextId(), ctx.tool.brush, p, ctx.stroke);
+			if(draw)
+				layer->dab(cmd.contextId(), ctx.tool.brush, p, ctx.stroke);
 		}
 		ctx.lastpoint = p;
 	}
@@ -646,7 +808,8 @@ void StateTracker::handlePenUp(const protocol::PenUp &cmd)
 	}
 
 	// This ends an indirect stroke. In incremental mode, this does nothing.
-	layer->mergeSublayer(cmd.contextId());
+	if(m_replayLayer < 0 || m_replayLayer == ctx.tool.layer_id)
+		layer->mergeSublayer(cmd.contextId());
 
 	ctx.pendown = false;
 	emit userMarkerHide(cmd.contextId());
@@ -654,6 +817,9 @@ void StateTracker::handlePenUp(const protocol::PenUp &cmd)
 
 void StateTracker::handlePutImage(const protocol::PutImage &cmd)
 {
+	if(m_replayLayer >= 0 && m_replayLayer != cmd.layer())
+		return;
+
 	paintcore::Layer *layer = _image->getLayer(cmd.layer());
 	if(!layer) {
 		qWarning() << "putImage on non-existent layer" << cmd.layer();
@@ -674,6 +840,9 @@ void StateTracker::handlePutImage(const protocol::PutImage &cmd)
 
 void StateTracker::handleFillRect(const protocol::FillRect &cmd)
 {
+	if(m_replayLayer >= 0 && m_replayLayer != cmd.layer())
+		return;
+
 	paintcore::Layer *layer = _image->getLayer(cmd.layer());
 	if(!layer) {
 		qWarning("fillRect on non-existent layer %d", cmd.layer());
@@ -688,6 +857,9 @@ void StateTracker::handleFillRect(const protocol::FillRect &cmd)
 
 void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
 {
+	if(m_replayLayer >= 0 && m_replayLayer != cmd.layer())
+		return;
+
 	paintcore::Layer *layer = _image->getLayer(cmd.layer());
 	if(!layer) {
 		qWarning("moveRegion on non-existent layer %d", cmd.layer());
@@ -734,7 +906,7 @@ void StateTracker::handleMoveRegion(const protocol::MoveRegion &cmd)
 	}
 
 	// Extract selected pixels
-	QImage selbuf = layer->toImage().copy(bounds); // TODO optimize
+	QImage selbuf = layer->regionImage(bounds);
 
 	// Mask out unselected pixels (if necessary)
 	if(!mask.isNull()) {
@@ -967,6 +1139,12 @@ void StateTracker::makeSavepoint(int pos)
 	if(!m_localfork.isEmpty())
 		return;
 
+	// Savepoints are taken at batch boundaries only
+	if(m_batchDepth > 0) {
+		m_savepointPending = true;
+		return;
+	}
+
 	// Check if sufficient time and actions has elapsed from previous savepoint
 	if(!m_savepoints.isEmpty()) {
 		const StateSavepoint sp = m_savepoints.last();
@@ -998,17 +1176,17 @@ void StateTracker::resetToSavepoint(const StateSavepoint savepoint)
 	m_savepoints.append(savepoint);
 }
 
-void StateTracker::revertSavepointAndReplay(const StateSavepoint savepoint)
+int StateTracker::revertSavepointAndReplay(const StateSavepoint savepoint)
 {
 	// This function is called when reverting to an earlier state to undo
 	// an action.
 	if(!savepoint) {
 		qWarning("revertSavepointAndReplay() was called with a null savepoint!");
-		return;
+		return 0;
 	}
 	if(!m_savepoints.contains(savepoint)) {
 		qWarning("revertSavepointAndReplay() the given savepoint was not found!");
-		return;
+		return 0;
 	}
 
 	_image->restoreSavepoint(savepoint->canvas);
@@ -1019,11 +1197,18 @@ void StateTracker::revertSavepointAndReplay(const StateSavepoint savepoint)
 	while(m_savepoints.last() != savepoint)
 		m_savepoints.removeLast();
 
-	// Replay all not-undo actions (and local fork)
+	return replaySince(savepoint);
+}
+
+//! Replay all not-undone actions after the savepoint and the local fork
+int StateTracker::replaySince(const StateSavepoint &savepoint)
+{
+	int replayed = 0;
 	int pos = savepoint->streampointer + 1;
 	while(pos < m_history.end()) {
 		if(m_history.at(pos)->undoState() == protocol::DONE) {
 			handleCommand(m_history.at(pos), true, pos);
+			++replayed;
 		}
 		++pos;
 	}
@@ -1034,10 +1219,107 @@ void StateTracker::revertSavepointAndReplay(const StateSavepoint savepoint)
 		m_localfork.setOffset(pos-1);
 		const QList<protocol::MessagePtr> local = m_localfork.messages();
 		for(const protocol::MessagePtr &msg : local) {
-			if(msg->type() != protocol::MSG_UNDO && msg->type() != protocol::MSG_UNDOPOINT)
+			if(msg->type() != protocol::MSG_UNDO && msg->type() != protocol::MSG_UNDOPOINT) {
 				handleCommand(msg, true, pos);
+				++replayed;
+			}
+		}
+	}
+
+	return replayed;
+}
+
+/**
+ * @brief Check if a rollback can be limited to the content of a single layer
+ *
+ * This is possible when nothing but drawing commands have been executed since the
+ * savepoint, since those don't affect any layers other than their own.
+ * If the local fork is to be discarded, its messages must not touch any other layer
+ * either: they would not get a chance to be undone when the layer is reverted.
+ *
+ * @param savepoint the savepoint to revert to
+ * @param layerId the layer that would be reverted
+ * @param keepLocalFork will the local fork be replayed after the history?
+ */
+bool StateTracker::canRevertLayer(const StateSavepoint &savepoint, int layerId, bool keepLocalFork) const
+{
+	if(!_image->getLayer(layerId))
+		return false;
+
+	// Which layer is each user drawing on
+	QHash<int, int> toolLayers;
+	for(auto i=savepoint->ctxstate.constBegin();i!=savepoint->ctxstate.constEnd();++i)
+		toolLayers[i.key()] = i.value().tool.layer_id;
+
+	// Returns the layer whose pixels the message changes, 0 if none or -1 if not a plain drawing command
+	auto targetLayer = [&toolLayers](const protocol::MessagePtr &msg) -> int {
+		using namespace protocol;
+		switch(msg->type()) {
+		case MSG_UNDOPOINT: return 0;
+		case MSG_TOOLCHANGE:
+			toolLayers[msg->contextId()] = msg.cast<ToolChange>().layer();
+			return 0;
+		case MSG_PEN_MOVE:
+		case MSG_PEN_MOVE_DELTA:
+		case MSG_PEN_UP: return toolLayers.value(msg->contextId(), 0);
+		case MSG_PUTIMAGE: return msg.cast<PutImage>().layer();
+		case MSG_FILLRECT: return msg.cast<FillRect>().layer();
+		case MSG_REGION_MOVE: return msg.cast<MoveRegion>().layer();
+		default: return -1;
 		}
+	};
+
+	for(int pos=savepoint->streampointer+1;pos<m_history.end();++pos) {
+		const protocol::MessagePtr &msg = m_history.at(pos);
+		if(msg->undoState() == protocol::DONE && targetLayer(msg) < 0)
+			return false;
+	}
+
+	for(const protocol::MessagePtr &msg : m_localfork.messages()) {
+		const int layer = targetLayer(msg);
+		if(layer < 0 || (!keepLocalFork && layer != 0 && layer != layerId))
+			return false;
 	}
+
+	return true;
+}
+
+/**
+ * @brief Revert the content of a single layer and replay the commands that touch it
+ *
+ * Only use this when canRevertLayer returns true.
+ *
+ * @return number of messages replayed
+ */
+int StateTracker::revertLayerAndReplay(const StateSavepoint &savepoint, int layerId)
+{
+	Q_ASSERT(m_savepoints.contains(savepoint));
+
+	if(!_image->restoreLayerContent(savepoint->canvas, layerId))
+		return revertSavepointAndReplay(savepoint);
+
+	const QHash<int, DrawingContext> contexts = _contexts;
+	_contexts = savepoint->ctxstate;
+
+	// Newer savepoints have the wrong content for this layer now
+	while(m_savepoints.last() != savepoint)
+		m_savepoints.removeLast();
+
+	// Replay with changes to other layers filtered out
+	m_replayLayer = layerId;
+	const int replayed = replaySince(savepoint);
+	m_replayLayer = -1;
+
+	// Strokes on other layers were not drawn during the replay, so their
+	// stroke state (dab distance, smudge color) was not advanced either.
+	// Those layers were not touched, so the state from before the rollback is
+	// still correct for users in the middle of a stroke on another layer.
+	for(auto i=contexts.constBegin();i!=contexts.constEnd();++i) {
+		if(i.value().pendown && i.value().tool.layer_id != layerId)
+			_contexts[i.key()] = i.value();
+	}
+
+	return replayed;
 }
 
 void StateTracker::handleAnnotationCreate(const protocol::AnnotationCreate &cmd)
@@ -1068,6 +1350,21 @@ void StateTracker::handleAnnotationDelete(const protocol::AnnotationDelete &cmd)
 	_image->annotations()->deleteAnnotation(cmd.id());
 }
 
+void RollbackStats::add(bool isPartial, int replayedMessages, qint64 msecs)
+{
+	if(isPartial)
+		++partial;
+	else
+		++full;
+
+	replayed += replayedMessages;
+
+	int bucket = 0;
+	while(bucket < BUCKETS-1 && msecs >= (qint64(1) << bucket))
+		++bucket;
+	++durations[bucket];
+}
+
 void StateSavepoint::toDatastream(QDataStream &out) const
 {
 	Q_ASSERT(m_data);
@@ -1099,7 +1396,7 @@ void StateSavepoint::toDatastream(QDataStream &out) const
 		out << ctx.pendown;
 
 		// write stroke state
-		out << ctx.stroke.distance << ctx.stroke.smudgeDistance << ctx.stroke.smudgeColor;
+		out << ctx.stroke.distance << ctx.stroke.smudgeDistance << QColor::fromRgb(ctx.stroke.smudgeColor);
 	}
 
 	// Write layer model
@@ -1168,7 +1465,9 @@ StateSavepoint StateSavepoint::fromDatastream(QDataStream &in, StateTracker *own
 		in >> ctx.pendown;
 
 		// Read stroke state
-		in >> ctx.stroke.distance >> ctx.stroke.smudgeDistance >> ctx.stroke.smudgeColor;
+		QColor smudgeColor;
+		in >> ctx.stroke.distance >> ctx.stroke.smudgeDistance >> smudgeColor;
+		ctx.stroke.smudgeColor = smudgeColor.rgb();
 
 		// Note: ctx.bounds is used only for retconning during online drawing
 		// so we don't need to restore it here, since saved snapshots are currently
@@ -1258,7 +1557,8 @@ AffectedArea StateTracker::affectedArea(protocol::MessagePtr msg) const
 		return AffectedArea(AffectedArea::PIXELS, m.layer(), QRect(m.x(), m.y(), m.width(), m.height()));
 	}
 	case MSG_TOOLCHANGE: return AffectedArea(AffectedArea::USERATTRS, 0);
-	case MSG_PEN_MOVE: {
+	case MSG_PEN_MOVE:
+	case MSG_PEN_MOVE_DELTA: {
 		const DrawingContext &ctx = _contexts.value(msg->contextId());
 
 		// Non-incremental brush draws on a private layer: we must check ordering in PenUp
@@ -21,6 +21,9 @@
 
 #include <QObject>
 #include <QHash>
+#include <QElapsedTimer>
+
+#include <algorithm>
 
 #include "retcon.h"
 #include "history.h"
@@ -102,8 +105,34 @@ struct DrawingContext {
 	QRect boundingRect;
 };
 
+/**
+ * @brief Statistics about canvas rollbacks caused by local fork conflicts
+ */
+struct RollbackStats {
+	//! Number of duration histogram buckets
+	static const int BUCKETS = 12;
+
+	RollbackStats() : full(0), partial(0), replayed(0) { std::fill(durations, durations+BUCKETS, 0); }
+
+	//! Add a rollback to the statistics
+	void add(bool isPartial, int replayedMessages, qint64 msecs);
+
+	//! Number of full (whole canvas) rollbacks
+	int full;
+
+	//! Number of single layer rollbacks
+	int partial;
+
+	//! Total number of messages replayed
+	qint64 replayed;
+
+	//! Rollback durations: bucket 0 counts rollbacks that took under 1ms, bucket N under 2^N ms. The last bucket gets the rest.
+	int durations[BUCKETS];
+};
+
 class StateTracker;
 class CanvasModel;
+class StrokePreview;
 
 /**
  * @brief A snapshot of the statetracker state.
@@ -250,6 +279,18 @@ public:
 	//! Get all existing savepoints (can be used for selecting a reset point)
 	QList<StateSavepoint> getSavepoints() const { return m_savepoints; }
 
+	//! Get statistics about local fork rollbacks
+	const RollbackStats &rollbackStats() const { return m_rollbackStats; }
+
+	/**
+	 * @brief Set the preview for local strokes
+	 *
+	 * When set, local pen moves are drawn into the preview right away and
+	 * onto the canvas in batches, when a command is received, the stroke
+	 * ends or at the latest after a short delay.
+	 */
+	void setStrokePreview(StrokePreview *preview) { m_preview = preview; }
+
 signals:
 	void myAnnotationCreated(int id);
 	void layerAutoselectRequest(int);
@@ -261,6 +302,9 @@ signals:
 	void catchupProgress(int percent);
 	void sequencePoint(int);
 
+	//! The canvas was rolled back to resolve a conflict with the local fork
+	void localForkRolledBack(const RollbackStats &stats);
+
 public slots:
 	void previewLayerOpacity(int id, float opacity);
 
@@ -278,10 +322,20 @@ public slots:
 
 private slots:
 	void processQueuedCommands();
+	void processLocalCommands();
 
 private:
+	void executeLocalCommand(protocol::MessagePtr msg);
+	bool beginStrokePreview(const protocol::MessagePtr &msg);
 	void handleCommand(protocol::MessagePtr msg, bool replay, int pos);
 
+	//! Coalesce canvas notifications and savepoints until endBatch
+	void beginBatch();
+	void endBatch();
+
+	//! Log how long it took to process the session history when joining
+	void measureCatchup(int progress);
+
 	AffectedArea affectedArea(const protocol::MessagePtr msg) const;
 
 	// Layer related commands
@@ -306,7 +360,11 @@ private:
 	void handleUndoPoint(const protocol::UndoPoint &cmd, bool replay, int pos);
 	void handleUndo(protocol::Undo &cmd);
 	void makeSavepoint(int pos);
-	void revertSavepointAndReplay(const StateSavepoint savepoint);
+	int revertSavepointAndReplay(const StateSavepoint savepoint);
+	int replaySince(const StateSavepoint &savepoint);
+	bool canRevertLayer(const StateSavepoint &savepoint, int layerId, bool keepLocalFork) const;
+	int revertLayerAndReplay(const StateSavepoint &savepoint, int layerId);
+	void rollbackLocalFork(const AffectedArea &area);
 
 	// Annotation related commands
 	void handleAnnotationCreate(const protocol::AnnotationCreate &cmd);
@@ -336,6 +394,20 @@ private:
 	QList<protocol::MessagePtr> m_msgqueue;
 	QTimer *m_queuetimer;
 	bool m_isQueued;
+
+	QList<protocol::MessagePtr> m_localqueue; // local pen moves waiting to be drawn
+	QTimer *m_localtimer;
+	StrokePreview *m_preview;
+	bool m_previewing; // the queued pen moves are shown in the preview
+
+	int m_batchDepth;
+	bool m_savepointPending; // a savepoint was requested during a batch
+
+	QElapsedTimer m_catchupTimer; // valid while catching up
+	int m_catchupStart; // history position where the catch-up started
+
+	int m_replayLayer; // if not -1, only the content of this layer is touched while replaying
+	RollbackStats m_rollbackStats;
 };
 
 }
@@ -0,0 +1,234 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "strokepreview.h"
+#include "statetracker.h"
+
+#include "core/layer.h"
+#include "core/layerstack.h"
+#include "../shared/net/pen.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+
+namespace canvas {
+
+class StrokePreviewRunnable : public QRunnable
+{
+public:
+	explicit StrokePreviewRunnable(StrokePreview *preview) : m_preview(preview) { }
+
+	void run() override { m_preview->drawPending(); }
+
+private:
+	StrokePreview *m_preview;
+};
+
+StrokePreview::StrokePreview(paintcore::LayerStack *image, QObject *parent)
+	: QObject(parent), m_image(image), m_layerId(0), m_opacity(255), m_shown(false),
+	  m_running(false), m_generation(0), m_startPendown(false), m_publishQueued(false),
+	  m_work(nullptr), m_workGeneration(-1), m_pendown(false)
+{
+	// A single worker keeps the moves in order
+	m_pool = new QThreadPool(this);
+	m_pool->setMaxThreadCount(1);
+}
+
+StrokePreview::~StrokePreview()
+{
+	m_mutex.lock();
+	m_pending.clear();
+	m_mutex.unlock();
+
+	m_pool->waitForDone();
+	delete m_work;
+}
+
+bool StrokePreview::canPreview(const paintcore::Brush &brush)
+{
+	return brush.blendingMode() == paintcore::BlendMode::MODE_NORMAL
+		&& brush.smudge1() == 0 && brush.smudge2() == 0;
+}
+
+void StrokePreview::begin(const DrawingContext &ctx)
+{
+	clear();
+
+	m_layerId = ctx.tool.layer_id;
+
+	QMutexLocker lock(&m_mutex);
+
+	// Indirect strokes are drawn at full opacity and the whole sublayer is
+	// blended at the stroke opacity, the same way Layer does it.
+	m_brush = ctx.tool.brush;
+	if(m_brush.incremental()) {
+		m_opacity = 255;
+	} else {
+		m_opacity = qRound(m_brush.opacity(1) * 255);
+		m_brush.setOpacity(1.0);
+		m_brush.setOpacity2(ctx.tool.brush.isOpacityVariable() ? 0.0 : 1.0);
+		m_brush.setIncremental(true);
+	}
+
+	m_startpoint = ctx.lastpoint;
+	m_startPendown = ctx.pendown;
+	m_startStroke = ctx.stroke;
+	m_canvasSize = m_image->size();
+}
+
+void StrokePreview::addPenMove(const protocol::PenMove &move)
+{
+	QMutexLocker lock(&m_mutex);
+	if(m_layerId == 0)
+		return;
+
+	for(const protocol::PenPoint &pp : move.points())
+		m_pending << paintcore::Point(pp.x / 4.0, pp.y / 4.0, pp.p/qreal(0xffff));
+
+	if(!m_running) {
+		m_running = true;
+		m_pool->start(new StrokePreviewRunnable(this));
+	}
+}
+
+void StrokePreview::drawPending()
+{
+	using paintcore::Tile;
+
+	QMutexLocker lock(&m_mutex);
+
+	while(!m_pending.isEmpty()) {
+		// Take the queued points and, if a new run has started, its initial state
+		const QVector<paintcore::Point> points = m_pending;
+		m_pending.clear();
+
+		const int generation = m_generation;
+		const bool newRun = generation != m_workGeneration;
+		if(newRun) {
+			m_workGeneration = generation;
+			m_workBrush = m_brush;
+			m_lastpoint = m_startpoint;
+			m_pendown = m_startPendown;
+			m_stroke = m_startStroke;
+		}
+		const QSize size = m_canvasSize;
+
+		// Draw without holding the lock
+		lock.unlock();
+
+		if(newRun) {
+			if(m_work && m_work->width() == size.width() && m_work->height() == size.height()) {
+				m_work->makeBlank();
+			} else {
+				delete m_work;
+				m_work = new paintcore::Layer(nullptr, 0, QString(), Qt::transparent, size);
+			}
+		}
+
+		// The brush does not change during a run, so the largest
+		// dab size is enough for the changed area
+		const int r = qMax(m_workBrush.size1(), m_workBrush.size2()) / 2 + 1;
+
+		QRect changed;
+		if(m_pendown)
+			changed = QRect(m_lastpoint.x() - r, m_lastpoint.y() - r, r*2, r*2);
+
+		for(const paintcore::Point &p : points) {
+			if(m_pendown) {
+				m_work->drawLine(1, m_workBrush, m_lastpoint, p, m_stroke);
+			} else {
+				m_pendown = true;
+				m_stroke = paintcore::StrokeState(m_workBrush);
+				m_work->dab(1, m_workBrush, p, m_stroke);
+			}
+			m_lastpoint = p;
+			changed |= QRect(p.x() - r, p.y() - r, r*2, r*2);
+		}
+
+		changed &= QRect(QPoint(), size);
+
+		// Publish the finished tiles. They are implicitly shared, so this is quick.
+		lock.relock();
+		if(generation != m_generation || changed.isEmpty())
+			continue;
+
+		const int xtiles = Tile::roundTiles(size.width());
+		for(int ty=changed.top()/Tile::SIZE;ty<=changed.bottom()/Tile::SIZE;++ty) {
+			for(int tx=changed.left()/Tile::SIZE;tx<=changed.right()/Tile::SIZE;++tx)
+				m_published[ty * xtiles + tx] = m_work->tile(tx, ty);
+		}
+
+		if(!m_publishQueued) {
+			m_publishQueued = true;
+			QMetaObject::invokeMethod(this, "applyPublished", Qt::QueuedConnection);
+		}
+	}
+
+	m_running = false;
+}
+
+void StrokePreview::applyPublished()
+{
+	using paintcore::Tile;
+
+	QHash<int, Tile> tiles;
+	{
+		QMutexLocker lock(&m_mutex);
+		m_publishQueued = false;
+		tiles.swap(m_published);
+	}
+
+	paintcore::Layer *layer = m_image->getLayer(m_layerId);
+	if(tiles.isEmpty() || !layer || layer->width() != m_canvasSize.width() || layer->height() != m_canvasSize.height())
+		return;
+
+	paintcore::Layer *sublayer = layer->getSubLayer(SUBLAYER_ID, paintcore::BlendMode::MODE_NORMAL, m_opacity);
+	const int xtiles = Tile::roundTiles(layer->width());
+
+	for(auto i=tiles.constBegin();i!=tiles.constEnd();++i) {
+		const int tx = i.key() % xtiles;
+		const int ty = i.key() / xtiles;
+		sublayer->rtile(tx, ty) = i.value();
+		if(layer->isVisible())
+			m_image->markDirty(tx, ty);
+	}
+	m_shown = true;
+	m_image->notifyAreaChanged();
+}
+
+void StrokePreview::clear()
+{
+	{
+		QMutexLocker lock(&m_mutex);
+		m_pending.clear();
+		m_published.clear();
+		++m_generation;
+	}
+
+	// Hiding the sublayer refreshes the tiles it covered. This happens in the
+	// same canvas update that draws the real stroke.
+	paintcore::Layer *layer = m_image->getLayer(m_layerId);
+	if(layer && m_shown)
+		layer->removeSublayer(SUBLAYER_ID);
+
+	m_shown = false;
+	m_layerId = 0;
+}
+
+}
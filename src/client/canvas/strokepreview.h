@@ -0,0 +1,131 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef STROKEPREVIEW_H
+#define STROKEPREVIEW_H
+
+#include "core/brush.h"
+#include "core/point.h"
+#include "core/tile.h"
+
+#include <QObject>
+#include <QMutex>
+#include <QVector>
+#include <QHash>
+#include <QSize>
+
+class QThreadPool;
+
+namespace protocol {
+	class PenMove;
+}
+
+namespace paintcore {
+	class Layer;
+	class LayerStack;
+}
+
+namespace canvas {
+
+struct DrawingContext;
+
+/**
+ * @brief A preview of the local user's stroke in progress
+ *
+ * Local pen moves are rasterized in a worker thread, so the GUI thread doesn't
+ * have to wait for the stroke to be drawn before it can handle the next input
+ * event. The worker draws into a layer only it touches and publishes the
+ * finished tiles, which are then put in a preview sublayer of the target layer.
+ * This way the preview is composited at the layer's position in the stack,
+ * with the layer's opacity and blending mode, just like the real stroke.
+ *
+ * The state tracker draws the same moves on the canvas later, in a batch,
+ * and then calls clear() to remove the preview sublayer. Both changes are
+ * part of the same canvas update, so the stroke never disappears for a frame.
+ */
+class StrokePreview : public QObject
+{
+	Q_OBJECT
+public:
+	explicit StrokePreview(paintcore::LayerStack *image, QObject *parent=nullptr);
+	~StrokePreview();
+
+	/**
+	 * @brief Can strokes drawn with this brush be previewed?
+	 *
+	 * The preview is drawn in a sublayer, so only normal blending
+	 * mode without smudging looks the same as the real stroke.
+	 */
+	static bool canPreview(const paintcore::Brush &brush);
+
+	/**
+	 * @brief Start previewing a new run of pen moves
+	 *
+	 * @param ctx drawing context as it is on the canvas before the moves
+	 */
+	void begin(const DrawingContext &ctx);
+
+	//! Queue a pen move for drawing in the worker thread
+	void addPenMove(const protocol::PenMove &move);
+
+	//! The moves have been drawn on the canvas: remove the preview
+	void clear();
+
+private slots:
+	void applyPublished();
+
+private:
+	//! ID of the preview sublayer
+	static const int SUBLAYER_ID = -2;
+
+	friend class StrokePreviewRunnable;
+	void drawPending();
+
+	paintcore::LayerStack *m_image;
+	QThreadPool *m_pool;
+
+	// GUI thread only
+	int m_layerId;
+	uchar m_opacity;
+	bool m_shown; // the sublayer has content
+
+	// Shared with the worker thread, guarded by m_mutex
+	QMutex m_mutex;
+	QVector<paintcore::Point> m_pending;
+	bool m_running;
+	int m_generation; // incremented whenever a new run starts
+	paintcore::Brush m_brush;
+	paintcore::Point m_startpoint;
+	bool m_startPendown;
+	paintcore::StrokeState m_startStroke;
+	QSize m_canvasSize;
+	QHash<int, paintcore::Tile> m_published; // finished tiles not yet put in the sublayer
+	bool m_publishQueued;
+
+	// Worker thread only
+	paintcore::Layer *m_work;
+	int m_workGeneration;
+	paintcore::Brush m_workBrush;
+	paintcore::Point m_lastpoint;
+	bool m_pendown;
+	paintcore::StrokeState m_stroke;
+};
+
+}
+
+#endif
@@ -40,10 +40,8 @@ int UserCursorModel::rowCount(const QModelIndex &parent) const
 
 QModelIndex UserCursorModel::indexForId(int id) const
 {
-	for(int i=0;i<m_cursors.size();++i)
-		if(m_cursors.at(i).id == id)
-			return index(i);
-	return QModelIndex();
+	const int row = m_rows.value(id, -1);
+	return row >= 0 ? index(row) : QModelIndex();
 }
 
 QVariant UserCursorModel::data(const QModelIndex &index, int role) const
@@ -116,13 +114,11 @@ void UserCursorModel::setCursorPosition(int id, const QPointF &pos)
 
 void UserCursorModel::hideCursor(int id)
 {
-	for(int i=0;i<m_cursors.size();++i) {
-		if(m_cursors.at(i).id == id) {
-			m_cursors[i].visible = false;
-			QModelIndex idx = index(i);
-			emit dataChanged(idx, idx, QVector<int>() << VisibleRole);
-			return;
-		}
+	const int row = m_rows.value(id, -1);
+	if(row >= 0) {
+		m_cursors[row].visible = false;
+		QModelIndex idx = index(row);
+		emit dataChanged(idx, idx, QVector<int>() << VisibleRole);
 	}
 }
 
@@ -130,19 +126,21 @@ void UserCursorModel::clear()
 {
 	beginResetModel();
 	m_cursors.clear();
+	m_rows.clear();
 	endResetModel();
 }
 
 UserCursor *UserCursorModel::getOrCreate(int id, QModelIndex &idx)
 {
-	for(int i=0;i<m_cursors.size();++i) {
-		if(m_cursors.at(i).id == id) {
-			idx = index(i);
-			return &m_cursors[i];
-		}
+	const int row = m_rows.value(id, -1);
+	if(row >= 0) {
+		idx = index(row);
+		return &m_cursors[row];
 	}
 
+	// Cursors are never removed individually, so rows stay valid until clear()
 	beginInsertRows(QModelIndex(), m_cursors.size(), m_cursors.size());
+	m_rows[id] = m_cursors.size();
 	m_cursors.append(UserCursor { id, false, QDateTime::currentMSecsSinceEpoch(), QPointF(), QStringLiteral("#%1").arg(id), QString(), QColor(Qt::black)});
 	endInsertRows();
 
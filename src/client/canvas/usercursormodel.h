@@ -75,6 +75,7 @@ private:
 	UserCursor *getOrCreate(int id, QModelIndex &index);
 
 	QList<UserCursor> m_cursors;
+	QHash<int, int> m_rows; // cursor ID -> row
 	int m_timerId;
 };
 
@@ -22,18 +22,63 @@
 #include <QTextDocument>
 #include <QPainter>
 #include <QImage>
+#include <QCache>
+#include <QMutex>
+#include <QtMath>
 
 namespace paintcore {
 
+namespace {
+
+// Zoom levels at which annotations are rendered: 2^MIN_SCALE ... 2^MAX_SCALE
+static const int MIN_SCALE = -3;
+static const int MAX_SCALE = 2;
+
+// Size of the annotation hit test grid cells
+static const int GRID_SIZE = 256;
+
+static inline int gridCell(int v) { return v >= 0 ? v / GRID_SIZE : (v - GRID_SIZE + 1) / GRID_SIZE; }
+static inline quint32 gridKey(int cx, int cy) { return quint32(quint16(cx)) | quint32(quint16(cy)) << 16; }
+
+// Rendered annotation cache size in kilobytes
+static const int RENDER_CACHE_SIZE = 32 * 1024;
+
+// Largest rendered image (in kilobytes) worth caching. Larger annotations are drawn directly.
+static const int MAX_CACHED_IMAGE_SIZE = RENDER_CACHE_SIZE / 4;
+
+struct RenderKey {
+	QString text;
+	QSize size;
+	QRgb background;
+	int valign;
+	int scale;
+
+	bool operator==(const RenderKey &o) const {
+		return scale == o.scale && size == o.size && background == o.background && valign == o.valign && text == o.text;
+	}
+};
+
+uint qHash(const RenderKey &k, uint seed=0)
+{
+	return ::qHash(k.text, seed) ^ ::qHash(k.size.width() << 16 | k.size.height()) ^ ::qHash(k.background) ^ ::qHash(k.valign << 8 | (k.scale - MIN_SCALE));
+}
+
+// Annotations are flattened from background threads as well (e.g. when building a recording index)
+QMutex renderCacheMutex;
+QCache<RenderKey, QImage> renderCache(RENDER_CACHE_SIZE);
+
+}
+
 AnnotationModel::AnnotationModel(QObject *parent)
-	: QAbstractListModel(parent)
+	: QAbstractListModel(parent), m_gridValid(false)
 {
 }
 
 AnnotationModel::AnnotationModel(const AnnotationModel *orig, QObject *newParent)
-	: QAbstractListModel(newParent)
+	: QAbstractListModel(newParent), m_gridValid(false)
 {
 	m_annotations = orig->m_annotations;
+	m_rows = orig->m_rows;
 }
 
 int AnnotationModel::rowCount(const QModelIndex &parent) const
@@ -81,7 +126,9 @@ void AnnotationModel::addAnnotation(const Annotation &annotation)
 	}
 
 	beginInsertRows(QModelIndex(), m_annotations.size(), m_annotations.size());
+	m_rows[annotation.id] = m_annotations.size();
 	m_annotations.append(annotation);
+	m_gridValid = false;
 	endInsertRows();
 }
 
@@ -100,6 +147,7 @@ void AnnotationModel::deleteAnnotation(int id)
 
 	beginRemoveRows(QModelIndex(), idx, idx);
 	m_annotations.removeAt(idx);
+	updateIndex();
 	endRemoveRows();
 }
 
@@ -111,7 +159,12 @@ void AnnotationModel::reshapeAnnotation(int id, const QRect &newrect)
 		return;
 	}
 
-	m_annotations[idx].rect = newrect;
+	Annotation &a = m_annotations[idx];
+	if(a.rect.size() != newrect.size())
+		Annotation::forgetRendered(a.text, a.rect.size(), a.background, a.valign);
+
+	a.rect = newrect;
+	m_gridValid = false;
 	emit dataChanged(index(idx), index(idx), QVector<int>() << RectRole);
 }
 
@@ -122,6 +175,8 @@ void AnnotationModel::changeAnnotation(int id, const QString &newtext, bool prot
 		qWarning("Cannot change annotation: ID %d not found!", id);
 		return;
 	}
+	Annotation::forgetRendered(m_annotations[idx].text, m_annotations[idx].rect.size(), m_annotations[idx].background, m_annotations[idx].valign);
+
 	m_annotations[idx].text = newtext;
 	m_annotations[idx].background = bgcolor;
 	m_annotations[idx].protect = protect;
@@ -134,23 +189,41 @@ void AnnotationModel::setAnnotations(const QList<Annotation> &annotations)
 {
 	beginResetModel();
 	m_annotations = annotations;
+	updateIndex();
 	endResetModel();
 }
 
 const Annotation *AnnotationModel::getById(int id) const
 {
-	for(const Annotation &a : m_annotations)
-		if(a.id == id)
-			return &a;
-	return nullptr;
+	const int idx = findById(id);
+	return idx >= 0 ? &m_annotations.at(idx) : nullptr;
 }
 
 int AnnotationModel::findById(int id) const
 {
+	return m_rows.value(id, -1);
+}
+
+//! Rebuild the ID index after rows have been removed or replaced
+void AnnotationModel::updateIndex()
+{
+	m_rows.clear();
 	for(int i=0;i<m_annotations.size();++i)
-		if(m_annotations.at(i).id == id)
-			return i;
-	return -1;
+		m_rows[m_annotations.at(i).id] = i;
+	m_gridValid = false;
+}
+
+void AnnotationModel::updateGrid() const
+{
+	m_grid.clear();
+	for(int i=0;i<m_annotations.size();++i) {
+		const QRect &r = m_annotations.at(i).rect;
+		for(int cy=gridCell(r.top());cy<=gridCell(r.bottom());++cy) {
+			for(int cx=gridCell(r.left());cx<=gridCell(r.right());++cx)
+				m_grid[gridKey(cx, cy)] << i;
+		}
+	}
+	m_gridValid = true;
 }
 
 /**
@@ -161,11 +234,36 @@ int AnnotationModel::findById(int id) const
 const Annotation *AnnotationModel::annotationAtPos(const QPoint &pos, qreal zoom) const
 {
 	const int H = qRound(qMax(qreal(Annotation::HANDLE_SIZE), Annotation::HANDLE_SIZE / zoom) / 2.0);
-	for(const Annotation &a : m_annotations) {
-		if(a.rect.adjusted(-H, -H, H, H).contains(pos))
-			return &a;
+
+	// A point is inside an annotation's handle margin if the annotation
+	// touches the square of the same size around the point
+	const int cx0 = gridCell(pos.x() - H), cx1 = gridCell(pos.x() + H);
+	const int cy0 = gridCell(pos.y() - H), cy1 = gridCell(pos.y() + H);
+
+	if((cx1-cx0+1) * (cy1-cy0+1) > m_annotations.size()) {
+		// Very far zoomed out: checking every annotation is cheaper
+		for(const Annotation &a : m_annotations) {
+			if(a.rect.adjusted(-H, -H, H, H).contains(pos))
+				return &a;
+		}
+		return nullptr;
 	}
-	return nullptr;
+
+	if(!m_gridValid)
+		updateGrid();
+
+	// The first matching annotation (in stacking order) wins
+	int found = -1;
+	for(int cy=cy0;cy<=cy1;++cy) {
+		for(int cx=cx0;cx<=cx1;++cx) {
+			for(const int i : m_grid.value(gridKey(cx, cy))) {
+				if((found < 0 || i < found) && m_annotations.at(i).rect.adjusted(-H, -H, H, H).contains(pos))
+					found = i;
+			}
+		}
+	}
+
+	return found >= 0 ? &m_annotations.at(found) : nullptr;
 }
 
 Annotation::Handle AnnotationModel::annotationHandleAt(int id, const QPoint &point, qreal zoom) const
@@ -178,14 +276,14 @@ Annotation::Handle AnnotationModel::annotationHandleAt(int id, const QPoint &poi
 
 Annotation::Handle AnnotationModel::annotationAdjustGeometry(int id, Annotation::Handle handle, const QPoint &delta)
 {
-	for(int idx=0;idx<m_annotations.size();++idx) {
-		if(m_annotations.at(idx).id == id) {
-			handle = m_annotations[idx].adjustGeometry(handle, delta);
-			emit dataChanged(index(idx), index(idx), QVector<int>() << RectRole);
-			return handle;
-		}
-	}
-	return Annotation::OUTSIDE;
+	const int idx = findById(id);
+	if(idx < 0)
+		return Annotation::OUTSIDE;
+
+	handle = m_annotations[idx].adjustGeometry(handle, delta);
+	m_gridValid = false;
+	emit dataChanged(index(idx), index(idx), QVector<int>() << RectRole);
+	return handle;
 }
 
 QList<int> AnnotationModel::getEmptyIds() const
@@ -202,6 +300,7 @@ void AnnotationModel::clear()
 {
 	beginResetModel();
 	m_annotations.clear();
+	updateIndex();
 	endResetModel();
 }
 
@@ -212,40 +311,117 @@ void Annotation::paint(QPainter *painter) const
 
 void Annotation::paint(QPainter *painter, const QRectF &paintrect) const
 {
-	painter->save();
-	painter->translate(paintrect.topLeft());
+	if(paintrect.isEmpty())
+		return;
+
+	const QTransform &t = painter->worldTransform();
+	const qreal scale = qSqrt(qAbs(t.determinant())) * paintrect.width() / qMax(1, rect.width());
+
+	paintContent(painter, paintrect, text, rect.size(), background, valign, scale);
+}
+
+QImage Annotation::toImage() const
+{
+	return render(text, rect.size(), background, valign).convertToFormat(QImage::Format_ARGB32);
+}
 
-	const QRectF rect0(QPointF(), paintrect.size());
+static void drawDocument(QPainter *painter, const QString &text, const QSize &size, int valign)
+{
+	if(text.isEmpty())
+		return;
 
-	painter->fillRect(rect0, background);
+	painter->setRenderHint(QPainter::Antialiasing);
+	painter->setRenderHint(QPainter::TextAntialiasing);
 
 	QTextDocument doc;
 	doc.setHtml(text);
-	doc.setTextWidth(rect0.width());
+	doc.setTextWidth(size.width());
 
 	QPointF offset;
 	if(valign == protocol::AnnotationEdit::FLAG_VALIGN_CENTER) {
-		offset.setY((rect0.height() - doc.size().height()) / 2);
+		offset.setY((size.height() - doc.size().height()) / 2);
 
 	} else if(valign == protocol::AnnotationEdit::FLAG_VALIGN_BOTTOM) {
-		offset.setY(rect0.height() - doc.size().height());
+		offset.setY(size.height() - doc.size().height());
 	}
 	painter->translate(offset);
 
-	doc.drawContents(painter, QRectF(-offset, rect0.size()));
+	doc.drawContents(painter, QRectF(-offset, size));
+}
 
-	painter->restore();
+static int scaleLevel(qreal scale)
+{
+	return qBound(MIN_SCALE, qCeil(std::log2(qMax(scale, 0.001))), MAX_SCALE);
 }
 
-QImage Annotation::toImage() const
+static QSize scaledImageSize(const QSize &size, int level)
+{
+	return (QSizeF(size) * qPow(2, level)).toSize().expandedTo(QSize(1, 1));
+}
+
+QImage Annotation::render(const QString &text, const QSize &size, const QColor &background, int valign, qreal scale)
 {
-	QImage img(rect.size(), QImage::Format_ARGB32);
-	img.fill(0);
-	QPainter painter(&img);
-	paint(&painter, QRectF(0, 0, rect.width(), rect.height()));
+	if(size.isEmpty())
+		return QImage();
+
+	const RenderKey key { text, size, background.rgba(), valign, scaleLevel(scale) };
+
+	{
+		QMutexLocker lock(&renderCacheMutex);
+		const QImage *cached = renderCache.object(key);
+		if(cached)
+			return *cached;
+	}
+
+	QImage img(scaledImageSize(size, key.scale), QImage::Format_ARGB32_Premultiplied);
+	img.fill(background);
+
+	if(!text.isEmpty()) {
+		QPainter painter(&img);
+		const qreal s = qPow(2, key.scale);
+		painter.scale(s, s);
+		drawDocument(&painter, text, size, valign);
+	}
+
+	QMutexLocker lock(&renderCacheMutex);
+	renderCache.insert(key, new QImage(img), qMax(1, img.byteCount() / 1024));
+
 	return img;
 }
 
+void Annotation::paintContent(QPainter *painter, const QRectF &target, const QString &text, const QSize &size, const QColor &background, int valign, qreal scale)
+{
+	if(size.isEmpty() || target.isEmpty())
+		return;
+
+	const QSize imageSize = scaledImageSize(size, scaleLevel(scale));
+	const bool tooLarge = qint64(imageSize.width()) * imageSize.height() * 4 / 1024 > MAX_CACHED_IMAGE_SIZE;
+
+	painter->save();
+	if(tooLarge || scale > qPow(2, MAX_SCALE)) {
+		// The cached image would either be rejected by the cache or be
+		// blurry when scaled up, so the text is drawn at full resolution
+		painter->translate(target.topLeft());
+		painter->scale(target.width() / size.width(), target.height() / size.height());
+		painter->setClipRect(QRect(QPoint(), size), Qt::IntersectClip);
+		painter->fillRect(QRect(QPoint(), size), background);
+		drawDocument(painter, text, size, valign);
+
+	} else {
+		painter->setRenderHint(QPainter::SmoothPixmapTransform);
+		painter->drawImage(target, render(text, size, background, valign, scale));
+	}
+	painter->restore();
+}
+
+void Annotation::forgetRendered(const QString &text, const QSize &size, const QColor &background, int valign)
+{
+	QMutexLocker lock(&renderCacheMutex);
+	RenderKey key { text, size, background.rgba(), valign, 0 };
+	for(key.scale=MIN_SCALE;key.scale<=MAX_SCALE;++key.scale)
+		renderCache.remove(key);
+}
+
 /**
  * Note. Assumes point is inside the text box.
  */
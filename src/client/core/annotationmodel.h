@@ -47,6 +47,37 @@ struct Annotation {
 	void paint(QPainter *painter, const QRectF &paintrect) const;
 	QImage toImage() const;
 
+	/**
+	 * @brief Get the annotation's content (background and text) as an image
+	 *
+	 * Rendered images are cached. The cache is keyed by the content, size
+	 * and zoom level, so an annotation is laid out again only after it has
+	 * been edited or resized.
+	 *
+	 * @param text annotation content (HTML)
+	 * @param size annotation size
+	 * @param background background color
+	 * @param valign vertical alignment flags
+	 * @param scale the scale the image will be drawn at. This is rounded up to the nearest power of two
+	 */
+	static QImage render(const QString &text, const QSize &size, const QColor &background, int valign, qreal scale=1.0);
+
+	/**
+	 * @brief Draw the annotation's content (background and text)
+	 *
+	 * The content is drawn from the render cache, unless the image would
+	 * be too large to cache or the zoom level is above what is cached.
+	 * In that case, the text is laid out and drawn directly.
+	 *
+	 * @param painter the painter to draw with
+	 * @param target the rectangle to draw the content in
+	 * @param scale the scale the content is drawn at
+	 */
+	static void paintContent(QPainter *painter, const QRectF &target, const QString &text, const QSize &size, const QColor &background, int valign, qreal scale);
+
+	//! Drop the cached images of the given annotation content
+	static void forgetRendered(const QString &text, const QSize &size, const QColor &background, int valign);
+
 	//! Get the translation handle at the point
 	Handle handleAt(const QPoint &point, qreal zoom) const;
 
@@ -117,8 +148,17 @@ private:
 	AnnotationModel(const AnnotationModel *orig, QObject *newParent);
 
 	int findById(int id) const;
+	void updateIndex();
+	void updateGrid() const;
 
 	QList<Annotation> m_annotations;
+
+	// Annotation ID -> row
+	QHash<int, int> m_rows;
+
+	// Spatial index for hit tests: grid cell -> rows of the annotations that touch it
+	mutable QHash<quint32, QVector<int>> m_grid;
+	mutable bool m_gridValid;
 };
 
 }
@@ -130,13 +130,13 @@ struct StrokeState {
 	// number of dabs since last smudge color sampling
 	int smudgeDistance;
 
-	// the smudged color. This is used instead of the normal
+	// the smudged color (always opaque). This is used instead of the normal
 	// brush color when smudging is enabled, so initialize it to the brush
 	// color at the start of the stroke.
-	QColor smudgeColor;
+	QRgb smudgeColor;
 
-	StrokeState() : distance(0), smudgeDistance(0) { }
-	explicit StrokeState(const Brush &b) : distance(0), smudgeDistance(0), smudgeColor(b.color()) { }
+	StrokeState() : distance(0), smudgeDistance(0), smudgeColor(qRgb(0, 0, 0)) { }
+	explicit StrokeState(const Brush &b) : distance(0), smudgeDistance(0), smudgeColor(b.color().rgb()) { }
 };
 
 }
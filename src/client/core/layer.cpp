@@ -16,7 +16,6 @@
    You should have received a copy of the GNU General Public License
    along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include <QPainter>
 #include <QImage>
 #include <QDataStream>
 #include <QtMath>
@@ -265,6 +264,51 @@ QImage Layer::toImage() const {
 	return image;
 }
 
+QImage Layer::regionImage(const QRect &rect) const
+{
+	QImage image(rect.size(), QImage::Format_ARGB32);
+	if(image.isNull())
+		return image;
+
+	const QRect area = rect.intersected(QRect(0, 0, m_width, m_height));
+	if(area != rect)
+		image.fill(0);
+
+	if(area.isEmpty())
+		return image;
+
+	const int tx0 = area.left() / Tile::SIZE;
+	const int tx1 = area.right() / Tile::SIZE;
+	const int ty0 = area.top() / Tile::SIZE;
+	const int ty1 = area.bottom() / Tile::SIZE;
+
+	for(int ty=ty0;ty<=ty1;++ty) {
+		for(int tx=tx0;tx<=tx1;++tx) {
+			const QRect tileRect = QRect(tx*Tile::SIZE, ty*Tile::SIZE, Tile::SIZE, Tile::SIZE).intersected(area);
+			const Tile &t = tile(tx, ty);
+
+			const int len = tileRect.width() * 4;
+			uchar *dest = image.bits() + (tileRect.y()-rect.y()) * image.bytesPerLine() + (tileRect.x()-rect.x()) * 4;
+
+			if(t.isNull()) {
+				for(int y=0;y<tileRect.height();++y) {
+					memset(dest, 0, len);
+					dest += image.bytesPerLine();
+				}
+			} else {
+				const quint32 *src = t.data() + (tileRect.y() - ty*Tile::SIZE) * Tile::SIZE + (tileRect.x() - tx*Tile::SIZE);
+				for(int y=0;y<tileRect.height();++y) {
+					memcpy(dest, src, len);
+					dest += image.bytesPerLine();
+					src += Tile::SIZE;
+				}
+			}
+		}
+	}
+
+	return image;
+}
+
 QImage Layer::toCroppedImage(int *xOffset, int *yOffset) const
 {
 	int top=m_ytiles, bottom=0;
@@ -328,7 +372,7 @@ QColor Layer::colorAt(int x, int y, int dia) const
 	} else {
 		Brush b(dia, 0.9);
 		BrushStamp bs = makeGimpStyleBrushStamp(b, Point(x, y, 1));
-		return getDabColor(bs);
+		return QColor::fromRgba(getDabColor(bs));
 	}
 }
 
@@ -380,89 +424,6 @@ void Layer::setHidden(bool hide)
 	}
 }
 
-/**
- * Return a temporary layer with the original image padded and composited with the
- * content of this layer.
- *
- * @param xpos target image position
- * @param ypos target image position
- * @param original the image to pad
- * @param mode compositing mode
- */
-Layer Layer::padImageToTileBoundary(int xpos, int ypos, const QImage &original, BlendMode::Mode mode) const
-{
-	const int x0 = Tile::roundDown(xpos);
-	const int x1 = qMin(m_width, Tile::roundUp(xpos+original.width()));
-	const int y0 = Tile::roundDown(ypos);
-	const int y1 = qMin(m_height, Tile::roundUp(ypos+original.height()));
-
-	const int w = x1 - x0;
-	const int h = y1 - y0;
-	
-	// Pad the image to tile boundaries
-	QImage image;
-	if(image.width() == w && image.height() == h) {
-		image = original;
-
-	} else {
-		image = QImage(w, h, QImage::Format_ARGB32);
-		QPainter painter(&image);
-
-		if(mode == BlendMode::MODE_REPLACE) {
-			// Replace mode is special: we must copy the original pixels
-			// and do the composition with QPainter, since layer merge
-			// can't distinguish the padding from image transparency
-			for(int y=0;y<h;y+=Tile::SIZE) {
-				for(int x=0;x<w;x+=Tile::SIZE) {
-					tile((x0+x) / Tile::SIZE, (y0+y) / Tile::SIZE).copyToImage(image, x, y);
-				}
-			}
-			painter.setCompositionMode(QPainter::CompositionMode_Source);
-
-		} else {
-			image.fill(0);
-		}
-
-		painter.drawImage(xpos-x0, ypos-y0, original);
-#if 0 /* debugging aid */
-		painter.setPen(Qt::red);
-		painter.drawLine(0, 0, w-1, 0);
-		painter.drawLine(0, 0, 0, h-1);
-		painter.drawLine(w-1, 0, w-1, h-1);
-		painter.drawLine(0, h-1, w-1, h-1);
-#endif
-	}
-
-	// Create scratch layers and composite
-	Layer scratch(nullptr, 0, QString(), Qt::transparent, QSize(w,h));
-	Layer imglayer = scratch;
-
-	// Copy image pixels to image layer
-	for(int y=0;y<h;y+=Tile::SIZE) {
-		for(int x=0;x<w;x+=Tile::SIZE) {
-			imglayer.rtile(x/Tile::SIZE, y/Tile::SIZE) = Tile(image, x, y);
-		}
-	}
-
-	// In replace mode, compositing was already done with QPainter
-	if(mode == BlendMode::MODE_REPLACE) {
-		return imglayer;
-	}
-
-	// Copy tiles from current layer to scratch layer
-	for(int y=0;y<h;y+=Tile::SIZE) {
-		for(int x=0;x<w;x+=Tile::SIZE) {
-			scratch.rtile(x/Tile::SIZE, y/Tile::SIZE) = tile((x+x0)/Tile::SIZE, (y+y0)/Tile::SIZE);
-		}
-	}
-
-	// Merge image using standard layer compositing ops
-	imglayer.setBlend(mode);
-
-	scratch.merge(&imglayer);
-	return scratch;
-}
-
 /**
  * @param x x coordinate
  * @param y y coordinate
@@ -472,40 +433,44 @@ Layer Layer::padImageToTileBoundary(int xpos, int ypos, const QImage &original,
 void Layer::putImage(int x, int y, QImage image, BlendMode::Mode mode)
 {
 	Q_ASSERT(image.format() == QImage::Format_ARGB32);
-	
-	// Check if the image is completely outside the layer
-	if(x >= m_width || y >= m_height || x+image.width() < 0 || y+image.height() < 0)
-		return;
 
-	// Crop image if x or y are negative
-	if(x<0 || y<0) {
-		const int xCrop = x<0 ? -x : 0;
-		const int yCrop = y<0 ? -y : 0;
-
-		image = image.copy(xCrop, yCrop, image.width()-xCrop, image.height()-yCrop);
-		x = qMax(0, x);
-		y = qMax(0, y);
-	}
-
-	const int x0 = Tile::roundDown(x);
-	const int y0 = Tile::roundDown(y);
-	
-	Layer imageLayer = padImageToTileBoundary(x, y, image, mode);
+	const QRect rect = QRect(x, y, image.width(), image.height()).intersected(QRect(0, 0, m_width, m_height));
+	if(rect.isEmpty())
+		return;
 
-	// Replace this layer's tiles with the scratch tiles
-	const int tx0 = x0 / Tile::SIZE;
-	const int ty0 = y0 / Tile::SIZE;
-	const int tx1 = qMin((x0 + imageLayer.width() - 1) / Tile::SIZE, m_xtiles-1);
-	const int ty1 = qMin((y0 + imageLayer.height() - 1) / Tile::SIZE, m_ytiles-1);
+	// Blit the image row by row directly into the tiles it covers
+	const int tx0 = rect.left() / Tile::SIZE;
+	const int tx1 = rect.right() / Tile::SIZE;
+	const int ty0 = rect.top() / Tile::SIZE;
+	const int ty1 = rect.bottom() / Tile::SIZE;
+	const int stride = image.bytesPerLine() / 4;
 
 	for(int ty=ty0;ty<=ty1;++ty) {
 		for(int tx=tx0;tx<=tx1;++tx) {
-			rtile(tx, ty) = imageLayer.tile(tx-tx0, ty-ty0);
+			const QRect tileRect = QRect(tx*Tile::SIZE, ty*Tile::SIZE, Tile::SIZE, Tile::SIZE).intersected(rect);
+			const int sx = tileRect.x() - x;
+			const int sy = tileRect.y() - y;
+
+			if(mode == BlendMode::MODE_REPLACE && tileRect.width() == Tile::SIZE && tileRect.height() == Tile::SIZE) {
+				// Fast path for tile aligned images (see net::command::putQImage): the whole tile is replaced
+				rtile(tx, ty) = Tile(image, sx, sy);
+
+			} else {
+				rtile(tx, ty).putPixels(
+					mode,
+					reinterpret_cast<const quint32*>(image.constScanLine(sy)) + sx,
+					tileRect.x() - tx*Tile::SIZE,
+					tileRect.y() - ty*Tile::SIZE,
+					tileRect.width(),
+					tileRect.height(),
+					stride
+				);
+			}
 		}
 	}
-	
+
 	if(m_owner && isVisible()) {
-		m_owner->markDirty(QRect(x, y, image.width(), image.height()));
+		m_owner->markDirty(rect);
 		m_owner->notifyAreaChanged();
 	}
 }
@@ -760,21 +725,22 @@ void Layer::directDab(const Brush &brush, const Point& point, StrokeState &state
 	const qreal smudge = brush.smudge(point.pressure());
 
 	if(++state.smudgeDistance > brush.resmudge() && smudge>0) {
-		const QColor sampled = getDabColor(bs);
+		const QRgb sampled = getDabColor(bs);
 
-		const qreal a = sampled.alphaF() * smudge;
+		const uint a = (qAlpha(sampled) * uint(qRound(smudge * 255)) + 127) / 255;
+		const uint ia = 255 - a;
 
-		state.smudgeColor = QColor::fromRgbF(
-			state.smudgeColor.redF() * (1-a) + sampled.redF() * a,
-			state.smudgeColor.greenF() * (1-a) + sampled.greenF() * a,
-			state.smudgeColor.blueF() * (1-a) + sampled.blueF() * a
+		state.smudgeColor = qRgb(
+			(qRed(state.smudgeColor) * ia + qRed(sampled) * a + 127) / 255,
+			(qGreen(state.smudgeColor) * ia + qGreen(sampled) * a + 127) / 255,
+			(qBlue(state.smudgeColor) * ia + qBlue(sampled) * a + 127) / 255
 		);
 		state.smudgeDistance = 0;
 	}
 
 	// Composite the brush mask onto the layer
 	const uchar *values = bs.mask.data();
-	QColor color = smudge > 0 ? state.smudgeColor : brush.color();
+	QColor color = smudge > 0 ? QColor::fromRgb(state.smudgeColor) : brush.color();
 
 	// A single dab can (and often does) span multiple tiles.
 	int y = top<0?0:top;
@@ -816,9 +782,9 @@ void Layer::directDab(const Brush &brush, const Point& point, StrokeState &state
 /**
  * @brief Get a weighted average of the layer's color, using the given brush mask as the weight
  * @param stamp
- * @return color average
+ * @return unpremultiplied color average
  */
-QColor Layer::getDabColor(const BrushStamp &stamp) const
+QRgb Layer::getDabColor(const BrushStamp &stamp) const
 {
 	// This is very much like directDab, instead we only read pixel values
 	const uchar *weights = stamp.mask.data();
@@ -833,7 +799,7 @@ QColor Layer::getDabColor(const BrushStamp &stamp) const
 	const int x0 = qMax(0, stamp.left);
 	const int xb0 = stamp.left<0?-stamp.left:0;
 
-	qreal weight=0, red=0, green=0, blue=0, alpha=0;
+	quint32 weight=0, red=0, green=0, blue=0, alpha=0;
 
 	// collect weighted color sums
 	while(y<bottom) {
@@ -862,20 +828,17 @@ QColor Layer::getDabColor(const BrushStamp &stamp) const
 		yb = yb + hb;
 	}
 
-	// Calculate final average
-	red /= weight;
-	green /= weight;
-	blue /= weight;
-	alpha /= weight;
-
-	// Unpremultiply
-	if(alpha>0) {
-		red = qMin(1.0, red/alpha);
-		green = qMin(1.0, green/alpha);
-		blue = qMin(1.0, blue/alpha);
-	}
+	if(weight == 0 || alpha == 0)
+		return 0;
 
-	return QColor::fromRgbF(red, green, blue, alpha);
+	// Calculate final average and unpremultiply.
+	// (The weight cancels out of the color channels)
+	return qRgba(
+		qMin(quint64(255), (quint64(red) * 255 + alpha/2) / alpha),
+		qMin(quint64(255), (quint64(green) * 255 + alpha/2) / alpha),
+		qMin(quint64(255), (quint64(blue) * 255 + alpha/2) / alpha),
+		qMin(quint64(255), (quint64(alpha) * 255 + weight/2) / weight)
+	);
 }
 
 /**
@@ -1046,6 +1009,28 @@ void Layer::removeSublayer(int id)
 	}
 }
 
+void Layer::restoreContent(const Layer &layer)
+{
+	Q_ASSERT(layer.m_width == m_width && layer.m_height == m_height);
+
+	m_tiles = layer.m_tiles;
+
+	// Preview sublayers are local and not part of the saved content
+	QMutableListIterator<Layer*> i(m_sublayers);
+	while(i.hasNext()) {
+		Layer *sl = i.next();
+		if(sl->id() >= 0) {
+			delete sl;
+			i.remove();
+		}
+	}
+
+	for(const Layer *sl : layer.sublayers()) {
+		if(sl->id() >= 0 && !sl->isHidden())
+			m_sublayers.append(new Layer(*sl));
+	}
+}
+
 void Layer::removePreviews()
 {
 	for(Layer *sl : m_sublayers) {
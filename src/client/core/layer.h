@@ -87,6 +87,14 @@ class Layer {
 		//! Get the layer as an image
 		QImage toImage() const;
 
+		/**
+		 * @brief Get a part of the layer as an image
+		 *
+		 * Only the tiles under the rectangle are read. Parts of the rectangle
+		 * outside the layer are transparent.
+		 */
+		QImage regionImage(const QRect &rect) const;
+
 		//! Get the layer as an image with excess transparency cropped away
 		QImage toCroppedImage(int *xOffset, int *yOffset) const;
 
@@ -171,6 +179,15 @@ class Layer {
 		//! Merge a layer
 		void merge(const Layer *layer, bool sublayers=false);
 
+		/**
+		 * @brief Replace this layer's pixel content with that of another layer
+		 *
+		 * The tiles and (non-preview) sublayers are copied, but layer
+		 * attributes are left as they are. The layers must be the same size.
+		 * Nothing is marked dirty.
+		 */
+		void restoreContent(const Layer &layer);
+
 		//! Optimize layer memory usage
 		void optimize();
 
@@ -226,13 +243,11 @@ class Layer {
 		//! Construct a sublayer
 		Layer(LayerStack *owner, int id, const QSize& size);
 
-		Layer padImageToTileBoundary(int leftpad, int toppad, const QImage &original, BlendMode::Mode mode) const;
-
 		void directDab(const Brush &brush, const Point& point, StrokeState &state);
 		void drawHardLine(const Brush &brush, const Point& from, const Point& to, StrokeState &state);
 		void drawSoftLine(const Brush &brush, const Point& from, const Point& to, StrokeState &state);
 
-		QColor getDabColor(const BrushStamp &stamp) const;
+		QRgb getDabColor(const BrushStamp &stamp) const;
 
 		LayerStack *m_owner;
 		LayerInfo m_info;
@@ -30,8 +30,58 @@
 
 namespace paintcore {
 
+/**
+ * @brief Downsample a flattened tile using a box filter
+ *
+ * Only the top-left w*h pixels of the source tile are used, so
+ * the pixels past the edge of the canvas don't bleed in.
+ *
+ * @param src source tile
+ * @param w source width
+ * @param h source height
+ * @param step downsampling factor (power of two)
+ * @param dest destination pixels
+ * @param destStride destination line length in pixels
+ */
+static void downsampleTile(const quint32 *src, int w, int h, int step, quint32 *dest, int destStride)
+{
+	for(int y=0;y<(h+step-1)/step;++y) {
+		quint32 *scanline = dest + y * destStride;
+		const int y1 = qMin(h, (y+1)*step);
+
+		for(int x=0;x<(w+step-1)/step;++x) {
+			const int x1 = qMin(w, (x+1)*step);
+			quint32 a=0, r=0, g=0, b=0, n=0;
+
+			for(int sy=y*step;sy<y1;++sy) {
+				const quint32 *line = src + sy*Tile::SIZE;
+				for(int sx=x*step;sx<x1;++sx) {
+					const quint32 c = line[sx];
+					a += qAlpha(c);
+					r += qRed(c);
+					g += qGreen(c);
+					b += qBlue(c);
+					++n;
+				}
+			}
+
+			scanline[x] = qRgba(r/n, g/n, b/n, a/n);
+		}
+	}
+}
+
+// Default reduced level tile cache size in kilobytes
+static const int DEFAULT_MIPMAP_CACHE_SIZE = 24 * 1024;
+
+static const int MIPMAP_TILE_COST = Tile::BYTES / 1024;
+
+static inline quint64 mipmapKey(int x, int y, int lod) { return quint64(lod) << 32 | quint64(y) << 16 | quint64(x); }
+
+const int LayerStack::MAX_LOD;
+
 LayerStack::LayerStack(QObject *parent)
-	: QObject(parent), m_width(0), m_height(0), m_viewmode(NORMAL), m_viewlayeridx(0),
+	: QObject(parent), m_width(0), m_height(0), m_batchDepth(0),
+	  m_mipmaps(DEFAULT_MIPMAP_CACHE_SIZE), m_viewmode(NORMAL), m_viewlayeridx(0),
 	  m_onionskinsBelow(4), m_onionskinsAbove(4), m_onionskinTint(true), m_viewBackgroundLayer(true)
 {
 	m_annotations = new AnnotationModel(this);
@@ -43,6 +93,8 @@ LayerStack::LayerStack(const LayerStack *orig, QObject *parent)
 	  m_height(orig->m_height),
 	  m_xtiles(orig->m_xtiles),
 	  m_ytiles(orig->m_ytiles),
+	  m_batchDepth(0),
+	  m_mipmaps(orig->m_mipmaps.maxCost()),
 	  m_viewmode(orig->m_viewmode),
 	  m_viewlayeridx(orig->m_viewlayeridx),
 	  m_onionskinsBelow(orig->m_onionskinsBelow),
@@ -52,6 +104,7 @@ LayerStack::LayerStack(const LayerStack *orig, QObject *parent)
 	m_annotations = orig->m_annotations->clone(this);
 	for(const Layer *l : orig->m_layers)
 		m_layers << new Layer(*l, this);
+	resetMipmaps();
 }
 
 LayerStack::~LayerStack()
@@ -71,6 +124,7 @@ void LayerStack::reset()
 		delete l;
 	m_layers.clear();
 	m_annotations->clear();
+	resetMipmaps();
 	emit resized(0, 0, oldsize);
 	emit layersChanged(QList<LayerInfo>());
 }
@@ -100,6 +154,7 @@ void LayerStack::resize(int top, int right, int bottom, int left)
 	m_xtiles = Tile::roundTiles(m_width);
 	m_ytiles = Tile::roundTiles(m_height);
 	m_dirtytiles = QBitArray(m_xtiles*m_ytiles, true);
+	resetMipmaps();
 
 	for(Layer *l : m_layers)
 		l->resize(top, right, bottom, left);
@@ -374,6 +429,140 @@ Tile LayerStack::getFlatTile(int x, int y) const
 	return t;
 }
 
+QImage LayerStack::flatTileImage(int x, int y, int lod) const
+{
+	Q_ASSERT(lod>=0 && lod<=MAX_LOD);
+
+	// The checkerboard makes the result opaque, so RGB32 can be used for faster drawing
+	QImage image(Tile::SIZE, Tile::SIZE, QImage::Format_RGB32);
+	quint32 *data = reinterpret_cast<quint32*>(image.bits());
+
+	Tile::fillChecker(data, QColor(128,128,128), Qt::white);
+
+	if(lod == 0) {
+		flattenTile(data, x, y);
+
+	} else {
+		const Tile reduced = mipmapTile(x, y, lod);
+		compositePixels(BlendMode::MODE_NORMAL, data, reduced.data(), Tile::LENGTH, 255);
+	}
+
+	return image;
+}
+
+/**
+ * Returns the cached tile if it is still up to date. Otherwise the tile is
+ * rebuilt by downsampling the four tiles below it at level lod-1.
+ * At level 1, the children are flattened full resolution tiles.
+ *
+ * Tiles at different levels can be built in parallel, as long as
+ * the layers are not modified at the same time.
+ */
+Tile LayerStack::mipmapTile(int x, int y, int lod) const
+{
+	Q_ASSERT(lod>0 && lod<=MAX_LOD);
+	Q_ASSERT(x>=0 && x<(m_xtiles + (1<<lod) - 1) >> lod);
+	Q_ASSERT(y>=0 && y<(m_ytiles + (1<<lod) - 1) >> lod);
+	const quint64 key = mipmapKey(x, y, lod);
+
+	{
+		QMutexLocker lock(&m_mipmapMutex);
+		const Tile *cached = m_mipmaps.object(key);
+		if(cached)
+			return *cached;
+	}
+
+	// Size of the level below, in tiles and in pixels
+	const int childLod = lod - 1;
+	const int childXtiles = (m_xtiles + (1<<childLod) - 1) >> childLod;
+	const int childYtiles = (m_ytiles + (1<<childLod) - 1) >> childLod;
+	const int childWidth = (m_width + (1<<childLod) - 1) >> childLod;
+	const int childHeight = (m_height + (1<<childLod) - 1) >> childLod;
+
+	const int half = Tile::SIZE / 2;
+	Tile tile(Qt::transparent);
+	quint32 flat[Tile::LENGTH];
+
+	for(int sy=0;sy<2;++sy) {
+		const int cy = y*2 + sy;
+		if(cy >= childYtiles)
+			break;
+
+		for(int sx=0;sx<2;++sx) {
+			const int cx = x*2 + sx;
+			if(cx >= childXtiles)
+				break;
+
+			Tile child;
+			const quint32 *src;
+			if(childLod == 0) {
+				memset(flat, 0, sizeof flat);
+				flattenTile(flat, cx, cy);
+				src = flat;
+			} else {
+				child = mipmapTile(cx, cy, childLod);
+				src = child.data();
+			}
+
+			downsampleTile(
+				src,
+				qMin(Tile::SIZE, childWidth - cx*Tile::SIZE),
+				qMin(Tile::SIZE, childHeight - cy*Tile::SIZE),
+				2,
+				tile.data() + sy*half*Tile::SIZE + sx*half,
+				Tile::SIZE
+			);
+		}
+	}
+
+	QMutexLocker lock(&m_mipmapMutex);
+	m_mipmaps.insert(key, new Tile(tile), MIPMAP_TILE_COST);
+
+	return tile;
+}
+
+void LayerStack::setMipmapCacheSize(int kilobytes)
+{
+	QMutexLocker lock(&m_mipmapMutex);
+	m_mipmaps.setMaxCost(qMax(MIPMAP_TILE_COST, kilobytes));
+}
+
+void LayerStack::resetMipmaps()
+{
+	QMutexLocker lock(&m_mipmapMutex);
+	m_mipmaps.clear();
+}
+
+/**
+ * Drop the reduced level tiles covering the given range of
+ * full resolution tiles from the cache.
+ */
+void LayerStack::markMipmapsDirty(int tx0, int ty0, int tx1, int ty1)
+{
+	QMutexLocker lock(&m_mipmapMutex);
+	if(m_mipmaps.isEmpty())
+		return;
+
+	if((tx1-tx0+1) * (ty1-ty0+1) > m_mipmaps.size()) {
+		// Large areas: check the cached tiles instead of every tile in the range
+		for(const quint64 key : m_mipmaps.keys()) {
+			const int lod = key >> 32;
+			const int x = key & 0xffff;
+			const int y = (key >> 16) & 0xffff;
+			if(x >= tx0>>lod && x <= tx1>>lod && y >= ty0>>lod && y <= ty1>>lod)
+				m_mipmaps.remove(key);
+		}
+
+	} else {
+		for(int lod=1;lod<=MAX_LOD;++lod) {
+			for(int y=ty0>>lod;y<=ty1>>lod;++y) {
+				for(int x=tx0>>lod;x<=tx1>>lod;++x)
+					m_mipmaps.remove(mipmapKey(x, y, lod));
+			}
+		}
+	}
+}
+
 const Layer *LayerStack::layerAt(int x, int y) const
 {
 	for(int i=m_layers.size()-1;i>=0;--i) {
@@ -445,6 +634,74 @@ QImage LayerStack::toFlatImage(bool includeAnnotations) const
 	return image;
 }
 
+QImage LayerStack::toFlatImageScaled(const QSize &maxSize, bool includeAnnotations) const
+{
+	if(m_width<=0 || m_height<=0)
+		return QImage();
+
+	QSize target = size();
+	if(target.width() > maxSize.width() || target.height() > maxSize.height())
+		target.scale(maxSize, Qt::KeepAspectRatio);
+
+	// Pick the smallest level of detail that is still at least as big as the target
+	int lod = 0;
+	while(lod < MAX_LOD && (m_width >> (lod+1)) >= target.width() && (m_height >> (lod+1)) >= target.height())
+		++lod;
+
+	QImage image;
+
+	if(lod == 0) {
+		// No reduction possible: a plain flatten is just as good
+		image = toFlatImage(includeAnnotations);
+
+	} else {
+		const int step = 1 << lod;
+		const int tilesize = Tile::SIZE / step;
+
+		image = QImage((m_width + step - 1) / step, (m_height + step - 1) / step, QImage::Format_ARGB32);
+		image.fill(0);
+
+		// Get the raw pointer here, since QImage::scanLine is not safe to call concurrently
+		uchar *bits = image.bits();
+		const int bytesPerLine = image.bytesPerLine();
+
+		QList<int> tiles;
+		tiles.reserve(m_xtiles * m_ytiles);
+		for(int i=0;i<m_xtiles*m_ytiles;++i)
+			tiles << i;
+
+		concurrentForEach<int>(tiles, [this, bits, bytesPerLine, step, tilesize](int idx) {
+			const int tx = idx % m_xtiles;
+			const int ty = idx / m_xtiles;
+
+			quint32 data[Tile::LENGTH];
+			memset(data, 0, sizeof data);
+			flattenTile(data, tx, ty, false);
+
+			const int w = qMin(Tile::SIZE, m_width - tx*Tile::SIZE);
+			const int h = qMin(Tile::SIZE, m_height - ty*Tile::SIZE);
+
+			downsampleTile(
+				data, w, h, step,
+				reinterpret_cast<quint32*>(bits + ty*tilesize*bytesPerLine) + tx*tilesize,
+				bytesPerLine / 4
+			);
+		});
+
+		if(includeAnnotations) {
+			QPainter painter(&image);
+			painter.scale(1.0/step, 1.0/step);
+			for(const Annotation &a : m_annotations->getAnnotations())
+				a.paint(&painter);
+		}
+	}
+
+	if(image.size() != target)
+		image = image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+	return image;
+}
+
 QImage LayerStack::flatLayerImage(int layerIdx, bool useBgLayer, const QColor &background)
 {
 	Q_ASSERT(layerIdx>=0 && layerIdx < m_layers.size());
@@ -462,14 +719,15 @@ QImage LayerStack::flatLayerImage(int layerIdx, bool useBgLayer, const QColor &b
 }
 
 // Flatten a single tile
-void LayerStack::flattenTile(quint32 *data, int xindex, int yindex) const
+void LayerStack::flattenTile(quint32 *data, int xindex, int yindex, bool useViewMode) const
 {
 	// Composite visible layers
 	int layeridx = 0;
 	for(const Layer *l : m_layers) {
-		if(isVisible(layeridx)) {
+		if(useViewMode ? isVisible(layeridx) : l->isVisible()) {
 			const Tile &tile = l->tile(xindex, yindex);
-			const quint32 tint = layerTint(layeridx);
+			const quint32 tint = useViewMode ? layerTint(layeridx) : 0;
+			const int opacity = useViewMode ? layerOpacity(layeridx) : l->opacity();
 
 			if(l->sublayers().count() || tint!=0) {
 				// Sublayers (or tint) present, composite them first
@@ -491,12 +749,12 @@ void LayerStack::flattenTile(quint32 *data, int xindex, int yindex) const
 
 				// Composite merged tile
 				compositePixels(l->blendmode(), data, ldata,
-						Tile::SIZE*Tile::SIZE, layerOpacity(layeridx));
+						Tile::SIZE*Tile::SIZE, opacity);
 
 			} else if(!tile.isNull()) {
 				// No sublayers or tint, just this tile as it is
 				compositePixels(l->blendmode(), data, tile.data(),
-						Tile::SIZE*Tile::SIZE, layerOpacity(layeridx));
+						Tile::SIZE*Tile::SIZE, opacity);
 			}
 		}
 
@@ -513,6 +771,8 @@ void LayerStack::markDirty(const QRect &area)
 	int ty0 = qBound(0, area.top() / Tile::SIZE, m_ytiles-1);
 	const int ty1 = qBound(ty0, area.bottom() / Tile::SIZE, m_ytiles-1);
 	
+	markMipmapsDirty(tx0, ty0, tx1-1, ty1);
+
 	for(;ty0<=ty1;++ty0) {
 		m_dirtytiles.fill(true, ty0*m_xtiles + tx0, ty0*m_xtiles + tx1);
 	}
@@ -524,6 +784,7 @@ void LayerStack::markDirty()
 	if(m_layers.isEmpty() || m_width<=0 || m_height<=0)
 		return;
 	m_dirtytiles.fill(true);
+	markMipmapsDirty(0, 0, m_xtiles-1, m_ytiles-1);
 
 	m_dirtyrect = QRect(0, 0, m_width, m_height);
 	notifyAreaChanged();
@@ -535,6 +796,7 @@ void LayerStack::markDirty(int x, int y)
 	Q_ASSERT(y>=0 && y < m_ytiles);
 
 	m_dirtytiles.setBit(y*m_xtiles + x);
+	markMipmapsDirty(x, y, x, y);
 
 	m_dirtyrect |= QRect(x*Tile::SIZE, y*Tile::SIZE, Tile::SIZE, Tile::SIZE);
 }
@@ -547,18 +809,26 @@ void LayerStack::markDirty(int index)
 
 	const int y = index / m_xtiles;
 	const int x = index % m_xtiles;
+	markMipmapsDirty(x, y, x, y);
 
 	m_dirtyrect |= QRect(x*Tile::SIZE, y*Tile::SIZE, Tile::SIZE, Tile::SIZE);
 }
 
 void LayerStack::notifyAreaChanged()
 {
-	if(!m_dirtyrect.isEmpty()) {
+	if(m_batchDepth == 0 && !m_dirtyrect.isEmpty()) {
 		emit areaChanged(m_dirtyrect);
 		m_dirtyrect = QRect();
 	}
 }
 
+void LayerStack::endBatch()
+{
+	Q_ASSERT(m_batchDepth>0);
+	if(--m_batchDepth == 0)
+		notifyAreaChanged();
+}
+
 void LayerStack::notifyLayerInfoChange(const Layer *layer)
 {
 	Q_ASSERT(layer);
@@ -696,6 +966,7 @@ void LayerStack::restoreSavepoint(const Savepoint *savepoint)
 		m_xtiles = Tile::roundTiles(m_width);
 		m_ytiles = Tile::roundTiles(m_height);
 		m_dirtytiles = QBitArray(m_xtiles*m_ytiles, true);
+		resetMipmaps();
 		emit resized(0, 0, oldsize);
 
 	} else {
@@ -705,6 +976,7 @@ void LayerStack::restoreSavepoint(const Savepoint *savepoint)
 			// Layers added or deleted, just refresh everything
 			// (force refresh even if layer stack is empty)
 			m_dirtytiles.fill(true);
+			markMipmapsDirty(0, 0, m_xtiles-1, m_ytiles-1);
 			m_dirtyrect = QRect(0, 0, m_width, m_height);
 
 		} else {
@@ -741,6 +1013,48 @@ void LayerStack::restoreSavepoint(const Savepoint *savepoint)
 	emit layersChanged(layerInfos());
 }
 
+bool LayerStack::restoreLayerContent(const Savepoint *savepoint, int id)
+{
+	if(m_width != savepoint->width || m_height != savepoint->height)
+		return false;
+
+	Layer *layer = getLayer(id);
+	const Layer *saved = nullptr;
+	for(const Layer *l : savepoint->layers) {
+		if(l->id() == id) {
+			saved = l;
+			break;
+		}
+	}
+
+	if(!layer || !saved)
+		return false;
+
+	const int tiles = m_xtiles * m_ytiles;
+
+	// Sublayers are not compared, just refresh everything they cover
+	for(const Layer *l : { static_cast<const Layer*>(layer), saved }) {
+		for(const Layer *sl : l->sublayers()) {
+			if(sl->id() < 0 || sl->isHidden())
+				continue;
+			for(int i=0;i<tiles;++i) {
+				if(!sl->tile(i).isNull())
+					markDirty(i);
+			}
+		}
+	}
+
+	for(int i=0;i<tiles;++i) {
+		if(layer->tile(i) != saved->tile(i))
+			markDirty(i);
+	}
+
+	layer->restoreContent(*saved);
+
+	notifyAreaChanged();
+	return true;
+}
+
 QList<LayerInfo> LayerStack::layerInfos() const
 {
 	QList<LayerInfo> infos;
@@ -25,15 +25,18 @@
 #include <QList>
 #include <QImage>
 #include <QBitArray>
+#include <QVector>
+#include <QMutex>
+#include <QCache>
 
 class QDataStream;
 
 #include "annotationmodel.h"
+#include "tile.h"
 
 namespace paintcore {
 
 class Layer;
-class Tile;
 class Savepoint;
 struct LayerInfo;
 
@@ -114,12 +117,53 @@ public:
 	//! Return a flattened image of the layer stack
 	QImage toFlatImage(bool includeAnnotations) const;
 
+	/**
+	 * @brief Return a flattened image scaled to fit inside the given size
+	 *
+	 * Unlike toFlatImage().scaled(), this does not create a full resolution
+	 * image first. Tiles are flattened one at a time and downsampled directly
+	 * to the nearest power-of-two level of detail, which is then scaled to
+	 * the final size. Images smaller than maxSize are not scaled up.
+	 */
+	QImage toFlatImageScaled(const QSize &maxSize, bool includeAnnotations) const;
+
 	//! Return a single layer composited with the given background
 	QImage flatLayerImage(int layerIdx, bool useBgLayer, const QColor &background);
 
 	//! Get a merged tile
 	Tile getFlatTile(int x, int y) const;
 
+	/**
+	 * @brief Get a merged tile on top of a checkerboard background, for display
+	 *
+	 * At level of detail N, the returned 64x64 image covers 2^N by 2^N
+	 * tiles of the full resolution image. The tile coordinates are
+	 * in the grid of the selected level.
+	 *
+	 * Reduced levels are cached: a tile at level N is built from the four
+	 * tiles below it at level N-1, and only the tiles over areas
+	 * marked dirty since the last call are rebuilt. The cache is
+	 * size limited (see setMipmapCacheSize) and least recently used
+	 * tiles are rebuilt when needed again.
+	 *
+	 * Unlike paintChangedTiles, this does not look at or clear the dirty tile flags.
+	 * This function is safe to call from multiple threads at the same time.
+	 *
+	 * @param x tile column
+	 * @param y tile row
+	 * @param lod level of detail (0 is full resolution, max is MAX_LOD)
+	 */
+	QImage flatTileImage(int x, int y, int lod=0) const;
+
+	/**
+	 * @brief Set the maximum amount of memory to use for cached reduced level tiles
+	 * @param kilobytes cache size in kilobytes
+	 */
+	void setMipmapCacheSize(int kilobytes);
+
+	//! Largest supported level of detail (one pixel per tile)
+	static const int MAX_LOD = 6;
+
 	//! Mark the tiles under the area dirty
 	void markDirty(const QRect &area);
 
@@ -135,6 +179,18 @@ public:
 	//! Emit areaChanged if anything has been marked as dirty
 	void notifyAreaChanged();
 
+	/**
+	 * @brief Start a batch of edits
+	 *
+	 * Until the matching endBatch() call, dirty areas are accumulated
+	 * and areaChanged is emitted just once at the end.
+	 * Batches can be nested.
+	 */
+	void beginBatch() { ++m_batchDepth; }
+
+	//! End a batch of edits and emit the accumulated areaChanged notification
+	void endBatch();
+
 	//! Emit a layer info change notification
 	void notifyLayerInfoChange(const Layer *layer);
 
@@ -144,6 +200,17 @@ public:
 	//! Restore layer stack to a previous savepoint
 	void restoreSavepoint(const Savepoint *savepoint);
 
+	/**
+	 * @brief Restore the content of a single layer from a previous savepoint
+	 *
+	 * Other layers and the attributes of the restored layer are not touched.
+	 * This fails if the canvas has been resized since the savepoint or the
+	 * layer does not exist in both.
+	 *
+	 * @return true on success
+	 */
+	bool restoreLayerContent(const Savepoint *savepoint, int id);
+
 	//! Set layer view mode
 	void setViewMode(ViewMode mode);
 
@@ -186,7 +253,11 @@ signals:
 private:
 	LayerStack(const LayerStack *orig, QObject *parent);
 
-	void flattenTile(quint32 *data, int xindex, int yindex) const;
+	void flattenTile(quint32 *data, int xindex, int yindex, bool useViewMode=true) const;
+
+	Tile mipmapTile(int x, int y, int lod) const;
+	void resetMipmaps();
+	void markMipmapsDirty(int tx0, int ty0, int tx1, int ty1);
 
 	bool isVisible(int idx) const;
 	int layerOpacity(int idx) const;
@@ -201,6 +272,12 @@ private:
 
 	QBitArray m_dirtytiles;
 	QRect m_dirtyrect;
+	int m_batchDepth;
+
+	// Reduced level of detail tiles for display. Key is (lod<<32 | y<<16 | x)
+	// and cost is the size in kilobytes. Stale tiles are removed from the cache.
+	mutable QCache<quint64, Tile> m_mipmaps;
+	mutable QMutex m_mipmapMutex;
 
 	ViewMode m_viewmode;
 	int m_viewlayeridx;
@@ -21,6 +21,12 @@
 
 #include <QRgb>
 
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace paintcore {
 
 // This is borrowed from Pigment of koffice libs:
@@ -350,13 +356,66 @@ void doMaskComposite(quint32 *base, quint32 color, const uchar *mask,
 	}
 }
 
+#ifdef __SSE2__
+// UINT8_MULT on eight 16 bit lanes. (a*b+0x80 + (a*b+0x80)>>8 never exceeds 16 bits)
+static inline __m128i uint8_mult_epi16(__m128i a, __m128i b)
+{
+	const __m128i c = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(0x80));
+	return _mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(c, 8), c), 8);
+}
+
+// Sample two pixels (unpacked to 16 bit lanes) using the per-pixel weights in m
+static inline __m128i sampleTwoPixels(__m128i px, __m128i m)
+{
+	// Color channels are premultiplied by alpha. Alpha is multiplied by 255, which leaves it unchanged
+	const __m128i colorLanes = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	const __m128i alphaLanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+	a = _mm_or_si128(_mm_and_si128(a, colorLanes), alphaLanes);
+
+	return uint8_mult_epi16(uint8_mult_epi16(px, a), m);
+}
+#endif
+
 std::array<quint32, 5> sampleMask(const quint32 *pixels, const uchar *mask, int w, int h, int maskskip, int pixelskip)
 {
 	std::array<quint32, 5> result{ {0, 0, 0, 0, 0} };
 	pixelskip *= 4;
 	const uchar *pix = reinterpret_cast<const uchar*>(pixels);
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sums = zero; // [blue, green, red, alpha]
+#endif
+
 	for(int y=0;y<h;++y) {
-		for(int x=0;x<w;++x,++mask) {
+		int x=0;
+
+#ifdef __SSE2__
+		// Four pixels at a time
+		for(;x<w-3;x+=4,mask+=4,pix+=16) {
+			quint32 m4;
+			memcpy(&m4, mask, 4);
+			if(m4 == 0)
+				continue;
+
+			result[0] += mask[0] + mask[1] + mask[2] + mask[3];
+
+			const __m128i m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(m4)), zero);
+			const __m128i mm = _mm_unpacklo_epi16(m, m);
+			const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pix));
+
+			const __m128i v = _mm_add_epi16(
+				sampleTwoPixels(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi32(mm, mm)),
+				sampleTwoPixels(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi32(mm, mm))
+			);
+
+			sums = _mm_add_epi32(sums, _mm_add_epi32(_mm_unpacklo_epi16(v, zero), _mm_unpackhi_epi16(v, zero)));
+		}
+#endif
+
+		for(;x<w;++x,++mask) {
 			const uchar m = *mask;
 			const uchar a = pix[3];
 			result[0] += m;
@@ -372,6 +431,15 @@ std::array<quint32, 5> sampleMask(const quint32 *pixels, const uchar *mask, int
 		mask += maskskip;
 	}
 
+#ifdef __SSE2__
+	quint32 s[4];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(s), sums);
+	result[1] += s[2];
+	result[2] += s[1];
+	result[3] += s[0];
+	result[4] += s[3];
+#endif
+
 	return result;
 }
 
@@ -168,6 +168,29 @@ void Tile::merge(const Tile &tile, uchar opacity, BlendMode::Mode blend)
 		compositePixels(blend, getOrCreateData(), tile.data(), SIZE*SIZE, opacity);
 }
 
+void Tile::putPixels(BlendMode::Mode mode, const quint32 *pixels, int x, int y, int w, int h, int stride)
+{
+	Q_ASSERT(x>=0 && x<SIZE && y>=0 && y<SIZE);
+	Q_ASSERT((x+w)<=SIZE && (y+h)<=SIZE);
+
+	quint32 *dest = getOrCreateData() + y * SIZE + x;
+
+	if(mode == BlendMode::MODE_REPLACE) {
+		for(int row=0;row<h;++row) {
+			memcpy(dest, pixels, w * 4);
+			dest += SIZE;
+			pixels += stride;
+		}
+
+	} else {
+		for(int row=0;row<h;++row) {
+			compositePixels(mode, dest, pixels, w, 255);
+			dest += SIZE;
+			pixels += stride;
+		}
+	}
+}
+
 /**
  * @return true if every pixel of this tile has an alpha value of zero
  */
@@ -123,6 +123,21 @@ class Tile {
 		//! Composite another tile with this tile
 		void merge(const Tile &tile, uchar opacity, BlendMode::Mode mode);
 
+		/**
+		 * @brief Composite a rectangle of raw pixels onto this tile
+		 *
+		 * In MODE_REPLACE, the pixels are copied as is.
+		 *
+		 * @param mode blending mode
+		 * @param pixels source pixel data
+		 * @param x x offset in the tile
+		 * @param y y offset in the tile
+		 * @param w width of the rectangle
+		 * @param h height of the rectangle
+		 * @param stride source line length in pixels
+		 */
+		void putPixels(BlendMode::Mode mode, const quint32 *pixels, int x, int y, int w, int h, int stride);
+
 		//! Copy the contents of this tile onto the given spot on an image
 		void copyToImage(QImage& image, int x, int y) const;
 
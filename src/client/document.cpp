@@ -174,6 +174,9 @@ void Document::onServerLogin(bool join)
 
 	m_canvas->connectedToServer(m_client->myId());
 
+	// Merge outgoing pen moves sent within this many milliseconds of each other
+	m_client->setPenMoveMergeInterval(QSettings().value("settings/server/penmovemerge", 8).toInt());
+
 	if(m_autoRecordOnConnect) {
 		startRecording(utils::uniqueFilename(utils::settings::recordingFolder(), "session-" + m_client->sessionId(), "dprec"));
 	}
@@ -419,21 +422,22 @@ void Document::autosaveNow()
 
 	Q_ASSERT(utils::isWritableFormat(currentFilename()));
 
-	saveCanvas();
+	saveCanvas(true);
 }
 
 void Document::saveCanvas(const QString &filename)
 {
 	setCurrentFilename(filename);
-	saveCanvas();
+	saveCanvas(false);
 }
 
-void Document::saveCanvas()
+void Document::saveCanvas(bool autosave)
 {
 	Q_ASSERT(!m_saveInProgress);
 	m_saveInProgress = true;
 
 	auto *saver = new canvas::CanvasSaverRunnable(m_canvas, m_currentFilename);
+	saver->setFastCompression(autosave);
 	unmarkDirty();
 	connect(saver, &canvas::CanvasSaverRunnable::saveComplete, this, &Document::onCanvasSaved);
 	emit canvasSaveStarted();
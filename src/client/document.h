@@ -226,7 +226,7 @@ private slots:
 	void onCanvasSaved(const QString &errorMessage);
 
 private:
-	void saveCanvas();
+	void saveCanvas(bool autosave);
 	bool startRecording(const QString &filename, const QList<protocol::MessagePtr> &initialState, QString *error);
 	void setCurrentFilename(const QString &filename);
 	void setSessionPersistent(bool p);
@@ -32,6 +32,7 @@
 #include "../shared/net/pen.h" // for sentColorChange
 
 #include <QDebug>
+#include <QTimer>
 
 using protocol::MessagePtr;
 
@@ -39,8 +40,13 @@ namespace net {
 
 Client::Client(QObject *parent)
 	: QObject(parent), m_myId(1), m_recordedChat(false),
-	  m_catchupTo(0), m_caughtUp(0), m_catchupProgress(0)
+	  m_catchupTo(0), m_caughtUp(0), m_catchupProgress(0),
+	  m_penMoveContext(0), m_penMoveInterval(0)
 {
+	m_penMoveTimer = new QTimer(this);
+	m_penMoveTimer->setSingleShot(true);
+	connect(m_penMoveTimer, &QTimer::timeout, this, &Client::flushPenMoves);
+
 	m_loopback = new LoopbackServer(this);
 	m_server = m_loopback;
 	m_isloopback = true;
@@ -87,6 +93,7 @@ void Client::connectToServer(LoginHandler *loginhandler)
 
 void Client::disconnectFromServer()
 {
+	flushPenMoves();
 	m_server->logout();
 }
 
@@ -122,6 +129,9 @@ void Client::handleDisconnect(const QString &message,const QString &errorcode, b
 {
 	Q_ASSERT(m_server != m_loopback);
 
+	m_penMoveTimer->stop();
+	m_penMovePoints.clear();
+
 	emit serverDisconnected(message, errorcode, localDisconnect);
 	m_server->deleteLater();
 	m_server = m_loopback;
@@ -139,8 +149,40 @@ int Client::uploadQueueBytes() const
 	return m_server->uploadQueueBytes();
 }
 
-void Client::sendMessage(const protocol::MessagePtr &msg)
+protocol::MessageType Client::penMoveType() const
 {
+	return m_server->supportsPenMoveDelta() ? protocol::MSG_PEN_MOVE_DELTA : protocol::MSG_PEN_MOVE;
+}
+
+/**
+ * Convert pen moves to the legacy encoding if the session doesn't support delta encoded ones.
+ * This is done before the local fork sees the message, so that the echoed message matches.
+ */
+protocol::MessagePtr Client::toSessionEncoding(const protocol::MessagePtr &msg) const
+{
+	if(protocol::isPenMove(msg->type()) && msg->type() != penMoveType()) {
+		const protocol::PenMove &pm = msg.cast<const protocol::PenMove>();
+		return protocol::MessagePtr(new protocol::PenMove(pm.contextId(), pm.points(), penMoveType()));
+	}
+	return msg;
+}
+
+QList<protocol::MessagePtr> Client::toSessionEncoding(const QList<protocol::MessagePtr> &msgs) const
+{
+	if(m_server->supportsPenMoveDelta())
+		return msgs;
+
+	QList<protocol::MessagePtr> converted;
+	converted.reserve(msgs.size());
+	for(const protocol::MessagePtr &msg : msgs)
+		converted << toSessionEncoding(msg);
+	return converted;
+}
+
+void Client::sendMessage(const protocol::MessagePtr &message)
+{
+	const protocol::MessagePtr msg = toSessionEncoding(message);
+
 #ifndef NDEBUG
 	if(!msg->isControl() && msg->contextId()==0) {
 		qWarning("Context ID not set for message type #%d (%s)", msg->type(), qPrintable(msg->messageName()));
@@ -153,11 +195,44 @@ void Client::sendMessage(const protocol::MessagePtr &msg)
 
 	if(msg->type() == protocol::MSG_TOOLCHANGE)
 		emit sentColorChange(QColor::fromRgb(msg.cast<const protocol::ToolChange&>().color()));
+
+	// Hold back pen moves for a moment so they can be sent as one message.
+	// Merging is not needed with the loopback server.
+	if(protocol::isPenMove(msg->type()) && m_penMoveInterval > 0 && !m_isloopback) {
+		const protocol::PenMove &pm = msg.cast<const protocol::PenMove>();
+
+		if(!m_penMovePoints.isEmpty() && (
+			pm.contextId() != m_penMoveContext ||
+			m_penMovePoints.size() + pm.points().size() > protocol::PenMove::MAX_POINTS
+		))
+			flushPenMoves();
+
+		m_penMoveContext = pm.contextId();
+		m_penMovePoints += pm.points();
+
+		if(!m_penMoveTimer->isActive())
+			m_penMoveTimer->start(m_penMoveInterval);
+		return;
+	}
+
+	// Everything else must preserve the message order
+	flushPenMoves();
 	m_server->sendMessage(msg);
 }
 
-void Client::sendMessages(const QList<protocol::MessagePtr> &msgs)
+void Client::flushPenMoves()
 {
+	m_penMoveTimer->stop();
+	if(m_penMovePoints.isEmpty())
+		return;
+
+	m_server->sendMessage(protocol::MessagePtr(new protocol::PenMove(m_penMoveContext, m_penMovePoints, penMoveType())));
+	m_penMovePoints.clear();
+}
+
+void Client::sendMessages(const QList<protocol::MessagePtr> &messages)
+{
+	const QList<protocol::MessagePtr> msgs = toSessionEncoding(messages);
 	uint32_t colorChange = 0;
 	for(const protocol::MessagePtr &msg : msgs) {
 #ifndef NDEBUG
@@ -171,6 +246,7 @@ void Client::sendMessages(const QList<protocol::MessagePtr> &msgs)
 		if(msg->type() == protocol::MSG_TOOLCHANGE)
 			colorChange = msg.cast<const protocol::ToolChange&>().color();
 	}
+	flushPenMoves();
 	m_server->sendMessages(msgs);
 
 	if(colorChange)
@@ -179,7 +255,8 @@ void Client::sendMessages(const QList<protocol::MessagePtr> &msgs)
 
 void Client::sendResetMessages(const QList<protocol::MessagePtr> &msgs)
 {
-	m_server->sendMessages(msgs);
+	flushPenMoves();
+	m_server->sendMessages(toSessionEncoding(msgs));
 }
 
 void Client::handleMessage(const protocol::MessagePtr &msg)
@@ -303,6 +380,8 @@ void Client::handleServerCommand(const protocol::Command &msg)
 		m_catchupTo = reply.reply["count"].toInt();
 		m_caughtUp = 0;
 		m_catchupProgress = 0;
+		// Marks the start of the catch-up for the state tracker
+		emit messageReceived(protocol::ClientInternal::makeCatchup(0));
 		break;
 	}
 }
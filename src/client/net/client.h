@@ -24,12 +24,15 @@
 #include "net/server.h"
 #include "../shared/net/message.h"
 #include "canvas/statetracker.h" // for ToolContext
+#include "../shared/net/pen.h"
 
 #include <QObject>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QSslCertificate>
 
+class QTimer;
+
 namespace paintcore {
 	class Point;
 }
@@ -155,6 +158,18 @@ public:
 	 */
 	void setRecordedChatMode(bool recordedChat) { m_recordedChat = recordedChat; }
 
+	/**
+	 * @brief Set the maximum time outgoing pen moves may be held back for merging
+	 *
+	 * Consecutive PenMove messages sent within this time
+	 * are merged into one multi-point message before they are sent to
+	 * the server. They still go to the local fork immediately, so this
+	 * does not add any latency to local drawing.
+	 *
+	 * @param ms latency window in milliseconds. Zero disables merging.
+	 */
+	void setPenMoveMergeInterval(int ms) { m_penMoveInterval = ms; }
+
 public slots:
 	/**
 	 * @brief Send a message to the server
@@ -201,12 +216,17 @@ private slots:
 	void handleMessage(const protocol::MessagePtr &msg);
 	void handleConnect(const QString &sessionId, int userid, bool join, bool auth, bool moderator);
 	void handleDisconnect(const QString &message, const QString &errorcode, bool localDisconnect);
+	void flushPenMoves();
 
 private:
 	void handleResetRequest(const protocol::ServerReply &msg);
 	void handleServerCommand(const protocol::Command &msg);
 	void handleDisconnectMessage(const protocol::Disconnect &msg);
 
+	protocol::MessageType penMoveType() const;
+	protocol::MessagePtr toSessionEncoding(const protocol::MessagePtr &msg) const;
+	QList<protocol::MessagePtr> toSessionEncoding(const QList<protocol::MessagePtr> &msgs) const;
+
 	Server *m_server;
 	LoopbackServer *m_loopback;
 
@@ -222,6 +242,12 @@ private:
 	int m_catchupProgress;
 
 	canvas::ToolContext m_lastToolCtx;
+
+	// Outgoing pen move merging
+	protocol::PenPointVector m_penMovePoints;
+	uint8_t m_penMoveContext;
+	QTimer *m_penMoveTimer;
+	int m_penMoveInterval;
 };
 
 }
@@ -324,7 +324,7 @@ QList<protocol::MessagePtr> penMove(int ctxid, const paintcore::PointVector &poi
 			ppvec.append(pointToProtocol(points[i]));
 			++i;
 		}
-		msgs << protocol::MessagePtr(new protocol::PenMove(ctxid, ppvec));
+		msgs << protocol::MessagePtr(new protocol::PenMove(ctxid, ppvec, protocol::MSG_PEN_MOVE_DELTA));
 
 	}
 
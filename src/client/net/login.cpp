@@ -446,7 +446,8 @@ void LoginHandler::expectSessionDescriptionJoin(const protocol::ServerReply &msg
 			session.id = js["id"].toString();
 			session.alias = js["alias"].toString();
 			const auto protoVer = protocol::ProtocolVersion::fromString(js["protocol"].toString());
-			session.incompatible = !protoVer.isCurrent();
+			session.protocol = protoVer;
+			session.incompatible = !protoVer.isCompatible();
 			session.needPassword = js["hasPassword"].toBool();
 			session.closed = js["closed"].toBool() || (js["authOnly"].toBool() && m_isGuest);
 			session.persistent = js["persistent"].toBool();
@@ -513,6 +514,7 @@ void LoginHandler::expectLoginOk(const protocol::ServerReply &msg)
 	if(msg.reply["state"] == "join" || msg.reply["state"] == "host") {
 		m_loggedInSessionId = msg.reply["join"].toObject()["id"].toString();
 		m_userid = msg.reply["join"].toObject()["user"].toInt();
+		m_sessionProtocol = m_mode == HOST ? protocol::ProtocolVersion::current() : m_sessions->getSession(m_selectedId).protocol;
 		m_server->loginSuccess();
 
 		// If in host mode, send initial session settings
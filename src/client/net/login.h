@@ -20,6 +20,7 @@
 #define DP_CLIENT_NET_LOGINHANDLER_H
 
 #include "../shared/net/message.h"
+#include "../shared/net/protover.h"
 
 #include <QString>
 #include <QUrl>
@@ -180,6 +181,13 @@ public:
 	 */
 	bool supportsAbuseReports() const { return m_canReport; }
 
+	/**
+	 * @brief Get the protocol version of the joined or hosted session
+	 *
+	 * This is valid only after a successful login.
+	 */
+	protocol::ProtocolVersion sessionProtocolVersion() const { return m_sessionProtocol; }
+
 	/**
 	 * @brief Check if the user has the given flag
 	 *
@@ -407,6 +415,7 @@ private:
 
 	QString m_selectedId;
 	QString m_loggedInSessionId;
+	protocol::ProtocolVersion m_sessionProtocol;
 
 	QFileInfo m_certFile;
 
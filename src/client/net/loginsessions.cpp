@@ -194,6 +194,15 @@ void LoginSessionModel::removeSession(const QString &id)
 	emit filteredCountChanged();
 }
 
+LoginSession LoginSessionModel::getSession(const QString &idOrAlias) const
+{
+	for(const LoginSession &s : m_sessions) {
+		if(s.isIdOrAlias(idOrAlias))
+			return s;
+	}
+	return LoginSession();
+}
+
 void LoginSessionModel::setHideNsfm(bool hide)
 {
 	if(hide != m_hideNsfm) {
@@ -20,6 +20,8 @@
 #ifndef LOGINSESSIONS_H
 #define LOGINSESSIONS_H
 
+#include "../shared/net/protover.h"
+
 #include <QAbstractTableModel>
 
 namespace net {
@@ -33,6 +35,7 @@ struct LoginSession {
 	int userCount;
 	QString title;
 	QString founder;
+	protocol::ProtocolVersion protocol;
 
 	bool needPassword;
 	bool persistent;
@@ -82,6 +85,9 @@ public:
 	void updateSession(const LoginSession &session);
 	void removeSession(const QString &id);
 
+	//! Find a session by its ID or alias. Returns a blank session if not found
+	LoginSession getSession(const QString &idOrAlias) const;
+
 	void setHideNsfm(bool hide);
 	int filteredCount() const { return m_sessions.size() - m_filtered.size(); }
 
@@ -85,6 +85,13 @@ public:
 	virtual bool supportsPersistence() const = 0;
 	virtual bool supportsAbuseReports() const = 0;
 
+	/**
+	 * @brief Can delta encoded pen moves be sent to the session?
+	 *
+	 * Sessions using a protocol version older than 20.2 only understand the legacy encoding.
+	 */
+	virtual bool supportsPenMoveDelta() const = 0;
+
 signals:
 	void messageReceived(protocol::MessagePtr message);
 
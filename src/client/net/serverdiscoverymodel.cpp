@@ -106,7 +106,7 @@ Qt::ItemFlags ServerDiscoveryModel::flags(const QModelIndex &index) const
 		return Qt::NoItemFlags;
 
 	const DiscoveredServer &s = _servers.at(index.row());
-	if(s.protocol.isCurrent())
+	if(s.protocol.isCompatible())
 		return QAbstractTableModel::flags(index);
 	else
 		return Qt::NoItemFlags;
@@ -76,7 +76,7 @@ QVariant SessionListingModel::data(const QModelIndex &index, int role) const
 		}
 	} else if(role == Qt::DecorationRole) {
 		if(index.column() == 0) {
-			if(!s.protocol.isCurrent())
+			if(!s.protocol.isCompatible())
 				return icon::fromTheme("dontknow");
 			else if(s.password)
 				return icon::fromTheme("object-locked");
@@ -123,7 +123,7 @@ Qt::ItemFlags SessionListingModel::flags(const QModelIndex &index) const
 		return Qt::NoItemFlags;
 
 	const Session &s = m_filtered.at(index.row());
-	if(s.protocol.isCurrent())
+	if(s.protocol.isCompatible())
 		return QAbstractTableModel::flags(index);
 	else
 		return Qt::NoItemFlags;
@@ -33,7 +33,7 @@ namespace net {
 
 TcpServer::TcpServer(QObject *parent) :
 	Server(false, parent), m_loginstate(nullptr), m_securityLevel(NO_SECURITY),
-	m_localDisconnect(false), m_supportsPersistence(false)
+	m_localDisconnect(false), m_supportsPersistence(false), m_supportsAbuseReports(false), m_supportsPenMoveDelta(false)
 {
 	m_socket = new QSslSocket(this);
 
@@ -150,6 +150,7 @@ void TcpServer::loginSuccess()
 
 	m_supportsPersistence = m_loginstate->supportsPersistence();
 	m_supportsAbuseReports = m_loginstate->supportsAbuseReports();
+	m_supportsPenMoveDelta = m_loginstate->sessionProtocolVersion().supportsPenMoveDelta();
 
 	emit loggedIn(
 		m_loginstate->sessionId(),
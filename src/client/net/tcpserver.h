@@ -57,6 +57,7 @@ public:
 
 	bool supportsPersistence() const override { return m_supportsPersistence; }
 	bool supportsAbuseReports() const override { return m_supportsAbuseReports; }
+	bool supportsPenMoveDelta() const override { return m_supportsPenMoveDelta; }
 
 	QUrl url() const { return m_url; }
 
@@ -90,6 +91,7 @@ private:
 	bool m_localDisconnect;
 	bool m_supportsPersistence;
 	bool m_supportsAbuseReports;
+	bool m_supportsPenMoveDelta;
 };
 
 }
@@ -19,6 +19,7 @@
 
 #include "core/blendmodes.h"
 #include "core/annotationmodel.h"
+#include "core/concurrent.h"
 #include "ora/orareader.h"
 #include "ora/orawriter.h"
 
@@ -60,6 +61,14 @@ namespace {
 		QString compositeOp;
 	};
 
+	//! Decoded content of a single layer
+	struct LayerContent {
+		QByteArray png;
+		QColor solidColor;
+		QList<MessagePtr> putImages;
+		bool ok;
+	};
+
 	struct Canvas {
 		QString error;
 
@@ -396,20 +405,55 @@ static OraResult makeInitCommands(KZip &zip, const Canvas &canvas)
 	// Set canvas size
 	result.commands << MessagePtr(new protocol::CanvasResize(ctxId, 0, canvas.size.width(), canvas.size.height(), 0));
 
+	// Decode the layer images in parallel.
+	// The archive itself must be read serially, but the PNG decoding and PutImage
+	// generation (which includes compression) can be done in parallel.
+	QVector<LayerContent> contents(canvas.layers.size());
+	QList<int> indices;
+	for(int i=0;i<canvas.layers.size();++i) {
+		contents[i].png = utils::getArchiveFile(zip, canvas.layers[i].src);
+		contents[i].ok = false;
+		indices << i;
+	}
+
+	{
+		LayerContent *c = contents.data();
+		const QList<Layer> &layers = canvas.layers;
+		// Layer IDs are assigned bottom-most first
+		const int topLayerId = (ctxId << 8) + canvas.layers.size();
+
+		paintcore::concurrentForEach<int>(indices, [c, &layers, ctxId, topLayerId](int idx) {
+			QImage content;
+			if(c[idx].png.isNull() || !content.loadFromData(c[idx].png))
+				return;
+
+			c[idx].png = QByteArray();
+			c[idx].ok = true;
+			c[idx].solidColor = utils::isSolidColorImage(content);
+
+			if(!c[idx].solidColor.isValid())
+				c[idx].putImages = net::command::putQImage(
+					ctxId,
+					topLayerId - idx,
+					layers[idx].offset.x(),
+					layers[idx].offset.y(),
+					content,
+					paintcore::BlendMode::MODE_REPLACE
+					);
+		});
+	}
+
 	// Create layers
 	// Note: layers are stored topmost first in ORA, but we create them bottom-most first
 	int layerId = ctxId << 8;
 	for(int i=canvas.layers.size()-1;i>=0;--i) {
 		const Layer &layer = canvas.layers[i];
-		QImage content;
-		{
-			QByteArray image = utils::getArchiveFile(zip, layer.src);
-			if(image.isNull() || !content.loadFromData(image)) {
-				return QGuiApplication::tr("Couldn't load layer %1").arg(layer.src);
-			}
-		}
+		const LayerContent &content = contents.at(i);
 
-		const QColor solidColor = utils::isSolidColorImage(content);
+		if(!content.ok)
+			return QGuiApplication::tr("Couldn't load layer %1").arg(layer.src);
+
+		const QColor solidColor = content.solidColor;
 
 		result.commands.append(MessagePtr(new protocol::LayerCreate(
 				ctxId,
@@ -420,15 +464,7 @@ static OraResult makeInitCommands(KZip &zip, const Canvas &canvas)
 				layer.name
 			)));
 
-		if(!solidColor.isValid())
-			result.commands << net::command::putQImage(
-					ctxId,
-					layerId,
-					layer.offset.x(),
-					layer.offset.y(),
-					content,
-					paintcore::BlendMode::MODE_REPLACE
-					);
+		result.commands << content.putImages;
 
 		bool exact_blendop;
 		int blendmode = paintcore::findBlendModeByName(layer.compositeOp, &exact_blendop).id;
@@ -1,7 +1,7 @@
 /*
    Drawpile - a collaborative drawing program.
 
-   Copyright (C) 2009-2017 Calle Laakkonen
+   Copyright (C) 2009-2018 Calle Laakkonen
 
    Drawpile is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
@@ -21,24 +21,42 @@
 #include "core/layerstack.h"
 #include "core/layer.h"
 #include "core/blendmodes.h"
+#include "core/concurrent.h"
 
 #include <QXmlStreamWriter>
 #include <QBuffer>
 #include <QDebug>
 #include <KZip>
 
+using paintcore::concurrentForEach;
+
 namespace openraster {
 
 const QString DP_NAMESPACE = QStringLiteral("http://drawpile.net/");
 
-static bool putPngInZip(KZip &zip, const QString &filename, const QImage &image, QString *errorMessage)
+namespace {
+	//! An image to be encoded and stored in the archive
+	struct PngEntry {
+		QString filename;
+		QImage image;
+		QByteArray data;
+	};
+}
+
+static QByteArray encodePng(const QImage &image, Compression compression)
 {
+	// For PNG, Qt maps the quality parameter to zlib compression level
+	// (100 is no compression, 0 is maximum.)
 	QBuffer buf;
-	image.save(&buf, "PNG");
+	image.save(&buf, "PNG", compression == Compression::Fast ? 80 : -1);
+	return buf.data();
+}
 
+static bool putPngInZip(KZip &zip, const QString &filename, const QByteArray &png, QString *errorMessage)
+{
 	// PNG is already compressed, so no use attempting to recompress
 	zip.setCompression(KZip::NoCompression);
-	if(!zip.writeFile(filename, buf.data())) {
+	if(!zip.writeFile(filename, png)) {
 		if(errorMessage)
 			*errorMessage = zip.errorString();
 		return false;
@@ -46,6 +64,28 @@ static bool putPngInZip(KZip &zip, const QString &filename, const QImage &image,
 	return true;
 }
 
+/**
+ * Encode all the given images in parallel.
+ *
+ * The source images are released as soon as they have been encoded.
+ */
+static void encodePngs(QVector<PngEntry> &entries, Compression compression)
+{
+	PngEntry *e = entries.data();
+	QList<int> indices;
+	for(int i=0;i<entries.size();++i)
+		indices << i;
+
+	// This may be called from a thread pool thread (e.g. by CanvasSaverRunnable.)
+	// Release our slot while waiting so the encoders can run even when the pool is full.
+	QThreadPool::globalInstance()->releaseThread();
+	concurrentForEach<int>(indices, [e, compression](int idx) {
+		e[idx].data = encodePng(e[idx].image, compression);
+		e[idx].image = QImage();
+	});
+	QThreadPool::globalInstance()->reserveThread();
+}
+
 static void writeStackStack(QXmlStreamWriter &writer, const paintcore::LayerStack *image, const QVector<QPoint> &layerOffsets)
 {
 	writer.writeStartElement("stack");
@@ -126,7 +166,7 @@ static bool writeStackXml(KZip &zip, const paintcore::LayerStack *image, const Q
 	return true;
 }
 
-static bool writeLayer(KZip &zf, const paintcore::LayerStack *layers, int index, QPoint &offset, QString *errorMessage)
+static PngEntry layerImage(const paintcore::LayerStack *layers, int index, QPoint &offset)
 {
 	const paintcore::Layer *l = layers->getLayerByIndex(index);
 	Q_ASSERT(l);
@@ -139,25 +179,24 @@ static bool writeLayer(KZip &zf, const paintcore::LayerStack *layers, int index,
 		image.fill(0);
 		offset = QPoint();
 	}
-	return putPngInZip(zf, QString("data/layer%1.png").arg(index), image, errorMessage);
+	return PngEntry { QString("data/layer%1.png").arg(index), image, QByteArray() };
 }
 
-static bool writePreviewImages(KZip &zf, const paintcore::LayerStack *layers, QString *errorMessage)
+static void previewImages(const paintcore::LayerStack *layers, QVector<PngEntry> &entries)
 {
 	QImage img = layers->toFlatImage(false);
 
-	// Flattened full size version for image viewers
-	if(!putPngInZip(zf, "mergedimage.png", img, errorMessage))
-		return false;
-
 	// Thumbnail for browsers and such
+	QImage thumbnail = img;
 	if(img.width() > 256 || img.height() > 256)
-		img = img.scaled(QSize(256, 256), Qt::KeepAspectRatio, Qt::SmoothTransformation);
+		thumbnail = img.scaled(QSize(256, 256), Qt::KeepAspectRatio, Qt::SmoothTransformation);
 
-	return putPngInZip(zf, "Thumbnails/thumbnail.png", img, errorMessage);
+	// Flattened full size version for image viewers
+	entries << PngEntry { "mergedimage.png", img, QByteArray() };
+	entries << PngEntry { "Thumbnails/thumbnail.png", thumbnail, QByteArray() };
 }
 
-bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image, QString *errorMessage)
+bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image, QString *errorMessage, Compression compression)
 {
 	KZip zf(filename);
 	if(!zf.open(QIODevice::WriteOnly)) {
@@ -175,10 +214,22 @@ bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image,
 		return false;
 	}
 
-	// Each layer is written as an individual PNG image
+	// Each layer is written as an individual PNG image.
+	// Ready to use preview images for viewers are included as well.
+	// The images are encoded in parallel, but the archive must be written serially.
 	QVector<QPoint> layerOffsets(image->layerCount());
-	for(int i=image->layerCount()-1;i>=0;--i) {
-		if(!writeLayer(zf, image, i, layerOffsets[i], errorMessage))
+	QVector<PngEntry> pngs;
+	pngs.reserve(image->layerCount() + 2);
+	for(int i=image->layerCount()-1;i>=0;--i)
+		pngs << layerImage(image, i, layerOffsets[i]);
+
+	const int layerPngs = pngs.size();
+	previewImages(image, pngs);
+
+	encodePngs(pngs, compression);
+
+	for(int i=0;i<layerPngs;++i) {
+		if(!putPngInZip(zf, pngs.at(i).filename, pngs.at(i).data, errorMessage))
 			return false;
 	}
 
@@ -187,8 +238,10 @@ bool saveOpenRaster(const QString& filename, const paintcore::LayerStack *image,
 	if(!writeStackXml(zf, image, layerOffsets, errorMessage))
 		return false;
 
-	// Ready to use images for viewers
-	writePreviewImages(zf, image, errorMessage);
+	for(int i=layerPngs;i<pngs.size();++i) {
+		if(!putPngInZip(zf, pngs.at(i).filename, pngs.at(i).data, errorMessage))
+			return false;
+	}
 
 	if(!zf.close()) {
 		if(errorMessage)
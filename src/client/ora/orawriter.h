@@ -29,15 +29,22 @@ namespace openraster {
 
 extern const QString DP_NAMESPACE;
 
+//! PNG compression effort for the layer images
+enum class Compression {
+	Normal, // Smallest output
+	Fast    // Faster to write, but produces bigger files (useful for autosaving)
+};
+
 /**
  * @brief Save the layer stack as an OpenRaster file
  *
  * @param filename target file path
  * @param image layer stack to save
  * @param errorMessage if not null, error message is put here
+ * @param compression PNG compression effort
  * @return false on error
  */
-bool saveOpenRaster(const QString &filename, const paintcore::LayerStack *image, QString *errorMessage=nullptr);
+bool saveOpenRaster(const QString &filename, const paintcore::LayerStack *image, QString *errorMessage=nullptr, Compression compression=Compression::Normal);
 
 }
 
@@ -1,7 +1,7 @@
 /*
    Drawpile - a collaborative drawing program.
 
-   Copyright (C) 2014-2016 Calle Laakkonen
+   Copyright (C) 2014-2018 Calle Laakkonen
 
    Drawpile is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
@@ -20,7 +20,6 @@
 #include <QDebug>
 #include <QVector>
 #include <QHash>
-#include <QSet>
 
 #include "../shared/record/reader.h"
 #include "../shared/record/writer.h"
@@ -37,89 +36,238 @@ namespace {
 static const uchar UNDOABLE = (1<<7);
 static const uchar REMOVED = (1<<6);
 
-struct FilterIndex {
+//! Maximum number of messages held back with a ToolChange
+static const int MAX_HELD_TOOLCHANGE = 100;
+
+/**
+ * @brief A message in the look-back window
+ *
+ * Messages stay in the window for as long as they may still be
+ * affected by an undo or a redo.
+ */
+struct WindowEntry {
+	protocol::MessagePtr msg;
 	uchar type;
 	uchar ctxid;
 	uchar flags;
-	qint64 offset;
 
-	FilterIndex() : type(0), ctxid(0), flags(0), offset(0) { }
+	WindowEntry(const protocol::MessagePtr &m)
+		: msg(m), type(m->type()), ctxid(m->contextId()), flags(m->isUndoable() ? UNDOABLE : 0)
+	{ }
 };
 
 struct State {
-	QVector<FilterIndex> index;
-	QHash<int, QList<int>> userjoins;
-	QHash<quint32, protocol::Message*> replacements;
-	QSet<int> users_seen;
-
-	~State() {
-		for(protocol::Message* msg : replacements.values())
-			delete msg;
+	QList<WindowEntry> window;
+	qint64 windowStart;  // absolute index of the first message in the window
+	int windowUndoPoints; // number of undo points in the window
+
+	QHash<int, qint64> strokes; // ctxId -> absolute index of the squished PenMove
+	QHash<int, protocol::MessagePtr> joins; // ctxId -> join message held until the user does something
+
+	// Output stage state
+	QList<protocol::MessagePtr> heldToolChange; // a ToolChange and the non-command messages following it
+	uchar prevOutputType;
+	uchar prevOutputCtx;
+
+	int maxWindowLength;
+
+	State() : windowStart(0), windowUndoPoints(0), prevOutputType(0), prevOutputCtx(0), maxWindowLength(0) { }
+
+	WindowEntry *entry(qint64 absIdx) {
+		if(absIdx < windowStart || absIdx >= windowStart + window.size())
+			return nullptr;
+		return &window[absIdx - windowStart];
 	}
 };
 
-void mark_delete(FilterIndex &i) {
+void mark_delete(WindowEntry &i) {
 	i.flags |= REMOVED;
 }
 
-inline protocol::MessageUndoState undostate(const FilterIndex &i) {
+inline protocol::MessageUndoState undostate(const WindowEntry &i) {
 	return protocol::MessageUndoState(i.flags & 0x03);
 }
 
-inline bool isUndoable(const FilterIndex &i) {
+inline bool isUndoable(const WindowEntry &i) {
 	return i.flags & UNDOABLE;
 }
 
-bool isDeleted(const FilterIndex &i) {
+bool isDeleted(const WindowEntry &i) {
 	return i.flags & (REMOVED | protocol::UNDONE);
 }
 
-void filterMessage(const Filter &filter, State &state, protocol::MessagePtr msg, qint64 offset)
+//! Perform an undo. This is a stripped down version of handleUndo from StateTracker
+void handleUndo(State &state, const protocol::Undo &cmd)
 {
-	// Put this message in the index
-	{
-		FilterIndex imsg;
-		imsg.type = msg->type();
-		imsg.ctxid = msg->contextId();
-		imsg.flags = msg->isUndoable() ? UNDOABLE : 0;
-		imsg.offset = offset;
-		state.index.append(imsg);
+	const uchar ctxid = cmd.contextId();
+
+	// Step 1. Find undo or redo point
+	int pos = state.window.size();
+	int upCount = 0;
+
+	if(cmd.isRedo()) {
+		// Find the start of the undo sequence (oldest undone UndoPoint)
+		int redostart = pos;
+		while(--pos>=0 && upCount <= protocol::UNDO_DEPTH_LIMIT) {
+			const WindowEntry &u = state.window.at(pos);
+			if(u.type == protocol::MSG_UNDOPOINT) {
+				++upCount;
+				if(u.ctxid == ctxid) {
+					if(undostate(u) != protocol::DONE)
+						redostart = pos;
+					else
+						break;
+				}
+			}
+		}
+
+		if(redostart == state.window.size()) {
+			qDebug() << "nothing to redo for user" << cmd.contextId();
+			return;
+		}
+		pos = redostart;
+
+	} else {
+		// Search for undoable actions from the end of the
+		// command stream towards the beginning
+		while(--pos>=0 && upCount <= protocol::UNDO_DEPTH_LIMIT) {
+			const WindowEntry &u = state.window.at(pos);
+
+			if(u.type == protocol::MSG_UNDOPOINT) {
+				++upCount;
+				if(u.ctxid == ctxid && undostate(u) == protocol::DONE)
+					break;
+			}
+		}
+	}
+
+	if(upCount > protocol::UNDO_DEPTH_LIMIT || pos < 0) {
+		qDebug() << "user" << cmd.contextId() << "cannot undo/redo beyond history limit";
+		return;
+	}
+
+	// Step 2 is not needed here
+
+	// Step 3. (Un)mark all actions by the user as undone
+	if(cmd.isRedo()) {
+		int i=pos;
+		int sequence=2;
+		while(i<state.window.size()) {
+			WindowEntry &u = state.window[i];
+			if(u.ctxid == ctxid) {
+				if(u.type == protocol::MSG_UNDOPOINT && undostate(u) != protocol::GONE)
+					if(--sequence==0)
+						break;
+
+				// GONE messages cannot be redone
+				if(undostate(u) == protocol::UNDONE)
+					u.flags &= ~protocol::UNDONE;
+			}
+			++i;
+		}
+	} else {
+		for(int i=pos;i<state.window.size();++i) {
+			WindowEntry &u = state.window[i];
+			if(u.ctxid == ctxid && isUndoable(u))
+				u.flags |= protocol::UNDONE;
+		}
+	}
+	// Steps 4 is not needed here.
+}
+
+//! Merge a PenMove into the ongoing stroke's first PenMove, if possible
+void squishPenMove(State &state, WindowEntry &e, qint64 absIdx)
+{
+	WindowEntry *head = state.strokes.contains(e.ctxid) ? state.entry(state.strokes[e.ctxid]) : nullptr;
+
+	if(head) {
+		// a stroke is still underway: add coordinates to the replacement PenMove
+		Q_ASSERT(protocol::isPenMove(head->type));
+
+		protocol::PenMove &pm = head->msg.cast<protocol::PenMove>();
+		const protocol::PenMove &pm2 = e.msg.cast<protocol::PenMove>();
+		if(pm.points().size() + pm2.points().size() <= protocol::PenMove::MAX_POINTS) {
+			pm.points() += pm2.points();
+			mark_delete(e);
+			return;
+		}
+		// Maximum points per message reached! Continue in a new message
 	}
 
+	// start a new stroke
+	state.strokes[e.ctxid] = absIdx;
+}
+
+//! Put a message in the look-back window
+WindowEntry &appendToWindow(State &state, const protocol::MessagePtr &msg)
+{
+	state.window.append(WindowEntry(msg));
+	if(msg->type() == protocol::MSG_UNDOPOINT)
+		++state.windowUndoPoints;
+	return state.window.last();
+}
+
+void filterMessage(const Filter &filter, State &state, protocol::MessagePtr msg)
+{
 	// Filter out select message types
 	switch(msg->type()) {
 	using namespace protocol;
 	case MSG_CHAT:
-		if(filter.removeChat()) {
-			mark_delete(state.index.last());
+		if(filter.removeChat())
 			return;
-		}
 		break;
 
 	case MSG_USER_JOIN:
+		// The join is held outside the window until the user does something.
+		// If they leave first, both the join and leave messages are dropped.
+		if(filter.removeLookyloos()) {
+			state.joins[msg->contextId()] = msg;
+			return;
+		}
+		appendToWindow(state, msg);
+		return;
+
 	case MSG_USER_LEAVE:
-		state.userjoins[msg->contextId()].append(state.index.size()-1);
+		if(filter.removeLookyloos() && state.joins.remove(msg->contextId()))
+			return;
+		appendToWindow(state, msg);
 		return;
 
 	case MSG_INTERVAL:
-		if(filter.removeDelays()) {
-			mark_delete(state.index.last());
+		if(filter.removeDelays())
 			return;
-		}
 		break;
 
 	case MSG_MOVEPOINTER:
-		if(filter.removeLasers()) {
-			mark_delete(state.index.last());
+		if(filter.removeLasers())
 			return;
-		}
 		break;
 
 	case MSG_MARKER:
-		if(filter.removeMarkers()) {
-			mark_delete(state.index.last());
+		if(filter.removeMarkers())
 			return;
-		}
+		break;
+
+	default: break;
+	}
+
+	// This is the user's first action since joining: the join is needed after all
+	if(msg->contextId()>0 && state.joins.contains(msg->contextId()))
+		appendToWindow(state, state.joins.take(msg->contextId()));
+
+	const qint64 absIdx = state.windowStart + state.window.size();
+	WindowEntry &e = appendToWindow(state, msg);
+
+	switch(msg->type()) {
+	using namespace protocol;
+	case MSG_PEN_MOVE:
+	case MSG_PEN_MOVE_DELTA:
+		if(filter.squishStrokes())
+			squishPenMove(state, e, absIdx);
+		break;
+
+	case MSG_PEN_UP:
+		state.strokes.remove(e.ctxid);
 		break;
 
 	default: break;
@@ -130,256 +278,117 @@ void filterMessage(const Filter &filter, State &state, protocol::MessagePtr msg,
 		// Normally, performing an undo will implicitly delete the undo action itself,
 		// but it can be restored by a redo. Therefore, we must explicitly flag the
 		// undo messages for deletion to be sure they are gone.
-		mark_delete(state.index.last());
-
-		// Perform an undo. This is a stripped down version of handleUndo from StateTracker
-		const protocol::Undo &cmd = msg.cast<protocol::Undo>();
-
-		const uchar ctxid = cmd.contextId();
-
-		// Step 1. Find undo or redo point
-		int pos = state.index.size();
-		int upCount = 0;
-
-		if(cmd.isRedo()) {
-			// Find the start of the undo sequence (oldest undone UndoPoint)
-			int redostart = pos;
-			while(--pos>=0 && upCount <= protocol::UNDO_DEPTH_LIMIT) {
-				const FilterIndex u = state.index[pos];
-				if(u.type == protocol::MSG_UNDOPOINT) {
-					++upCount;
-					if(u.ctxid == ctxid) {
-						if(undostate(u) != protocol::DONE)
-							redostart = pos;
-						else
-							break;
-					}
-				}
-			}
-
-			if(redostart == state.index.size()) {
-				qDebug() << "nothing to redo for user" << cmd.contextId();
-				mark_delete(state.index.last());
-				return;
-			}
-			pos = redostart;
-
-		} else {
-			// Search for undoable actions from the end of the
-			// command stream towards the beginning
-			while(--pos>=0 && upCount <= protocol::UNDO_DEPTH_LIMIT) {
-				const FilterIndex u = state.index[pos];
+		mark_delete(e);
+		handleUndo(state, msg.cast<protocol::Undo>());
+	}
+}
 
-				if(u.type == protocol::MSG_UNDOPOINT) {
-					++upCount;
-					if(u.ctxid == ctxid && undostate(u) == protocol::DONE)
-						break;
-				}
-			}
-		}
+/**
+ * @brief Remove adjacent undo points by the same user and write the message
+ *
+ * Such undo points are left over when actions are undone or silenced.
+ */
+void writeFiltered(State &state, Writer &writer, const protocol::MessagePtr &msg)
+{
+	const uchar type = msg->type();
 
-		if(upCount > protocol::UNDO_DEPTH_LIMIT) {
-			qDebug() << "user" << cmd.contextId() << "cannot undo/redo beyond history limit";
-			mark_delete(state.index.last());
+	if(type != protocol::MSG_INTERVAL) {
+		if(type == protocol::MSG_UNDOPOINT && state.prevOutputType == protocol::MSG_UNDOPOINT && state.prevOutputCtx == msg->contextId())
 			return;
-		}
 
-		// Step 2 is not needed here
-
-		// Step 3. (Un)mark all actions by the user as undone
-		if(cmd.isRedo()) {
-			int i=pos;
-			int sequence=2;
-			while(i<state.index.size()) {
-				FilterIndex &u = state.index[i];
-				if(u.ctxid == ctxid) {
-					if(u.type == protocol::MSG_UNDOPOINT && undostate(u) != protocol::GONE)
-						if(--sequence==0)
-							break;
-
-					// GONE messages cannot be redone
-					if(undostate(u) == protocol::UNDONE)
-						u.flags &= ~protocol::UNDONE;
-				}
-				++i;
-			}
-		} else {
-			for(int i=pos;i<state.index.size();++i) {
-				FilterIndex &u = state.index[i];
-				if(u.ctxid == ctxid && isUndoable(u))
-					u.flags |= protocol::UNDONE;
-			}
-		}
-		// Steps 4 is not needed here.
+		state.prevOutputType = type;
+		state.prevOutputCtx = msg->contextId();
 	}
 
-	if(msg->contextId()>0)
-		state.users_seen.insert(msg->contextId());
-
-	return;
+	writer.writeMessage(*msg);
 }
 
-//! Remove all users who haven't done anything
-void filterLookyloos(State &state)
+void releaseHeldToolChange(State &state, Writer &writer)
 {
-	for(const int id : state.userjoins.keys()) {
-		if(!state.users_seen.contains(id)) {
-			for(const int idx : state.userjoins[id]) {
-				mark_delete(state.index[idx]);
-			}
-		}
-	}
+	for(const protocol::MessagePtr &h : state.heldToolChange)
+		writeFiltered(state, writer, h);
+	state.heldToolChange.clear();
 }
 
 /**
- * @brief Remove adjacent undo points by the same user
- *
- * This removes all duplicate undo points that appear _next to each other_ in
- * the message stream. Such undo points are left over when actions are undone or
- * silenced.
+ * @brief Output stage: write a message that is no longer in the look-back window
  *
- * @param state
+ * This removes extraneous tool change messages. A ToolChange is held
+ * until the next command (meta messages and undo points are ignored) is seen,
+ * since it can be dropped if that command is another ToolChange by the same user.
+ * If too many messages pile up behind it, the ToolChange is written out anyway.
  */
-void filterAdjacentUndoPoints(State &state)
+void outputMessage(State &state, Writer &writer, const protocol::MessagePtr &msg)
 {
-	FilterIndex prev;
+	const uchar type = msg->type();
 
-	for(int i=0;i<state.index.size();++i) {
-		FilterIndex &fi = state.index[i];
-
-		if(isDeleted(fi))
-			continue;
-
-		if(fi.type == protocol::MSG_INTERVAL)
-			continue;
-
-		if(fi.type == protocol::MSG_UNDOPOINT && prev.type == protocol::MSG_UNDOPOINT) {
-			if(fi.ctxid == prev.ctxid) {
-				mark_delete(fi);
-			}
+	if(type >= 128 && type != protocol::MSG_UNDOPOINT) {
+		if(!state.heldToolChange.isEmpty()) {
+			if(type == protocol::MSG_TOOLCHANGE && state.heldToolChange.first()->contextId() == msg->contextId())
+				state.heldToolChange.removeFirst();
+			releaseHeldToolChange(state, writer);
 		}
 
-		prev = fi;
-	}
-}
-
-//! Remove extraneous tool change messages
-void filterExtraToolChanges(State &state)
-{
-	FilterIndex prev;
-	prev.type = 0;
-
-	for(int i=state.index.size()-1;i>0;--i) {
-		FilterIndex &fi = state.index[i];
-
-		if(isDeleted(fi))
-			continue;
-
-		// ignroe meta messages
-		if(fi.type < 128)
-			continue;
-
-		if(fi.type == protocol::MSG_UNDOPOINT)
-			continue;
-
-		if(fi.type == protocol::MSG_TOOLCHANGE && prev.type == protocol::MSG_TOOLCHANGE) {
-			if(fi.ctxid == prev.ctxid) {
-				mark_delete(fi);
-			}
+		if(type == protocol::MSG_TOOLCHANGE) {
+			state.heldToolChange << msg;
+			return;
 		}
 
-		prev = fi;
+	} else if(!state.heldToolChange.isEmpty()) {
+		state.heldToolChange << msg;
+		if(state.heldToolChange.size() > MAX_HELD_TOOLCHANGE)
+			releaseHeldToolChange(state, writer);
+		return;
 	}
-}
-
-void squishStrokes(State &state, Reader &recording)
-{
-	QHash<int,int> strokes; // ctxId -> current stroke mapping
-
-	for(int i=0;i<state.index.size();++i) {
-		FilterIndex &fi = state.index[i];
-
-		if(isDeleted(fi))
-			continue;
-
-		if(fi.type == protocol::MSG_PEN_MOVE) {
-			recording.seekTo(i, fi.offset);
-			MessageRecord msg = recording.readNext();
-			Q_ASSERT(msg.status == MessageRecord::OK);
-			Q_ASSERT(msg.message->type() == protocol::MSG_PEN_MOVE);
-
-			if(strokes.contains(fi.ctxid)) {
-				// a stroke is still underway: add coordinates to the replacement PenMove
-				protocol::Message *squished = state.replacements[strokes[fi.ctxid]];
-				Q_ASSERT(squished);
-				Q_ASSERT(squished->type() == protocol::MSG_PEN_MOVE);
-
-				protocol::PenMove *pm = static_cast<protocol::PenMove*>(squished);
-				protocol::PenMove *pm2 = static_cast<protocol::PenMove*>(msg.message);
-				if(pm->points().size() + pm2->points().size() > protocol::PenMove::MAX_POINTS) {
-					// Maximum points per message reached! Continue in a new message
-					strokes[fi.ctxid] = i;
-					state.replacements[i] = msg.message;
-
-				} else {
-					pm->points() += pm2->points();
-					mark_delete(fi);
-					delete msg.message;
-				}
 
-			} else {
-				// start a new stroke
-				strokes[fi.ctxid] = i;
-				state.replacements[i] = msg.message;
-			}
-
-		} else if(fi.type == protocol::MSG_PEN_UP) {
-			strokes.remove(fi.ctxid);
-		}
-	}
+	writeFiltered(state, writer, msg);
 }
 
-void doFilterRecording(Filter &filter, State &state, Reader &recording)
+//! Move messages that can no longer be affected by undos out of the window
+void flushWindow(State &state, Writer &writer, bool all)
 {
-	while(true) {
-		MessageRecord msg = recording.readNext();
-		if(msg.status == MessageRecord::END_OF_RECORDING)
-			break;
-		if(msg.status == MessageRecord::INVALID) {
-			qWarning() << "skipping invalid message type" << msg.error.type;
-			continue;
-		}
-
-		protocol::MessagePtr msgp(msg.message);
-		filterMessage(filter, state, msgp, recording.currentPosition());
+	// Undo and redo always start from an undo point, so messages preceding the
+	// oldest one in the window are never affected. Neither are messages preceding
+	// the oldest undo point reachable within the undo depth limit.
+	while(!state.window.isEmpty() && (
+		all ||
+		state.window.first().type != protocol::MSG_UNDOPOINT ||
+		state.windowUndoPoints > protocol::UNDO_DEPTH_LIMIT + 1
+		)) {
+		const WindowEntry e = state.window.takeFirst();
+		const qint64 absIdx = state.windowStart++;
+
+		if(e.type == protocol::MSG_UNDOPOINT)
+			--state.windowUndoPoints;
+
+		// A stroke whose first PenMove has been written out must be continued in a new message
+		if(protocol::isPenMove(e.type) && state.strokes.value(e.ctxid, -1) == absIdx)
+			state.strokes.remove(e.ctxid);
+
+		if(!isDeleted(e))
+			outputMessage(state, writer, e.msg);
 	}
 
-	if(filter.removeLookyloos())
-		filterLookyloos(state);
-
-	if(filter.squishStrokes())
-		squishStrokes(state, recording);
-
-	filterExtraToolChanges(state);
-	filterAdjacentUndoPoints(state);
+	if(all)
+		releaseHeldToolChange(state, writer);
 }
 
 }
 
 Filter::Filter()
 	: _expunge_undos(false), _remove_chat(false), _remove_lookyloos(false), _remove_delays(false),
-	  _remove_lasers(false), _remove_markers(false)
+	  _remove_lasers(false), _remove_markers(false), _squish_strokes(false), _maxWindowLength(0)
 {
 }
 
 bool Filter::filterRecording(const QString &input, const QString &outputfile)
 {
 	// Step 1. Open input and output files
-	Reader reader1(input);
-	Compatibility readOk = reader1.open();
+	Reader reader(input);
+	Compatibility readOk = reader.open();
 	if(readOk != COMPATIBLE && readOk != MINOR_INCOMPATIBILITY) {
 		qWarning() << "Cannot open recording for filtering. Error code" << readOk;
-		_errormsg = reader1.errorString();
+		_errormsg = reader.errorString();
 		return false;
 	}
 
@@ -390,38 +399,34 @@ bool Filter::filterRecording(const QString &input, const QString &outputfile)
 		return false;
 	}
 
-	// Step 2. Mark messages for removal
-	State state;
-	doFilterRecording(*this, state, reader1);
-
-	// Step 4. Write messages back to output file
-#if 0
-	reader.rewind();
-#else
-	// KCompressionDevice::seek appears to be buggy
-	reader1.close();
-	Reader reader2(input);
-	reader2.open();
-#endif
-
 	writer.writeHeader();
 
-	QByteArray buffer;
-	while(reader2.readNextToBuffer(buffer)) {
-		const unsigned int pos = reader2.currentIndex();
-
-		// Copy (or replace) original message, unless marked for deletion
-		if(!isDeleted(state.index[pos])) {
-
-			if(state.replacements.contains(pos))
-				writer.writeMessage(*state.replacements[pos]);
-			else
-				writer.writeFromBuffer(buffer);
+	// Step 2. Filter the recording in a single pass.
+	// Messages are kept in a look-back window until they can no longer
+	// be affected by undo/redo, after which they are written out.
+	State state;
+	while(true) {
+		MessageRecord msg = reader.readNext();
+		if(msg.status == MessageRecord::END_OF_RECORDING)
+			break;
+		if(msg.status == MessageRecord::INVALID) {
+			qWarning() << "skipping invalid message type" << msg.error.type;
+			continue;
 		}
+
+		filterMessage(*this, state, protocol::MessagePtr(msg.message));
+		state.maxWindowLength = qMax(state.maxWindowLength, state.window.size());
+		flushWindow(state, writer, false);
 	}
 
+	// Step 3. Write out the rest. Joins still held back belong to users
+	// who never did anything and are dropped.
+	flushWindow(state, writer, true);
 	writer.close();
 
+	_maxWindowLength = state.maxWindowLength;
+	qDebug() << "Recording filtered. Peak look-back window length:" << _maxWindowLength;
+
 	return true;
 }
 
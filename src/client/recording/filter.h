@@ -1,7 +1,7 @@
 /*
    Drawpile - a collaborative drawing program.
 
-   Copyright (C) 2014-2016 Calle Laakkonen
+   Copyright (C) 2014-2018 Calle Laakkonen
 
    Drawpile is free software: you can redistribute it and/or modify
    it under the terms of the GNU General Public License as published by
@@ -66,6 +66,15 @@ public:
 	//! Get the error message
 	const QString &errorString() const { return _errormsg; }
 
+	/**
+	 * @brief Get the peak number of messages held in memory during the last filtering run
+	 *
+	 * Filtering is done in a single pass: only messages that may still be affected
+	 * by an undo (see protocol::UNDO_DEPTH_LIMIT) are kept in memory, so this number
+	 * does not grow with the length of the recording.
+	 */
+	int maxWindowLength() const { return _maxWindowLength; }
+
 	/**
 	 * @brief Perform filtering.
 	 *
@@ -86,6 +95,8 @@ private:
 	bool _remove_lasers;
 	bool _remove_markers;
 	bool _squish_strokes;
+
+	int _maxWindowLength;
 };
 
 }
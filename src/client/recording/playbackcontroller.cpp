@@ -134,6 +134,9 @@ void PlaybackController::nextCommands(int stepCount)
 		return;
 	}
 
+	// Messages are handed to the canvas as one batch
+	QList<protocol::MessagePtr> batch;
+
 	while(stepCount-->0) {
 		MessageRecord next = m_reader->readNext();
 
@@ -144,6 +147,7 @@ void PlaybackController::nextCommands(int stepCount)
 			if(msg->type() == protocol::MSG_INTERVAL) {
 				if(m_play) {
 					// Autoplay mode: pause for the given interval
+					m_canvas->handleCommands(batch);
 					expectSequencePoint(msg.cast<protocol::Interval>().milliseconds() / m_speedFactor);
 					return;
 
@@ -153,13 +157,17 @@ void PlaybackController::nextCommands(int stepCount)
 				}
 
 			} else {
+				batch << msg;
+
 				if(msg->type() == protocol::MSG_MARKER) {
+					// The canvas must be up to date when the marker is shown
+					m_canvas->handleCommands(batch);
+					batch.clear();
+
 					emit markerEncountered(msg.cast<protocol::Marker>().text());
 					if(m_stopOnMarkers)
 						setPlaying(false);
 				}
-
-				m_canvas->handleCommand(msg);
 			}
 			break;
 		}
@@ -167,11 +175,14 @@ void PlaybackController::nextCommands(int stepCount)
 			qWarning("Unrecognized command %d of length %d", next.error.type, next.error.len);
 			break;
 		case MessageRecord::END_OF_RECORDING:
+			m_canvas->handleCommands(batch);
+			batch.clear();
 			emit endOfFileReached();
 			break;
 		}
 	}
 
+	m_canvas->handleCommands(batch);
 	expectSequencePoint(qMax(1.0, 33.0 / m_speedFactor) + 0.5);
 }
 
@@ -207,6 +218,7 @@ void PlaybackController::nextSequence()
 		return;
 
 	// Play back until either an undopoint or end-of-file is reached
+	QList<protocol::MessagePtr> batch;
 	bool loop=true;
 	while(loop) {
 		MessageRecord next = m_reader->readNext();
@@ -216,7 +228,7 @@ void PlaybackController::nextSequence()
 				// skip intervals
 				delete next.message;
 			} else {
-				m_canvas->handleCommand(protocol::MessagePtr(next.message));
+				batch << protocol::MessagePtr(next.message);
 				if(next.message->type() == protocol::MSG_UNDOPOINT)
 					loop = false;
 			}
@@ -225,12 +237,15 @@ void PlaybackController::nextSequence()
 			qWarning("Unrecognized command %d of length %d", next.error.type, next.error.len);
 			break;
 		case MessageRecord::END_OF_RECORDING:
+			m_canvas->handleCommands(batch);
+			batch.clear();
 			emit endOfFileReached();
 			loop = false;
 			break;
 		}
 	}
 
+	m_canvas->handleCommands(batch);
 	expectSequencePoint(0);
 }
 
@@ -270,6 +285,7 @@ void PlaybackController::jumpTo(int pos)
 	}
 
 	// Now the current position is somewhere before the target position: replay commands
+	QList<protocol::MessagePtr> batch;
 	while(m_reader->currentIndex() < pos && !m_reader->isEof()) {
 		MessageRecord next = m_reader->readNext();
 		switch(next.status) {
@@ -278,18 +294,21 @@ void PlaybackController::jumpTo(int pos)
 				// skip intervals
 				delete next.message;
 			} else {
-				m_canvas->handleCommand(protocol::MessagePtr(next.message));
+				batch << protocol::MessagePtr(next.message);
 			}
 			break;
 		case MessageRecord::INVALID:
 			qWarning("Unrecognized command %d of length %d", next.error.type, next.error.len);
 			break;
 		case MessageRecord::END_OF_RECORDING:
+			m_canvas->handleCommands(batch);
+			batch.clear();
 			emit endOfFileReached();
 			break;
 		}
 	}
 
+	m_canvas->handleCommands(batch);
 	expectSequencePoint(0);
 }
 
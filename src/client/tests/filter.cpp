@@ -0,0 +1,341 @@
+#include "../recording/filter.h"
+#include "../../shared/record/reader.h"
+#include "../../shared/record/writer.h"
+#include "../../shared/net/meta.h"
+#include "../../shared/net/pen.h"
+#include "../../shared/net/undo.h"
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+#include <QVector>
+#include <QSet>
+
+using namespace protocol;
+
+Q_DECLARE_METATYPE(QList<MessagePtr>)
+
+// The original two-pass filter: every message is put in an index, undos and
+// lookyloos are marked in it and the extra tool changes and adjacent undo points
+// are removed at the end. The single pass filter must produce the same output.
+namespace reference {
+
+static const uchar UNDOABLE = (1<<7);
+static const uchar REMOVED = (1<<6);
+
+struct Entry {
+	MessagePtr msg;
+	uchar flags;
+};
+
+static MessageUndoState undostate(const Entry &e) { return MessageUndoState(e.flags & 0x03); }
+static bool isDeleted(const Entry &e) { return e.flags & (REMOVED | UNDONE); }
+
+static void undo(QVector<Entry> &index, const Undo &cmd)
+{
+	const uchar ctxid = cmd.contextId();
+	int pos = index.size();
+	int upCount = 0;
+
+	if(cmd.isRedo()) {
+		int redostart = pos;
+		while(--pos>=0 && upCount <= UNDO_DEPTH_LIMIT) {
+			const Entry &u = index.at(pos);
+			if(u.msg->type() == MSG_UNDOPOINT) {
+				++upCount;
+				if(u.msg->contextId() == ctxid) {
+					if(undostate(u) != DONE)
+						redostart = pos;
+					else
+						break;
+				}
+			}
+		}
+		if(redostart == index.size())
+			return;
+		pos = redostart;
+
+	} else {
+		while(--pos>=0 && upCount <= UNDO_DEPTH_LIMIT) {
+			const Entry &u = index.at(pos);
+			if(u.msg->type() == MSG_UNDOPOINT) {
+				++upCount;
+				if(u.msg->contextId() == ctxid && undostate(u) == DONE)
+					break;
+			}
+		}
+	}
+
+	if(upCount > UNDO_DEPTH_LIMIT)
+		return;
+
+	if(cmd.isRedo()) {
+		int sequence=2;
+		for(int i=pos;i<index.size();++i) {
+			Entry &u = index[i];
+			if(u.msg->contextId() == ctxid) {
+				if(u.msg->type() == MSG_UNDOPOINT && undostate(u) != GONE)
+					if(--sequence==0)
+						break;
+				if(undostate(u) == UNDONE)
+					u.flags &= ~UNDONE;
+			}
+		}
+	} else {
+		for(int i=pos;i<index.size();++i) {
+			Entry &u = index[i];
+			if(u.msg->contextId() == ctxid && (u.flags & UNDOABLE))
+				u.flags |= UNDONE;
+		}
+	}
+}
+
+static QList<MessagePtr> filter(const QList<MessagePtr> &input, bool expungeUndos, bool removeLookyloos)
+{
+	QVector<Entry> index;
+	QHash<int, QList<int>> userjoins;
+	QSet<int> usersSeen;
+
+	for(const MessagePtr &msg : input) {
+		index.append(Entry { msg, uchar(msg->isUndoable() ? UNDOABLE : 0) });
+
+		if(msg->type() == MSG_USER_JOIN || msg->type() == MSG_USER_LEAVE) {
+			userjoins[msg->contextId()].append(index.size()-1);
+			continue;
+		}
+
+		if(msg->type() == MSG_UNDO && expungeUndos) {
+			index.last().flags |= REMOVED;
+			undo(index, msg.cast<Undo>());
+		}
+
+		if(msg->contextId()>0)
+			usersSeen.insert(msg->contextId());
+	}
+
+	if(removeLookyloos) {
+		for(const int id : userjoins.keys()) {
+			if(!usersSeen.contains(id)) {
+				for(const int idx : userjoins[id])
+					index[idx].flags |= REMOVED;
+			}
+		}
+	}
+
+	// Extra tool changes
+	{
+		uchar prevType = 0, prevCtx = 0;
+		for(int i=index.size()-1;i>0;--i) {
+			Entry &e = index[i];
+			if(isDeleted(e) || e.msg->type() < 128 || e.msg->type() == MSG_UNDOPOINT)
+				continue;
+
+			if(e.msg->type() == MSG_TOOLCHANGE && prevType == MSG_TOOLCHANGE && prevCtx == e.msg->contextId())
+				e.flags |= REMOVED;
+
+			prevType = e.msg->type();
+			prevCtx = e.msg->contextId();
+		}
+	}
+
+	// Adjacent undo points
+	{
+		uchar prevType = 0, prevCtx = 0;
+		for(Entry &e : index) {
+			if(isDeleted(e) || e.msg->type() == MSG_INTERVAL)
+				continue;
+
+			if(e.msg->type() == MSG_UNDOPOINT && prevType == MSG_UNDOPOINT && prevCtx == e.msg->contextId())
+				e.flags |= REMOVED;
+
+			prevType = e.msg->type();
+			prevCtx = e.msg->contextId();
+		}
+	}
+
+	QList<MessagePtr> output;
+	for(const Entry &e : index) {
+		if(!isDeleted(e))
+			output << e.msg;
+	}
+	return output;
+}
+
+}
+
+static MessagePtr toolChange(int ctx, quint32 color)
+{
+	return MessagePtr(new ToolChange(ctx, 1, paintcore::BlendMode::MODE_NORMAL, TOOL_MODE_INCREMENTAL, 25, color, 255, 255, 10, 10, 255, 255, 0, 0, 0));
+}
+
+static QList<MessagePtr> stroke(int ctx, int y)
+{
+	return QList<MessagePtr> {
+		MessagePtr(new UndoPoint(ctx)),
+		toolChange(ctx, 0xff000000 | y),
+		MessagePtr(new PenMove(ctx, PenPointVector { PenPoint(0, y, 0xffff), PenPoint(100, y, 0xffff) })),
+		MessagePtr(new PenUp(ctx))
+	};
+}
+
+static MessagePtr undo(int ctx, bool redo)
+{
+	return MessagePtr(new Undo(ctx, 0, redo));
+}
+
+class TestFilter : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testSinglePass_data()
+	{
+		QTest::addColumn<QList<MessagePtr>>("input");
+		QTest::addColumn<bool>("expungeUndos");
+		QTest::addColumn<bool>("removeLookyloos");
+
+		QTest::newRow("undo") << (
+			stroke(1, 10) + stroke(2, 20) + stroke(1, 30) + stroke(1, 40)
+			+ QList<MessagePtr> { undo(1, false), undo(1, false), undo(2, false), undo(1, true) }
+			+ stroke(2, 50)
+			+ QList<MessagePtr> { undo(2, true), undo(1, false) }
+			) << true << false;
+
+		QList<MessagePtr> deep;
+		for(int i=0;i<UNDO_DEPTH_LIMIT+10;++i)
+			deep << stroke(1 + i % 2, i);
+		for(int i=0;i<UNDO_DEPTH_LIMIT;++i)
+			deep << undo(1, false);
+		deep << undo(1, true) << undo(2, false);
+		QTest::newRow("deepundo") << deep << true << false;
+
+		// Joins of active users are written just before their first action,
+		// so this input has them there already
+		QTest::newRow("lookyloo") << (QList<MessagePtr> {
+			MessagePtr(new UserJoin(3, 0, QString("idle"))),
+			MessagePtr(new UserLeave(3)),
+			MessagePtr(new UserJoin(5, 0, QString("stays"))),
+			MessagePtr(new UserJoin(1, 0, QString("one"))),
+			} + stroke(1, 10) + QList<MessagePtr> {
+			MessagePtr(new UserJoin(4, 0, QString("active"))),
+			} + stroke(4, 20) + QList<MessagePtr> {
+			MessagePtr(new UserLeave(4)),
+			MessagePtr(new UserLeave(1))
+			}) << false << true;
+
+		QTest::newRow("toolchange") << (QList<MessagePtr> {
+			MessagePtr(new UserJoin(1, 0, QString("one"))),
+			toolChange(1, 0xff000001),
+			Chat::regular(2, "hello", false),
+			toolChange(1, 0xff000002),
+			MessagePtr(new UndoPoint(1)),
+			toolChange(1, 0xff000003),
+			} + stroke(1, 10) + QList<MessagePtr> {
+			toolChange(2, 0xff000004),
+			MessagePtr(new UndoPoint(2)),
+			MessagePtr(new UndoPoint(2)),
+			toolChange(1, 0xff000005),
+			toolChange(2, 0xff000006),
+			} + stroke(2, 20) + QList<MessagePtr> {
+			toolChange(1, 0xff000007)
+			}) << false << false;
+
+		QTest::newRow("toolchangeundo") << (
+			stroke(1, 10) + stroke(1, 20)
+			+ QList<MessagePtr> { undo(1, false), toolChange(1, 0xff000001) }
+			+ stroke(1, 30) + stroke(2, 40)
+			) << true << false;
+	}
+
+	void testSinglePass()
+	{
+		QFETCH(QList<MessagePtr>, input);
+		QFETCH(bool, expungeUndos);
+		QFETCH(bool, removeLookyloos);
+
+		QList<MessagePtr> output;
+		QVERIFY(filterMessages(input, expungeUndos, removeLookyloos, output));
+
+		const QList<MessagePtr> expected = reference::filter(input, expungeUndos, removeLookyloos);
+		QVERIFY(expected.size() < input.size());
+		compare(output, expected);
+	}
+
+	void testLookyloos()
+	{
+		// The idle user stays for longer than the undo depth limit
+		const MessagePtr join1 { new UserJoin(1, 0, QString("one")) };
+		const MessagePtr join4 { new UserJoin(4, 0, QString("active")) };
+
+		QList<MessagePtr> strokes;
+		for(int i=0;i<UNDO_DEPTH_LIMIT+10;++i)
+			strokes << stroke(1, i);
+
+		const QList<MessagePtr> input = QList<MessagePtr> {
+			join1,
+			MessagePtr(new UserJoin(3, 0, QString("idle"))),
+			join4,
+			} + strokes + QList<MessagePtr> {
+			MessagePtr(new UserLeave(3)),
+			} + stroke(4, 1) + QList<MessagePtr> {
+			MessagePtr(new UserLeave(4)),
+			MessagePtr(new UserJoin(3, 0, QString("idle again"))),
+			};
+
+		// The active user's join is moved to just before their first action
+		const QList<MessagePtr> expected = QList<MessagePtr> { join1 } + strokes
+			+ QList<MessagePtr> { join4 } + stroke(4, 1)
+			+ QList<MessagePtr> { MessagePtr(new UserLeave(4)) };
+
+		QList<MessagePtr> output;
+		QVERIFY(filterMessages(input, false, true, output));
+		compare(output, expected);
+	}
+
+private:
+	bool filterMessages(const QList<MessagePtr> &input, bool expungeUndos, bool removeLookyloos, QList<MessagePtr> &output)
+	{
+		QTemporaryDir tempDir;
+		if(!tempDir.isValid())
+			return false;
+		const QString inputFile = tempDir.filePath("input.dprec");
+		const QString outputFile = tempDir.filePath("output.dprec");
+
+		{
+			recording::Writer writer(inputFile);
+			if(!writer.open())
+				return false;
+			writer.writeHeader();
+			for(const MessagePtr &msg : input)
+				writer.writeMessage(*msg);
+			writer.close();
+		}
+
+		recording::Filter filter;
+		filter.setExpungeUndos(expungeUndos);
+		filter.setRemoveLookyloos(removeLookyloos);
+		if(!filter.filterRecording(inputFile, outputFile))
+			return false;
+
+		recording::Reader reader(outputFile);
+		if(reader.open() != recording::COMPATIBLE)
+			return false;
+		while(true) {
+			recording::MessageRecord mr = reader.readNext();
+			if(mr.status == recording::MessageRecord::END_OF_RECORDING)
+				return true;
+			if(mr.status != recording::MessageRecord::OK)
+				return false;
+			output << MessagePtr(mr.message);
+		}
+	}
+
+	void compare(const QList<MessagePtr> &output, const QList<MessagePtr> &expected)
+	{
+		QCOMPARE(output.size(), expected.size());
+		for(int i=0;i<output.size();++i)
+			QVERIFY2(output.at(i).equals(expected.at(i)), qPrintable(QString("Mismatch at message %1").arg(i)));
+	}
+};
+
+
+QTEST_MAIN(TestFilter)
+#include "filter.moc"
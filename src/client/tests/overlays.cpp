@@ -0,0 +1,86 @@
+#include "../canvas/usercursormodel.h"
+#include "../canvas/lasertrailmodel.h"
+#include "../core/annotationmodel.h"
+
+#include <QtTest/QtTest>
+
+using namespace canvas;
+
+class TestOverlays : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testCursorLookup()
+	{
+		UserCursorModel model;
+		model.setCursorPosition(3, QPointF(1, 2));
+		model.setCursorPosition(7, QPointF(3, 4));
+		model.setCursorName(3, "test");
+
+		QCOMPARE(model.rowCount(), 2);
+		QCOMPARE(model.indexForId(7).data(UserCursorModel::PositionRole).toPointF(), QPointF(3, 4));
+		QCOMPARE(model.indexForId(3).data(Qt::DisplayRole).toString(), QString("test"));
+		QVERIFY(!model.indexForId(5).isValid());
+
+		model.clear();
+		QVERIFY(!model.indexForId(3).isValid());
+	}
+
+	void testAnnotationHitTest()
+	{
+		paintcore::AnnotationModel model;
+		model.addAnnotation(0x0101, QRect(10, 10, 100, 100));
+		model.addAnnotation(0x0102, QRect(50, 50, 400, 400));
+		model.addAnnotation(0x0103, QRect(-300, -300, 100, 100));
+
+		QCOMPARE(hit(model, QPoint(20, 20)), 0x0101);
+		QCOMPARE(hit(model, QPoint(60, 60)), 0x0101); // topmost in stacking order
+		QCOMPARE(hit(model, QPoint(300, 300)), 0x0102);
+		QCOMPARE(hit(model, QPoint(-250, -250)), 0x0103);
+		QCOMPARE(hit(model, QPoint(1000, 1000)), 0);
+
+		// Handles extend slightly outside the box
+		QCOMPARE(hit(model, QPoint(453, 300)), 0x0102);
+
+		model.reshapeAnnotation(0x0101, QRect(1000, 1000, 10, 10));
+		QCOMPARE(hit(model, QPoint(20, 20)), 0);
+		QCOMPARE(hit(model, QPoint(1005, 1005)), 0x0101);
+
+		model.deleteAnnotation(0x0101);
+		QCOMPARE(hit(model, QPoint(1005, 1005)), 0);
+		QCOMPARE(model.getById(0x0103)->rect, QRect(-300, -300, 100, 100));
+	}
+
+	void benchmarkCursorMoves()
+	{
+		UserCursorModel cursors;
+		LaserTrailModel lasers;
+
+		for(int id=1;id<=100;++id) {
+			cursors.setCursorName(id, QString("User %1").arg(id));
+			lasers.startTrail(id, Qt::red, 10);
+		}
+
+		int step = 0;
+		QBENCHMARK {
+			// Every user moves their pointer once
+			for(int id=1;id<=100;++id) {
+				const QPointF p(id * 10 + step % 100, step % 200);
+				cursors.setCursorPosition(id, p);
+				lasers.addPoint(id, p);
+			}
+			++step;
+		}
+	}
+
+private:
+	static int hit(const paintcore::AnnotationModel &model, const QPoint &p)
+	{
+		const paintcore::Annotation *a = model.annotationAtPos(p, 1.0);
+		return a ? a->id : 0;
+	}
+};
+
+
+QTEST_MAIN(TestOverlays)
+#include "overlays.moc"
@@ -1,5 +1,6 @@
 #include "../canvas/retcon.h"
 #include "../../shared/net/textmode.h"
+#include "../../shared/net/pen.h"
 
 #include <QtTest/QtTest>
 
@@ -193,6 +194,38 @@ private slots:
 		QCOMPARE(lf.isEmpty(), true);
 	}
 
+	void testMergedPenMoves()
+	{
+		LocalFork lf;
+
+		// Local pen moves are added one point at a time...
+		lf.addLocalMessage(msg("1 penmove 1 1"), AffectedArea(AffectedArea::PIXELS, 1, QRect(1,1,1,1)));
+		lf.addLocalMessage(msg("1 penmove 2 2"), AffectedArea(AffectedArea::PIXELS, 1, QRect(2,2,1,1)));
+		lf.addLocalMessage(msg("1 penmove 3 3"), AffectedArea(AffectedArea::PIXELS, 1, QRect(3,3,1,1)));
+
+		// ...but the first two come back merged into one message
+		const MessagePtr local1 = lf.messages().at(0);
+		const MessagePtr local2 = lf.messages().at(1);
+		PenPointVector points;
+		points << local1.cast<PenMove>().points() << local2.cast<PenMove>().points();
+
+		QCOMPARE(
+			lf.handleReceivedMessage(MessagePtr(new PenMove(1, points)), AffectedArea(AffectedArea::PIXELS, 1, QRect(1,1,2,2))),
+			LocalFork::ALREADYDONE
+		);
+		QCOMPARE(lf.messages().size(), 1);
+
+		// A merged message that doesn't match the local fork is still a conflict
+		points.clear();
+		points << lf.messages().at(0).cast<PenMove>().points() << PenPoint(100, 100, 0);
+
+		QCOMPARE(
+			lf.handleReceivedMessage(MessagePtr(new PenMove(1, points)), AffectedArea(AffectedArea::PIXELS, 1, QRect(3,3,100,100))),
+			LocalFork::ROLLBACK
+		);
+		QVERIFY(lf.isEmpty());
+	}
+
 	void testFallBehind()
 	{
 		LocalFork lf;
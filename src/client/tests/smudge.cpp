@@ -0,0 +1,73 @@
+#include "../core/layer.h"
+#include "../core/brush.h"
+#include "../core/point.h"
+
+#include <QtTest/QtTest>
+
+using paintcore::Layer;
+using paintcore::Brush;
+using paintcore::Point;
+using paintcore::StrokeState;
+
+class TestSmudge : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testDabColor()
+	{
+		Layer layer(nullptr, 0, QString(), QColor(255, 0, 0), QSize(200, 200));
+
+		// Solid color is sampled as is, also across tile boundaries
+		QCOMPARE(layer.colorAt(64, 64, 31), QColor(255, 0, 0));
+
+		// Half transparent color is unpremultiplied
+		Layer layer2(nullptr, 0, QString(), QColor(0, 0, 255, 128), QSize(200, 200));
+		const QColor c = layer2.colorAt(100, 100, 15);
+		QVERIFY(c.blue() >= 254);
+		QVERIFY(qAbs(c.alpha() - 128) <= 1);
+	}
+
+	void testSmudgeStroke()
+	{
+		Layer layer(nullptr, 0, QString(), QColor(255, 0, 0), QSize(200, 200));
+
+		Brush brush(16, 1.0, 1.0, Qt::blue);
+		brush.setSmudge(1.0);
+		brush.setSmudge2(1.0);
+
+		// With full smudging, the brush only picks up and spreads the layer color
+		StrokeState ss(brush);
+		layer.drawLine(1, brush, Point(20, 100, 1), Point(180, 100, 1), ss);
+
+		QCOMPARE(ss.smudgeColor, qRgb(255, 0, 0));
+		QCOMPARE(layer.pixelAt(100, 100), qRgb(255, 0, 0));
+	}
+
+	void benchmarkSmudge_data()
+	{
+		QTest::addColumn<int>("size");
+		QTest::newRow("4") << 4;
+		QTest::newRow("16") << 16;
+		QTest::newRow("64") << 64;
+		QTest::newRow("128") << 128;
+	}
+
+	void benchmarkSmudge()
+	{
+		QFETCH(int, size);
+
+		Layer layer(nullptr, 0, QString(), QColor(255, 255, 255), QSize(1024, 1024));
+		Brush brush(size, 0.5, 1.0, Qt::black, 10);
+		brush.setSmudge(0.8);
+		brush.setSmudge2(0.8);
+		brush.setResmudge(0);
+
+		QBENCHMARK {
+			StrokeState ss(brush);
+			layer.drawLine(1, brush, Point(100, 100, 1), Point(900, 900, 1), ss);
+		}
+	}
+};
+
+QTEST_MAIN(TestSmudge)
+#include "smudge.moc"
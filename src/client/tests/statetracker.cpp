@@ -0,0 +1,116 @@
+#include "../canvas/statetracker.h"
+#include "../canvas/layerlist.h"
+#include "../core/layerstack.h"
+#include "../../shared/net/pen.h"
+#include "../../shared/net/layer.h"
+#include "../../shared/net/undo.h"
+
+#include <QtTest/QtTest>
+
+using namespace protocol;
+using canvas::StateTracker;
+using canvas::LayerListModel;
+
+static MessagePtr toolChange(int ctx, int layer, quint32 color)
+{
+	return MessagePtr(new ToolChange(ctx, layer, paintcore::BlendMode::MODE_NORMAL, TOOL_MODE_INCREMENTAL, 25, color, 255, 255, 10, 10, 255, 255, 0, 0, 0));
+}
+
+static MessagePtr penMove(int ctx, int x0, int x1, int y)
+{
+	PenPointVector points;
+	for(int x=x0;x<=x1;x+=10)
+		points << PenPoint(x*4, y*4, 0xffff);
+	return MessagePtr(new PenMove(ctx, points));
+}
+
+static QList<MessagePtr> sessionStart()
+{
+	QList<MessagePtr> msgs;
+	msgs << MessagePtr(new CanvasResize(2, 0, 200, 200, 0));
+	msgs << MessagePtr(new LayerCreate(2, 1, 0, 0xffffffff, 0, "Background"));
+	msgs << MessagePtr(new LayerCreate(2, 2, 0, 0, 0, "Layer 2"));
+
+	// Enough messages to get a savepoint after the layers are created
+	for(int i=0;i<100;++i)
+		msgs << MessagePtr(new UndoPoint(2));
+
+	msgs << toolChange(2, 1, 0xffff0000);
+	return msgs;
+}
+
+class TestStateTracker : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testRollback_data()
+	{
+		QTest::addColumn<bool>("full");
+		QTest::addColumn<bool>("otherLayerStroke");
+
+		QTest::newRow("layer") << false << false;
+		QTest::newRow("full") << true << false;
+		QTest::newRow("layer, stroke on another layer") << false << true;
+	}
+
+	void testRollback()
+	{
+		QFETCH(bool, full);
+		QFETCH(bool, otherLayerStroke);
+
+		// The local user draws a stroke, but the server orders another
+		// user's overlapping stroke before it
+		const QList<MessagePtr> local {
+			toolChange(1, 1, 0xff0000ff),
+			penMove(1, 20, 100, 50),
+			MessagePtr(new PenUp(1))
+		};
+
+		QList<MessagePtr> remote;
+		if(full) {
+			// A layer attribute change in between rules out the single layer rollback
+			remote << MessagePtr(new LayerAttributes(2, 2, 128, paintcore::BlendMode::MODE_NORMAL));
+		}
+		remote << penMove(2, 50, 150, 55) << MessagePtr(new PenUp(2));
+
+		// A third user's smudge stroke on another layer starts before
+		// the rollback and ends after it
+		QList<MessagePtr> strokeStart, strokeEnd;
+		if(otherLayerStroke) {
+			strokeStart
+				<< MessagePtr(new ToolChange(3, 2, paintcore::BlendMode::MODE_NORMAL, TOOL_MODE_INCREMENTAL, 50, 0xff00ff00, 255, 255, 30, 30, 255, 255, 128, 128, 0))
+				<< penMove(3, 10, 95, 120);
+			strokeEnd << penMove(3, 103, 190, 120) << MessagePtr(new PenUp(3));
+		}
+
+		paintcore::LayerStack image;
+		LayerListModel layers;
+		StateTracker tracker(&image, &layers, 1);
+
+		for(const MessagePtr &msg : sessionStart() + strokeStart)
+			tracker.receiveCommand(msg);
+		for(const MessagePtr &msg : local)
+			tracker.localCommand(msg);
+		for(const MessagePtr &msg : remote)
+			tracker.receiveCommand(msg);
+		for(const MessagePtr &msg : local + strokeEnd)
+			tracker.receiveCommand(msg);
+
+		QCOMPARE(tracker.rollbackStats().partial, full ? 0 : 1);
+		QCOMPARE(tracker.rollbackStats().full, full ? 1 : 0);
+
+		// The result must be the same as replaying the session from the start
+		paintcore::LayerStack refImage;
+		LayerListModel refLayers;
+		StateTracker reference(&refImage, &refLayers, 4);
+
+		for(const MessagePtr &msg : sessionStart() + strokeStart + remote + local + strokeEnd)
+			reference.receiveCommand(msg);
+
+		QCOMPARE(image.toFlatImage(false), refImage.toFlatImage(false));
+	}
+};
+
+
+QTEST_MAIN(TestStateTracker)
+#include "statetracker.moc"
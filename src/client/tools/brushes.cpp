@@ -47,7 +47,7 @@ void Freehand::begin(const paintcore::Point& point, bool right, float zoom)
 	msgs << net::command::brushToToolChange(owner.client()->myId(), owner.activeLayer(), owner.activeBrush());
 	protocol::PenPointVector v(1);
 	v[0] = net::command::pointToProtocol(point);
-	msgs << protocol::MessagePtr(new protocol::PenMove(owner.client()->myId(), v));
+	msgs << protocol::MessagePtr(new protocol::PenMove(owner.client()->myId(), v, protocol::MSG_PEN_MOVE_DELTA));
 	owner.client()->sendMessages(msgs);
 }
 
@@ -58,7 +58,7 @@ void Freehand::motion(const paintcore::Point& point, bool constrain, bool center
 
 	protocol::PenPointVector v(1);
 	v[0] = net::command::pointToProtocol(point);
-	owner.client()->sendMessage(protocol::MessagePtr(new protocol::PenMove(owner.client()->myId(), v)));
+	owner.client()->sendMessage(protocol::MessagePtr(new protocol::PenMove(owner.client()->myId(), v, protocol::MSG_PEN_MOVE_DELTA)));
 }
 
 void Freehand::end()
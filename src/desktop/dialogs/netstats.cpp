@@ -54,6 +54,11 @@ void NetStats::setCurrentLag(int lag)
 	_ui->lagLabel->setText(QStringLiteral("%1 ms").arg(lag));
 }
 
+void NetStats::setRollbacks(int full, int partial)
+{
+	_ui->rollbackLabel->setText(tr("%1 (%2 layer only)").arg(full + partial).arg(partial));
+}
+
 void NetStats::setDisconnected()
 {
 	_ui->lagLabel->setText(tr("not connected"));
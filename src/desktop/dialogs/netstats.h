@@ -36,6 +36,7 @@ public slots:
 	void setSentBytes(int bytes);
 	void setRecvBytes(int bytes);
 	void setCurrentLag(int lag);
+	void setRollbacks(int full, int partial);
 	void setDisconnected();
 
 private:
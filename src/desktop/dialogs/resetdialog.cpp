@@ -77,10 +77,7 @@ ResetDialog::ResetDialog(const canvas::StateTracker *state, QWidget *parent)
 	connect(d->ui->btnPrev, &QToolButton::clicked, this, &ResetDialog::onPrevClick);
 	connect(d->ui->btnNext, &QToolButton::clicked, this, &ResetDialog::onNextClick);
 
-	QImage currentImage = state->image()->toFlatImage(true);
-	if(currentImage.width() > THUMBNAIL_SIZE.width() || currentImage.height() > THUMBNAIL_SIZE.height())
-		currentImage = currentImage.scaled(THUMBNAIL_SIZE, Qt::KeepAspectRatio);
-	d->thumbnails.append(QPixmap::fromImage(currentImage));
+	d->thumbnails.append(QPixmap::fromImage(state->image()->toFlatImageScaled(THUMBNAIL_SIZE, true)));
 
 	d->updateSelectionTitle();
 }
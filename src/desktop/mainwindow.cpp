@@ -444,6 +444,11 @@ void MainWindow::onCanvasChanged(canvas::CanvasModel *canvas)
 
 	connect(canvas, &canvas::CanvasModel::userJoined, m_netstatus, &widgets::NetStatus::join);
 	connect(canvas, &canvas::CanvasModel::userLeft, m_netstatus, &widgets::NetStatus::leave);
+
+	m_netstatus->setRollbackStats(0, 0);
+	connect(canvas->stateTracker(), &canvas::StateTracker::localForkRolledBack, m_netstatus, [this](const canvas::RollbackStats &stats) {
+		m_netstatus->setRollbackStats(stats.full, stats.partial);
+	});
 	connect(canvas, &canvas::CanvasModel::userJoined, m_chatbox, &widgets::ChatBox::userJoined);
 	connect(canvas, &canvas::CanvasModel::userLeft, m_chatbox, &widgets::ChatBox::userParted);
 
@@ -922,7 +927,7 @@ void MainWindow::open()
 {
 	// Get a list of supported formats
 	QString dpimages = "*.ora ";
-	QString dprecs = "*.dptxt *.dprec *.dprecz *.dprec.gz *.dptxtz *.dptxt.gz ";
+	QString dprecs = "*.dptxt *.dprec *.dprecz *.dprecb *.dprec.gz *.dptxtz *.dptxt.gz ";
 	QString formats;
 	for(QByteArray format : QImageReader::supportedImageFormats()) {
 		formats += "*." + format + " ";
@@ -1174,6 +1179,7 @@ void MainWindow::toggleRecording()
 			tr("Text Recordings (%1)").arg("*.dptxt") + ";;" +
 			tr("Compressed Binary Recordings (%1)").arg("*.dprecz") + ";;" +
 			tr("Compressed Text Recordings (%1)").arg("*.dptxtz") + ";;" +
+			tr("Block Compressed Binary Recordings (%1)").arg("*.dprecb") + ";;" +
 			QApplication::tr("All Files (*)");
 	QString file = QFileDialog::getSaveFileName(this,
 			tr("Record Session"), getLastPath(), filter);
@@ -20,15 +20,18 @@
 #include <QApplication>
 #include <QPalette>
 #include <QPainter>
+#include <QTextDocument>
+#include <QStyleOptionGraphicsItem>
 
 #include "core/layerstack.h"
+#include "core/annotationmodel.h"
 #include "scene/annotationitem.h"
 #include "../shared/net/annotation.h"
 
 namespace drawingboard {
 
 AnnotationItem::AnnotationItem(int id, QGraphicsItem *parent)
-	: QGraphicsItem(parent), m_id(id), m_valign(0), m_highlight(false), m_showborder(false)
+	: QGraphicsItem(parent), m_id(id), m_valign(0), m_textEmpty(true), m_highlight(false), m_showborder(false)
 {
 }
 
@@ -36,7 +39,6 @@ void AnnotationItem::setGeometry(const QRect &rect)
 {
 	prepareGeometryChange();
 	m_rect = rect;
-	m_doc.setTextWidth(rect.width());
 }
 
 void AnnotationItem::setColor(const QColor &color)
@@ -47,7 +49,12 @@ void AnnotationItem::setColor(const QColor &color)
 
 void AnnotationItem::setText(const QString &text)
 {
-	m_doc.setHtml(text);
+	m_text = text;
+
+	QTextDocument doc;
+	doc.setHtml(text);
+	m_textEmpty = doc.isEmpty();
+
 	update();
 }
 
@@ -88,13 +95,21 @@ QRectF AnnotationItem::boundingRect() const
 
 void AnnotationItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *options, QWidget *widget)
 {
-	Q_UNUSED(options);
 	Q_UNUSED(widget);
 
 	painter->save();
 	painter->setClipRect(boundingRect().adjusted(-1, -1, 1, 1));
 
-	painter->fillRect(m_rect, m_color);
+	// The rendered content is shared with the canvas flattening code
+	paintcore::Annotation::paintContent(
+		painter,
+		m_rect,
+		m_text,
+		m_rect.size().toSize(),
+		m_color,
+		m_valign,
+		options->levelOfDetailFromTransform(painter->worldTransform())
+	);
 
 	paintHiddenBorder(painter);
 
@@ -119,26 +134,13 @@ void AnnotationItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *op
 		painter->drawPoint(m_rect.bottomRight());
 	}
 
-	m_doc.setTextWidth(m_rect.width());
-
-	QPointF offset;
-	if(m_valign == protocol::AnnotationEdit::FLAG_VALIGN_CENTER) {
-		offset.setY((m_rect.height() - m_doc.size().height()) / 2);
-
-	} else if(m_valign == protocol::AnnotationEdit::FLAG_VALIGN_BOTTOM) {
-		offset.setY(m_rect.height() - m_doc.size().height());
-	}
-
-	painter->translate(m_rect.topLeft() + offset);
-	m_doc.drawContents(painter, QRectF(-offset, m_rect.size()));
-
 	painter->restore();
 }
 
 void AnnotationItem::paintHiddenBorder(QPainter *painter)
 {
 	// Hidden border is usually hidden
-	if(!m_showborder && !m_doc.isEmpty())
+	if(!m_showborder && !m_textEmpty)
 		return;
 
 	const qreal devicePixelRatio = qApp->devicePixelRatio();
@@ -20,7 +20,6 @@
 #define ANNOTATIONITEM_H
 
 #include <QGraphicsItem>
-#include <QTextDocument>
 
 namespace paintcore { struct Annotation; }
 
@@ -76,7 +75,8 @@ private:
 	int m_valign;
 	QRectF m_rect;
 	QColor m_color;
-	QTextDocument m_doc;
+	QString m_text;
+	bool m_textEmpty;
 
 	bool m_highlight;
 	bool m_showborder;
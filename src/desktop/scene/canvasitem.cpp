@@ -19,28 +19,100 @@
 
 #include <QPainter>
 #include <QStyleOptionGraphicsItem>
+#include <QSettings>
+#include <QTimer>
+#include <QGuiApplication>
+#include <QScreen>
 
 #include "canvasitem.h"
 
 #include "core/layerstack.h"
+#include "core/tile.h"
+#include "core/concurrent.h"
 
 namespace drawingboard {
 
+// Default tile cache size in kilobytes. Enough for a 4K screen with some margin.
+static const int DEFAULT_CACHE_SIZE = 96 * 1024;
+
+static const int TILE_COST = paintcore::Tile::BYTES / 1024;
+
+static inline quint64 tileKey(int x, int y, int lod) { return quint64(lod) << 32 | quint64(y) << 16 | quint64(x); }
+
 /**
  * @param parent use another QGraphicsItem as a parent
  * @param scene the picture to which this layer belongs to
  */
 CanvasItem::CanvasItem(paintcore::LayerStack *layerstack, QGraphicsItem *parent)
-	: QGraphicsObject(parent), m_image(layerstack)
+	: QGraphicsObject(parent), m_image(layerstack), m_xtiles(0),
+	m_refreshesDelivered(0), m_refreshesCoalesced(0)
 {
 	connect(m_image, SIGNAL(areaChanged(QRect)), this, SLOT(refreshImage(QRect)));
 	connect(m_image, SIGNAL(resized(int, int, QSize)), this, SLOT(canvasResize()));
 	setFlag(ItemUsesExtendedStyleOption);
+
+	// Changes are delivered to the view in sync with the display refresh rate
+	const QScreen *screen = QGuiApplication::primaryScreen();
+	const qreal refreshRate = screen && screen->refreshRate() > 0 ? screen->refreshRate() : 60.0;
+
+	m_refreshTimer = new QTimer(this);
+	m_refreshTimer->setSingleShot(true);
+	m_refreshTimer->setTimerType(Qt::PreciseTimer);
+	m_refreshTimer->setInterval(qMax(1, qRound(1000.0 / refreshRate)));
+	connect(m_refreshTimer, &QTimer::timeout, this, &CanvasItem::deliverRefresh);
+
+	canvasResize();
+
+	setCacheSize(QSettings().value("settings/canvascache", DEFAULT_CACHE_SIZE).toInt());
+}
+
+void CanvasItem::setCacheSize(int kilobytes)
+{
+	m_image->setMipmapCacheSize(kilobytes / 4);
+	m_tiles.setMaxCost(qMax(TILE_COST, kilobytes - kilobytes / 4));
 }
 
 void CanvasItem::refreshImage(const QRect &area)
 {
-	update(area.adjusted(-2, -2, 2, 2));
+	using paintcore::Tile;
+
+	const QRect r = area & QRect(QPoint(), m_image->size());
+	if(r.isEmpty())
+		return;
+
+	for(int ty=r.top()/Tile::SIZE;ty<=r.bottom()/Tile::SIZE;++ty) {
+		const int row = ty * m_xtiles;
+		m_dirtyTiles.fill(true, row + r.left()/Tile::SIZE, row + r.right()/Tile::SIZE + 1);
+	}
+	m_dirtyArea |= r;
+
+	if(m_refreshTimer->isActive())
+		++m_refreshesCoalesced;
+	else
+		m_refreshTimer->start();
+}
+
+void CanvasItem::deliverRefresh()
+{
+	using paintcore::Tile;
+
+	if(m_dirtyArea.isEmpty())
+		return;
+
+	// Discard the cached tiles covering the changed tiles on every level of detail
+	for(int ty=m_dirtyArea.top()/Tile::SIZE;ty<=m_dirtyArea.bottom()/Tile::SIZE;++ty) {
+		for(int tx=m_dirtyArea.left()/Tile::SIZE;tx<=m_dirtyArea.right()/Tile::SIZE;++tx) {
+			if(!m_dirtyTiles.testBit(ty * m_xtiles + tx))
+				continue;
+			for(int lod=0;lod<=paintcore::LayerStack::MAX_LOD;++lod)
+				m_tiles.remove(tileKey(tx >> lod, ty >> lod, lod));
+		}
+	}
+	m_dirtyTiles.fill(false);
+
+	update(m_dirtyArea.adjusted(-2, -2, 2, 2));
+	m_dirtyArea = QRect();
+	++m_refreshesDelivered;
 }
 
 QRectF CanvasItem::boundingRect() const
@@ -51,23 +123,69 @@ QRectF CanvasItem::boundingRect() const
 void CanvasItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
 	 QWidget *)
 {
-	if((_cache.isNull() || _cache.size() != m_image->size()) && m_image->size().isValid()) {
-		_cache = QPixmap(m_image->size());
-		_cache.fill();
+	using paintcore::Tile;
+
+	const QRect exposed = option->exposedRect.adjusted(-1, -1, 1, 1).toAlignedRect() & QRect(QPoint(), m_image->size());
+	if(exposed.isEmpty())
+		return;
+
+	// Pick the level of detail matching the current zoom, so that the tiles
+	// are never scaled down by more than half when drawn.
+	qreal scale = option->levelOfDetailFromTransform(painter->worldTransform());
+	int lod = 0;
+	while(lod < paintcore::LayerStack::MAX_LOD && scale <= 0.5) {
+		scale *= 2;
+		++lod;
+	}
+
+	const int span = Tile::SIZE << lod; // canvas pixels covered by one tile
+	const int tx0 = exposed.left() / span;
+	const int tx1 = exposed.right() / span;
+	const int ty0 = exposed.top() / span;
+	const int ty1 = exposed.bottom() / span;
+
+	struct RenderTile {
+		int x, y;
+		QImage image;
+	};
+	QList<RenderTile*> missing;
+
+	painter->save();
+	painter->setClipRect(exposed, Qt::IntersectClip);
+
+	// Draw the cached tiles first and collect the rest for rendering
+	for(int ty=ty0;ty<=ty1;++ty) {
+		for(int tx=tx0;tx<=tx1;++tx) {
+			const QImage *img = m_tiles.object(tileKey(tx, ty, lod));
+			if(img)
+				painter->drawImage(QRect(tx*span, ty*span, span, span), *img);
+			else
+				missing << new RenderTile { tx, ty, QImage() };
+		}
 	}
 
-	QRect exposed = option->exposedRect.adjusted(-1, -1, 1, 1).toAlignedRect();
-	exposed &= _cache.rect();
+	paintcore::concurrentForEach<RenderTile*>(missing, [this, lod](RenderTile *t) {
+		t->image = m_image->flatTileImage(t->x, t->y, lod);
+	});
 
-	m_image->paintChangedTiles(exposed, &_cache, true);
+	for(RenderTile *t : missing) {
+		painter->drawImage(QRect(t->x*span, t->y*span, span, span), t->image);
+		m_tiles.insert(tileKey(t->x, t->y, lod), new QImage(t->image), TILE_COST);
+		delete t;
+	}
 
-	painter->drawPixmap(exposed, _cache, exposed);
+	painter->restore();
 }
 
 void CanvasItem::canvasResize()
 {
+	using paintcore::Tile;
+
+	m_tiles.clear();
+	m_xtiles = Tile::roundTiles(m_image->width());
+	m_dirtyTiles = QBitArray(m_xtiles * Tile::roundTiles(m_image->height()));
+	m_dirtyArea = QRect();
 	prepareGeometryChange();
 }
 
 }
-
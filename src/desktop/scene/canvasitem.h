@@ -20,6 +20,11 @@
 #define DP_CANVASITEM_H
 
 #include <QGraphicsObject>
+#include <QCache>
+#include <QImage>
+#include <QBitArray>
+
+class QTimer;
 
 namespace paintcore {
 	class LayerStack;
@@ -29,6 +34,17 @@ namespace drawingboard {
 
 /**
  * @brief A graphics item that draws a LayerStack
+ *
+ * Flattened tiles are kept in a cache of limited size. Only the tiles
+ * that are actually painted get rendered, so the memory use depends on
+ * the size of the view rather than the size of the canvas.
+ *
+ * When zoomed out, tiles are rendered at a reduced level of detail
+ * matching the zoom level, so each cached tile still covers roughly
+ * 64x64 screen pixels.
+ *
+ * Change notifications from the layer stack are collected into a dirty
+ * tile bitmap and delivered to the view at most once per display frame.
  */
 class CanvasItem : public QGraphicsObject
 {
@@ -40,11 +56,28 @@ public:
 	/** reimplematation */
 	QRectF boundingRect() const;
 
+	/**
+	 * @brief Set the maximum amount of memory to use for cached tiles
+	 *
+	 * Least recently used tiles are discarded when the cache is full.
+	 * A quarter of the budget goes to the layer stack's reduced
+	 * level of detail tiles.
+	 * @param kilobytes cache size in kilobytes
+	 */
+	void setCacheSize(int kilobytes);
+
+	//! Number of consolidated view updates delivered so far
+	quint64 refreshesDelivered() const { return m_refreshesDelivered; }
+
+	//! Number of change notifications merged into an already pending update
+	quint64 refreshesCoalesced() const { return m_refreshesCoalesced; }
+
 public slots:
 	void refreshImage(const QRect &area);
 
 private slots:
 	void canvasResize();
+	void deliverRefresh();
 
 protected:
 	/** reimplementation */
@@ -52,7 +85,18 @@ protected:
 
 private:
 	paintcore::LayerStack *m_image;
-	QPixmap _cache;
+
+	// Rendered tiles. Key is (lod<<32 | y<<16 | x) and cost is the size in kilobytes
+	QCache<quint64, QImage> m_tiles;
+
+	// Changes not yet delivered to the view
+	QTimer *m_refreshTimer;
+	QBitArray m_dirtyTiles;
+	int m_xtiles;
+	QRect m_dirtyArea;
+
+	quint64 m_refreshesDelivered;
+	quint64 m_refreshesCoalesced;
 };
 
 }
@@ -127,19 +127,15 @@ void CanvasScene::onSelectionChanged(canvas::Selection *selection)
 void CanvasScene::showAnnotations(bool show)
 {
 	_showAnnotations = show;
-	for(QGraphicsItem *item : items()) {
-		if(item->type() == AnnotationItem::Type)
-			item->setVisible(show);
-	}
+	for(AnnotationItem *item : m_annotations)
+		item->setVisible(show);
 }
 
 void CanvasScene::showAnnotationBorders(bool hl)
 {
 	_showAnnotationBorders = hl;
-	for(QGraphicsItem *item : items()) {
-		if(item->type() == AnnotationItem::Type)
-			static_cast<AnnotationItem*>(item)->setShowBorder(hl);
-	}
+	for(AnnotationItem *item : m_annotations)
+		item->setShowBorder(hl);
 }
 
 void CanvasScene::handleCanvasResize(int xoffset, int yoffset, const QSize &oldsize)
@@ -159,21 +155,13 @@ void CanvasScene::handleCanvasResize(int xoffset, int yoffset, const QSize &olds
 
 AnnotationItem *CanvasScene::getAnnotationItem(int id)
 {
-	for(QGraphicsItem *i : items()) {
-		AnnotationItem *item = qgraphicsitem_cast<AnnotationItem*>(i);
-		if(item && item->id() == id)
-			return item;
-	}
-	return nullptr;
+	return m_annotations.value(id);
 }
 
 void CanvasScene::activeAnnotationChanged(int id)
 {
-	for(QGraphicsItem *i : items()) {
-		AnnotationItem *item = qgraphicsitem_cast<AnnotationItem*>(i);
-		if(item)
-			item->setHighlight(item->id() == id);
-	}
+	for(AnnotationItem *item : m_annotations)
+		item->setHighlight(item->id() == id);
 }
 
 void CanvasScene::annotationsAdded(const QModelIndex&, int first, int last)
@@ -190,6 +178,7 @@ void CanvasScene::annotationsAdded(const QModelIndex&, int first, int last)
 		item->setShowBorder(showAnnotationBorders());
 		item->setVisible(_showAnnotations);
 		addItem(item);
+		m_annotations[id] = item;
 		annotationsChanged(a, a, QVector<int>());
 	}
 }
@@ -199,7 +188,7 @@ void CanvasScene::annotationsRemoved(const QModelIndex&, int first, int last)
 	for(int i=first;i<=last;++i) {
 		const QModelIndex a = m_model->layerStack()->annotations()->index(i);
 		int id = a.data(paintcore::AnnotationModel::IdRole).toInt();
-		AnnotationItem *item = getAnnotationItem(id);
+		AnnotationItem *item = m_annotations.take(id);
 		if(item)
 			delete item;
 		else
@@ -239,11 +228,8 @@ void CanvasScene::annotationsChanged(const QModelIndex &first, const QModelIndex
 void CanvasScene::annotationsReset()
 {
 	// Clear out any old annotation items
-	for(QGraphicsItem *item : items()) {
-		if(item->type() == AnnotationItem::Type) {
-			delete item;
-		}
-	}
+	qDeleteAll(m_annotations);
+	m_annotations.clear();
 
 	if(!m_model->layerStack()->annotations()->isEmpty()) {
 		annotationsAdded(QModelIndex(), 0, m_model->layerStack()->annotations()->rowCount()-1);
@@ -127,6 +127,9 @@ private:
 
 	canvas::CanvasModel *m_model;
 
+	//! Annotation items
+	QHash<int, AnnotationItem*> m_annotations;
+
 	//! Laser pointer trails
 	QHash<int, LaserTrailItem*> m_lasertrails;
 
@@ -42,7 +42,8 @@
 namespace widgets {
 
 NetStatus::NetStatus(QWidget *parent)
-	: QWidget(parent), m_state(NotConnected), _sentbytes(0), _recvbytes(0), _lag(0)
+	: QWidget(parent), m_state(NotConnected), _sentbytes(0), _recvbytes(0), _lag(0),
+	  m_fullRollbacks(0), m_partialRollbacks(0)
 {
 	setMinimumHeight(16+2);
 
@@ -307,6 +308,14 @@ void NetStatus::lagMeasured(qint64 lag)
 		_netstats->setCurrentLag(lag);
 }
 
+void NetStatus::setRollbackStats(int full, int partial)
+{
+	m_fullRollbacks = full;
+	m_partialRollbacks = partial;
+	if(_netstats)
+		_netstats->setRollbacks(full, partial);
+}
+
 /**
  * Copy the current address to clipboard.
  * Should not be called if disconnected.
@@ -438,6 +447,7 @@ void NetStatus::showNetStats()
 		_netstats->setSentBytes(_sentbytes);
 		if(!m_address.isEmpty())
 			_netstats->setCurrentLag(_lag);
+		_netstats->setRollbacks(m_fullRollbacks, m_partialRollbacks);
 	}
 	_netstats->show();
 }
@@ -64,6 +64,9 @@ public slots:
 
 	void lagMeasured(qint64 lag);
 
+	//! Update the number of canvas rollbacks shown in the statistics
+	void setRollbackStats(int full, int partial);
+
 	//! Show the message in the balloon popup if alert is true
 	void alertMessage(const QString &msg, bool alert);
 
@@ -123,6 +126,7 @@ private:
 	QAction *_discoverIp;
 
 	quint64 _sentbytes, _recvbytes, _lag;
+	int m_fullRollbacks, m_partialRollbacks;
 
 	QSslCertificate m_certificate;
 };
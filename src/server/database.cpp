@@ -40,6 +40,7 @@ namespace server {
 struct Database::Private {
 	QSqlDatabase db;
 	ServerLog *logger;
+	QString path;
 };
 
 static bool initDatabase(QSqlDatabase db)
@@ -107,6 +108,14 @@ bool Database::openFile(const QString &path)
 		qCritical("Unable to open database: %s", qPrintable(path));
 		return false;
 	}
+	d->path = path;
+
+	// In WAL mode, readers (such as the web admin's read-only connection)
+	// and the writer don't block each other.
+	// (An in-memory database stays in "memory" mode, but it has no other readers.)
+	QSqlQuery walQuery(d->db);
+	if(!walQuery.exec("PRAGMA journal_mode=WAL"))
+		qWarning("Unable to enable write-ahead logging: %s", qPrintable(walQuery.lastError().text()));
 
 	if(!initDatabase(d->db)) {
 		qCritical("Database initialization failed: %s", qPrintable(path));
@@ -217,10 +226,18 @@ static QJsonObject banResultToJson(const QSqlQuery &q)
 }
 
 QJsonArray Database::getBanlist() const
+{
+	return getBanlist(d->db, 0, 0);
+}
+
+QJsonArray Database::getBanlist(const QSqlDatabase &db, int afterId, int limit)
 {
 	QJsonArray result;
-	QSqlQuery q(d->db);
-	q.exec("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans");
+	QSqlQuery q(db);
+	q.prepare("SELECT rowid, ip, subnet, expires, comment, added FROM ipbans WHERE rowid>? ORDER BY rowid LIMIT ?");
+	q.bindValue(0, afterId);
+	q.bindValue(1, limit>0 ? limit : -1);
+	q.exec();
 
 	while(q.next()) {
 		result.append(banResultToJson(q));
@@ -276,7 +293,23 @@ ServerLog *Database::logger() const
 	return d->logger;
 }
 
-RegisteredUser Database::getUserAccount(const QString &username, const QString &password) const
+QSqlDatabase Database::openReadOnlyConnection(const QString &connectionName) const
+{
+	if(d->path.isEmpty())
+		return QSqlDatabase();
+
+	QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+	db.setDatabaseName(d->path);
+	db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=1000");
+	if(!db.open()) {
+		qWarning("Unable to open read-only database connection: %s", qPrintable(d->path));
+		return QSqlDatabase();
+	}
+
+	return db;
+}
+
+RegisteredUser Database::findUserAccount(const QString &username) const
 {
 	QSqlQuery q(d->db);
 	q.prepare("SELECT password, locked, flags FROM users WHERE username=?");
@@ -295,18 +328,11 @@ RegisteredUser Database::getUserAccount(const QString &username, const QString &
 			};
 		}
 
-		if(!passwordhash::check(password, passwordHash)) {
-			return RegisteredUser {
-				RegisteredUser::BadPass,
-				username,
-				QStringList()
-			};
-		}
-
 		return RegisteredUser {
 			RegisteredUser::Ok,
 			username,
-			flags
+			flags,
+			passwordHash
 		};
 	} else {
 		return RegisteredUser {
@@ -328,10 +354,18 @@ static QJsonObject userQueryToJson(const QSqlQuery &q)
 }
 
 QJsonArray Database::getAccountList() const
+{
+	return getAccountList(d->db, 0, 0);
+}
+
+QJsonArray Database::getAccountList(const QSqlDatabase &db, int afterId, int limit)
 {
 	QJsonArray list;
-	QSqlQuery q(d->db);
-	q.exec("SELECT rowid, username, locked, flags FROM users");
+	QSqlQuery q(db);
+	q.prepare("SELECT rowid, username, locked, flags FROM users WHERE rowid>? ORDER BY rowid LIMIT ?");
+	q.bindValue(0, afterId);
+	q.bindValue(1, limit>0 ? limit : -1);
+	q.exec();
 	while(q.next()) {
 		list << userQueryToJson(q);
 	}
@@ -22,6 +22,8 @@
 
 #include "../shared/server/serverconfig.h"
 
+class QSqlDatabase;
+
 namespace server {
 
 /**
@@ -40,16 +42,40 @@ public:
 
 	bool isAllowedAnnouncementUrl(const QUrl &url) const override;
 	bool isAddressBanned(const QHostAddress &addr) const override;
-	RegisteredUser getUserAccount(const QString &username, const QString &password) const override;
+	RegisteredUser findUserAccount(const QString &username) const override;
 	ServerLog *logger() const override;
 
+	/**
+	 * @brief Open a new read-only connection to the database file
+	 *
+	 * The connection belongs to the calling thread. This lets another thread
+	 * run (potentially slow) listing queries without blocking the main connection:
+	 * the database is in WAL mode, so an open read transaction does not make
+	 * the main connection's writes wait.
+	 *
+	 * @param connectionName unique name of the connection
+	 * @return an invalid connection if the database file could not be opened
+	 */
+	QSqlDatabase openReadOnlyConnection(const QString &connectionName) const;
+
 	//! Get a JSON representation of the full banlist
 	QJsonArray getBanlist() const;
+
+	/**
+	 * @brief Get a page of banlist entries using the given connection
+	 *
+	 * @param afterId return entries whose ID is greater than this
+	 * @param limit maximum number of entries to return (0 for unlimited)
+	 */
+	static QJsonArray getBanlist(const QSqlDatabase &db, int afterId, int limit);
 	QJsonObject addBan(const QHostAddress &ip, int subnet,	const QDateTime &expiration, const QString &comment);
 	bool deleteBan(int entryId);
 
 	//! Get a JSON representation of registered user accounts
 	QJsonArray getAccountList() const;
+
+	//! Get a page of user accounts using the given connection (see getBanlist)
+	static QJsonArray getAccountList(const QSqlDatabase &db, int afterId, int limit);
 	QJsonObject addAccount(const QString &username, const QString &password, bool locked, const QStringList &flags);
 	QJsonObject updateAccount(int id, const QJsonObject &update);
 	bool deleteAccount(int id);
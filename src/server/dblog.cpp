@@ -40,10 +40,8 @@ bool DbLog::initDb()
 	);
 }
 
-QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const
+static void appendFilters(QString &sql, QVariantList &params, const QUuid &session, const QDateTime &after, Log::Level atleast)
 {
-	QString sql = "SELECT timestamp, session, user, level, topic, message FROM serverlog WHERE 1=1";
-	QVariantList params;
 	if(!session.isNull()) {
 		sql += " AND session=?";
 		params << session.toString();
@@ -57,6 +55,39 @@ QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Lo
 		sql += " AND level<=?";
 		params << int(atleast);
 	}
+}
+
+static Log logFromQuery(const QSqlQuery &q)
+{
+	return Log(
+		q.value(0).toDateTime(),
+		QUuid(q.value(1).toString()),
+		q.value(2).toString(),
+		Log::Level(q.value(3).toInt()),
+		Log::Topic(QMetaEnum::fromType<Log::Topic>().keyToValue(q.value(4).toString().toLocal8Bit().constData())),
+		q.value(5).toString()
+	);
+}
+
+static bool execQuery(QSqlQuery &q, const QString &sql, const QVariantList &params)
+{
+	q.prepare(sql);
+	for(int i=0;i<params.size();++i)
+		q.bindValue(i, params.at(i));
+
+	if(!q.exec()) {
+		qDebug("exec: %s", qPrintable(q.executedQuery()));
+		qWarning("Database log query error: %s", qPrintable(q.lastError().text()));
+		return false;
+	}
+	return true;
+}
+
+QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const
+{
+	QString sql = "SELECT timestamp, session, user, level, topic, message FROM serverlog WHERE 1=1";
+	QVariantList params;
+	appendFilters(sql, params, session, after, atleast);
 
 	sql += " ORDER BY timestamp DESC, rowid DESC";
 
@@ -70,26 +101,50 @@ QList<Log> DbLog::getLogEntries(const QUuid &session, const QDateTime &after, Lo
 	}
 
 	QSqlQuery q(m_db);
-	q.prepare(sql);
-	for(int i=0;i<params.size();++i)
-		q.bindValue(i, params.at(i));
+	execQuery(q, sql, params);
 
-	if(!q.exec()) {
-		qDebug("exec: %s", qPrintable(q.executedQuery()));
-		qWarning("Database log query error: %s", qPrintable(q.lastError().text()));
+	QList<Log> results;
+	while(q.next()) {
+		results << logFromQuery(q);
 	}
+	return results;
+}
+
+QList<Log> DbLog::getLogPage(const QUuid &session, const QDateTime &after, Log::Level atleast, const QString &cursor, int limit, QString *nextCursor) const
+{
+	Q_ASSERT(limit>0);
+	Q_ASSERT(nextCursor);
+
+	QString sql = "SELECT timestamp, session, user, level, topic, message, rowid FROM serverlog WHERE 1=1";
+	QVariantList params;
+	appendFilters(sql, params, session, after, atleast);
+
+	// The cursor is the timestamp and row ID of the last entry of the previous page
+	if(!cursor.isEmpty()) {
+		const int sep = cursor.lastIndexOf('/');
+		bool ok = sep>0;
+		const qint64 rowid = ok ? cursor.midRef(sep+1).toLongLong(&ok) : 0;
+		if(ok) {
+			const QString timestamp = cursor.left(sep);
+			sql += " AND (timestamp<? OR (timestamp=? AND rowid<?))";
+			params << timestamp << timestamp << rowid;
+		}
+	}
+
+	sql += " ORDER BY timestamp DESC, rowid DESC LIMIT ?";
+	params << limit;
+
+	QSqlQuery q(m_db);
+	execQuery(q, sql, params);
 
 	QList<Log> results;
+	QString last;
 	while(q.next()) {
-		results << Log(
-			q.value(0).toDateTime(),
-			QUuid(q.value(1).toString()),
-			q.value(2).toString(),
-			Log::Level(q.value(3).toInt()),
-			Log::Topic(QMetaEnum::fromType<Log::Topic>().keyToValue(q.value(4).toString().toLocal8Bit().constData())),
-			q.value(5).toString()
-		);
+		results << logFromQuery(q);
+		last = q.value(0).toString() + '/' + q.value(6).toString();
 	}
+
+	*nextCursor = results.size() < limit ? QString() : last;
 	return results;
 }
 
@@ -35,6 +35,17 @@ public:
 
 	QList<Log> getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const override;
 
+	/**
+	 * @brief Get a page of log entries, newest first
+	 *
+	 * Unlike offset based paging, cursors stay valid when new entries are logged.
+	 *
+	 * @param cursor return entries older than this (empty to start from the newest entry)
+	 * @param limit maximum number of entries to return
+	 * @param nextCursor the cursor of the next page, or an empty string if this was the last page
+	 */
+	QList<Log> getLogPage(const QUuid &session, const QDateTime &after, Log::Level atleast, const QString &cursor, int limit, QString *nextCursor) const;
+
 	/**
 	 * @brief Delete all log entries older than the given number of days
 	 * @param olderThanDays
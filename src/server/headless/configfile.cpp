@@ -194,7 +194,7 @@ bool ConfigFile::isAllowedAnnouncementUrl(const QUrl &url) const
 	return m_announcewhitelist.contains(url);
 }
 
-RegisteredUser ConfigFile::getUserAccount(const QString &username, const QString &password) const
+RegisteredUser ConfigFile::findUserAccount(const QString &username) const
 {
 	if(m_users.contains(username)) {
 		const User &u = m_users[username];
@@ -205,17 +205,12 @@ RegisteredUser ConfigFile::getUserAccount(const QString &username, const QString
 				QStringList()
 			};
 
-		} else if(!passwordhash::check(password, u.password)) {
-			return RegisteredUser {
-				RegisteredUser::BadPass,
-				username,
-				QStringList()
-			};
 		} else {
 			return RegisteredUser {
 				RegisteredUser::Ok,
 				username,
-				u.flags
+				u.flags,
+				u.password
 			};
 		}
 
@@ -60,7 +60,7 @@ public:
 
 	bool isAllowedAnnouncementUrl(const QUrl &url) const override;
 	bool isAddressBanned(const QHostAddress &addr) const override;
-	RegisteredUser getUserAccount(const QString &username, const QString &password) const override;
+	RegisteredUser findUserAccount(const QString &username) const override;
 
 	ServerLog *logger() const override { return m_logger; }
 
@@ -0,0 +1,51 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jsonapisnapshot.h"
+
+#include <QMutexLocker>
+
+namespace server {
+
+void JsonApiSnapshot::update(const QString &resource, const QJsonDocument &doc)
+{
+	QMutexLocker lock(&m_mutex);
+	Resource &r = m_resources[resource];
+	r.doc = doc;
+	r.age.start();
+}
+
+bool JsonApiSnapshot::get(const QString &resource, qint64 maxAge, QJsonDocument *doc) const
+{
+	QMutexLocker lock(&m_mutex);
+	const auto i = m_resources.constFind(resource);
+	if(i == m_resources.constEnd() || i.value().age.hasExpired(maxAge))
+		return false;
+
+	*doc = i.value().doc;
+	return true;
+}
+
+void JsonApiSnapshot::invalidate()
+{
+	QMutexLocker lock(&m_mutex);
+	m_resources.clear();
+}
+
+}
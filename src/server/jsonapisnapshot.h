@@ -0,0 +1,68 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DP_SERVER_JSONAPISNAPSHOT_H
+#define DP_SERVER_JSONAPISNAPSHOT_H
+
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHash>
+
+namespace server {
+
+/**
+ * @brief A thread safe cache of frequently polled JSON API resources
+ *
+ * The web admin thread answers repeated listing queries from here instead
+ * of waiting for the main event loop every time. A resource is fetched from
+ * the main thread again only when someone asks for it and the cached copy
+ * has gone stale or was invalidated by a change made through the API.
+ * Resources are identified by their API path (e.g. "sessions").
+ */
+class JsonApiSnapshot
+{
+public:
+	//! Replace the content of a resource
+	void update(const QString &resource, const QJsonDocument &doc);
+
+	/**
+	 * @brief Get the content of a resource
+	 *
+	 * @param maxAge maximum age of the copy in milliseconds
+	 * @return false if the resource hasn't been snapshotted yet or the copy is too old
+	 */
+	bool get(const QString &resource, qint64 maxAge, QJsonDocument *doc) const;
+
+	//! Drop all copies, so the next request gets fresh content
+	void invalidate();
+
+private:
+	struct Resource {
+		QJsonDocument doc;
+		QElapsedTimer age;
+	};
+
+	mutable QMutex m_mutex;
+	QHash<QString, Resource> m_resources;
+};
+
+}
+
+#endif
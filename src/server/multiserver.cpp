@@ -28,6 +28,8 @@
 #include "../shared/server/client.h"
 #include "../shared/server/serverconfig.h"
 #include "../shared/server/serverlog.h"
+#include "../shared/server/credentialverifier.h"
+#include "../shared/server/metrics.h"
 
 #include "../shared/util/announcementapi.h"
 
@@ -37,6 +39,7 @@
 #include <QDir>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QTimer>
 
 namespace server {
 
@@ -46,7 +49,8 @@ MultiServer::MultiServer(ServerConfig *config, QObject *parent)
 	m_server(nullptr),
 	m_state(STOPPED),
 	m_autoStop(false),
-	m_port(0)
+	m_port(0),
+	m_metricsTimer(nullptr)
 {
 	m_sessions = new SessionServer(config, this);
 	m_started = QDateTime::currentDateTimeUtc();
@@ -344,6 +348,58 @@ JsonApiResult MultiServer::callJsonApi(JsonApiMethod method, const QStringList &
 	return JsonApiNotFound();
 }
 
+void MultiServer::startMetricsSampling(int interval)
+{
+	if(!m_metricsTimer) {
+		m_metricsTimer = new QTimer(this);
+		m_metricsTimer->setTimerType(Qt::PreciseTimer);
+		connect(m_metricsTimer, &QTimer::timeout, this, &MultiServer::updateMetrics);
+	}
+
+	m_metricsTick.start();
+	m_metricsTimer->start(interval);
+}
+
+/**
+ * @brief Sample the metrics that are not tracked continuously
+ *
+ * This runs on a timer, so how late the timer fires
+ * is also a measure of how busy the main event loop is.
+ */
+void MultiServer::updateMetrics()
+{
+	ServerMetrics &metrics = ServerMetrics::instance();
+
+	const qint64 lag = m_metricsTick.restart() - m_metricsTimer->interval();
+	metrics.eventLoopLag.observe(qMax(qint64(0), lag) * 1000);
+
+	metrics.sessions.set(m_sessions->sessionCount());
+	metrics.users.set(m_sessions->totalUsers());
+
+	qint64 queued = 0;
+	int queuedMax = 0;
+	QVector<ServerMetrics::SessionTraffic> traffic;
+	traffic.reserve(m_sessions->sessions().size());
+
+	for(const Session *s : m_sessions->sessions()) {
+		for(const Client *c : s->clients()) {
+			const int q = c->uploadQueueBytes();
+			queued += q;
+			queuedMax = qMax(queuedMax, q);
+		}
+		traffic << ServerMetrics::SessionTraffic {
+			s->idString(),
+			s->bytesReceived(),
+			s->bytesSent(),
+			s->userCount()
+		};
+	}
+
+	metrics.uploadQueueBytes.set(queued);
+	metrics.uploadQueueBytesMax.set(queuedMax);
+	metrics.setSessionTraffic(traffic);
+}
+
 void MultiServer::callJsonApiAsync(const QString &requestId, JsonApiMethod method, const QStringList &path, const QJsonObject &request)
 {
 	JsonApiResult result = callJsonApi(method, path, request);
@@ -430,6 +486,16 @@ JsonApiResult MultiServer::statusJsonApi(JsonApiMethod method, const QStringList
 	result["maxSessions"] = m_config->getConfigInt(config::SessionCountLimit);
 	result["users"] = m_sessions->totalUsers();
 
+	const CredentialVerifier::Stats verifier = m_sessions->credentialVerifier()->stats();
+	QJsonObject login;
+	login["queued"] = verifier.queued;
+	login["running"] = verifier.running;
+	login["completed"] = double(verifier.completed);
+	login["overloaded"] = double(verifier.overloaded);
+	login["averageLatency"] = double(verifier.averageLatency);
+	login["maxLatency"] = double(verifier.maxLatency);
+	result["loginVerification"] = login;
+
 	return JsonApiResult { JsonApiResult::Ok, QJsonDocument(result) };
 }
 
@@ -23,9 +23,11 @@
 #include <QObject>
 #include <QHostAddress>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include "../shared/server/jsonapi.h"
 
 class QTcpServer;
+class QTimer;
 class QDir;
 
 namespace server {
@@ -69,6 +71,16 @@ public:
 
 	ServerConfig *config() { return m_config; }
 
+	/**
+	 * @brief Start periodically sampling the server metrics gauges
+	 *
+	 * Session and user counts, upload queue lengths and per-session traffic
+	 * are copied into ServerMetrics in the main thread at the given interval.
+	 *
+	 * @param interval sampling interval in milliseconds
+	 */
+	void startMetricsSampling(int interval);
+
 public slots:
 	//! Start the server on the given port and listening address
 	bool start(quint16 port, const QHostAddress& address = QHostAddress::Any);
@@ -98,6 +110,7 @@ private slots:
 	void printStatusUpdate();
 	void tryAutoStop();
 	void assignRecording(Session *session);
+	void updateMetrics();
 
 signals:
 	void serverStartError(const QString &message);
@@ -131,6 +144,9 @@ private:
 	QString m_recordingPath;
 
 	QDateTime m_started;
+
+	QTimer *m_metricsTimer;
+	QElapsedTimer m_metricsTick;
 };
 
 }
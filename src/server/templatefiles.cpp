@@ -24,13 +24,14 @@
 
 #include <QJsonArray>
 #include <QFileSystemWatcher>
+#include <QFileInfo>
 
 namespace server {
 
 TemplateFiles::TemplateFiles(const QDir &dir, QObject *parent)
-	: QObject(parent), m_dir(dir)
+	: QObject(parent), m_dir(dir), m_revision(0)
 {
-	m_dir.setNameFilters(QStringList() << "*.dprec" << "*.dptxt" << "*.dprecz" << "*.dptxtz" << "*.dprec.*" << "*.dptxt.*");
+	m_dir.setNameFilters(QStringList() << "*.dprec" << "*.dptxt" << "*.dprecz" << "*.dptxtz" << "*.dprecb" << "*.dptxtb" << "*.dprec.*" << "*.dptxt.*");
 	m_watcher = new QFileSystemWatcher(QStringList() << dir.absolutePath(), this);
 	connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &TemplateFiles::scanDirectory);
 
@@ -62,7 +63,17 @@ void TemplateFiles::scanDirectory()
 		}
 	}
 
+	// Drop decoded content of removed and modified templates
+	auto i = m_decoded.begin();
+	while(i != m_decoded.end()) {
+		if(!templates.contains(i.key()) || templates[i.key()].lastmod != i.value().lastmod)
+			i = m_decoded.erase(i);
+		else
+			++i;
+	}
+
 	m_templates = templates;
+	++m_revision;
 }
 
 QJsonArray TemplateFiles::templateDescriptions() const
@@ -110,47 +121,38 @@ bool TemplateFiles::exists(const QString &alias) const
 	return m_templates.contains(alias) && !m_templates[alias].description.isEmpty();
 }
 
-bool TemplateFiles::init(SessionHistory *session) const
+const TemplateFiles::DecodedTemplate *TemplateFiles::decodedTemplate(const QString &alias) const
 {
-	if(!m_templates.contains(session->idAlias()))
-		return false;
+	if(!m_templates.contains(alias))
+		return nullptr;
 
-	recording::Reader reader(m_templates[session->idAlias()].filename);
-	if(reader.open() != recording::COMPATIBLE) {
-		qWarning("%s: template not compatible", qPrintable(m_templates[session->idAlias()].filename));
-		return false;
-	}
+	// The directory watcher may not have noticed a change yet, so check the file itself too
+	const Template &t = m_templates[alias];
+	const QDateTime lastmod = QFileInfo(t.filename).lastModified();
 
-	// Set session metadata
-	Q_ASSERT(protocol::ProtocolVersion::fromString(reader.metadata().value("version").toString()) == session->protocolVersion());
-	session->setMaxUsers(reader.metadata().value("maxUserCount").toInt(25));
-	session->setPasswordHash(reader.metadata().value("password").toString().toUtf8());
-	session->setOpwordHash(reader.metadata().value("opword").toString().toUtf8());
-	session->setTitle(reader.metadata().value("title").toString());
-
-	if(reader.metadata().contains("announce")) {
-		session->addAnnouncement(reader.metadata()["announce"].toString());
+	auto cached = m_decoded.constFind(alias);
+	if(cached != m_decoded.constEnd() && cached.value().lastmod == lastmod)
+		return &cached.value();
+
+	recording::Reader reader(t.filename);
+	if(reader.open() != recording::COMPATIBLE) {
+		qWarning("%s: template not compatible", qPrintable(t.filename));
+		m_decoded.remove(alias);
+		return nullptr;
 	}
 
-	SessionHistory::Flags flags;
-	if(reader.metadata().value("nsfm").toBool())
-		flags |= SessionHistory::Nsfm;
-	if(reader.metadata().value("persistent").toBool())
-		flags |= SessionHistory::Persistent;
-	if(reader.metadata().value("preserveChat").toBool())
-		flags |= SessionHistory::PreserveChat;
-	session->setFlags(flags);
+	DecodedTemplate decoded { lastmod, reader.metadata(), QList<protocol::MessagePtr>(), 0 };
 
-	// Set initial history
 	bool keepReading=true;
 	do {
 		recording::MessageRecord r = reader.readNext();
 		switch(r.status) {
 		case recording::MessageRecord::OK:
-			session->addMessage(protocol::MessagePtr(r.message));
+			decoded.history << protocol::MessagePtr(r.message);
+			decoded.size += r.message->length();
 			break;
 		case recording::MessageRecord::INVALID:
-			qWarning("%s: Invalid message (type %d, len %d) in template!", qPrintable(session->idAlias()), r.error.type, r.error.len);
+			qWarning("%s: Invalid message (type %d, len %d) in template!", qPrintable(alias), r.error.type, r.error.len);
 			break;
 		case recording::MessageRecord::END_OF_RECORDING:
 			keepReading = false;
@@ -158,8 +160,47 @@ bool TemplateFiles::init(SessionHistory *session) const
 		}
 	} while(keepReading);
 
-	return true;
+	qDebug("%s: template decoded (%d messages)", qPrintable(t.filename), decoded.history.size());
+
+	return &(m_decoded[alias] = decoded);
 }
 
+bool TemplateFiles::init(SessionHistory *session) const
+{
+	const DecodedTemplate *tpl = decodedTemplate(session->idAlias());
+	if(!tpl)
+		return false;
+
+	const QJsonObject &metadata = tpl->metadata;
+
+	// Set session metadata
+	Q_ASSERT(protocol::ProtocolVersion::fromString(metadata.value("version").toString()) == session->protocolVersion());
+	session->setMaxUsers(metadata.value("maxUserCount").toInt(25));
+	session->setPasswordHash(metadata.value("password").toString().toUtf8());
+	session->setOpwordHash(metadata.value("opword").toString().toUtf8());
+	session->setTitle(metadata.value("title").toString());
+
+	if(metadata.contains("announce")) {
+		session->addAnnouncement(metadata["announce"].toString());
+	}
+
+	SessionHistory::Flags flags;
+	if(metadata.value("nsfm").toBool())
+		flags |= SessionHistory::Nsfm;
+	if(metadata.value("persistent").toBool())
+		flags |= SessionHistory::Persistent;
+	if(metadata.value("preserveChat").toBool())
+		flags |= SessionHistory::PreserveChat;
+	session->setFlags(flags);
+
+	// Set initial history. The decoded messages are shared with every other
+	// session instantiated from this template.
+	if(!session->reset(tpl->history)) {
+		qWarning("%s: template (%u bytes) does not fit in the session size limit", qPrintable(session->idAlias()), tpl->size);
+		return false;
+	}
+
+	return true;
 }
 
+}
@@ -21,6 +21,7 @@
 #define DP_SERVER_TEMPLATEFILES_H
 
 #include "../shared/server/templateloader.h"
+#include "../shared/net/message.h"
 
 #include <QObject>
 #include <QDir>
@@ -39,6 +40,7 @@ public:
 	QJsonArray templateDescriptions() const override;
 	QJsonObject templateDescription(const QString &alias) const override;
 	bool exists(const QString &alias) const override;
+	int revision() const override { return m_revision; }
 
 	bool init(SessionHistory *session) const override;
 
@@ -54,9 +56,27 @@ private:
 		QDateTime lastmod;
 	};
 
+	/**
+	 * Decoded template content.
+	 *
+	 * The messages are immutable, so every session instantiated from the
+	 * same template shares them. The history list itself is implicitly shared
+	 * until a session adds to or resets its history.
+	 */
+	struct DecodedTemplate {
+		QDateTime lastmod;
+		QJsonObject metadata;
+		QList<protocol::MessagePtr> history;
+		uint size;
+	};
+
+	const DecodedTemplate *decodedTemplate(const QString &alias) const;
+
 	QHash<QString,Template> m_templates;
+	mutable QHash<QString,DecodedTemplate> m_decoded;
 	QFileSystemWatcher *m_watcher;
 	QDir m_dir;
+	int m_revision;
 };
 
 }
@@ -2,6 +2,9 @@
 #include "../dblog.h"
 
 #include <QtTest/QtTest>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTemporaryDir>
 
 using server::Database;
 using server::DbLog;
@@ -45,6 +48,73 @@ private slots:
 		QCOMPARE(logEntryCount(), 1);
 	}
 
+	void testLogPaging()
+	{
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+
+		// Entries with identical timestamps must not be skipped or repeated
+		for(int i=0;i<5;++i)
+			logger->logMessage(Log(now.addDays(-1), QUuid(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+		for(int i=5;i<8;++i)
+			logger->logMessage(Log(now.addSecs(i), QUuid(), "test", Log::Level::Info, Log::Topic::Status, QString::number(i)));
+
+		QStringList messages;
+		QString cursor;
+		int pages = 0;
+		do {
+			const QList<Log> page = logger->getLogPage(QUuid(), QDateTime(), Log::Level::Debug, cursor, 3, &cursor);
+			QVERIFY(page.size() <= 3);
+			for(const Log &l : page)
+				messages << l.message();
+			++pages;
+		} while(!cursor.isEmpty());
+
+		QCOMPARE(pages, 3);
+
+		// Newest first; entries with the same timestamp in reverse insertion order
+		QCOMPARE(messages, QStringList() << "7" << "6" << "5" << "4" << "3" << "2" << "1" << "0");
+
+		// A new entry doesn't shift the pages after it
+		const QList<Log> first = logger->getLogPage(QUuid(), QDateTime(), Log::Level::Debug, QString(), 3, &cursor);
+		logger->logMessage(Log(now.addSecs(10), QUuid(), "test", Log::Level::Info, Log::Topic::Status, "new"));
+		const QList<Log> second = logger->getLogPage(QUuid(), QDateTime(), Log::Level::Debug, cursor, 3, &cursor);
+		QCOMPARE(first.last().message(), QString("5"));
+		QCOMPARE(second.first().message(), QString("4"));
+	}
+
+	void testReaderDoesNotBlockWriter()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+
+		m_db.reset(new Database);
+		QVERIFY(m_db->openFile(dir.filePath("test.db")));
+		logger = dynamic_cast<DbLog*>(m_db->logger());
+		QVERIFY(logger);
+		logger->setSilent(true);
+
+		const QDateTime now = QDateTime::currentDateTimeUtc();
+		logger->logMessage(Log(now, QUuid(), "test", Log::Level::Info, Log::Topic::Status, "first"));
+
+		{
+			QSqlDatabase readDb = m_db->openReadOnlyConnection("testreader");
+			QVERIFY(readDb.isOpen());
+
+			// A SELECT that has not been stepped to the end keeps its read transaction open
+			QSqlQuery q(readDb);
+			QVERIFY(q.exec("SELECT message FROM serverlog"));
+			QVERIFY(q.next());
+
+			// With a rollback journal, this would wait for the busy timeout and then fail
+			QElapsedTimer timer;
+			timer.start();
+			logger->logMessage(Log(now, QUuid(), "test", Log::Level::Info, Log::Topic::Status, "second"));
+			QVERIFY(timer.elapsed() < 1000);
+			QCOMPARE(logEntryCount(), 2);
+		}
+		QSqlDatabase::removeDatabase("testreader");
+	}
+
 private:
 	int logEntryCount()
 	{
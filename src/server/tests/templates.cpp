@@ -71,6 +71,42 @@ private slots:
 		QCOMPARE(msgs.at(1)->type(), protocol::MSG_LAYER_CREATE);
 	}
 
+	void testSharedTemplateHistory()
+	{
+		QTemporaryDir tempDir;
+		QVERIFY(tempDir.isValid());
+		QDir dir(tempDir.path());
+		QVERIFY(QFile(":test/test.dptxt").copy(dir.absoluteFilePath("test.dptxt")));
+
+		TemplateFiles templates(dir);
+		const auto version = protocol::ProtocolVersion::fromString(templates.templateDescription("test").value("protocol").toString());
+
+		InMemoryHistory history1(QUuid::createUuid(), "test", version, "tester");
+		InMemoryHistory history2(QUuid::createUuid(), "test", version, "tester");
+		QVERIFY(templates.init(&history1));
+		QVERIFY(templates.init(&history2));
+
+		// Both sessions should share the same decoded messages
+		QList<protocol::MessagePtr> msgs1, msgs2;
+		int last;
+		std::tie(msgs1, last) = history1.getBatch(-1);
+		std::tie(msgs2, last) = history2.getBatch(-1);
+
+		QCOMPARE(msgs1.size(), 2);
+		QCOMPARE(msgs2.size(), 2);
+		QCOMPARE(&(*msgs1.at(0)), &(*msgs2.at(0)));
+		QCOMPARE(&(*msgs1.at(1)), &(*msgs2.at(1)));
+		QCOMPARE(history1.sizeInBytes(), history2.sizeInBytes());
+		QCOMPARE(history1.lastIndex(), 1);
+
+		// Adding to one session's history must not affect the other
+		QVERIFY(history1.addMessage(msgs1.at(0)));
+		QCOMPARE(history1.lastIndex(), 2);
+		QCOMPARE(history2.lastIndex(), 1);
+		std::tie(msgs2, last) = history2.getBatch(-1);
+		QCOMPARE(msgs2.size(), 2);
+	}
+
 private:
 	bool touch(const QString &path)
 	{
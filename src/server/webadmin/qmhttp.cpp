@@ -25,6 +25,7 @@
 #include <QJsonObject>
 #include <QUrl>
 #include <QDateTime>
+#include <QStringList>
 
 #include <microhttpd.h>
 
@@ -63,6 +64,9 @@ struct MicroHttpd::Private {
 
 namespace {
 
+// Responses larger than this are compressed if the client supports it
+static const int COMPRESS_THRESHOLD = 1024;
+
 struct RequestContext {
 	HttpRequest request;
 	HttpRequestHandler reqhandler;
@@ -90,6 +94,40 @@ static void logMessage(MHD_Connection *connection, int statusCode, const char *m
 			statusCode, qPrintable(clientAddress.toString()), method, url);
 }
 
+static bool acceptsDeflate(MHD_Connection *connection)
+{
+	const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+	if(!accept)
+		return false;
+
+	for(const QString &enc : QString::fromLatin1(accept).split(',')) {
+		const QStringList params = enc.split(';');
+		if(params.first().trimmed().compare("deflate", Qt::CaseInsensitive) != 0)
+			continue;
+
+		// "deflate;q=0" means the encoding is explicitly not acceptable
+		for(int i=1;i<params.size();++i) {
+			const QString p = params.at(i).trimmed();
+			if(p.startsWith("q=") && p.midRef(2).toDouble() <= 0)
+				return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+static void compressResponse(HttpResponse &response)
+{
+	// qCompress produces a zlib stream prefixed with the uncompressed length.
+	// The "deflate" content coding is the bare zlib stream.
+	const QByteArray compressed = qCompress(response.body(), 6);
+	if(compressed.length() - 4 >= response.body().length())
+		return;
+
+	response.setBody(compressed.mid(4));
+	response.setHeader("Content-Encoding", "deflate");
+}
+
 int iterate_post(void *con_cls, enum MHD_ValueKind kind, const char *key, const char *filename, const char *content_type, const char *transfer_encoding, const char *data, uint64_t off, size_t size)
 {
 	Q_UNUSED(kind);
@@ -239,6 +277,12 @@ int request_handler(void *cls, MHD_Connection *connection, const char *url, cons
 	MHD_Response *mhdresponse;
 	int ret;
 
+	if(response.body().length() > COMPRESS_THRESHOLD && !response.headers().contains("Content-Encoding")) {
+		response.setHeader("Vary", "Accept-Encoding");
+		if(acceptsDeflate(connection))
+			compressResponse(response);
+	}
+
 	logMessage(connection, response.code(), methodstr, url);
 
 	mhdresponse = MHD_create_response_from_buffer(response.body().length(), const_cast<char*>(response.body().data()), MHD_RESPMEM_MUST_COPY);
@@ -20,17 +20,186 @@
 #include "webadmin.h"
 #include "qmhttp.h"
 #include "multiserver.h"
-
-#include "../shared/server/jsonapi.h"
+#include "database.h"
+#include "dblog.h"
+#include "../shared/server/metrics.h"
 
 #include <QJsonObject>
+#include <QJsonArray>
 #include <QMetaObject>
+#include <QUuid>
 
 namespace server {
 
+// How old a snapshotted status, session or user list may be (milliseconds)
+static const int SNAPSHOT_MAX_AGE = 1000;
+
+// How often the metrics gauges are sampled (milliseconds)
+static const int METRICS_INTERVAL = 1000;
+
+static const int DEFAULT_PAGE_SIZE = 100;
+static const int MAX_PAGE_SIZE = 1000;
+
 Webadmin::Webadmin(QObject *parent)
-	: QObject(parent), m_server(new MicroHttpd(this))
+	: QObject(parent), m_server(new MicroHttpd(this)), m_multiserver(nullptr), m_database(nullptr)
+{
+}
+
+//! Listings are paginated if the request includes a limit or a cursor
+static bool isPaged(const QJsonObject &request)
+{
+	return request.contains("limit") || request.contains("cursor");
+}
+
+static int pageSize(const QJsonObject &request)
+{
+	const int limit = request.value("limit").toString().toInt();
+	return limit > 0 ? qMin(limit, MAX_PAGE_SIZE) : DEFAULT_PAGE_SIZE;
+}
+
+static JsonApiResult pageResult(const QJsonArray &items, const QString &nextCursor)
+{
+	QJsonObject page;
+	page["items"] = items;
+	if(!nextCursor.isEmpty())
+		page["next"] = nextCursor;
+	return JsonApiResult { JsonApiResult::Ok, QJsonDocument(page) };
+}
+
+/**
+ * @brief Return a snapshotted listing, or a page of it
+ *
+ * The cursor is the position of the next item in the listing.
+ */
+static JsonApiResult snapshotListing(const QJsonDocument &doc, const QJsonObject &request)
 {
+	if(!isPaged(request))
+		return JsonApiResult { JsonApiResult::Ok, doc };
+
+	const QJsonArray items = doc.array();
+	const int offset = qBound(0, request.value("cursor").toString().toInt(), items.size());
+	const int end = qMin(offset + pageSize(request), items.size());
+
+	QJsonArray page;
+	for(int i=offset;i<end;++i)
+		page << items.at(i);
+
+	return pageResult(page, end < items.size() ? QString::number(end) : QString());
+}
+
+/**
+ * @brief Return a database listing, or a page of it
+ *
+ * The cursor is the ID of the last item on the previous page.
+ */
+static JsonApiResult databaseListing(QJsonArray (*getList)(const QSqlDatabase&, int, int), const QSqlDatabase &db, const QJsonObject &request)
+{
+	if(!isPaged(request))
+		return JsonApiResult { JsonApiResult::Ok, QJsonDocument(getList(db, 0, 0)) };
+
+	const int limit = pageSize(request);
+	const QJsonArray items = getList(db, request.value("cursor").toString().toInt(), limit);
+
+	return pageResult(
+		items,
+		items.size() < limit ? QString() : QString::number(items.last().toObject().value("id").toInt())
+	);
+}
+
+QSqlDatabase Webadmin::readOnlyDatabase()
+{
+	if(!m_readDb.isOpen() && m_database)
+		m_readDb = m_database->openReadOnlyConnection(QStringLiteral("webadmin"));
+	return m_readDb;
+}
+
+bool Webadmin::callReadOnlyJsonApi(const QStringList &path, const QJsonObject &request, JsonApiResult *result)
+{
+	if(path.size() != 1)
+		return false;
+
+	const QString &resource = path.first();
+
+	if(resource == "status" || resource == "sessions" || resource == "users") {
+		if(!m_multiserver)
+			return false;
+
+		QJsonDocument doc;
+		if(!m_snapshot.get(resource, SNAPSHOT_MAX_AGE, &doc)) {
+			// Fetch a fresh copy from the main thread. Requests arriving
+			// within SNAPSHOT_MAX_AGE from now can reuse it.
+			JsonApiResult fresh;
+			QMetaObject::invokeMethod(
+				m_multiserver, "callJsonApi", Qt::BlockingQueuedConnection,
+				Q_RETURN_ARG(JsonApiResult, fresh),
+				Q_ARG(JsonApiMethod, JsonApiMethod::Get),
+				Q_ARG(QStringList, QStringList() << resource),
+				Q_ARG(QJsonObject, QJsonObject())
+				);
+
+			if(fresh.status != JsonApiResult::Ok) {
+				*result = fresh;
+				return true;
+			}
+
+			doc = fresh.body;
+			m_snapshot.update(resource, doc);
+		}
+
+		*result = resource == "status" ? JsonApiResult { JsonApiResult::Ok, doc } : snapshotListing(doc, request);
+		return true;
+	}
+
+	if(resource != "banlist" && resource != "accounts" && resource != "log")
+		return false;
+
+	const QSqlDatabase db = readOnlyDatabase();
+	if(!db.isOpen())
+		return false;
+
+	if(resource == "banlist") {
+		*result = databaseListing(&Database::getBanlist, db, request);
+		return true;
+
+	} else if(resource == "accounts") {
+		*result = databaseListing(&Database::getAccountList, db, request);
+		return true;
+	}
+
+	// Server log
+	QUuid session;
+	if(request.contains("session")) {
+		session = QUuid(request.value("session").toString());
+		if(session.isNull()) {
+			*result = JsonApiErrorResult(JsonApiResult::BadRequest, "Invalid session ID");
+			return true;
+		}
+	}
+
+	QDateTime after;
+	if(request.contains("after")) {
+		after = QDateTime::fromString(request.value("after").toString(), Qt::ISODate);
+		if(!after.isValid()) {
+			*result = JsonApiErrorResult(JsonApiResult::BadRequest, "Invalid timestamp");
+			return true;
+		}
+	}
+
+	const DbLog log(db);
+	QList<Log> entries;
+	QString nextCursor;
+
+	if(isPaged(request))
+		entries = log.getLogPage(session, after, Log::Level::Debug, request.value("cursor").toString(), pageSize(request), &nextCursor);
+	else
+		entries = log.query().session(session).after(after).page(request.value("page").toString().toInt(), DEFAULT_PAGE_SIZE).get();
+
+	QJsonArray out;
+	for(const Log &l : entries)
+		out.append(l.toJson());
+
+	*result = isPaged(request) ? pageResult(out, nextCursor) : JsonApiResult { JsonApiResult::Ok, QJsonDocument(out) };
+	return true;
 }
 
 void Webadmin::setBasicAuth(const QString &userpass)
@@ -47,7 +216,18 @@ void Webadmin::setBasicAuth(const QString &userpass)
 
 void Webadmin::setSessions(MultiServer *server)
 {
-	m_server->addRequestHandler(".*", [server](const HttpRequest &req) {
+	m_multiserver = server;
+	server->startMetricsSampling(METRICS_INTERVAL);
+	m_database = qobject_cast<Database*>(server->config());
+
+	// Metrics are kept in atomics, so they can be rendered right here in the HTTP thread
+	m_server->addRequestHandler("^/metrics/?$", [](const HttpRequest &) {
+		HttpResponse res(200, ServerMetrics::instance().toPrometheusText());
+		res.setHeader("Content-Type", "text/plain; version=0.0.4");
+		return res;
+	});
+
+	m_server->addRequestHandler(".*", [this, server](const HttpRequest &req) {
 		JsonApiMethod m;
 		switch(req.method()) {
 		case HttpRequest::HEAD:
@@ -91,6 +271,10 @@ void Webadmin::setSessions(MultiServer *server)
 
 		JsonApiResult result;
 
+		// Read-only queries can be answered right here in the HTTP server thread
+		if(m == JsonApiMethod::Get && callReadOnlyJsonApi(path, reqBodyDoc.object(), &result))
+			return HttpResponse::JsonResponse(result.body, result.status);
+
 		// The HTTP server runs in another thread, so we can't
 		// call the main server directly
 		QMetaObject::invokeMethod(
@@ -101,6 +285,10 @@ void Webadmin::setSessions(MultiServer *server)
 			Q_ARG(QJsonObject, reqBodyDoc.object())
 			);
 
+		// Make sure the admin sees the effect of a change in the next listing
+		if(m != JsonApiMethod::Get && result.status == JsonApiResult::Ok)
+			m_snapshot.invalidate();
+
 		return HttpResponse::JsonResponse(result.body, result.status);
 	});
 }
@@ -19,13 +19,28 @@
 #ifndef WEBADMIN_H
 #define WEBADMIN_H
 
+#include "../../shared/server/jsonapi.h"
+#include "../jsonapisnapshot.h"
+
 #include <QObject>
+#include <QSqlDatabase>
 
 class MicroHttpd;
 
 namespace server {
 
 class MultiServer;
+class Database;
+
+/**
+ * @brief The HTTP admin API server
+ *
+ * Requests are served in the HTTP server's own thread. Read-only queries
+ * (status, session and user lists, banlist, accounts and log) are answered
+ * from a short lived snapshot or a separate read-only database connection,
+ * so polling admin dashboards do not compete with the main event loop.
+ * Everything else is forwarded to the main thread.
+ */
 
 class Webadmin : public QObject
 {
@@ -68,7 +83,17 @@ public:
 	static QString version();
 
 private:
+	bool callReadOnlyJsonApi(const QStringList &path, const QJsonObject &request, JsonApiResult *result);
+	QSqlDatabase readOnlyDatabase();
+
 	MicroHttpd *m_server;
+
+	MultiServer *m_multiserver;
+	JsonApiSnapshot m_snapshot;
+
+	// Only accessed in the HTTP server thread
+	Database *m_database;
+	QSqlDatabase m_readDb;
 };
 
 }
@@ -73,6 +73,7 @@ enum MessageType {
 	MSG_ANNOTATION_EDIT,
 	MSG_ANNOTATION_DELETE,
 	MSG_REGION_MOVE,
+	MSG_PEN_MOVE_DELTA,
 	MSG_UNDO=255,
 };
 
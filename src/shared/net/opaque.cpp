@@ -73,6 +73,7 @@ Message *OpaqueMessage::decode(MessageType type, uint8_t ctx, const uchar *data,
 	case MSG_PUTIMAGE: return PutImage::deserialize(ctx, data, len);
 	case MSG_TOOLCHANGE: return ToolChange::deserialize(ctx, data, len);
 	case MSG_PEN_MOVE: return PenMove::deserialize(ctx, data, len);
+	case MSG_PEN_MOVE_DELTA: return PenMove::deserializeDelta(ctx, data, len);
 	case MSG_PEN_UP: return PenUp::deserialize(ctx, data, len);
 	case MSG_ANNOTATION_CREATE: return AnnotationCreate::deserialize(ctx, data, len);
 	case MSG_ANNOTATION_RESHAPE: return AnnotationReshape::deserialize(ctx, data, len);
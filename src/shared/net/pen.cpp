@@ -178,22 +178,118 @@ PenMove *PenMove::deserialize(uint8_t ctx, const uchar *data, uint len)
 		));
 		data += 10;
 	}
-	return new PenMove(ctx, pp);
+	return new PenMove(ctx, pp, MSG_PEN_MOVE);
+}
+
+PenMove *PenMove::deserializeDelta(uint8_t ctx, const uchar *data, uint len)
+{
+	if(len<3)
+		return nullptr;
+
+	const uchar *end = data + len;
+
+	// Read an unsigned LEB128 varint
+	auto readVarint = [&data, end](quint64 &value) -> bool {
+		value = 0;
+		for(int shift=0;shift<64;shift+=7) {
+			if(data >= end)
+				return false;
+			const uchar b = *(data++);
+			value |= quint64(b & 0x7f) << shift;
+			if(!(b & 0x80))
+				return true;
+		}
+		return false;
+	};
+	auto unzigzag = [](quint64 v) -> qint64 { return qint64(v >> 1) ^ -qint64(v & 1); };
+
+	PenPointVector pp;
+	qint64 x=0, y=0, p=0;
+
+	while(data < end) {
+		quint64 dx, dy, dp;
+		if(!readVarint(dx) || !readVarint(dy) || !readVarint(dp))
+			return nullptr;
+
+		x += unzigzag(dx);
+		y += unzigzag(dy);
+		p += unzigzag(dp);
+
+		if(x < INT32_MIN || x > INT32_MAX || y < INT32_MIN || y > INT32_MAX || p < 0 || p > 0xffff)
+			return nullptr;
+
+		pp.append(PenPoint(int32_t(x), int32_t(y), uint16_t(p)));
+	}
+
+	if(pp.isEmpty() || pp.size() > MAX_POINTS)
+		return nullptr;
+
+	return new PenMove(ctx, pp, MSG_PEN_MOVE_DELTA);
+}
+
+static inline quint64 zigzag(qint64 v) { return (quint64(v) << 1) ^ quint64(v >> 63); }
+
+static inline int varintLength(quint64 v)
+{
+	int len = 1;
+	while(v >= 0x80) {
+		v >>= 7;
+		++len;
+	}
+	return len;
+}
+
+static inline uchar *writeVarint(uchar *ptr, quint64 v)
+{
+	while(v >= 0x80) {
+		*(ptr++) = uchar(v) | 0x80;
+		v >>= 7;
+	}
+	*(ptr++) = uchar(v);
+	return ptr;
 }
 
 int PenMove::payloadLength() const
 {
-	return 10 * m_points.size();
+	if(type() == MSG_PEN_MOVE)
+		return 10 * m_points.size();
+
+	int len = 0;
+	qint64 x=0, y=0, p=0;
+	for(const PenPoint &pt : m_points) {
+		len += varintLength(zigzag(pt.x - x));
+		len += varintLength(zigzag(pt.y - y));
+		len += varintLength(zigzag(pt.p - p));
+		x = pt.x;
+		y = pt.y;
+		p = pt.p;
+	}
+	return len;
 }
 
 int PenMove::serializePayload(uchar *data) const
 {
 	uchar *ptr = data;
-	for(const PenPoint &p : m_points) {
-		qToBigEndian(p.x, ptr); ptr += 4;
-		qToBigEndian(p.y, ptr); ptr += 4;
-		qToBigEndian(p.p, ptr); ptr += 2;
+
+	if(type() == MSG_PEN_MOVE) {
+		for(const PenPoint &p : m_points) {
+			qToBigEndian(p.x, ptr); ptr += 4;
+			qToBigEndian(p.y, ptr); ptr += 4;
+			qToBigEndian(p.p, ptr); ptr += 2;
+		}
+
+	} else {
+		qint64 x=0, y=0, p=0;
+		for(const PenPoint &pt : m_points) {
+			ptr = writeVarint(ptr, zigzag(pt.x - x));
+			ptr = writeVarint(ptr, zigzag(pt.y - y));
+			ptr = writeVarint(ptr, zigzag(pt.p - p));
+			x = pt.x;
+			y = pt.y;
+			p = pt.p;
+		}
 	}
+
 	return ptr - data;
 }
 
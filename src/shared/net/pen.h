@@ -124,21 +124,36 @@ typedef QVector<PenPoint> PenPointVector;
  * @brief Pen move command
  * 
  * The first pen move command starts a new stroke.
+ *
+ * There are two encodings for this message:
+ *
+ * MSG_PEN_MOVE (legacy): each point is stored as absolute coordinates and pressure (10 bytes)
+ *
+ * MSG_PEN_MOVE_DELTA: each point is stored as the difference to the previous point
+ * (the first one relative to zero) as zigzag encoded varints. Consecutive points of
+ * a stroke are usually very close to each other, so this typically takes 3 to 4 bytes
+ * per point.
+ *
+ * New messages are created in the legacy encoding unless the delta encoding is asked
+ * for explicitly, since only protocol 20.2 and newer support it. net::Client converts
+ * outgoing messages to the encoding the session supports.
  */
 class PenMove : public Message {
 public:
-	//! The maximum number of points that will fit into a single PenMove message
-	static const int MAX_POINTS = 0xffff / 10;
+	//! The maximum number of points that will fit into a single PenMove message in any encoding
+	static const int MAX_POINTS = 0xffff / 13;
 
-	PenMove(uint8_t ctx, const PenPointVector &points)
-		: Message(MSG_PEN_MOVE, ctx),
+	PenMove(uint8_t ctx, const PenPointVector &points, MessageType type=MSG_PEN_MOVE)
+		: Message(type, ctx),
 		m_points(points)
 	{
+		Q_ASSERT(type == MSG_PEN_MOVE || type == MSG_PEN_MOVE_DELTA);
 		Q_ASSERT(!points.isEmpty());
-		Q_ASSERT(points.size() <= MAX_POINTS);
+		Q_ASSERT(points.size() <= (type == MSG_PEN_MOVE ? 0xffff / 10 : MAX_POINTS));
 	}
 	
 	static PenMove *deserialize(uint8_t ctx, const uchar *data, uint len);
+	static PenMove *deserializeDelta(uint8_t ctx, const uchar *data, uint len);
 
 	const PenPointVector &points() const { return m_points; }
 	PenPointVector &points() { return m_points; }
@@ -156,6 +171,9 @@ private:
 	PenPointVector m_points;
 };
 
+//! Is this a PenMove message (in either encoding)?
+inline bool isPenMove(int type) { return type == MSG_PEN_MOVE || type == MSG_PEN_MOVE_DELTA; }
+
 /**
  * @brief Pen up command
  *
@@ -62,6 +62,24 @@ bool ProtocolVersion::isCurrent() const
 			m_minor == DRAWPILE_PROTO_MINOR_VERSION;
 }
 
+bool ProtocolVersion::isCompatible() const
+{
+	// Protocol 20.2 changed how smudge colors are sampled, so 20.1 clients
+	// render smudge strokes differently.
+	static const int OLDEST_COMPATIBLE_MINOR_VERSION = 2;
+
+	return m_namespace == QStringLiteral("dp") &&
+			m_server == DRAWPILE_PROTO_SERVER_VERSION &&
+			m_major == DRAWPILE_PROTO_MAJOR_VERSION &&
+			m_minor >= OLDEST_COMPATIBLE_MINOR_VERSION &&
+			m_minor <= DRAWPILE_PROTO_MINOR_VERSION;
+}
+
+bool ProtocolVersion::supportsPenMoveDelta() const
+{
+	return m_major > 20 || (m_major == 20 && m_minor >= 2);
+}
+
 ProtocolVersion ProtocolVersion::fromString(const QString &str)
 {
 	QRegularExpression re("([a-z]+):(\\d+)\\.(\\d+)\\.(\\d+)");
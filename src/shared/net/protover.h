@@ -66,6 +66,17 @@ public:
 	//! Is this the current protocol version?
 	bool isCurrent() const;
 
+	/**
+	 * @brief Can this client take part in a session using this protocol version?
+	 *
+	 * This is true for the current version and for older minor versions that
+	 * differ only by lacking newer message encodings. (See doc/protocol.md)
+	 */
+	bool isCompatible() const;
+
+	//! Does this protocol version include the delta encoded pen move message?
+	bool supportsPenMoveDelta() const;
+
 	/**
 	 * @brief Get the protocol namespace. 
 	 *
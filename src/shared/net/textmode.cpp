@@ -28,68 +28,193 @@
 #include "recording.h"
 #include "undo.h"
 
+#include <QVarLengthArray>
+
 namespace protocol {
 namespace text {
 
-static PenPoint parsePenPoint(const QStringList &tokens, bool *ok)
+namespace {
+
+//! A reference to a part of a UTF-8 encoded line
+struct Token {
+	const char *ptr;
+	int len;
+
+	bool operator==(const char *str) const { return int(qstrlen(str)) == len && memcmp(ptr, str, len) == 0; }
+	Token left(int n) const { return Token { ptr, n }; }
+	Token mid(int from) const { return Token { ptr + from, len - from }; }
+
+	int indexOf(char c) const {
+		const char *found = static_cast<const char*>(memchr(ptr, c, len));
+		return found ? int(found - ptr) : -1;
+	}
+
+	QString toString() const { return QString::fromUtf8(ptr, len); }
+};
+
+typedef QVarLengthArray<Token, 32> Tokens;
+
+inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+Token trimmed(const char *ptr, int len)
+{
+	while(len>0 && isSpace(*ptr)) {
+		++ptr;
+		--len;
+	}
+	while(len>0 && isSpace(ptr[len-1]))
+		--len;
+	return Token { ptr, len };
+}
+
+void splitTokens(const Token &line, Tokens &tokens)
+{
+	const char *p = line.ptr;
+	const char *end = line.ptr + line.len;
+	while(p<end) {
+		if(*p == ' ') {
+			++p;
+			continue;
+		}
+		const char *start = p;
+		while(p<end && *p != ' ')
+			++p;
+		tokens.append(Token { start, int(p - start) });
+	}
+}
+
+QString joinTokens(const Token *tokens, int count)
+{
+	if(count==0)
+		return QString();
+	return Token { tokens[0].ptr, int(tokens[count-1].ptr + tokens[count-1].len - tokens[0].ptr) }.toString();
+}
+
+bool parseUInt8(const Token &t, int *out)
 {
-	if(tokens.length() < 2 || tokens.length() > 3) {
-		*ok = false;
-		return PenPoint(0, 0, 0);
+	if(t.len == 0)
+		return false;
+
+	int value = 0;
+	for(int i=0;i<t.len;++i) {
+		if(t.ptr[i] < '0' || t.ptr[i] > '9')
+			return false;
+		value = value * 10 + (t.ptr[i] - '0');
+		if(value > 255)
+			return false;
+	}
+	*out = value;
+	return true;
+}
+
+bool parseFloat(const Token &t, float *out)
+{
+	// Fast path for the plain decimal numbers the text serializer writes.
+	// With at most 15 significant digits, both the mantissa and the power of ten
+	// are exact doubles, so a single division gives the correctly rounded result.
+	static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+	const char *p = t.ptr;
+	const char *end = t.ptr + t.len;
+
+	bool negative = false;
+	if(p<end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+
+	qint64 mantissa = 0;
+	int digits = 0;
+	int decimals = 0;
+	bool point = false;
+	for(;p<end;++p) {
+		if(*p >= '0' && *p <= '9') {
+			mantissa = mantissa * 10 + (*p - '0');
+			++digits;
+			if(point)
+				++decimals;
+		} else if(*p == '.' && !point) {
+			point = true;
+		} else {
+			break;
+		}
 	}
 
-	float x = tokens[0].toFloat(ok);
-	if(!ok)
-		return PenPoint(0, 0, 0);
-	float y = tokens[1].toFloat(ok);
-	if(!ok)
-		return PenPoint(0, 0, 0);
-	float p=1;
-	if(tokens.length()==3) {
-		p = tokens[2].toFloat(ok) / 100.0;
-		if(!ok)
-			return PenPoint(0, 0, 0);
+	if(p == end && digits > 0 && digits <= 15) {
+		const double value = mantissa / POW10[decimals];
+		*out = float(negative ? -value : value);
+		return true;
 	}
-	return PenPoint(qRound(x*4), qRound(y*4), qRound(p*0xffff));
+
+	// Anything else (exponents, overlong numbers) takes the slow path
+	bool ok;
+	*out = t.toString().toFloat(&ok);
+	return ok;
 }
 
-Parser::Result Parser::parseLine(const QString &line)
+bool parsePenPoint(const Token *tokens, int count, PenPoint *point)
 {
+	if(count < 2 || count > 3)
+		return false;
+
+	float x, y, p=100;
+	if(!parseFloat(tokens[0], &x) || !parseFloat(tokens[1], &y))
+		return false;
+	if(count==3 && !parseFloat(tokens[2], &p))
+		return false;
+
+	const float pressure = p / 100.0;
+	*point = PenPoint(qRound(x*4), qRound(y*4), qRound(pressure * 0xffff));
+	return true;
+}
+
+}
+
+void Parser::setProtocolVersion(const ProtocolVersion &version)
+{
+	m_penMoveType = version.supportsPenMoveDelta() ? MSG_PEN_MOVE_DELTA : MSG_PEN_MOVE;
+}
+
+Parser::Result Parser::parseLine(const QByteArray &rawLine)
+{
+	const Token line = trimmed(rawLine.constData(), rawLine.length());
+
 	switch(m_state) {
 	case ExpectCommand: {
-		if(line.isEmpty() || line.at(0) == '#')
+		if(line.len == 0 || line.ptr[0] == '#')
 			return Result { Result::Skip, nullptr };
 
-		if(line.at(0) == '!') {
+		if(line.ptr[0] == '!') {
 			// Metadata line
 			int i = line.indexOf('=');
 			if(i>1) {
-				QString key = line.mid(1, i-1);
-				QString value = line.mid(i+1);
+				const QString key = line.mid(1).left(i-1).toString();
+				const QString value = line.mid(i+1).toString();
 				m_metadata[key] = value;
+				if(key == QStringLiteral("version"))
+					setProtocolVersion(ProtocolVersion::fromString(value));
 			}
 			return Result { Result::Skip, nullptr };
 		}
 
-		QStringList tokens = line.split(' ', QString::SkipEmptyParts);
-		if(tokens.length() < 2) {
+		Tokens tokens;
+		splitTokens(line, tokens);
+		if(tokens.size() < 2) {
 			m_error = "Expected at least two tokens";
 			return Result { Result::Error, nullptr };
 		}
 
 		// Get context ID
-		{
-			bool ok;
-			int ctxId = tokens[0].toInt(&ok);
-			if(!ok || ctxId<0 || ctxId>255) {
-				m_error = "Invalid context id: " + tokens[0];
-				return Result { Result::Error, nullptr };
-			}
-			m_ctx = ctxId;
+		if(!parseUInt8(tokens[0], &m_ctx)) {
+			m_error = "Invalid context id: " + tokens[0].toString();
+			return Result { Result::Error, nullptr };
 		}
 
 		// Get message name
-		m_cmd = tokens[1];
+		m_cmd = QByteArray(tokens[1].ptr, tokens[1].len);
 		m_kwargs = Kwargs();
 		m_points = PenPointVector();
 
@@ -104,12 +229,12 @@ Parser::Result Parser::parseLine(const QString &line)
 			// Extract Pen Point (special case for penmove message)
 			// If this is a multiline penpoint, the first point can be in the body part
 			if(!multiline || tokens.size()>2) {
-				bool ok;
-				m_points << parsePenPoint(tokens.mid(2), &ok);
-				if(!ok) {
-					m_error = "Invalid pen point: " + tokens.mid(2).join(' ');
+				PenPoint pp(0, 0, 0);
+				if(!parsePenPoint(tokens.constData()+2, tokens.size()-2, &pp)) {
+					m_error = "Invalid pen point: " + joinTokens(tokens.constData()+2, tokens.size()-2);
 					return Result { Result::Error, nullptr };
 				}
+				m_points << pp;
 			}
 
 		} else {
@@ -117,10 +242,10 @@ Parser::Result Parser::parseLine(const QString &line)
 			for(int i=2;i<tokens.size();++i) {
 				int j = tokens[i].indexOf('=');
 				if(j<0) {
-					m_error = "No value in keyword argument: " + tokens[i];
+					m_error = "No value in keyword argument: " + tokens[i].toString();
 					return Result { Result::Error, nullptr };
 				}
-				m_kwargs[tokens[i].left(j)] = tokens[i].mid(j+1);
+				m_kwargs[tokens[i].left(j).toString()] = tokens[i].mid(j+1).toString();
 			}
 		}
 
@@ -137,16 +262,16 @@ Parser::Result Parser::parseLine(const QString &line)
 
 	case ExpectKwargLine: {
 		// Extract named argument
-		if(line=="}")
+		if(line == "}")
 			break;
 
 		const int i = line.indexOf('=');
 		if(i<0) {
-			m_error = "Invalid named argument: " + line;
+			m_error = "Invalid named argument: " + line.toString();
 			return Result { Result::Error, nullptr };
 		}
-		const QString name = line.left(i);
-		const QString value = line.mid(i+1);
+		const QString name = line.left(i).toString();
+		const QString value = line.mid(i+1).toString();
 		if(m_kwargs.contains(name)) {
 			m_kwargs[name] += "\n";
 			m_kwargs[name] += value;
@@ -158,15 +283,16 @@ Parser::Result Parser::parseLine(const QString &line)
 
 	case ExpectPenMovePoint: {
 		// Extract pen point
-		if(line=="}")
+		if(line == "}")
 			break;
-		QStringList tokens = line.split(' ');
-		bool ok;
-		m_points << parsePenPoint(tokens, &ok);
-		if(!ok) {
-			m_error = "Invalid pen point: " + tokens.join(' ');
+		Tokens tokens;
+		splitTokens(line, tokens);
+		PenPoint pp(0, 0, 0);
+		if(!parsePenPoint(tokens.constData(), tokens.size(), &pp)) {
+			m_error = "Invalid pen point: " + line.toString();
 			return Result { Result::Error, nullptr };
 		}
+		m_points << pp;
 		return { Result::NeedMore, nullptr };
 	}
 	}
@@ -177,7 +303,7 @@ Parser::Result Parser::parseLine(const QString &line)
 	Message *msg=nullptr;
 
 #define FROMTEXT(name, Cls) if(m_cmd==name) msg = Cls::fromText(m_ctx, m_kwargs)
-	if(m_cmd=="penmove") msg = new PenMove(m_ctx, m_points);
+	if(m_cmd=="penmove") msg = new PenMove(m_ctx, m_points, m_penMoveType);
 	else FROMTEXT("join", UserJoin);
 	else FROMTEXT("leave", UserLeave);
 	else FROMTEXT("owner", SessionOwner);
@@ -210,7 +336,7 @@ Parser::Result Parser::parseLine(const QString &line)
 	else if(m_cmd=="undo") msg = Undo::fromText(m_ctx, m_kwargs, false);
 	else if(m_cmd=="redo") msg = Undo::fromText(m_ctx, m_kwargs, true);
 	else {
-		m_error = "Unknown message type: " + m_cmd;
+		m_error = "Unknown message type: " + QString::fromUtf8(m_cmd);
 		return { Result::Error, nullptr };
 	}
 #undef FROMTEXT
@@ -219,7 +345,7 @@ Parser::Result Parser::parseLine(const QString &line)
 		return { Result::Ok, msg };
 
 	} else {
-		m_error = "Couldn't parse " + m_cmd + " message.";
+		m_error = "Couldn't parse " + QString::fromUtf8(m_cmd) + " message.";
 		return { Result::Error, nullptr };
 	}
 }
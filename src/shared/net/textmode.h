@@ -21,12 +21,18 @@
 
 #include "message.h"
 #include "pen.h"
+#include "protover.h"
 
 namespace protocol {
 namespace text {
 
 /**
  * Text mode file parser
+ *
+ * The parser works directly on UTF-8 encoded lines. Lines are tokenized in place
+ * and pen points are decoded straight from the bytes, so the common case (penmove
+ * bodies) produces messages without any intermediate string allocations.
+ * Other message types still go through the keyword argument map.
  */
 class Parser {
 public:
@@ -40,12 +46,28 @@ public:
 		Message *msg;
 	};
 
-	Result parseLine(const QString &line);
+	/**
+	 * @brief Parse a line of UTF-8 encoded text
+	 *
+	 * Leading and trailing whitespace (including the line terminator) is ignored.
+	 */
+	Result parseLine(const QByteArray &line);
+	Result parseLine(const QString &line) { return parseLine(line.toUtf8()); }
+
 	QString errorString() const { return m_error; }
 
 	Kwargs metadata() const { return m_metadata; }
 
-	Parser() : m_state(ExpectCommand), m_ctx(0) { }
+	/**
+	 * @brief Set the protocol version the text was written for
+	 *
+	 * This selects the encoding of PenMove messages. Versions older than 20.2
+	 * (or an unknown version) get the legacy encoding.
+	 * A "version" metadata line sets this as well.
+	 */
+	void setProtocolVersion(const ProtocolVersion &version);
+
+	Parser() : m_state(ExpectCommand), m_ctx(0), m_penMoveType(MSG_PEN_MOVE) { }
 private:
 	enum {
 		ExpectCommand,
@@ -55,10 +77,11 @@ private:
 
 	Kwargs m_metadata;
 	QString m_error;
-	QString m_cmd;
+	QByteArray m_cmd;
 	Kwargs m_kwargs;
 	PenPointVector m_points;
 	int m_ctx;
+	MessageType m_penMoveType;
 };
 
 // Formatting helper functions
@@ -0,0 +1,467 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "blockcompression.h"
+
+#include <QtEndian>
+#include <QFileDevice>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace recording {
+
+static const char MAGIC[] = "DPBLOCK"; // the terminating zero is included in the magic number
+static const int MAGIC_LEN = BlockCompressionDevice::MAGIC_LENGTH;
+static const int BLOCK_HEADER_LEN = BlockCompressionDevice::BLOCK_HEADER_LENGTH;
+static const int BLOCK_SIZE = BlockCompressionDevice::MAX_BLOCK_LENGTH;
+
+static const int ZSTD_ARCHIVAL_LEVEL = 19;
+
+BlockCompressionDevice::BlockCompressionDevice(QIODevice *device, bool autoclose, QObject *parent)
+	: QIODevice(parent),
+	  m_device(device),
+	  m_autoclose(autoclose),
+	  m_mode(Mode::Fast),
+	  m_scannedEnd(0),
+	  m_scanComplete(false),
+	  m_blockIndex(-1),
+	  m_blockPos(0),
+	  m_written(0)
+{
+	Q_ASSERT(device);
+}
+
+BlockCompressionDevice::~BlockCompressionDevice()
+{
+	if(isOpen())
+		close();
+	if(m_autoclose)
+		delete m_device;
+}
+
+void BlockCompressionDevice::setMode(Mode mode)
+{
+	Q_ASSERT(m_written == 0);
+	m_mode = mode;
+}
+
+bool BlockCompressionDevice::isCodecSupported(Codec codec)
+{
+	switch(codec) {
+	case Stored:
+	case Zlib:
+	case Open:
+		return true;
+	case Lz4:
+#ifdef HAVE_LZ4
+		return true;
+#else
+		return false;
+#endif
+	case Zstd:
+#ifdef HAVE_ZSTD
+		return true;
+#else
+		return false;
+#endif
+	}
+	return false;
+}
+
+QByteArray BlockCompressionDevice::magic()
+{
+	return QByteArray(MAGIC, MAGIC_LEN);
+}
+
+QByteArray BlockCompressionDevice::blockHeader(int compressedLength, int uncompressedLength, Codec codec)
+{
+	QByteArray header(BLOCK_HEADER_LEN, 0);
+	uchar *h = reinterpret_cast<uchar*>(header.data());
+	qToBigEndian(quint32(compressedLength), h);
+	qToBigEndian(quint32(uncompressedLength), h+4);
+	h[8] = codec;
+	return header;
+}
+
+bool BlockCompressionDevice::parseBlockHeader(const QByteArray &header, int *compressedLength, int *uncompressedLength, Codec *codec)
+{
+	if(header.length() < BLOCK_HEADER_LEN)
+		return false;
+
+	const uchar *h = reinterpret_cast<const uchar*>(header.constData());
+	const quint32 compressedLen = qFromBigEndian<quint32>(h);
+	const quint32 uncompressedLen = qFromBigEndian<quint32>(h+4);
+
+	// Anything larger is not a valid block
+	if(compressedLen > quint32(BLOCK_SIZE) || uncompressedLen > quint32(BLOCK_SIZE))
+		return false;
+
+	*compressedLength = int(compressedLen);
+	*uncompressedLength = int(uncompressedLen);
+	*codec = Codec(h[8]);
+	return true;
+}
+
+bool BlockCompressionDevice::open(OpenMode mode)
+{
+	if((mode & ReadWrite) == ReadWrite || (mode & Append)) {
+		qWarning("BlockCompressionDevice: unsupported open mode");
+		return false;
+	}
+
+	if(!m_device->isOpen() && !m_device->open(mode & ~Text)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	m_index.clear();
+	m_scanComplete = false;
+	m_block.clear();
+	m_blockIndex = -1;
+	m_blockPos = 0;
+	m_written = 0;
+
+	if(mode & WriteOnly) {
+		if(m_device->write(MAGIC, MAGIC_LEN) != MAGIC_LEN) {
+			setErrorString(m_device->errorString());
+			return false;
+		}
+
+	} else {
+		if(m_device->read(MAGIC_LEN) != QByteArray(MAGIC, MAGIC_LEN)) {
+			setErrorString(tr("Not a block compressed file"));
+			return false;
+		}
+		m_scannedEnd = m_device->pos();
+	}
+
+	// Reads are served from the decompressed block, so there is no need for QIODevice's buffer
+	return QIODevice::open(mode | Unbuffered);
+}
+
+void BlockCompressionDevice::close()
+{
+	if(!isOpen())
+		return;
+
+	if(isWritable())
+		flushBlock();
+
+	QIODevice::close();
+
+	if(m_autoclose)
+		m_device->close();
+}
+
+qint64 BlockCompressionDevice::size() const
+{
+	if(openMode() & WriteOnly)
+		return m_written;
+
+	while(!m_scanComplete)
+		scanNextBlock();
+
+	if(m_index.isEmpty())
+		return 0;
+	return m_index.last().uncompressedStart + m_index.last().uncompressedLength;
+}
+
+bool BlockCompressionDevice::scanNextBlock() const
+{
+	if(m_scanComplete)
+		return false;
+
+	if(!m_device->seek(m_scannedEnd)) {
+		m_scanComplete = true;
+		return false;
+	}
+
+	const QByteArray header = m_device->read(BLOCK_HEADER_LEN);
+	if(header.length() != BLOCK_HEADER_LEN) {
+		m_scanComplete = true;
+		return false;
+	}
+
+	int compressedLen, uncompressedLen;
+	Codec codec;
+
+	// A truncated last block is ignored
+	const bool valid = parseBlockHeader(header, &compressedLen, &uncompressedLen, &codec);
+	const qint64 blockEnd = m_scannedEnd + BLOCK_HEADER_LEN + compressedLen;
+	if(!valid || blockEnd > m_device->size()) {
+		qWarning("BlockCompressionDevice: truncated or invalid block at %lld", m_scannedEnd);
+		m_scanComplete = true;
+		return false;
+	}
+
+	const qint64 start = m_index.isEmpty() ? 0 : m_index.last().uncompressedStart + m_index.last().uncompressedLength;
+	m_index << BlockIndex { start, m_scannedEnd, uncompressedLen };
+	m_scannedEnd = blockEnd;
+
+	// An open block is always the last one. Only the part covered
+	// by its header is readable.
+	if(codec == Open)
+		m_scanComplete = true;
+
+	return true;
+}
+
+bool BlockCompressionDevice::loadBlock(int index)
+{
+	Q_ASSERT(index >= 0 && index < m_index.size());
+	if(index == m_blockIndex)
+		return true;
+
+	const BlockIndex &bi = m_index.at(index);
+
+	if(!m_device->seek(bi.fileOffset)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	int compressedLen, uncompressedLen;
+	Codec codec;
+	if(!parseBlockHeader(m_device->read(BLOCK_HEADER_LEN), &compressedLen, &uncompressedLen, &codec)) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	const QByteArray compressed = m_device->read(compressedLen);
+	if(compressed.length() != compressedLen) {
+		setErrorString(m_device->errorString());
+		return false;
+	}
+
+	if(!isCodecSupported(codec)) {
+		m_block.clear();
+		m_blockIndex = -1;
+		setErrorString(tr("Unsupported block compression codec %1").arg(int(codec)));
+		return false;
+	}
+
+	m_block = decompressBlock(compressed, codec, bi.uncompressedLength);
+	if(m_block.isNull()) {
+		m_blockIndex = -1;
+		setErrorString(tr("Corrupt compressed block"));
+		return false;
+	}
+
+	m_blockIndex = index;
+	m_blockPos = 0;
+	return true;
+}
+
+bool BlockCompressionDevice::seek(qint64 pos)
+{
+	if(openMode() & WriteOnly) {
+		// Only a no-op seek is possible in write mode
+		return pos == m_written && QIODevice::seek(pos);
+	}
+
+	if(pos < 0)
+		return false;
+
+	// Find the block containing the position
+	int idx = m_blockIndex >= 0 && m_index.at(m_blockIndex).uncompressedStart <= pos ? m_blockIndex : 0;
+	while(true) {
+		while(idx >= m_index.size()) {
+			if(!scanNextBlock())
+				break;
+		}
+
+		if(idx >= m_index.size()) {
+			// Seeking to the very end is allowed
+			if(pos != size())
+				return false;
+			if(!m_index.isEmpty()) {
+				if(!loadBlock(m_index.size()-1))
+					return false;
+				m_blockPos = m_block.length();
+			}
+			return QIODevice::seek(pos);
+		}
+
+		const BlockIndex &bi = m_index.at(idx);
+		if(pos < bi.uncompressedStart + bi.uncompressedLength)
+			break;
+		++idx;
+	}
+
+	if(!loadBlock(idx))
+		return false;
+
+	m_blockPos = pos - m_index.at(idx).uncompressedStart;
+	return QIODevice::seek(pos);
+}
+
+qint64 BlockCompressionDevice::readData(char *data, qint64 maxlen)
+{
+	qint64 read = 0;
+	while(read < maxlen) {
+		if(m_blockIndex < 0 || m_blockPos >= m_block.length()) {
+			const int next = m_blockIndex + 1;
+			if(next >= m_index.size() && !scanNextBlock())
+				break;
+			if(!loadBlock(next))
+				return read > 0 ? read : -1;
+		}
+
+		const int len = int(qMin(maxlen - read, qint64(m_block.length() - m_blockPos)));
+		memcpy(data + read, m_block.constData() + m_blockPos, len);
+		m_blockPos += len;
+		read += len;
+	}
+
+	return read;
+}
+
+qint64 BlockCompressionDevice::writeData(const char *data, qint64 len)
+{
+	qint64 written = 0;
+	while(written < len) {
+		const int chunk = int(qMin(len - written, qint64(BLOCK_SIZE - m_block.length())));
+		m_block.append(data + written, chunk);
+		written += chunk;
+
+		if(m_block.length() >= BLOCK_SIZE && !flushBlock())
+			return -1;
+	}
+
+	m_written += len;
+	return len;
+}
+
+bool BlockCompressionDevice::flushBlock()
+{
+	Q_ASSERT(openMode() & WriteOnly);
+
+	if(!m_block.isEmpty()) {
+		Codec codec;
+		const QByteArray compressed = compressBlock(m_block, m_mode, &codec);
+
+		if(
+			m_device->write(blockHeader(compressed.length(), m_block.length(), codec)) != BLOCK_HEADER_LEN ||
+			m_device->write(compressed) != compressed.length()
+		) {
+			setErrorString(m_device->errorString());
+			return false;
+		}
+
+		m_block.clear();
+	}
+
+	auto *fd = qobject_cast<QFileDevice*>(m_device);
+	if(fd)
+		fd->flush();
+
+	return true;
+}
+
+QByteArray BlockCompressionDevice::compressBlock(const QByteArray &data, Mode mode, Codec *codec)
+{
+	QByteArray out;
+
+	if(mode == Mode::Fast) {
+#ifdef HAVE_LZ4
+		out.resize(LZ4_compressBound(data.length()));
+		const int len = LZ4_compress_default(data.constData(), out.data(), data.length(), out.length());
+		out.resize(len);
+		*codec = Lz4;
+#else
+		out = qCompress(data, 1);
+		*codec = Zlib;
+#endif
+	} else {
+#ifdef HAVE_ZSTD
+		out.resize(ZSTD_compressBound(data.length()));
+		const size_t len = ZSTD_compress(out.data(), out.length(), data.constData(), data.length(), ZSTD_ARCHIVAL_LEVEL);
+		out.resize(ZSTD_isError(len) ? 0 : int(len));
+		*codec = Zstd;
+#else
+		out = qCompress(data, 9);
+		*codec = Zlib;
+#endif
+	}
+
+	// Incompressible data (or a compression error)
+	if(out.isEmpty() || out.length() >= data.length()) {
+		*codec = Stored;
+		return data;
+	}
+
+	return out;
+}
+
+QByteArray BlockCompressionDevice::decompressBlock(const QByteArray &data, Codec codec, int uncompressedLength)
+{
+	QByteArray out;
+
+	switch(codec) {
+	case Stored:
+	case Open:
+		out = data.left(uncompressedLength);
+		break;
+
+	case Zlib:
+		out = qUncompress(data);
+		break;
+
+#ifdef HAVE_LZ4
+	case Lz4: {
+		out.resize(uncompressedLength);
+		const int len = LZ4_decompress_safe(data.constData(), out.data(), data.length(), uncompressedLength);
+		// A short block would leave uninitialized bytes at the end
+		if(len != uncompressedLength)
+			return QByteArray();
+		break;
+	}
+#endif
+
+#ifdef HAVE_ZSTD
+	case Zstd: {
+		out.resize(uncompressedLength);
+		const size_t len = ZSTD_decompress(out.data(), uncompressedLength, data.constData(), data.length());
+		if(ZSTD_isError(len) || len != size_t(uncompressedLength))
+			return QByteArray();
+		break;
+	}
+#endif
+
+	default:
+		return QByteArray();
+	}
+
+	// (Stored blocks may be cut short and zlib blocks carry their own length)
+	if(out.length() != uncompressedLength)
+		return QByteArray();
+
+	// An empty block is not an error
+	if(out.isNull())
+		out = QByteArray("");
+
+	return out;
+}
+
+}
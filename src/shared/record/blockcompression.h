@@ -0,0 +1,172 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef REC_BLOCKCOMPRESSION_H
+#define REC_BLOCKCOMPRESSION_H
+
+#include <QIODevice>
+#include <QVector>
+
+namespace recording {
+
+/**
+ * @brief A compression device that stores data in independently compressed blocks
+ *
+ * Unlike KCompressionDevice, random access is cheap: seeking only needs
+ * to read the block headers and decompress the one block that contains
+ * the target position.
+ *
+ * File format:
+ *
+ *     "DPBLOCK\0"
+ *     repeat {
+ *         uint32 compressed length
+ *         uint32 uncompressed length
+ *         uint8  codec
+ *         compressed data
+ *     }
+ *
+ * All numbers are in network byte order.
+ *
+ * A block is written whenever the write buffer gets full or flushBlock()
+ * is called, so a partially written file is readable up to the last
+ * complete block.
+ *
+ * The last block may also be an Open block: uncompressed data that is still
+ * being appended to. Its length fields are updated only now and then, so
+ * the data may continue past them to the end of the file.
+ */
+class BlockCompressionDevice : public QIODevice
+{
+	Q_OBJECT
+public:
+	//! Per-block compression codec
+	enum Codec {
+		Stored = 0,
+		Zlib = 1,
+		Lz4 = 2,
+		Zstd = 3,
+		Open = 4
+	};
+
+	//! Compression tradeoff to use when writing
+	enum class Mode {
+		Fast,     // Cheap enough to use while recording live (LZ4 if available)
+		Archival  // Best compression ratio (zstd if available)
+	};
+
+	/**
+	 * @brief Construct a block compressed device on top of another device
+	 *
+	 * @param device the underlying device
+	 * @param autoclose if true, this device takes ownership of the underlying device
+	 * @param parent
+	 */
+	BlockCompressionDevice(QIODevice *device, bool autoclose, QObject *parent=nullptr);
+	~BlockCompressionDevice();
+
+	//! Select the compression mode. This must be called before anything is written
+	void setMode(Mode mode);
+	Mode mode() const { return m_mode; }
+
+	//! Length of the magic number at the start of the file
+	static const int MAGIC_LENGTH = 8;
+
+	//! Length of a block header
+	static const int BLOCK_HEADER_LENGTH = 9;
+
+	//! Maximum uncompressed length of a block
+	static const int MAX_BLOCK_LENGTH = 0x40000;
+
+	//! Is the given codec supported by this build?
+	static bool isCodecSupported(Codec codec);
+
+	//! Get the magic number that starts a block compressed file
+	static QByteArray magic();
+
+	//! Encode a block header
+	static QByteArray blockHeader(int compressedLength, int uncompressedLength, Codec codec);
+
+	/**
+	 * @brief Decode a block header
+	 *
+	 * @return false if the header is too short
+	 */
+	static bool parseBlockHeader(const QByteArray &header, int *compressedLength, int *uncompressedLength, Codec *codec);
+
+	/**
+	 * @brief Compress a block of data
+	 *
+	 * If the data does not compress, it is returned as is and the codec is set to Stored.
+	 */
+	static QByteArray compressBlock(const QByteArray &data, Mode mode, Codec *codec);
+
+	/**
+	 * @brief Decompress a block of data
+	 *
+	 * @return decompressed data or a null array if the codec is not supported or the data is corrupt
+	 */
+	static QByteArray decompressBlock(const QByteArray &data, Codec codec, int uncompressedLength);
+
+	bool open(OpenMode mode) override;
+	void close() override;
+	bool isSequential() const override { return false; }
+	bool seek(qint64 pos) override;
+	qint64 size() const override;
+
+	/**
+	 * @brief Compress and write out the current block, even if it isn't full
+	 *
+	 * Data written so far will be readable from the underlying device after this.
+	 */
+	bool flushBlock();
+
+protected:
+	qint64 readData(char *data, qint64 maxlen) override;
+	qint64 writeData(const char *data, qint64 len) override;
+
+private:
+	struct BlockIndex {
+		qint64 uncompressedStart; // position of the first byte of the block in the uncompressed stream
+		qint64 fileOffset;        // position of the block header in the underlying file
+		int uncompressedLength;
+	};
+
+	bool scanNextBlock() const;
+	bool loadBlock(int index);
+
+	QIODevice *m_device;
+	bool m_autoclose;
+	Mode m_mode;
+
+	// Block index (lazily built when reading)
+	mutable QVector<BlockIndex> m_index;
+	mutable qint64 m_scannedEnd; // underlying file offset of the first unscanned block
+	mutable bool m_scanComplete;
+
+	// Current block
+	QByteArray m_block;
+	int m_blockIndex;
+	int m_blockPos;
+
+	qint64 m_written;
+};
+
+}
+
+#endif
@@ -21,6 +21,7 @@
 #include "header.h"
 #include "../net/recording.h"
 #include "../net/textmode.h"
+#include "blockcompression.h"
 
 #include "config.h"
 
@@ -42,6 +43,7 @@ struct Reader::Private {
 	QByteArray msgbuf;
 
 	QJsonObject metadata;
+	protocol::ProtocolVersion textVersion; // selects the pen move encoding of text mode messages
 
 	int current;
 	qint64 currentPos;
@@ -55,7 +57,7 @@ struct Reader::Private {
 
 bool Reader::isRecordingExtension(const QString &filename)
 {
-	QRegularExpression re("\\.dp(?:rec|txt)(?:z|\\.(?:gz|bz2|xz))?$");
+	QRegularExpression re("\\.dp(?:rec|txt)(?:z|b|\\.(?:gz|bz2|xz))?$");
 	return re.match(filename).hasMatch();
 }
 
@@ -78,7 +80,10 @@ Reader::Reader(const QString &filename, Encoding encoding, QObject *parent)
 	else if(filename.endsWith(".xz", Qt::CaseInsensitive))
 		ct = KCompressionDevice::Xz;
 
-	if(ct == KCompressionDevice::None) {
+	if(filename.endsWith(".dprecb", Qt::CaseInsensitive) || filename.endsWith(".dptxtb", Qt::CaseInsensitive)) {
+		d->file = new BlockCompressionDevice(new QFile(filename), true);
+		d->isCompressed = true;
+	} else if(ct == KCompressionDevice::None) {
 		d->file = new QFile(filename);
 		d->isCompressed = false;
 	} else {
@@ -168,8 +173,7 @@ static Reader::Encoding detectEncoding(QIODevice *dev)
 			break;
 		}
 
-		QString line = QString::fromUtf8(rawLine).trimmed();
-		Parser::Result res = parser.parseLine(line);
+		Parser::Result res = parser.parseLine(rawLine);
 		switch(res.status) {
 		case Parser::Result::Ok:
 		case Parser::Result::NeedMore:
@@ -270,6 +274,10 @@ Compatibility Reader::readBinaryHeader() {
 		if(version.majorVersion() < 20)
 			return INCOMPATIBLE;
 
+		// Older minor versions that render identically
+		if(version.isCompatible())
+			return COMPATIBLE;
+
 		// Different minor version: expect rendering differences
 		if(current.minorVersion() != version.minorVersion())
 			return MINOR_INCOMPATIBILITY;
@@ -290,8 +298,7 @@ Compatibility Reader::readTextHeader()
 		if(rawLine.isEmpty())
 			return NOT_DPREC;
 
-		QString line = QString::fromUtf8(rawLine).trimmed();
-		Parser::Result res = parser.parseLine(line);
+		Parser::Result res = parser.parseLine(rawLine);
 		switch(res.status) {
 		case Parser::Result::Skip:
 			// Comments or metadata. Remember this potential start of the first real message
@@ -330,6 +337,7 @@ Compatibility Reader::readTextHeader()
 
 	// Check compatibility
 	const auto version = formatVersion();
+	d->textVersion = version;
 
 	if(!version.isValid()) {
 		// No version header given
@@ -364,6 +372,10 @@ Compatibility Reader::readTextHeader()
 		if(version.majorVersion() < 20)
 			return INCOMPATIBLE;
 
+		// Older minor versions that render identically
+		if(version.isCompatible())
+			return COMPATIBLE;
+
 		// Different minor version: expect rendering differences
 		if(current.minorVersion() != version.minorVersion())
 			return MINOR_INCOMPATIBILITY;
@@ -415,9 +427,10 @@ void Reader::seekTo(int pos, qint64 position)
 	d->eof = false;
 }
 
-static protocol::Message *readTextMessage(QIODevice *file, bool *eof)
+static protocol::Message *readTextMessage(QIODevice *file, const protocol::ProtocolVersion &version, bool *eof)
 {
 	Parser parser;
+	parser.setProtocolVersion(version);
 	while(1) {
 		QByteArray rawLine = file->readLine();
 		if(rawLine.isEmpty()) {
@@ -425,7 +438,7 @@ static protocol::Message *readTextMessage(QIODevice *file, bool *eof)
 			return nullptr;
 		}
 
-		Parser::Result res = parser.parseLine(QString::fromUtf8(rawLine).trimmed());
+		Parser::Result res = parser.parseLine(rawLine);
 		switch(res.status) {
 		case Parser::Result::Skip:
 		case Parser::Result::NeedMore:
@@ -452,7 +465,7 @@ bool Reader::readNextToBuffer(QByteArray &buffer)
 		}
 
 	} else {
-		protocol::Message *msg = readTextMessage(d->file, &d->eof);
+		protocol::Message *msg = readTextMessage(d->file, d->textVersion, &d->eof);
 		if(!msg)
 			return false;
 		if(buffer.length() < msg->length())
@@ -489,7 +502,7 @@ MessageRecord Reader::readNext()
 
 	} else {
 		d->currentPos = filePosition();
-		protocol::Message *message = readTextMessage(d->file, &d->eof);
+		protocol::Message *message = readTextMessage(d->file, d->textVersion, &d->eof);
 		if(!d->eof) {
 			if(message) {
 				msg.status = MessageRecord::OK;
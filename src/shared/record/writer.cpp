@@ -19,6 +19,7 @@
 
 #include "writer.h"
 #include "header.h"
+#include "blockcompression.h"
 #include "../net/recording.h"
 
 #include <QVarLengthArray>
@@ -45,6 +46,8 @@ Writer::Writer(const QString &filename, QObject *parent)
 
 	if(ct != KCompressionDevice::None)
 		m_file = new KCompressionDevice(m_file, true, ct);
+	else if(filename.endsWith(".dprecb", Qt::CaseInsensitive) || filename.endsWith(".dptxtb", Qt::CaseInsensitive))
+		m_file = new BlockCompressionDevice(m_file, true);
 
 	if(filename.contains(".dptxt", Qt::CaseInsensitive) && !filename.contains(".dprec", Qt::CaseInsensitive))
 		m_encoding = Encoding::Text;
@@ -81,17 +84,28 @@ void Writer::setAutoflush()
 		return;
 
 	auto *fd = qobject_cast<QFileDevice*>(m_file);
-	if(!fd) {
+	auto *bcd = qobject_cast<BlockCompressionDevice*>(m_file);
+	if(!fd && !bcd) {
 		qWarning("Cannot enable recording autoflush: output device not a QFileDevice");
 		return;
 	}
 
 	m_autoflush = new QTimer(this);
 	m_autoflush->setSingleShot(false);
-	connect(m_autoflush, &QTimer::timeout, fd, &QFileDevice::flush);
+	if(fd)
+		connect(m_autoflush, &QTimer::timeout, fd, &QFileDevice::flush);
+	else
+		connect(m_autoflush, &QTimer::timeout, bcd, &BlockCompressionDevice::flushBlock);
 	m_autoflush->start(5000);
 }
 
+void Writer::setArchivalCompression()
+{
+	auto *bcd = qobject_cast<BlockCompressionDevice*>(m_file);
+	if(bcd)
+		bcd->setMode(BlockCompressionDevice::Mode::Archival);
+}
+
 void Writer::setEncoding(Encoding e)
 {
 	Q_ASSERT(m_file->pos()==0);
@@ -181,6 +195,12 @@ bool Writer::writeMessage(const protocol::Message &msg)
 	return true;
 }
 
+bool Writer::writeEncoded(const QByteArray &data)
+{
+	Q_ASSERT(m_file->isOpen());
+	return m_file->write(data) == data.length();
+}
+
 bool Writer::writeComment(const QString &comment)
 {
 	if(m_encoding != Encoding::Text)
@@ -65,6 +65,7 @@ public:
 	 * This must be called before any write operation.
 	 */
 	void setEncoding(Encoding e);
+	Encoding encoding() const { return m_encoding; }
 
 	//! Open the file for writing
 	bool open();
@@ -75,6 +76,15 @@ public:
 	//! Enable periodic flushing of the output file
 	void setAutoflush();
 
+	/**
+	 * @brief Prefer compression ratio over speed
+	 *
+	 * This only affects block compressed (.dprecb) recordings, which
+	 * use a fast codec by default. This must be called before anything
+	 * is written.
+	 */
+	void setArchivalCompression();
+
 	/**
 	 * @brief Set the minimum time between messages before writing an Interval message
 	 *
@@ -117,6 +127,16 @@ public:
 	 */
 	bool writeMessage(const protocol::Message &msg);
 
+	/**
+	 * @brief Write already encoded data as is
+	 *
+	 * The data must be in this writer's encoding, e.g. the output of
+	 * another Writer that wrote to a buffer.
+	 *
+	 * @return false on error
+	 */
+	bool writeEncoded(const QByteArray &data);
+
 	/**
 	 * @brief Write a comment line
 	 *
@@ -23,6 +23,7 @@
 #include "opcommands.h"
 #include "serverlog.h"
 #include "serverconfig.h"
+#include "metrics.h"
 
 #include "../net/messagequeue.h"
 #include "../net/control.h"
@@ -31,6 +32,7 @@
 #include <QSslSocket>
 #include <QStringList>
 #include <QPointer>
+#include <QElapsedTimer>
 
 namespace server {
 
@@ -45,6 +47,8 @@ struct Client::Private {
 	QList<MessagePtr> holdqueue;
 	int historyPosition;
 
+	QElapsedTimer connectedTimer;
+
 	int id;
 	QString username;
 	QString extAuthId;
@@ -61,6 +65,7 @@ struct Client::Private {
 	{
 		Q_ASSERT(socket);
 		Q_ASSERT(logger);
+		connectedTimer.start();
 	}
 };
 
@@ -74,6 +79,17 @@ Client::Client(QTcpSocket *socket, ServerLog *logger, QObject *parent)
 	connect(d->socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError(QAbstractSocket::SocketError)));
 	connect(d->msgqueue, &protocol::MessageQueue::messageAvailable, this, &Client::receiveMessages);
 	connect(d->msgqueue, &protocol::MessageQueue::badData, this, &Client::gotBadData);
+
+	connect(d->msgqueue, &protocol::MessageQueue::bytesReceived, this, [this](int count) {
+		ServerMetrics::instance().bytesReceived.add(count);
+		if(d->session)
+			d->session->addBytesReceived(count);
+	});
+	connect(d->msgqueue, &protocol::MessageQueue::bytesSent, this, [this](int count) {
+		ServerMetrics::instance().bytesSent.add(count);
+		if(d->session)
+			d->session->addBytesSent(count);
+	});
 }
 
 Client::~Client()
@@ -248,6 +264,16 @@ void Client::setRandomLag(uint lag)
 }
 #endif
 
+int Client::uploadQueueBytes() const
+{
+	return d->msgqueue->uploadQueueBytes();
+}
+
+qint64 Client::connectedTime() const
+{
+	return d->connectedTimer.elapsed();
+}
+
 QHostAddress Client::peerAddress() const
 {
 	return d->socket->peerAddress();
@@ -263,15 +289,26 @@ void Client::sendNextHistoryBatch()
 
 	d->session->historyCacheCleanup();
 
+	ServerMetrics &metrics = ServerMetrics::instance();
+
+	QElapsedTimer batchTimer;
+	batchTimer.start();
+
 	QList<protocol::MessagePtr> batch;
 	int batchLast;
 	std::tie(batch, batchLast) = d->session->history()->getBatch(d->historyPosition);
 	d->historyPosition = batchLast;
+
+	metrics.historyBatchLatency.observe(batchTimer.nsecsElapsed() / 1000);
+	for(const protocol::MessagePtr &msg : batch)
+		metrics.messageSent(*msg);
+
 	d->msgqueue->send(batch);
 }
 
 void Client::sendDirectMessage(protocol::MessagePtr msg)
 {
+	ServerMetrics::instance().messageSent(*msg);
 	d->msgqueue->send(msg);
 }
 
@@ -283,13 +320,16 @@ void Client::sendSystemChat(const QString &message)
 		QJsonObject()
 	};
 
-	d->msgqueue->send(MessagePtr(new protocol::Command(0, msg.toJson())));
+	MessagePtr cmd(new protocol::Command(0, msg.toJson()));
+	ServerMetrics::instance().messageSent(*cmd);
+	d->msgqueue->send(cmd);
 }
 
 void Client::receiveMessages()
 {
 	while(d->msgqueue->isPending()) {
 		MessagePtr msg = d->msgqueue->getPending();
+		ServerMetrics::instance().messageReceived(*msg);
 
 		if(d->session == nullptr) {
 			// No session? We must be in the login phase
@@ -119,6 +119,12 @@ public:
 	 */
 	void setConnectionTimeout(int timeout);
 
+	//! Get the number of bytes waiting to be sent to this client
+	int uploadQueueBytes() const;
+
+	//! Get the time since the client connected (in milliseconds)
+	qint64 connectedTime() const;
+
 #ifndef NDEBUG
 	void setRandomLag(uint lag);
 #endif
@@ -0,0 +1,173 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "credentialverifier.h"
+#include "metrics.h"
+#include "../util/passwordhash.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+
+namespace server {
+
+namespace {
+
+class CheckRunnable : public QRunnable
+{
+public:
+	CheckRunnable(CredentialVerifier *verifier, quint64 id, const CredentialVerifier::CheckFn &check)
+		: m_verifier(verifier), m_id(id), m_check(check)
+	{ }
+
+	void run() override
+	{
+		emit m_verifier->checkFinished(m_id, m_check());
+	}
+
+private:
+	CredentialVerifier *m_verifier;
+	quint64 m_id;
+	CredentialVerifier::CheckFn m_check;
+};
+
+}
+
+CredentialVerifier::CredentialVerifier(QObject *parent)
+	: QObject(parent),
+	  m_pool(new QThreadPool(this)),
+	  m_maxThreads(qMax(1, QThread::idealThreadCount())),
+	  m_perAddressLimit(2),
+	  m_maxQueueLength(256),
+	  m_perAddressQueueLength(8),
+	  m_lastId(0),
+	  m_completed(0),
+	  m_overloaded(0),
+	  m_totalLatency(0),
+	  m_maxLatency(0)
+{
+	m_pool->setMaxThreadCount(m_maxThreads);
+	connect(this, &CredentialVerifier::checkFinished, this, &CredentialVerifier::onCheckFinished, Qt::QueuedConnection);
+}
+
+CredentialVerifier::~CredentialVerifier()
+{
+	// The runnables refer to this object
+	m_pool->waitForDone();
+}
+
+void CredentialVerifier::setMaxThreads(int threads)
+{
+	m_maxThreads = qMax(1, threads);
+	m_pool->setMaxThreadCount(m_maxThreads);
+	startJobs();
+}
+
+void CredentialVerifier::verify(const QHostAddress &address, QObject *context, CheckFn check, CallbackFn callback)
+{
+	int &queued = m_queuedPerAddress[address];
+	if(m_queue.size() >= m_maxQueueLength || queued >= m_perAddressQueueLength) {
+		if(queued == 0)
+			m_queuedPerAddress.remove(address);
+		++m_overloaded;
+		callback(Overloaded);
+		return;
+	}
+
+	Job job { ++m_lastId, address, context, check, callback, QElapsedTimer() };
+	job.timer.start();
+	m_queue << job;
+	++queued;
+
+	startJobs();
+}
+
+void CredentialVerifier::verifyPassword(const QHostAddress &address, QObject *context, const QString &password, const QByteArray &hash, CallbackFn callback)
+{
+	verify(address, context, [password, hash]() { return passwordhash::check(password, hash); }, callback);
+}
+
+void CredentialVerifier::startJobs()
+{
+	for(int i=0;i<m_queue.size() && m_running.size() < m_maxThreads;) {
+		const Job &job = m_queue.at(i);
+
+		// Skip jobs whose context is already gone
+		if(job.context.isNull()) {
+			takeQueued(i);
+			continue;
+		}
+
+		int &running = m_runningPerAddress[job.address];
+		if(running >= m_perAddressLimit) {
+			++i;
+			continue;
+		}
+
+		++running;
+		m_pool->start(new CheckRunnable(this, job.id, job.check));
+		m_running[job.id] = takeQueued(i);
+	}
+}
+
+CredentialVerifier::Job CredentialVerifier::takeQueued(int index)
+{
+	const Job job = m_queue.takeAt(index);
+
+	auto queued = m_queuedPerAddress.find(job.address);
+	if(--queued.value() <= 0)
+		m_queuedPerAddress.erase(queued);
+
+	return job;
+}
+
+void CredentialVerifier::onCheckFinished(quint64 id, bool accepted)
+{
+	Q_ASSERT(m_running.contains(id));
+	const Job job = m_running.take(id);
+
+	auto running = m_runningPerAddress.find(job.address);
+	if(--running.value() <= 0)
+		m_runningPerAddress.erase(running);
+
+	const qint64 latency = job.timer.elapsed();
+	ServerMetrics::instance().loginVerificationLatency.observe(job.timer.nsecsElapsed() / 1000);
+	++m_completed;
+	m_totalLatency += latency;
+	m_maxLatency = qMax(m_maxLatency, latency);
+
+	startJobs();
+
+	if(!job.context.isNull())
+		job.callback(accepted ? Accepted : Rejected);
+}
+
+CredentialVerifier::Stats CredentialVerifier::stats() const
+{
+	return Stats {
+		m_queue.size(),
+		m_running.size(),
+		m_completed,
+		m_overloaded,
+		m_completed > 0 ? m_totalLatency / qint64(m_completed) : 0,
+		m_maxLatency
+	};
+}
+
+}
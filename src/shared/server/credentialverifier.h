@@ -0,0 +1,139 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DP_SERVER_CREDENTIALVERIFIER_H
+#define DP_SERVER_CREDENTIALVERIFIER_H
+
+#include <QObject>
+#include <QHostAddress>
+#include <QPointer>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <functional>
+
+class QThreadPool;
+
+namespace server {
+
+/**
+ * @brief Runs credential checks (password hashes, auth token signatures) in worker threads
+ *
+ * Checks are queued and run on a bounded thread pool, so expensive
+ * hash functions don't stall the event loop. The number of concurrently
+ * running and queued checks per client address is limited, so a single
+ * host can't hog all the workers or fill up the queue.
+ *
+ * The result callback is called in the thread this object lives in.
+ */
+class CredentialVerifier : public QObject
+{
+	Q_OBJECT
+public:
+	enum Result {
+		Accepted,  // the check passed
+		Rejected,  // the check failed
+		Overloaded // the check was not run because too many are already pending
+	};
+
+	typedef std::function<bool()> CheckFn;
+	typedef std::function<void(Result)> CallbackFn;
+
+	struct Stats {
+		int queued;              // checks waiting for a free worker
+		int running;             // checks being run right now
+		quint64 completed;       // total number of completed checks
+		quint64 overloaded;      // total number of checks refused
+		qint64 averageLatency;   // average time from submission to completion (ms)
+		qint64 maxLatency;       // longest time from submission to completion (ms)
+	};
+
+	explicit CredentialVerifier(QObject *parent=nullptr);
+	~CredentialVerifier();
+
+	//! Set the maximum number of worker threads
+	void setMaxThreads(int threads);
+
+	//! Set the maximum number of concurrently running checks per client address
+	void setPerAddressLimit(int limit) { m_perAddressLimit = qMax(1, limit); }
+
+	//! Set the maximum number of checks that may be waiting for a worker
+	void setMaxQueueLength(int length) { m_maxQueueLength = length; }
+
+	//! Set the maximum number of checks per client address that may be waiting for a worker
+	void setPerAddressQueueLength(int length) { m_perAddressQueueLength = length; }
+
+	/**
+	 * @brief Run a check in a worker thread
+	 *
+	 * The check function must be thread safe. Capture everything it needs by value.
+	 *
+	 * @param address the address of the client the check is for
+	 * @param context if this object is deleted before the check is done, the callback is not called
+	 * @param check the check function
+	 * @param callback function to call with the result
+	 */
+	void verify(const QHostAddress &address, QObject *context, CheckFn check, CallbackFn callback);
+
+	//! Check a password against a hash in a worker thread
+	void verifyPassword(const QHostAddress &address, QObject *context, const QString &password, const QByteArray &hash, CallbackFn callback);
+
+	//! Get queue and latency statistics
+	Stats stats() const;
+
+signals:
+	//! Emitted from a worker thread when a check is finished (internal)
+	void checkFinished(quint64 id, bool accepted);
+
+private slots:
+	void onCheckFinished(quint64 id, bool accepted);
+
+private:
+	struct Job {
+		quint64 id;
+		QHostAddress address;
+		QPointer<QObject> context;
+		CheckFn check;
+		CallbackFn callback;
+		QElapsedTimer timer;
+	};
+
+	void startJobs();
+	Job takeQueued(int index);
+
+	QThreadPool *m_pool;
+	int m_maxThreads;
+	int m_perAddressLimit;
+	int m_maxQueueLength;
+	int m_perAddressQueueLength;
+
+	QList<Job> m_queue;
+	QHash<quint64, Job> m_running;
+	QHash<QHostAddress, int> m_runningPerAddress;
+	QHash<QHostAddress, int> m_queuedPerAddress;
+	quint64 m_lastId;
+
+	quint64 m_completed;
+	quint64 m_overloaded;
+	qint64 m_totalLatency;
+	qint64 m_maxLatency;
+};
+
+}
+
+#endif
@@ -18,21 +18,79 @@
 */
 
 #include "filedhistory.h"
+#include "metrics.h"
 #include "../shared/util/passwordhash.h"
 #include "../shared/util/filename.h"
 #include "../shared/record/header.h"
+#include "../shared/record/blockcompression.h"
 #include "../shared/net/meta.h"
 
 #include <QFile>
+#include <QSaveFile>
+#include <QBuffer>
 #include <QJsonObject>
 #include <QVarLengthArray>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <QTimerEvent>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace server {
 
-// A block is closed when its size goes above this limit
-static const qint64 MAX_BLOCK_SIZE = 0xffff * 10;
+using recording::BlockCompressionDevice;
+
+static const int BLOCK_HEADER_LEN = BlockCompressionDevice::BLOCK_HEADER_LENGTH;
+
+// A block is closed when its size goes above this limit.
+// The last message may take it over by at most one maximum length message,
+// so a closed block always fits in a compressed file block.
+static const qint64 MAX_BLOCK_SIZE = BlockCompressionDevice::MAX_BLOCK_LENGTH - (0xffff + 4);
+
+//! Flush the file and wait until its content is on the disk
+static bool syncToDisk(QFile *file)
+{
+	if(!file->flush())
+		return false;
+#ifdef Q_OS_WIN
+	return _commit(file->handle()) == 0;
+#else
+	return fsync(file->handle()) == 0;
+#endif
+}
+
+//! Write the block compressed file magic and the recording header block
+static bool writeRecordingStart(QIODevice *out, const protocol::ProtocolVersion &version)
+{
+	// The recording header goes in a block of its own.
+	QBuffer header;
+	header.open(QBuffer::WriteOnly);
+
+	QJsonObject metadata;
+	metadata["version"] = version.asString(); // the hosting client's protocol version
+	recording::writeRecordingHeader(&header, metadata);
+
+	const QByteArray start = BlockCompressionDevice::magic()
+		+ BlockCompressionDevice::blockHeader(header.size(), header.size(), BlockCompressionDevice::Stored)
+		+ header.data();
+
+	return out->write(start) == start.length();
+}
+
+//! Compress a block of messages and write it as a closed block
+static bool writeClosedBlock(QIODevice *out, const QByteArray &content)
+{
+	BlockCompressionDevice::Codec codec;
+	const QByteArray compressed = BlockCompressionDevice::compressBlock(content, BlockCompressionDevice::Mode::Fast, &codec);
+	const QByteArray block = BlockCompressionDevice::blockHeader(compressed.length(), content.length(), codec) + compressed;
+
+	return out->write(block) == block.length();
+}
 
 FiledHistory::FiledHistory(const QDir &dir, QFile *journal, const QUuid &id, const QString &alias, const protocol::ProtocolVersion &version, const QString &founder, QObject *parent)
 	: SessionHistory(id, parent),
@@ -73,7 +131,7 @@ static QString uniqueRecordingFilename(const QDir &dir, const QUuid &id)
 	QString idstr = id.toString();
 	idstr = idstr.mid(1, idstr.length()-2);
 
-	return utils::uniqueFilename(dir, idstr, "dprec", false);
+	return utils::uniqueFilename(dir, idstr, "dprecb", false);
 }
 
 FiledHistory *FiledHistory::startNew(const QDir &dir, const QUuid &id, const QString &alias, const protocol::ProtocolVersion &version, const QString &founder, QObject *parent)
@@ -153,22 +211,103 @@ bool FiledHistory::initRecording()
 		return false;
 	}
 
-	QJsonObject metadata;
-	metadata["version"] = m_version.asString(); // the hosting client's protocol version
-	recording::writeRecordingHeader(m_recording, metadata);
+	// The recording is block compressed
+	if(!writeRecordingStart(m_recording, m_version)) {
+		qWarning() << filename << m_recording->errorString();
+		return false;
+	}
 
+	startBlock(firstIndex());
 	m_recording->flush();
 
 	m_journal->write(QString("FILE %1\n").arg(filename).toUtf8());
 	m_journal->flush();
 
-	m_blocks << Block {
-		m_recording->pos(),
-		firstIndex(),
-		0,
-		m_recording->pos(),
-		QList<protocol::MessagePtr>()
-		};
+	return true;
+}
+
+/**
+ * @brief Convert a session recorded by an older version to the block compressed format
+ *
+ * When called, m_recording should be the old uncompressed recording.
+ * It is replaced with a new file, which is written in full and synced
+ * to the disk before the journal is pointed at it. The old recording is
+ * removed only after that, and only if it could be read completely.
+ */
+bool FiledHistory::convertRecording()
+{
+	QFile *oldRecording = m_recording;
+	m_recording = nullptr;
+
+	const QJsonObject header = recording::readRecordingHeader(oldRecording);
+	m_version = protocol::ProtocolVersion::fromString(header["version"].toString());
+	if(header.isEmpty() || !m_version.isValid()) {
+		qWarning() << oldRecording->fileName() << "invalid header";
+		delete oldRecording;
+		return false;
+	}
+
+	const QString filename = uniqueRecordingFilename(m_dir, id());
+	qInfo() << "Converting" << oldRecording->fileName() << "to block compressed format" << filename;
+
+	QSaveFile newRecording(m_dir.absoluteFilePath(filename));
+	if(!newRecording.open(QFile::WriteOnly)) {
+		qWarning() << filename << newRecording.errorString();
+		delete oldRecording;
+		return false;
+	}
+
+	bool ok = writeRecordingStart(&newRecording, m_version);
+
+	QByteArray block;
+	QByteArray buffer;
+	bool readComplete = true;
+	while(ok && !oldRecording->atEnd()) {
+		if(!recording::readRecordingMessage(oldRecording, buffer)) {
+			readComplete = false;
+			break;
+		}
+
+		// Note: the buffer may be longer than the message
+		block.append(buffer.constData(), protocol::Message::sniffLength(buffer.constData()));
+		if(block.length() > MAX_BLOCK_SIZE) {
+			ok = writeClosedBlock(&newRecording, block);
+			block.clear();
+		}
+	}
+
+	if(ok && !block.isEmpty())
+		ok = writeClosedBlock(&newRecording, block);
+
+	// New messages will be appended to an open block at the end
+	if(ok)
+		ok = newRecording.write(BlockCompressionDevice::blockHeader(0, 0, BlockCompressionDevice::Open)) == BLOCK_HEADER_LEN;
+
+	if(!ok || !newRecording.commit()) {
+		qWarning() << filename << "conversion failed:" << newRecording.errorString();
+		delete oldRecording;
+		return false;
+	}
+
+	m_journal->write(QString("FILE %1\n").arg(filename).toUtf8());
+	if(!syncToDisk(m_journal)) {
+		qWarning() << m_journal->fileName() << m_journal->errorString();
+		delete oldRecording;
+		return false;
+	}
+
+	if(readComplete)
+		oldRecording->remove();
+	else
+		qWarning() << oldRecording->fileName() << "could not be read completely. Leaving it in place.";
+	delete oldRecording;
+
+	// The new recording is loaded like any other
+	m_recording = new QFile(m_dir.absoluteFilePath(filename), this);
+	if(!m_recording->open(QFile::ReadWrite)) {
+		qWarning() << filename << m_recording->errorString();
+		return false;
+	}
 
 	return true;
 }
@@ -300,10 +439,32 @@ bool FiledHistory::load()
 		return false;
 	}
 
-	// Recording must have a valid header
-	QJsonObject header = recording::readRecordingHeader(m_recording);
+	// Sessions stored by older versions are uncompressed
+	if(!recordingFile.endsWith(".dprecb") && !convertRecording())
+		return false;
+
+	if(!completePendingBlock())
+		return false;
+
+	// Recording must have a valid header. It is stored in the first block.
+	if(m_recording->read(BlockCompressionDevice::MAGIC_LENGTH) != BlockCompressionDevice::magic()) {
+		qWarning() << m_recording->fileName() << "not a block compressed file";
+		return false;
+	}
+
+	QJsonObject header;
+	{
+		int compressedLen, uncompressedLen;
+		BlockCompressionDevice::Codec codec;
+		if(BlockCompressionDevice::parseBlockHeader(m_recording->read(BLOCK_HEADER_LEN), &compressedLen, &uncompressedLen, &codec)) {
+			QByteArray headerBlock = BlockCompressionDevice::decompressBlock(m_recording->read(compressedLen), codec, uncompressedLen);
+			QBuffer buffer(&headerBlock);
+			buffer.open(QBuffer::ReadOnly);
+			header = recording::readRecordingHeader(&buffer);
+		}
+	}
 	if(header.isEmpty()) {
-		qWarning() << recordingFile << "invalid header";
+		qWarning() << m_recording->fileName() << "invalid header";
 		return false;
 	}
 
@@ -318,16 +479,12 @@ bool FiledHistory::load()
 		return false;
 	}
 
-	qint64 startOffset = m_recording->pos();
-
 	// Scan the recording file and build the index of blocks
 	if(!scanBlocks()) {
 		qWarning() << recordingFile << "error occurred during indexing";
 		return false;
 	}
 
-	historyLoaded(m_blocks.last().endOffset-startOffset, m_blocks.last().startIndex+m_blocks.last().count);
-
 	// If a loaded session is empty, the server expects the first joining client
 	// to supply the initial content, while the client is expecting to join
 	// an existing session.
@@ -342,69 +499,109 @@ bool FiledHistory::load()
 bool FiledHistory::scanBlocks()
 {
 	Q_ASSERT(m_blocks.isEmpty());
-	// Note: m_recording should be at the start of the recording
-
-	m_blocks << Block {
-		m_recording->pos(),
-		firstIndex(),
-		0,
-		m_recording->pos(),
-		QList<protocol::MessagePtr>()
-	};
+	// Note: m_recording should be at the start of the first message block
 
 	QSet<uint8_t> users;
+	qint64 size = 0;
+	bool isOpen = false;
 
-	do {
-		Block &b = m_blocks.last();
-		uint8_t msgType, ctxId;
-
-		const int msglen = recording::skipRecordingMessage(m_recording, &msgType, &ctxId);
-		if(msglen<0) {
-			// Truncated message encountered.
-			// Rewind back to the end of the previous message
-			qWarning() << m_recording->fileName() << "Recording truncated at" << int(b.endOffset);
-			m_recording->seek(b.endOffset);
+	while(!isOpen && !m_recording->atEnd()) {
+		const qint64 offset = m_recording->pos();
+
+		int compressedLen, uncompressedLen;
+		BlockCompressionDevice::Codec codec;
+		if(!BlockCompressionDevice::parseBlockHeader(m_recording->read(BLOCK_HEADER_LEN), &compressedLen, &uncompressedLen, &codec)) {
+			qWarning() << m_recording->fileName() << "Recording truncated at" << offset;
+			m_recording->seek(offset);
 			break;
 		}
-		++m_blocks.last().count;
-
-		b.endOffset += msglen;
-		Q_ASSERT(b.endOffset == m_recording->pos());
-
-		if(b.endOffset-b.startOffset >= MAX_BLOCK_SIZE) {
-			m_blocks << Block {
-				b.endOffset,
-				b.startIndex+b.count,
-				0,
-				b.endOffset,
-				QList<protocol::MessagePtr>()
-			};
+
+		QByteArray data;
+		isOpen = codec == BlockCompressionDevice::Open;
+		if(isOpen) {
+			// The length fields of the open block are updated only now and then,
+			// so it is read up to the end of the file
+			data = m_recording->readAll();
+		} else {
+			data = BlockCompressionDevice::decompressBlock(m_recording->read(compressedLen), codec, uncompressedLen);
+			if(data.isNull()) {
+				qWarning() << m_recording->fileName() << "Truncated or corrupt block at" << offset;
+				m_recording->seek(offset);
+				break;
+			}
 		}
 
-		switch(msgType) {
-		case protocol::MSG_USER_JOIN: users.insert(ctxId); break;
-		case protocol::MSG_USER_LEAVE:
-			users.remove(ctxId);
-			idQueue().reserveId(ctxId);
-			break;
+		Block b {
+			offset,
+			m_blocks.isEmpty() ? firstIndex() : m_blocks.last().startIndex + m_blocks.last().count,
+			0,
+			m_recording->pos(),
+			QList<protocol::MessagePtr>()
+		};
+
+		QBuffer buffer(&data);
+		buffer.open(QBuffer::ReadOnly);
+		while(!buffer.atEnd()) {
+			const qint64 msgStart = buffer.pos();
+			uint8_t msgType, ctxId;
+
+			const int msglen = recording::skipRecordingMessage(&buffer, &msgType, &ctxId);
+			if(msglen<0) {
+				// Truncated message encountered.
+				// Rewind back to the end of the previous message
+				qWarning() << m_recording->fileName() << "Recording truncated in block at" << offset;
+				if(isOpen)
+					b.endOffset = offset + BLOCK_HEADER_LEN + msgStart;
+				break;
+			}
+			++b.count;
+			size += msglen;
+
+			switch(msgType) {
+			case protocol::MSG_USER_JOIN: users.insert(ctxId); break;
+			case protocol::MSG_USER_LEAVE:
+				users.remove(ctxId);
+				idQueue().reserveId(ctxId);
+				break;
+			}
 		}
-	} while(!m_recording->atEnd());
+
+		m_blocks << b;
+	}
+
+	// Anything after the last valid message is discarded
+	const qint64 end = isOpen ? m_blocks.last().endOffset : m_recording->pos();
+	if(m_recording->size() > end)
+		m_recording->resize(end);
+	m_recording->seek(end);
+
+	// New messages are appended to the open block at the end
+	if(isOpen)
+		updateOpenBlockHeader();
+	else
+		startBlock(m_blocks.isEmpty() ? firstIndex() : m_blocks.last().startIndex + m_blocks.last().count);
 
 	// There should be no users at the end of the recording.
 	for(const uint8_t user : users) {
 		protocol::UserLeave msg(user);
-		m_blocks.last().count++;
-		m_blocks.last().endOffset += msg.length();
 		char buf[16];
-		msg.serialize(buf);
-		m_recording->write(buf, msg.length());
+		const int len = msg.serialize(buf);
+		appendMessage(buf, len);
+		size += len;
 		idQueue().reserveId(user);
 	}
+
+	m_recording->flush();
+	historyLoaded(size, m_blocks.last().startIndex+m_blocks.last().count);
 	return true;
 }
 
 void FiledHistory::terminate()
 {
+	// Leave an archived recording fully compressed
+	if(m_archive)
+		closeBlock();
+
 	m_recording->close();
 	m_journal->close();
 
@@ -419,25 +616,201 @@ void FiledHistory::terminate()
 
 void FiledHistory::closeBlock()
 {
+	Block &b = m_blocks.last();
+
+	// Check if anything needs to be done
+	if(b.count==0) {
+		// Flush the output files just to be safe
+		updateOpenBlockHeader();
+		m_journal->flush();
+		return;
+	}
+
+	// Compress the block and write it over the uncompressed content.
+	// A copy of the compressed block is saved first, so a crash in the
+	// middle of the write can be recovered from when the session is loaded.
+	QElapsedTimer timer;
+	timer.start();
+
+	const QByteArray content = readBlock(m_blocks.size()-1);
+	const int length = b.endOffset - b.startOffset - BLOCK_HEADER_LEN;
+
+	BlockCompressionDevice::Codec codec = BlockCompressionDevice::Stored;
+	QByteArray compressed;
+	if(content.length() == length) {
+		compressed = BlockCompressionDevice::compressBlock(content, BlockCompressionDevice::Mode::Fast, &codec);
+	} else {
+		qWarning() << m_recording->fileName() << "read error! Leaving block uncompressed";
+	}
+
+	const QByteArray block = BlockCompressionDevice::blockHeader(compressed.length(), length, codec) + compressed;
+	if(codec != BlockCompressionDevice::Stored && !savePendingBlock(b.startOffset, block)) {
+		qWarning() << m_recording->fileName() << "couldn't save pending block! Leaving block uncompressed";
+		codec = BlockCompressionDevice::Stored;
+	}
+
+	if(codec == BlockCompressionDevice::Stored) {
+		// Once the lengths in the open block's header are up to date,
+		// only the codec byte changes when the block is closed.
+		updateOpenBlockHeader();
+		syncToDisk(m_recording);
+		m_recording->seek(b.startOffset);
+		m_recording->write(BlockCompressionDevice::blockHeader(length, length, codec));
+		m_recording->seek(b.endOffset);
+
+	} else {
+		m_recording->resize(b.startOffset);
+		m_recording->seek(b.startOffset);
+		m_recording->write(block);
+		b.endOffset = m_recording->pos();
+
+		// The pending block must be gone before anything is appended after this one
+		if(!syncToDisk(m_recording))
+			qWarning() << m_recording->fileName() << "sync failed:" << m_recording->errorString();
+		QFile::remove(pendingBlockFilename());
+	}
+
+	ServerMetrics &metrics = ServerMetrics::instance();
+	metrics.historyBlockBytes.add(length);
+	metrics.historyBlockCompressedBytes.add(b.endOffset - b.startOffset - BLOCK_HEADER_LEN);
+	metrics.historyBlockCompressionLatency.observe(timer.nsecsElapsed() / 1000);
+
+	// Start a new block
+	startBlock(b.startIndex + b.count);
+
 	// Flush the output files just to be safe
 	m_recording->flush();
 	m_journal->flush();
+}
 
-	// Check if anything needs to be done
-	Block &b = m_blocks.last();
-	if(b.count==0)
-		return;
+QString FiledHistory::pendingBlockFilename() const
+{
+	return m_recording->fileName() + ".pending";
+}
+
+/**
+ * @brief Save a copy of a compressed block before it is written in place
+ *
+ * The file contains the block's offset in the recording, followed by the block itself.
+ */
+bool FiledHistory::savePendingBlock(qint64 offset, const QByteArray &block)
+{
+	uchar offsetBytes[8];
+	qToBigEndian(offset, offsetBytes);
+
+	QSaveFile f(pendingBlockFilename());
+	if(
+		!f.open(QFile::WriteOnly) ||
+		f.write(reinterpret_cast<const char*>(offsetBytes), 8) != 8 ||
+		f.write(block) != block.length() ||
+		!f.commit()
+	) {
+		qWarning() << f.fileName() << f.errorString();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Finish writing a block, if the server went down while closeBlock() was writing it
+ */
+bool FiledHistory::completePendingBlock()
+{
+	QFile f(pendingBlockFilename());
+	if(!f.exists())
+		return true;
+
+	if(!f.open(QFile::ReadOnly)) {
+		qWarning() << f.fileName() << f.errorString();
+		return false;
+	}
+
+	const QByteArray offsetBytes = f.read(8);
+	const QByteArray block = f.readAll();
+	f.close();
+
+	int compressedLen, uncompressedLen;
+	BlockCompressionDevice::Codec codec;
+	if(
+		offsetBytes.length() != 8 ||
+		!BlockCompressionDevice::parseBlockHeader(block, &compressedLen, &uncompressedLen, &codec) ||
+		block.length() != BLOCK_HEADER_LEN + compressedLen
+	) {
+		qWarning() << f.fileName() << "invalid pending block";
+		return false;
+	}
+
+	const qint64 offset = qFromBigEndian<qint64>(reinterpret_cast<const uchar*>(offsetBytes.constData()));
+
+	// If the block was written completely, new messages may already follow it
+	m_recording->seek(offset);
+	if(m_recording->read(block.length()) != block) {
+		qWarning() << m_recording->fileName() << "completing block interrupted at" << offset;
+		if(
+			!m_recording->resize(offset) ||
+			!m_recording->seek(offset) ||
+			m_recording->write(block) != block.length() ||
+			!syncToDisk(m_recording)
+		) {
+			qWarning() << m_recording->fileName() << m_recording->errorString();
+			return false;
+		}
+	}
+
+	m_recording->seek(0);
+	f.remove();
+	return true;
+}
+
+void FiledHistory::startBlock(int startIndex)
+{
+	const qint64 offset = m_recording->pos();
+	m_recording->write(BlockCompressionDevice::blockHeader(0, 0, BlockCompressionDevice::Open));
 
-	// Mark last block as closed and start a new one
 	m_blocks << Block {
-				b.endOffset,
-				b.startIndex+b.count,
-				0,
-				b.endOffset,
-				QList<protocol::MessagePtr>()
+		offset,
+		startIndex,
+		0,
+		m_recording->pos(),
+		QList<protocol::MessagePtr>()
 	};
 }
 
+void FiledHistory::updateOpenBlockHeader()
+{
+	const Block &b = m_blocks.last();
+	const int length = b.endOffset - b.startOffset - BLOCK_HEADER_LEN;
+
+	m_recording->seek(b.startOffset);
+	m_recording->write(BlockCompressionDevice::blockHeader(length, length, BlockCompressionDevice::Open));
+	m_recording->seek(b.endOffset);
+	m_recording->flush();
+}
+
+//! Read the uncompressed content of a block
+QByteArray FiledHistory::readBlock(int index) const
+{
+	const Block &b = m_blocks.at(index);
+	const qint64 prevPos = m_recording->pos();
+
+	QByteArray content;
+	if(index == m_blocks.size()-1) {
+		// The open block is stored uncompressed and its header may not be up to date
+		m_recording->seek(b.startOffset + BLOCK_HEADER_LEN);
+		content = m_recording->read(b.endOffset - b.startOffset - BLOCK_HEADER_LEN);
+
+	} else {
+		int compressedLen, uncompressedLen;
+		BlockCompressionDevice::Codec codec;
+		m_recording->seek(b.startOffset);
+		if(BlockCompressionDevice::parseBlockHeader(m_recording->read(BLOCK_HEADER_LEN), &compressedLen, &uncompressedLen, &codec))
+			content = BlockCompressionDevice::decompressBlock(m_recording->read(compressedLen), codec, uncompressedLen);
+	}
+
+	m_recording->seek(prevPos);
+	return content;
+}
+
 void FiledHistory::setPasswordHash(const QByteArray &password)
 {
 	if(m_password != password) {
@@ -532,12 +905,16 @@ std::tuple<QList<protocol::MessagePtr>, int> FiledHistory::getBatch(int after) c
 
 	if(b.messages.isEmpty() && b.count>0) {
 		// Load the block worth of messages to memory if not already loaded
-		const qint64 prevPos = m_recording->pos();
 		qDebug() << m_recording->fileName() << "loading block" << i;
-		m_recording->seek(b.startOffset);
+		ServerMetrics::instance().historyBlockLoads.add();
+
+		QByteArray content = readBlock(i);
+		QBuffer blockBuffer(&content);
+		blockBuffer.open(QBuffer::ReadOnly);
+
 		QByteArray buffer;
 		for(int m=0;m<b.count;++m) {
-			if(!recording::readRecordingMessage(m_recording, buffer)) {
+			if(!recording::readRecordingMessage(&blockBuffer, buffer)) {
 				qWarning() << m_recording->fileName() << "read error!";
 				m_recording->close();
 				break;
@@ -550,8 +927,6 @@ std::tuple<QList<protocol::MessagePtr>, int> FiledHistory::getBatch(int after) c
 			}
 			const_cast<Block&>(b).messages << protocol::MessagePtr(msg);
 		}
-
-		m_recording->seek(prevPos);
 	}
 	Q_ASSERT(b.messages.size() == b.count);
 	return std::make_tuple(b.messages.mid(idxOffset), b.startIndex+b.count-1);
@@ -562,36 +937,49 @@ void FiledHistory::historyAdd(const protocol::MessagePtr &msg)
 	QVarLengthArray<char> buf(msg->length());
 	const int len = msg->serialize(buf.data());
 	Q_ASSERT(len == buf.length());
-	m_recording->write(buf.data(), len);
-
-	Block &b = m_blocks.last();
-	b.count++;
-	b.endOffset += len;
 
 	// Add message to cache, if already active (if cache is empty, it will be loaded from disk when needed)
+	Block &b = m_blocks.last();
 	if(!b.messages.isEmpty())
 		b.messages.append(msg);
 
-	if(b.endOffset-b.startOffset > MAX_BLOCK_SIZE)
-		closeBlock();
+	appendMessage(buf.data(), len);
 }
 
-void FiledHistory::historyReset(const QList<protocol::MessagePtr> &newHistory)
+void FiledHistory::appendMessage(const char *data, int len)
 {
-	QFile *oldRecording = m_recording;
-	oldRecording->close();
+	m_recording->write(data, len);
 
-	m_recording = nullptr;
-	m_blocks.clear();
-	initRecording();
+	Block &b = m_blocks.last();
+	b.count++;
+	b.endOffset += len;
 
-	// Remove old recording after the new one has been created so
-	// that the new file will not have the same name.
-	if(m_archive)
-		oldRecording->rename(oldRecording->fileName() + ".archived");
-	else
-		oldRecording->remove();
-	delete oldRecording;
+	if(b.endOffset-b.startOffset-BLOCK_HEADER_LEN > MAX_BLOCK_SIZE)
+		closeBlock();
+}
+
+void FiledHistory::historyReset(const QList<protocol::MessagePtr> &newHistory)
+{
+	// A freshly created recording (e.g. one being initialized from a template)
+	// has nothing to replace, so the new history can simply be appended to it.
+	const bool isEmpty = m_blocks.size() == 1 && m_blocks.first().count == 0;
+
+	if(!isEmpty) {
+		QFile *oldRecording = m_recording;
+		oldRecording->close();
+
+		m_recording = nullptr;
+		m_blocks.clear();
+		initRecording();
+
+		// Remove old recording after the new one has been created so
+		// that the new file will not have the same name.
+		if(m_archive)
+			oldRecording->rename(oldRecording->fileName() + ".archived");
+		else
+			oldRecording->remove();
+		delete oldRecording;
+	}
 
 	for(const protocol::MessagePtr &msg : newHistory)
 		historyAdd(msg);
@@ -630,8 +1018,8 @@ void FiledHistory::historyRemoveBan(int id)
 
 void FiledHistory::timerEvent(QTimerEvent *)
 {
-	if(m_recording)
-		m_recording->flush();
+	if(m_recording && m_recording->isOpen())
+		updateOpenBlockHeader();
 }
 
 void FiledHistory::addAnnouncement(const QString &url)
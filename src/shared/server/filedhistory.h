@@ -115,18 +115,27 @@ private:
 	FiledHistory(const QDir &dir, QFile *journal, const QUuid &id, QObject *parent);
 
 	struct Block {
-		qint64 startOffset;
+		qint64 startOffset; // position of the block header in the file
 		int startIndex;
 		int count;
-		qint64 endOffset;
+		qint64 endOffset;   // end of the block's (compressed) content in the file
 		QList<protocol::MessagePtr> messages;
 	};
 
 	bool create();
 	bool load();
+	bool convertRecording();
 	bool scanBlocks();
 	bool initRecording();
 
+	void startBlock(int startIndex);
+	void updateOpenBlockHeader();
+	QString pendingBlockFilename() const;
+	bool savePendingBlock(qint64 offset, const QByteArray &block);
+	bool completePendingBlock();
+	void appendMessage(const char *data, int len);
+	QByteArray readBlock(int index) const;
+
 	QDir m_dir;
 	QFile *m_journal;
 	QFile *m_recording;
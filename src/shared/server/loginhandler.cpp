@@ -24,6 +24,7 @@
 #include "serverconfig.h"
 #include "serverlog.h"
 #include "templateloader.h"
+#include "credentialverifier.h"
 
 #include "../net/control.h"
 #include "../util/authtoken.h"
@@ -35,6 +36,7 @@
 #include <QRegularExpression>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <QPointer>
 
 #ifndef Q_FALLTHROUGH // not present in Qt 5.6
 #define Q_FALLTHROUGH() (void)0
@@ -43,11 +45,10 @@
 namespace server {
 
 LoginHandler::LoginHandler(Client *client, SessionServer *server) :
-	QObject(client), m_client(client), m_server(server), m_extauth_nonce(0), m_hostPrivilege(false), m_complete(false)
+	QObject(client), m_client(client), m_server(server), m_extauth_nonce(0), m_hostPrivilege(false), m_complete(false), m_verifying(false)
 {
 	connect(client, &Client::loginMessage, this, &LoginHandler::handleLoginMessage);
-	connect(server, &SessionServer::sessionChanged, this, &LoginHandler::announceSession);
-	connect(server, &SessionServer::sessionEnded, this, &LoginHandler::announceSessionEnd);
+	connect(server, &SessionServer::sessionListingUpdate, this, &LoginHandler::announceSessionListingUpdate);
 }
 
 void LoginHandler::startLoginProcess()
@@ -86,83 +87,19 @@ void LoginHandler::startLoginProcess()
 
 void LoginHandler::announceServerInfo()
 {
-	protocol::ServerReply greeting;
-	greeting.type = protocol::ServerReply::LOGIN;
-	greeting.message = "Welcome";
-	greeting.reply["title"] = m_server->config()->getConfigString(config::ServerTitle);
-	QJsonArray sessions = m_server->sessionDescriptions();
-	if(m_server->templateLoader()) {
-		// Add session templates to list, if not shadowed by live sessions
-		QJsonArray templates = m_server->templateLoader()->templateDescriptions();
-		QStringList aliases;
-		for(const QJsonValue &v : sessions) {
-			const QJsonObject o = v.toObject();
-			const QString alias = o.value("alias").toString();
-			if(!alias.isEmpty())
-				aliases << alias;
-		}
-		for(const QJsonValue &v : templates) {
-			if(!aliases.contains(v.toObject().value("alias").toString()))
-				sessions << v;
-		}
-	}
-	greeting.reply["sessions"] = sessions;
-
-	if(!send(greeting)) {
-		// Reply was too long to fit in the message envelope!
-		// Split the reply into separte announcements and send it in pieces
-		protocol::ServerReply piece;
-		piece.type = greeting.type;
-		piece.message = greeting.message;
-		piece.reply["title"] = greeting.reply["title"];
-
-		if(!greeting.reply["title"].toString().isEmpty()) {
-			send(piece);
-		}
-
-		for(const QJsonValue &session : sessions) {
-			QJsonArray a;
-			a << session;
-			piece.reply["sessions"] = a;
-			send(piece);
-			// Include the title as part of the first message, but not the later ones
-			piece.reply.remove("title");
-		}
-	}
-}
-
-void LoginHandler::announceSession(const QJsonObject &session)
-{
-	Q_ASSERT(session.contains("id"));
-
-	if(m_state != WAIT_FOR_LOGIN)
+	if(m_complete)
 		return;
 
-	protocol::ServerReply greeting;
-	greeting.type = protocol::ServerReply::LOGIN;
-	greeting.message = "New session";
-
-	QJsonArray s;
-	s << session;
-	greeting.reply["sessions"] = s;
-
-	send(greeting);
+	for(const protocol::MessagePtr &msg : m_server->sessionListing())
+		m_client->sendDirectMessage(msg);
 }
 
-void LoginHandler::announceSessionEnd(const QString &id)
+void LoginHandler::announceSessionListingUpdate(protocol::MessagePtr msg)
 {
-	if(m_state != WAIT_FOR_LOGIN)
+	if(m_state != WAIT_FOR_LOGIN || m_complete)
 		return;
 
-	protocol::ServerReply greeting;
-	greeting.type = protocol::ServerReply::LOGIN;
-	greeting.message = "Session ended";
-
-	QJsonArray s;
-	s << id;
-	greeting.reply["remove"] = s;
-
-	send(greeting);
+	m_client->sendDirectMessage(msg);
 }
 
 void LoginHandler::handleLoginMessage(protocol::MessagePtr msg)
@@ -174,6 +111,13 @@ void LoginHandler::handleLoginMessage(protocol::MessagePtr msg)
 
 	protocol::ServerCommand cmd = msg.cast<protocol::Command>().cmd();
 
+	if(m_verifying) {
+		// Clients must wait for a reply before sending the next login command
+		m_client->log(Log().about(Log::Level::Error, Log::Topic::RuleBreak).message("Login command received while verifying credentials: " + cmd.cmd));
+		m_client->disconnectError("invalid message");
+		return;
+	}
+
 	if(m_state == WAIT_FOR_SECURE) {
 		// Secure mode: wait for STARTTLS before doing anything
 		if(cmd.cmd == "startTls") {
@@ -222,8 +166,34 @@ void LoginHandler::handleIdentMessage(const protocol::ServerCommand &cmd)
 		return;
 	}
 
-	const RegisteredUser userAccount = m_server->config()->getUserAccount(username, password);
+	const RegisteredUser userAccount = m_server->config()->findUserAccount(username);
 
+	if(userAccount.status == RegisteredUser::Ok) {
+		// Check the password in a worker thread and continue when done
+		m_verifying = true;
+		m_server->credentialVerifier()->verifyPassword(m_client->peerAddress(), this, password, userAccount.passwordHash,
+			[this, cmd, username, password, userAccount](CredentialVerifier::Result result) {
+				m_verifying = false;
+				if(result == CredentialVerifier::Overloaded) {
+					sendError("busy", "Server is busy. Try again later.");
+					return;
+				}
+
+				RegisteredUser checkedAccount = userAccount;
+				if(result == CredentialVerifier::Rejected) {
+					checkedAccount.status = RegisteredUser::BadPass;
+					checkedAccount.flags.clear();
+				}
+				identify(cmd, username, password, checkedAccount);
+			});
+
+	} else {
+		identify(cmd, username, password, userAccount);
+	}
+}
+
+void LoginHandler::identify(const protocol::ServerCommand &cmd, const QString &username, const QString &password, const RegisteredUser &userAccount)
+{
 	if(userAccount.status != RegisteredUser::NotFound && cmd.kwargs.contains("extauth")) {
 		// This should never happen. If it does, it means there's a bug in the client
 		// or someone is probing for bugs in the server.
@@ -248,25 +218,37 @@ void LoginHandler::handleIdentMessage(const protocol::ServerCommand &cmd)
 				}
 				const AuthToken extAuthToken(cmd.kwargs["extauth"].toString().toUtf8());
 				const QByteArray key = QByteArray::fromBase64(m_server->config()->getConfigString(config::ExtAuthKey).toUtf8());
-				if(!extAuthToken.checkSignature(key)) {
-					sendError("extAuthError", "Ext auth token signature mismatch!");
-					return;
-				}
-				if(!extAuthToken.validatePayload(m_server->config()->getConfigString(config::ExtAuthGroup), m_extauth_nonce)) {
-					sendError("extAuthError", "Ext auth token is invalid!");
-					return;
-				}
 
-				// Token is valid: log in as an authenticated user
-				const QJsonObject ea = extAuthToken.payload();
-				const QJsonValue uid = ea["uid"];
-
-				authLoginOk(
-					ea["username"].toString(),
-					uid.isDouble() ? QString::number(uid.toInt()) : uid.toString(),
-					ea["flags"].toArray(),
-					m_server->config()->getConfigBool(config::ExtAuthMod)
-					);
+				// The signature is checked in a worker thread
+				m_verifying = true;
+				m_server->credentialVerifier()->verify(m_client->peerAddress(), this,
+					[extAuthToken, key]() { return extAuthToken.checkSignature(key); },
+					[this, extAuthToken](CredentialVerifier::Result result) {
+						m_verifying = false;
+						if(result == CredentialVerifier::Overloaded) {
+							sendError("busy", "Server is busy. Try again later.");
+							return;
+						}
+						if(result == CredentialVerifier::Rejected) {
+							sendError("extAuthError", "Ext auth token signature mismatch!");
+							return;
+						}
+						if(!extAuthToken.validatePayload(m_server->config()->getConfigString(config::ExtAuthGroup), m_extauth_nonce)) {
+							sendError("extAuthError", "Ext auth token is invalid!");
+							return;
+						}
+
+						// Token is valid: log in as an authenticated user
+						const QJsonObject ea = extAuthToken.payload();
+						const QJsonValue uid = ea["uid"];
+
+						authLoginOk(
+							ea["username"].toString(),
+							uid.isDouble() ? QString::number(uid.toInt()) : uid.toString(),
+							ea["flags"].toArray(),
+							m_server->config()->getConfigBool(config::ExtAuthMod)
+							);
+					});
 
 			} else {
 				// No ext-auth token provided: request it now
@@ -585,25 +567,51 @@ void LoginHandler::handleJoinMessage(const protocol::ServerCommand &cmd)
 
 	if(!m_client->isModerator()) {
 		// Non-moderators have to obey access restrictions
-		if(session->banlist().isBanned(m_client->peerAddress(), m_client->extAuthId())) {
-			sendError("banned", "You have been banned from this session");
-			return;
-		}
-		if(session->isClosed()) {
-			sendError("closed", "This session is closed");
-			return;
-		}
-		if(session->isAuthOnly() && !m_client->isAuthenticated()) {
-			sendError("authOnly", "This session does not allow guest logins");
+		if(!checkSessionAccess(session))
 			return;
-		}
 
-		if(!session->checkPassword(cmd.kwargs.value("password").toString())) {
-			sendError("badPassword", "Incorrect password");
+		if(session->hasPassword()) {
+			// Check the password in a worker thread and continue when done
+			QPointer<Session> s = session;
+			m_verifying = true;
+			m_server->credentialVerifier()->verifyPassword(m_client->peerAddress(), this, cmd.kwargs.value("password").toString(), session->passwordHash(),
+				[this, s](CredentialVerifier::Result result) {
+					m_verifying = false;
+					if(result == CredentialVerifier::Overloaded)
+						sendError("busy", "Server is busy. Try again later.");
+					else if(result == CredentialVerifier::Rejected)
+						sendError("badPassword", "Incorrect password");
+					else if(s.isNull())
+						sendError("notFound", "Session not found!");
+					else if(checkSessionAccess(s)) // restrictions may have changed during the check
+						joinSession(s);
+				});
 			return;
 		}
 	}
 
+	joinSession(session);
+}
+
+bool LoginHandler::checkSessionAccess(Session *session)
+{
+	if(session->banlist().isBanned(m_client->peerAddress(), m_client->extAuthId())) {
+		sendError("banned", "You have been banned from this session");
+		return false;
+	}
+	if(session->isClosed()) {
+		sendError("closed", "This session is closed");
+		return false;
+	}
+	if(session->isAuthOnly() && !m_client->isAuthenticated()) {
+		sendError("authOnly", "This session does not allow guest logins");
+		return false;
+	}
+	return true;
+}
+
+void LoginHandler::joinSession(Session *session)
+{
 	if(session->getClientByUsername(m_client->username())) {
 #ifdef NDEBUG
 		sendError("nameInuse", "This username is already in use");
@@ -35,6 +35,7 @@ class Client;
 class Session;
 class SessionServer;
 struct SessionDescription;
+struct RegisteredUser;
 
 /**
  * @brief Perform the client login handshake
@@ -92,8 +93,7 @@ public:
 private slots:
 	void handleLoginMessage(protocol::MessagePtr message);
 
-	void announceSession(const QJsonObject &session);
-	void announceSessionEnd(const QString &id);
+	void announceSessionListingUpdate(protocol::MessagePtr msg);
 
 private:
 	enum State {
@@ -104,8 +104,11 @@ private:
 
 	void announceServerInfo();
 	void handleIdentMessage(const protocol::ServerCommand &cmd);
+	void identify(const protocol::ServerCommand &cmd, const QString &username, const QString &password, const RegisteredUser &userAccount);
 	void handleHostMessage(const protocol::ServerCommand &cmd);
 	void handleJoinMessage(const protocol::ServerCommand &cmd);
+	bool checkSessionAccess(Session *session);
+	void joinSession(Session *session);
 	void handleAbuseReport(const protocol::ServerCommand &cmd);
 	void handleStarttls();
 	void requestExtAuth();
@@ -122,6 +125,7 @@ private:
 	quint64 m_extauth_nonce;
 	bool m_hostPrivilege;
 	bool m_complete;
+	bool m_verifying;
 };
 
 }
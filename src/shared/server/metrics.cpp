@@ -0,0 +1,189 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "metrics.h"
+#include "../net/message.h"
+
+#include <QMutexLocker>
+
+namespace server {
+
+const qint64 MetricHistogram::BOUNDS[MetricHistogram::BUCKETS] = {
+	100, 250, 500,
+	1000, 2500, 5000,
+	10000, 25000, 50000,
+	100000, 250000, 500000,
+	1000000, 2500000, 5000000,
+	10000000
+};
+
+MetricHistogram::MetricHistogram()
+	: m_count(0), m_sum(0)
+{
+	for(int i=0;i<=BUCKETS;++i)
+		m_buckets[i].store(0);
+}
+
+void MetricHistogram::observe(qint64 usecs)
+{
+	usecs = qMax(qint64(0), usecs);
+
+	int i=0;
+	while(i<BUCKETS && usecs > BOUNDS[i])
+		++i;
+
+	m_buckets[i].fetchAndAddRelaxed(1);
+	m_sum.fetchAndAddRelaxed(usecs);
+	m_count.fetchAndAddRelaxed(1);
+}
+
+ServerMetrics::ServerMetrics()
+{
+}
+
+ServerMetrics &ServerMetrics::instance()
+{
+	static ServerMetrics metrics;
+	return metrics;
+}
+
+void ServerMetrics::countMessage(MetricCounter *counters, const protocol::Message &msg)
+{
+	const int type = msg.type();
+	counters[type].add();
+
+	if(!m_typeNamed[type].loadAcquire()) {
+		QMutexLocker lock(&m_mutex);
+		if(!m_typeNamed[type].load()) {
+			m_typeNames[type] = msg.messageName();
+			m_typeNamed[type].storeRelease(1);
+		}
+	}
+}
+
+void ServerMetrics::setSessionTraffic(const QVector<SessionTraffic> &sessions)
+{
+	QMutexLocker lock(&m_mutex);
+	m_sessionTraffic = sessions;
+}
+
+static void writeHeader(QByteArray &out, const char *name, const char *type, const char *help)
+{
+	out += QByteArray("# HELP ") + name + ' ' + help + '\n';
+	out += QByteArray("# TYPE ") + name + ' ' + type + '\n';
+}
+
+static void writeValue(QByteArray &out, const char *name, const QByteArray &labels, quint64 value)
+{
+	out += name;
+	if(!labels.isEmpty())
+		out += '{' + labels + '}';
+	out += ' ' + QByteArray::number(value) + '\n';
+}
+
+static void writeHistogram(QByteArray &out, const char *name, const char *help, const MetricHistogram &h)
+{
+	writeHeader(out, name, "histogram", help);
+
+	const QByteArray bucket = QByteArray(name) + "_bucket";
+
+	// Buckets are cumulative and in seconds in the exposition format
+	quint64 cumulative = 0;
+	for(int i=0;i<MetricHistogram::BUCKETS;++i) {
+		cumulative += h.bucket(i);
+		writeValue(out, bucket.constData(), "le=\"" + QByteArray::number(MetricHistogram::BOUNDS[i] / 1000000.0) + '"', cumulative);
+	}
+
+	// Read the total last, so it is never smaller than any bucket
+	cumulative += h.bucket(MetricHistogram::BUCKETS);
+	writeValue(out, bucket.constData(), "le=\"+Inf\"", cumulative);
+
+	out += QByteArray(name) + "_sum " + QByteArray::number(h.sum() / 1000000.0, 'f', 6) + '\n';
+	out += QByteArray(name) + "_count " + QByteArray::number(cumulative) + '\n';
+}
+
+QByteArray ServerMetrics::toPrometheusText() const
+{
+	QByteArray out;
+	out.reserve(8192);
+
+	QMutexLocker lock(&m_mutex);
+
+	const struct {
+		const char *name;
+		const char *help;
+		const MetricCounter *counters;
+	} messageCounters[] = {
+		{ "drawpile_messages_received_total", "Messages received from clients", m_messagesIn },
+		{ "drawpile_messages_sent_total", "Messages queued for sending to clients", m_messagesOut }
+	};
+
+	for(const auto &mc : messageCounters) {
+		writeHeader(out, mc.name, "counter", mc.help);
+		for(int type=0;type<256;++type) {
+			const quint64 value = mc.counters[type].value();
+			if(value == 0)
+				continue;
+			const QByteArray typeName = m_typeNamed[type].loadAcquire() ? m_typeNames[type].toUtf8() : QByteArray::number(type);
+			writeValue(out, mc.name, "type=\"" + typeName + '"', value);
+		}
+	}
+
+	writeHeader(out, "drawpile_received_bytes_total", "counter", "Bytes received from clients");
+	writeValue(out, "drawpile_received_bytes_total", QByteArray(), bytesReceived.value());
+	writeHeader(out, "drawpile_sent_bytes_total", "counter", "Bytes sent to clients");
+	writeValue(out, "drawpile_sent_bytes_total", QByteArray(), bytesSent.value());
+
+	writeHeader(out, "drawpile_session_received_bytes_total", "counter", "Bytes received from the users of a session");
+	for(const SessionTraffic &s : m_sessionTraffic)
+		writeValue(out, "drawpile_session_received_bytes_total", "session=\"" + s.id.toUtf8() + '"', s.bytesReceived);
+	writeHeader(out, "drawpile_session_sent_bytes_total", "counter", "Bytes sent to the users of a session");
+	for(const SessionTraffic &s : m_sessionTraffic)
+		writeValue(out, "drawpile_session_sent_bytes_total", "session=\"" + s.id.toUtf8() + '"', s.bytesSent);
+	writeHeader(out, "drawpile_session_users", "gauge", "Users in a session");
+	for(const SessionTraffic &s : m_sessionTraffic)
+		writeValue(out, "drawpile_session_users", "session=\"" + s.id.toUtf8() + '"', s.users);
+
+	writeHeader(out, "drawpile_sessions", "gauge", "Active sessions");
+	writeValue(out, "drawpile_sessions", QByteArray(), sessions.value());
+	writeHeader(out, "drawpile_users", "gauge", "Logged in users");
+	writeValue(out, "drawpile_users", QByteArray(), users.value());
+
+	writeHeader(out, "drawpile_upload_queue_bytes", "gauge", "Total length of all client upload queues");
+	writeValue(out, "drawpile_upload_queue_bytes", QByteArray(), uploadQueueBytes.value());
+	writeHeader(out, "drawpile_upload_queue_max_bytes", "gauge", "Length of the longest client upload queue");
+	writeValue(out, "drawpile_upload_queue_max_bytes", QByteArray(), uploadQueueBytesMax.value());
+
+	writeHeader(out, "drawpile_history_block_loads_total", "counter", "Session history blocks loaded from disk");
+	writeValue(out, "drawpile_history_block_loads_total", QByteArray(), historyBlockLoads.value());
+	writeHeader(out, "drawpile_history_block_bytes_total", "counter", "Uncompressed size of closed session history blocks");
+	writeValue(out, "drawpile_history_block_bytes_total", QByteArray(), historyBlockBytes.value());
+	writeHeader(out, "drawpile_history_block_compressed_bytes_total", "counter", "Compressed size of closed session history blocks");
+	writeValue(out, "drawpile_history_block_compressed_bytes_total", QByteArray(), historyBlockCompressedBytes.value());
+
+	writeHistogram(out, "drawpile_history_batch_seconds", "Time taken to fetch a batch of session history", historyBatchLatency);
+	writeHistogram(out, "drawpile_history_block_compression_seconds", "Time taken to compress a closed session history block", historyBlockCompressionLatency);
+	writeHistogram(out, "drawpile_login_verification_seconds", "Time from submitting a credential check to its completion", loginVerificationLatency);
+	writeHistogram(out, "drawpile_login_seconds", "Time from connecting to joining a session", loginLatency);
+	writeHistogram(out, "drawpile_event_loop_lag_seconds", "How late the main event loop runs its timers", eventLoopLag);
+
+	return out;
+}
+
+}
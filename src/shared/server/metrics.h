@@ -0,0 +1,169 @@
+/*
+   Drawpile - a collaborative drawing program.
+
+   Copyright (C) 2018 Calle Laakkonen
+
+   Drawpile is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Drawpile is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with Drawpile.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DP_SERVER_METRICS_H
+#define DP_SERVER_METRICS_H
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QVector>
+#include <QString>
+
+namespace protocol {
+	class Message;
+}
+
+namespace server {
+
+//! A monotonically increasing counter
+class MetricCounter {
+public:
+	MetricCounter() : m_value(0) { }
+
+	void add(quint64 n=1) { m_value.fetchAndAddRelaxed(n); }
+	quint64 value() const { return m_value.load(); }
+
+private:
+	QAtomicInteger<quint64> m_value;
+};
+
+//! A value that can go up and down
+class MetricGauge {
+public:
+	MetricGauge() : m_value(0) { }
+
+	void set(qint64 value) { m_value.store(value); }
+	qint64 value() const { return m_value.load(); }
+
+private:
+	QAtomicInteger<qint64> m_value;
+};
+
+/**
+ * @brief A latency histogram with fixed buckets
+ *
+ * Observations are in microseconds. The bucket upper bounds
+ * grow roughly exponentially from 100µs to 10s.
+ */
+class MetricHistogram {
+public:
+	static const int BUCKETS = 16;
+
+	//! Upper bounds of the buckets (in microseconds.) The implicit last bucket is +Inf
+	static const qint64 BOUNDS[BUCKETS];
+
+	MetricHistogram();
+
+	void observe(qint64 usecs);
+
+	//! Get the number of observations in a bucket (not cumulative.) Bucket BUCKETS is +Inf
+	quint64 bucket(int i) const { return m_buckets[i].load(); }
+
+	//! Total number of observations
+	quint64 count() const { return m_count.load(); }
+
+	//! Sum of all observations in microseconds
+	quint64 sum() const { return m_sum.load(); }
+
+private:
+	QAtomicInteger<quint64> m_buckets[BUCKETS+1];
+	QAtomicInteger<quint64> m_count;
+	QAtomicInteger<quint64> m_sum;
+};
+
+/**
+ * @brief Server performance telemetry
+ *
+ * The counters and histograms are updated lock free from the hot paths
+ * and can be read from any thread. Values that would be expensive to
+ * track continuously (queue depths, per-session traffic) are gauges
+ * that the main thread samples periodically.
+ */
+class ServerMetrics {
+public:
+	static ServerMetrics &instance();
+
+	//! Count a message received from a client
+	void messageReceived(const protocol::Message &msg) { countMessage(m_messagesIn, msg); }
+
+	//! Count a message queued for sending to a client
+	void messageSent(const protocol::Message &msg) { countMessage(m_messagesOut, msg); }
+
+	MetricCounter bytesReceived;
+	MetricCounter bytesSent;
+
+	//! Number of history blocks loaded from disk
+	MetricCounter historyBlockLoads;
+
+	//! Size of closed history blocks before and after compression
+	MetricCounter historyBlockBytes;
+	MetricCounter historyBlockCompressedBytes;
+
+	MetricGauge sessions;
+	MetricGauge users;
+
+	//! Total and largest per client upload queue length in bytes
+	MetricGauge uploadQueueBytes;
+	MetricGauge uploadQueueBytesMax;
+
+	//! Time taken to fetch a history batch for a client
+	MetricHistogram historyBatchLatency;
+
+	//! Time taken to compress a closed history block
+	MetricHistogram historyBlockCompressionLatency;
+
+	//! Time from submitting a credential check to its completion
+	MetricHistogram loginVerificationLatency;
+
+	//! Time from connection to joining a session
+	MetricHistogram loginLatency;
+
+	//! How late the main event loop runs its timers
+	MetricHistogram eventLoopLag;
+
+	struct SessionTraffic {
+		QString id;
+		quint64 bytesReceived;
+		quint64 bytesSent;
+		int users;
+	};
+
+	//! Replace the per-session traffic sample
+	void setSessionTraffic(const QVector<SessionTraffic> &sessions);
+
+	//! Render all metrics in the Prometheus text exposition format
+	QByteArray toPrometheusText() const;
+
+private:
+	ServerMetrics();
+	void countMessage(MetricCounter *counters, const protocol::Message &msg);
+
+	MetricCounter m_messagesIn[256];
+	MetricCounter m_messagesOut[256];
+
+	// Message type names are recorded the first time each type is seen
+	QAtomicInt m_typeNamed[256];
+	QString m_typeNames[256];
+
+	QVector<SessionTraffic> m_sessionTraffic;
+	mutable QMutex m_mutex;
+};
+
+}
+
+#endif
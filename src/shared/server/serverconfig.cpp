@@ -18,6 +18,7 @@
 */
 
 #include "serverconfig.h"
+#include "../util/passwordhash.h"
 
 #include <QRegularExpression>
 
@@ -141,7 +142,17 @@ bool ServerConfig::isAddressBanned(const QHostAddress &addr) const
 
 RegisteredUser ServerConfig::getUserAccount(const QString &username, const QString &password) const
 {
-	Q_UNUSED(password);
+	RegisteredUser user = findUserAccount(username);
+	if(user.status == RegisteredUser::Ok && !passwordhash::check(password, user.passwordHash)) {
+		user.status = RegisteredUser::BadPass;
+		user.flags.clear();
+	}
+	user.passwordHash.clear();
+	return user;
+}
+
+RegisteredUser ServerConfig::findUserAccount(const QString &username) const
+{
 	return RegisteredUser {
 		RegisteredUser::NotFound,
 		username,
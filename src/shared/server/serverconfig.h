@@ -22,6 +22,7 @@
 
 #include <QObject>
 #include <QString>
+#include <QByteArray>
 #include <QHash>
 #include <QUrl>
 
@@ -101,6 +102,7 @@ struct RegisteredUser {
 	Status status;
 	QString username;
 	QStringList flags;
+	QByteArray passwordHash; // set by findUserAccount
 };
 
 /**
@@ -157,9 +159,20 @@ public:
 	/**
 	 * @brief See if there is a registered user with the given credentials
 	 *
+	 * This is findUserAccount() followed by a password check.
+	 */
+	RegisteredUser getUserAccount(const QString &username, const QString &password) const;
+
+	/**
+	 * @brief Look up a registered user without checking the password
+	 *
+	 * If the user exists and is not banned, the status is Ok and the
+	 * password hash is included. The caller must check the password
+	 * (possibly asynchronously, see CredentialVerifier.)
+	 *
 	 * The default implementation always returns NotFound
 	 */
-	virtual RegisteredUser getUserAccount(const QString &username, const QString &password) const;
+	virtual RegisteredUser findUserAccount(const QString &username) const;
 
 	/**
 	 * @brief Get the configured logger instance
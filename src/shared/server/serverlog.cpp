@@ -71,43 +71,137 @@ void ServerLog::logMessage(const Log &entry)
 	storeMessage(entry);
 }
 
+InMemoryLog::InMemoryLog()
+	: m_next(0), m_size(0), m_limit(1000)
+{
+	setCapacity(m_limit);
+}
+
 void InMemoryLog::setHistoryLimit(int limit)
 {
 	m_limit = limit;
-	if(limit>0 && limit<m_history.size())
-		m_history.erase(m_history.begin() + limit, m_history.end());
+	if(limit>0)
+		setCapacity(limit);
+}
+
+void InMemoryLog::setCapacity(int capacity)
+{
+	Q_ASSERT(capacity>0);
+	while(m_size > capacity)
+		evictOldest();
+
+	if(capacity == m_ring.size())
+		return;
+
+	QVector<Log> ring(capacity);
+	QVector<qint64> timestamps(capacity);
+
+	for(quint64 seq=m_next-m_size;seq<m_next;++seq) {
+		const int from = int(seq % m_ring.size());
+		const int to = int(seq % capacity);
+		ring[to] = m_ring.at(from);
+		timestamps[to] = m_timestamps.at(from);
+	}
+
+	m_ring.swap(ring);
+	m_timestamps.swap(timestamps);
+}
+
+void InMemoryLog::evictOldest()
+{
+	Q_ASSERT(m_size>0);
+	const quint64 seq = m_next - m_size;
+	const Log &l = m_ring.at(int(seq % m_ring.size()));
+
+	if(!l.session().isNull()) {
+		auto i = m_sessionIndex.find(l.session());
+		Q_ASSERT(i != m_sessionIndex.end() && i->first() == seq);
+		i->removeFirst();
+		if(i->isEmpty())
+			m_sessionIndex.erase(i);
+	}
+
+	for(int level=int(l.level());level<3;++level) {
+		Q_ASSERT(m_levelIndex[level].first() == seq);
+		m_levelIndex[level].removeFirst();
+	}
+
+	--m_size;
 }
 
 void InMemoryLog::storeMessage(const Log &entry)
 {
-	m_history.prepend(entry);
-	if(m_limit>0 && m_history.size() >= m_limit)
-		m_history.pop_back();
+	if(m_size == m_ring.size()) {
+		if(m_limit>0)
+			evictOldest();
+		else
+			setCapacity(m_ring.size() * 2);
+	}
+
+	const int pos = int(m_next % m_ring.size());
+	m_ring[pos] = entry;
+	m_timestamps[pos] = entry.timestamp().toMSecsSinceEpoch();
+
+	if(!entry.session().isNull())
+		m_sessionIndex[entry.session()] << m_next;
+
+	for(int level=int(entry.level());level<3;++level)
+		m_levelIndex[level] << m_next;
+
+	++m_next;
+	++m_size;
 }
 
 QList<Log> InMemoryLog::getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const
 {
 	QList<Log> filtered;
 
-	for(const Log &l : m_history) {
-		if(after.isValid() && after.msecsTo(l.timestamp()) < 1000)
-			break;
+	// Pick the narrowest index that covers the query. A null index means the whole ring.
+	const QList<quint64> *index = nullptr;
+	bool checkLevel = false;
 
-		if(!session.isNull() && session != l.session())
-			continue;
+	if(!session.isNull()) {
+		const auto i = m_sessionIndex.constFind(session);
+		if(i == m_sessionIndex.constEnd())
+			return filtered;
+		index = &i.value();
+		checkLevel = atleast != Log::Level::Debug;
 
-		if(l.level() > atleast)
-			continue;
+	} else if(atleast != Log::Level::Debug) {
+		index = &m_levelIndex[int(atleast)];
+	}
 
-		if(offset<=0) {
-			if(limit>0 && filtered.size() >= limit)
-				break;
+	const int count = index ? index->size() : m_size;
+	const qint64 afterTs = after.isValid() ? after.toMSecsSinceEpoch() : 0;
 
-			filtered << l;
+	int i = 0;
+	if(!checkLevel) {
+		// Every indexed entry matches, so the offset can be skipped directly
+		i = qMin(offset, count);
+		offset = 0;
+	}
 
-		} else {
+	// Newest entries first
+	for(;i<count;++i) {
+		const quint64 seq = index ? index->at(count - 1 - i) : m_next - 1 - i;
+		const int pos = int(seq % m_ring.size());
+
+		if(after.isValid() && m_timestamps.at(pos) - afterTs < 1000)
+			break;
+
+		const Log &l = m_ring.at(pos);
+		if(checkLevel && l.level() > atleast)
+			continue;
+
+		if(offset>0) {
 			--offset;
+			continue;
 		}
+
+		if(limit>0 && filtered.size() >= limit)
+			break;
+
+		filtered << l;
 	}
 
 	return filtered;
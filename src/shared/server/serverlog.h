@@ -23,6 +23,8 @@
 #include <QDateTime>
 #include <QUuid>
 #include <QHostAddress>
+#include <QVector>
+#include <QHash>
 
 class QJsonObject;
 
@@ -196,11 +198,23 @@ inline QList<Log> ServerLogQuery::get() const {
 
 /**
  * @brief A simple ServerLog implementation that keeps the latest messages in memory
+ *
+ * The entries are stored in a fixed size ring buffer. Per-session and per-level
+ * indices are kept alongside, so queries take time proportional to the
+ * number of entries returned rather than the size of the whole log.
+ *
+ * Entries are assumed to be logged in timestamp order.
  */
 class InMemoryLog : public ServerLog
 {
 public:
-	InMemoryLog() : m_limit(1000) { }
+	InMemoryLog();
+
+	/**
+	 * @brief Set the maximum number of entries to keep
+	 *
+	 * If the limit is zero or negative, the buffer grows without bound.
+	 */
 	void setHistoryLimit(int limit);
 
 	QList<Log> getLogEntries(const QUuid &session, const QDateTime &after, Log::Level atleast, int offset, int limit) const override;
@@ -209,8 +223,23 @@ protected:
 	void storeMessage(const Log &entry) override;
 
 private:
-	QList<Log> m_history;
+	void setCapacity(int capacity);
+	void evictOldest();
+
+	// Entries are numbered sequentially. Entry n is stored at index n % capacity
+	// and the oldest retained entry is m_next - m_size.
+	QVector<Log> m_ring;
+	QVector<qint64> m_timestamps;
+	quint64 m_next;
+	int m_size;
 	int m_limit;
+
+	// Sequence numbers (oldest first) of entries of each session
+	QHash<QUuid, QList<quint64>> m_sessionIndex;
+
+	// Sequence numbers (oldest first) of entries whose level is at least
+	// Error, Warn and Info. (The ring itself covers Debug.)
+	QList<quint64> m_levelIndex[3];
 };
 
 }
@@ -50,6 +50,8 @@ Session::Session(SessionHistory *history, ServerConfig *config, QObject *parent)
 	m_resetstreamsize(0),
 	m_publicListingClient(nullptr),
 	m_refreshTimer(nullptr),
+	m_bytesReceived(0),
+	m_bytesSent(0),
 	m_closed(false),
 	m_authOnly(false),
 	m_historyLimitWarningSent(false)
@@ -144,6 +144,13 @@ public:
 	 */
 	bool checkPassword(const QString &password) const;
 
+	/**
+	 * @brief Get the session password hash
+	 *
+	 * This can be used for checking the password asynchronously.
+	 */
+	QByteArray passwordHash() const { return m_history->passwordHash(); }
+
 	/**
 	 * @brief Get the title of the session
 	 * @return
@@ -248,6 +255,16 @@ public:
 
 	const QList<Client*> &clients() const { return m_clients; }
 
+	//! Count network traffic of this session's users
+	void addBytesReceived(int count) { m_bytesReceived += count; }
+	void addBytesSent(int count) { m_bytesSent += count; }
+
+	//! Get the total number of bytes received from this session's users
+	quint64 bytesReceived() const { return m_bytesReceived; }
+
+	//! Get the total number of bytes sent to this session's users
+	quint64 bytesSent() const { return m_bytesSent; }
+
 	/**
 	 * @brief Get the ID of the user uploading initialization or reset data
 	 * @return user ID or invalid ID if init not in progress
@@ -501,6 +518,9 @@ private:
 	QElapsedTimer m_lastEventTime;
 	QElapsedTimer m_lastStatusUpdate;
 
+	quint64 m_bytesReceived;
+	quint64 m_bytesSent;
+
 	bool m_closed;
 	bool m_authOnly;
 	bool m_historyLimitWarningSent;
@@ -26,12 +26,16 @@
 #include "inmemoryhistory.h"
 #include "filedhistory.h"
 #include "templateloader.h"
+#include "credentialverifier.h"
+#include "metrics.h"
 
 #include "../util/announcementapi.h"
+#include "../net/control.h"
 
 #include <QTimer>
 #include <QJsonArray>
 #include <QJsonDocument>
+#include <QStringList>
 
 namespace server {
 
@@ -39,14 +43,38 @@ SessionServer::SessionServer(ServerConfig *config, QObject *parent)
 	: QObject(parent),
 	m_config(config),
 	m_tpls(nullptr),
+	m_verifier(new CredentialVerifier(this)),
 	m_useFiledSessions(false),
-	m_mustSecure(false)
+	m_mustSecure(false),
+	m_listingTemplateRevision(-1)
 {
 	QTimer *cleanupTimer = new QTimer(this);
 	connect(cleanupTimer, &QTimer::timeout, this, &SessionServer::cleanupSessions);
 	cleanupTimer->setInterval(15 * 1000);
 	cleanupTimer->start(cleanupTimer->interval());
 
+	// Keep the cached session listing up to date and serialize
+	// the announcements to lobby clients just once
+	connect(this, &SessionServer::sessionChanged, this, [this](const QJsonObject &session) {
+		updateListingEntry(session);
+
+		emit sessionListingUpdate(protocol::MessagePtr(new protocol::Command(0,
+			"{\"type\":\"login\",\"message\":\"New session\",\"sessions\":[" + m_listingEntries.value(session["id"].toString()).json + "]}"
+		)));
+	});
+
+	connect(this, &SessionServer::sessionEnded, this, [this](const QString &id) {
+		m_listingEntries.remove(id);
+		m_sessionListing.clear();
+
+		protocol::ServerReply msg;
+		msg.type = protocol::ServerReply::LOGIN;
+		msg.message = "Session ended";
+		msg.reply["remove"] = QJsonArray() << id;
+
+		emit sessionListingUpdate(protocol::MessagePtr(new protocol::Command(0, msg)));
+	});
+
 #ifndef NDEBUG
 	m_randomlag = 0;
 #endif
@@ -93,6 +121,98 @@ QJsonArray SessionServer::sessionDescriptions() const
 	return descs;
 }
 
+static QByteArray toCompactJson(const QJsonObject &o)
+{
+	return QJsonDocument(o).toJson(QJsonDocument::Compact);
+}
+
+void SessionServer::updateListingEntry(const QJsonObject &description)
+{
+	m_listingEntries[description["id"].toString()] = ListingEntry {
+		toCompactJson(description),
+		description["alias"].toString(),
+		description["size"].toInt()
+	};
+	m_sessionListing.clear();
+}
+
+QList<protocol::MessagePtr> SessionServer::sessionListing()
+{
+	const QString title = m_config->getConfigString(config::ServerTitle);
+	if(title != m_sessionListingTitle) {
+		m_sessionListingTitle = title;
+		m_sessionListing.clear();
+	}
+
+	const int templateRevision = m_tpls ? m_tpls->revision() : 0;
+	if(templateRevision != m_listingTemplateRevision) {
+		m_listingTemplateRevision = templateRevision;
+		m_listingTemplates.clear();
+		if(m_tpls) {
+			for(const QJsonValue &v : m_tpls->templateDescriptions()) {
+				const QJsonObject o = v.toObject();
+				m_listingTemplates << ListingEntry { toCompactJson(o), o["alias"].toString(), 0 };
+			}
+		}
+		m_sessionListing.clear();
+	}
+
+	// History growth doesn't emit sessionChanged, so refresh the entries
+	// of sessions whose size has changed since they were serialized
+	for(const Session *s : m_sessions) {
+		const auto entry = m_listingEntries.constFind(s->idString());
+		if(entry == m_listingEntries.constEnd() || entry.value().size != int(s->history()->sizeInBytes()))
+			updateListingEntry(s->getDescription());
+	}
+
+	if(!m_sessionListing.isEmpty())
+		return m_sessionListing;
+
+	// Live sessions, followed by the templates not shadowed by them
+	QList<const ListingEntry*> entries;
+	QStringList aliases;
+	for(const Session *s : m_sessions) {
+		const ListingEntry &e = m_listingEntries[s->idString()];
+		entries << &e;
+		if(!e.alias.isEmpty())
+			aliases << e.alias;
+	}
+	for(const ListingEntry &e : m_listingTemplates) {
+		if(!aliases.contains(e.alias))
+			entries << &e;
+	}
+
+	// The title as a JSON key/value pair (with the surrounding braces removed)
+	QByteArray titleJson = toCompactJson(QJsonObject { {"title", title} });
+	titleJson = titleJson.mid(1, titleJson.length() - 2);
+
+	static const QByteArray HEADER = "{\"type\":\"login\",\"message\":\"Welcome\"";
+
+	QByteArray greeting = HEADER + ',' + titleJson + ",\"sessions\":[";
+	for(int i=0;i<entries.size();++i) {
+		if(i>0)
+			greeting += ',';
+		greeting += entries.at(i)->json;
+	}
+	greeting += "]}";
+
+	protocol::MessagePtr msg(new protocol::Command(0, greeting));
+	if(!msg.cast<protocol::Command>().isOversize()) {
+		m_sessionListing << msg;
+		return m_sessionListing;
+	}
+
+	// Reply was too long to fit in the message envelope!
+	// Split the reply into separate announcements
+	if(!title.isEmpty())
+		m_sessionListing << protocol::MessagePtr(new protocol::Command(0, HEADER + ',' + titleJson + '}'));
+
+	for(const ListingEntry *e : entries)
+		m_sessionListing << protocol::MessagePtr(new protocol::Command(0, HEADER + ",\"sessions\":[" + e->json + "]}"));
+
+	return m_sessionListing;
+}
+
 SessionHistory *SessionServer::initHistory(const QUuid &id, const QString alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder)
 {
 	if(m_useFiledSessions) {
@@ -256,6 +376,8 @@ void SessionServer::moveFromLobby(Session *session, Client *client)
 	// the session handles disconnect events from now on
 	disconnect(client, &Client::loggedOff, this, &SessionServer::lobbyDisconnectedEvent);
 
+	ServerMetrics::instance().loginLatency.observe(client->connectedTime() * 1000);
+
 	emit userLoggedIn(totalUsers());
 	emit sessionChanged(session->getDescription());
 }
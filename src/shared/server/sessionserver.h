@@ -18,10 +18,12 @@
 */
 
 #include "../net/protover.h"
+#include "../net/message.h"
 #include "jsonapi.h"
 
 #include <QObject>
 #include <QDir>
+#include <QHash>
 
 namespace sessionlisting {
 	class AnnouncementApi;
@@ -36,6 +38,7 @@ class SessionHistory;
 class Client;
 class ServerConfig;
 class TemplateLoader;
+class CredentialVerifier;
 
 /**
  * @brief Session manager
@@ -55,7 +58,7 @@ public:
 	/**
 	 * @brief Set the template loader to use
 	 */
-	void setTemplateLoader(TemplateLoader *loader) { m_tpls = loader; }
+	void setTemplateLoader(TemplateLoader *loader) { m_tpls = loader; m_listingTemplateRevision = -1; m_sessionListing.clear(); }
 	const TemplateLoader *templateLoader() const { return m_tpls; }
 
 	/**
@@ -71,6 +74,11 @@ public:
 	 */
 	const ServerConfig *config() const { return m_config; }
 
+	/**
+	 * @brief Get the service for checking login credentials in worker threads
+	 */
+	CredentialVerifier *credentialVerifier() const { return m_verifier; }
+
 	/**
 	 * @brief Set whether a secure connection is mandatory
 	 * @param mustSecure
@@ -114,6 +122,18 @@ public:
 	 */
 	QJsonArray sessionDescriptions() const;
 
+	/**
+	 * @brief Get the session list announcement sent to clients at login
+	 *
+	 * The list includes all live sessions and the templates not shadowed by them.
+	 * Each session's description is kept pre-serialized and reserialized only
+	 * when that session changes, so assembling the list is just concatenation.
+	 * The assembled messages are reused until an entry, the templates or the
+	 * server title change. If the list is too long to fit in a single message,
+	 * it is split into one message per session.
+	 */
+	QList<protocol::MessagePtr> sessionListing();
+
 	/**
 	 * @brief Get the session with the specified ID
 	 *
@@ -137,6 +157,9 @@ public:
 	 */
 	int sessionCount() const { return m_sessions.size(); }
 
+	//! Get all active sessions
+	const QList<Session*> &sessions() const { return m_sessions; }
+
 	/**
 	 * @brief Stop all running sessions
 	 */
@@ -201,6 +224,14 @@ signals:
 	 */
 	void sessionEnded(const QString &id);
 
+	/**
+	 * @brief Session list update for clients in the login phase
+	 *
+	 * This is a pre-serialized announcement emitted whenever sessionChanged
+	 * or sessionEnded is, so it can be sent to every client in the lobby as is.
+	 */
+	void sessionListingUpdate(protocol::MessagePtr msg);
+
 private slots:
 	void moveFromLobby(Session *session, Client *client);
 	void lobbyDisconnectedEvent(Client *client);
@@ -210,15 +241,31 @@ private slots:
 private:
 	SessionHistory *initHistory(const QUuid &id, const QString alias, const protocol::ProtocolVersion &protocolVersion, const QString &founder);
 	void initSession(Session *session);
+	void updateListingEntry(const QJsonObject &description);
 
 	ServerConfig *m_config;
 	TemplateLoader *m_tpls;
+	CredentialVerifier *m_verifier;
 	QDir m_sessiondir;
 	bool m_useFiledSessions;
 
 	QList<Session*> m_sessions;
 	QList<Client*> m_lobby;
 
+	// Login session listing cache
+	struct ListingEntry {
+		QByteArray json; // compact serialized description
+		QString alias;
+		int size;        // history size when the description was made
+	};
+	QHash<QString, ListingEntry> m_listingEntries; // live sessions by ID
+	QList<ListingEntry> m_listingTemplates;
+	int m_listingTemplateRevision;
+
+	// Assembled listing (empty when out of date)
+	QList<protocol::MessagePtr> m_sessionListing;
+	QString m_sessionListingTitle;
+
 	bool m_mustSecure;
 
 #ifndef NDEBUG
@@ -63,6 +63,13 @@ public:
 	 */
 	virtual QJsonObject templateDescription(const QString &alias) const = 0;
 
+	/**
+	 * @brief Get the revision number of the template list
+	 *
+	 * The number changes whenever templates are added, removed or modified.
+	 */
+	virtual int revision() const = 0;
+
 	/**
 	 * @brief Check if a template with the given alias exists
 	 */
@@ -0,0 +1,106 @@
+#include "../server/credentialverifier.h"
+#include "../util/passwordhash.h"
+
+#include <QtTest/QtTest>
+#include <QSemaphore>
+
+using server::CredentialVerifier;
+
+class TestCredentialVerifier : public QObject
+{
+	Q_OBJECT
+private slots:
+	void testPasswordCheck()
+	{
+		CredentialVerifier verifier;
+		const QByteArray hash = server::passwordhash::hash("secret");
+		const QHostAddress addr("192.168.1.1");
+
+		QList<CredentialVerifier::Result> results;
+		auto collect = [&results](CredentialVerifier::Result r) { results << r; };
+
+		verifier.verifyPassword(addr, this, "secret", hash, collect);
+		verifier.verifyPassword(addr, this, "wrong", hash, collect);
+
+		// Results are delivered through the event loop
+		QCOMPARE(results.size(), 0);
+		QTRY_COMPARE(results.size(), 2);
+
+		QVERIFY(results.contains(CredentialVerifier::Accepted));
+		QVERIFY(results.contains(CredentialVerifier::Rejected));
+		QCOMPARE(verifier.stats().completed, quint64(2));
+		QCOMPARE(verifier.stats().queued, 0);
+		QCOMPARE(verifier.stats().running, 0);
+	}
+
+	void testPerAddressLimit()
+	{
+		CredentialVerifier verifier;
+		verifier.setMaxThreads(4);
+		verifier.setPerAddressLimit(1);
+
+		QSemaphore gate;
+		int done = 0;
+		auto blocked = [&gate]() { gate.acquire(); return true; };
+		auto callback = [&done](CredentialVerifier::Result) { ++done; };
+
+		verifier.verify(QHostAddress("10.0.0.1"), this, blocked, callback);
+		verifier.verify(QHostAddress("10.0.0.1"), this, blocked, callback);
+		verifier.verify(QHostAddress("10.0.0.2"), this, blocked, callback);
+
+		// Only one check per address may run at a time
+		QCOMPARE(verifier.stats().running, 2);
+		QCOMPARE(verifier.stats().queued, 1);
+
+		gate.release(3);
+		QTRY_COMPARE(done, 3);
+	}
+
+	void testPerAddressQueueLimit()
+	{
+		CredentialVerifier verifier;
+		verifier.setMaxThreads(1);
+		verifier.setPerAddressQueueLength(2);
+
+		QSemaphore gate;
+		int done = 0;
+		int overloaded = 0;
+		auto blocked = [&gate]() { gate.acquire(); return true; };
+		auto callback = [&done, &overloaded](CredentialVerifier::Result r) {
+			if(r == CredentialVerifier::Overloaded)
+				++overloaded;
+			else
+				++done;
+		};
+
+		// The first check runs, the next two wait in the queue and the rest are refused
+		for(int i=0;i<5;++i)
+			verifier.verify(QHostAddress("10.0.0.1"), this, blocked, callback);
+
+		QCOMPARE(overloaded, 2);
+		QCOMPARE(verifier.stats().queued, 2);
+
+		// Other hosts can still queue their checks
+		verifier.verify(QHostAddress("10.0.0.2"), this, blocked, callback);
+		QCOMPARE(overloaded, 2);
+		QCOMPARE(verifier.stats().queued, 3);
+
+		gate.release(4);
+		QTRY_COMPARE(done, 4);
+	}
+
+	void testOverload()
+	{
+		CredentialVerifier verifier;
+		verifier.setMaxQueueLength(0);
+
+		CredentialVerifier::Result result = CredentialVerifier::Accepted;
+		verifier.verify(QHostAddress("10.0.0.1"), this, []() { return true; }, [&result](CredentialVerifier::Result r) { result = r; });
+
+		QCOMPARE(result, CredentialVerifier::Overloaded);
+		QCOMPARE(verifier.stats().overloaded, quint64(1));
+	}
+};
+
+QTEST_MAIN(TestCredentialVerifier)
+#include "credentialverifier.moc"
@@ -1,10 +1,15 @@
 #include "../server/filedhistory.h"
+#include "../server/metrics.h"
 #include "../util/passwordhash.h"
+#include "../record/header.h"
+#include "../record/blockcompression.h"
 #include "../net/meta.h"
 
 #include <QtTest/QtTest>
 #include <QTemporaryDir>
 #include <QDir>
+#include <QJsonObject>
+#include <QtEndian>
 #include <memory>
 
 using namespace server;
@@ -168,7 +173,7 @@ private slots:
 
 		// Cut off the end of the recording
 		QString recfile = m_dir.absoluteFilePath(file);
-		recfile.replace(".session", ".dprec");
+		recfile.replace(".session", ".dprecb");
 		QFile rf(recfile);
 		QVERIFY(rf.resize(rf.size() - 3));
 
@@ -301,6 +306,163 @@ private slots:
 		}
 	}
 
+	// Closed blocks are compressed and can still be read back
+	void testCompressedBlocks()
+	{
+		ServerMetrics &metrics = ServerMetrics::instance();
+		const quint64 bytesBefore = metrics.historyBlockBytes.value();
+		const quint64 compressedBefore = metrics.historyBlockCompressedBytes.value();
+		const quint64 usecsBefore = metrics.historyBlockCompressionLatency.sum();
+
+		const int count = 20000;
+		QUuid id = QUuid::createUuid();
+		{
+			std::unique_ptr<FiledHistory> fh { FiledHistory::startNew(m_dir, id, QString(), protocol::ProtocolVersion::current(), "test") };
+			for(int i=0;i<count;++i)
+				fh->addMessage(protocol::MessagePtr(new protocol::Chat(1, 0, 0, QString("message number %1").arg(i))));
+		}
+
+		const quint64 bytes = metrics.historyBlockBytes.value() - bytesBefore;
+		const quint64 compressed = metrics.historyBlockCompressedBytes.value() - compressedBefore;
+		const quint64 usecs = metrics.historyBlockCompressionLatency.sum() - usecsBefore;
+		QVERIFY(bytes > 0);
+		QVERIFY(compressed < bytes);
+
+		qInfo("Compressed %llu bytes of history to %.1f%% at %.1f MB/s",
+			bytes, 100.0 * compressed / bytes, double(bytes) / qMax(quint64(1), usecs));
+
+		std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(FiledHistory::journalFilename(id))) };
+		QVERIFY(fh.get());
+		QCOMPARE(fh->lastIndex(), count-1);
+
+		QList<protocol::MessagePtr> msgs;
+		int lastIdx = -1;
+		int read = 0;
+		do {
+			std::tie(msgs, lastIdx) = fh->getBatch(lastIdx);
+			for(const protocol::MessagePtr &msg : msgs) {
+				QCOMPARE(msg.cast<protocol::Chat>().message(), QString("message number %1").arg(read));
+				++read;
+			}
+		} while(!msgs.isEmpty());
+		QCOMPARE(read, count);
+	}
+
+	void testConvertUncompressed_data()
+	{
+		QTest::addColumn<bool>("truncated");
+		QTest::newRow("complete") << false;
+		QTest::newRow("truncated") << true;
+	}
+
+	// Sessions stored in the old uncompressed format are converted when loaded
+	void testConvertUncompressed()
+	{
+		QFETCH(bool, truncated);
+		QUuid id = QUuid::createUuid();
+		const QString idstr = id.toString().mid(1, 36);
+		const QString oldFile = m_dir.absoluteFilePath(idstr + ".dprec");
+		{
+			QFile journal(m_dir.absoluteFilePath(FiledHistory::journalFilename(id)));
+			QVERIFY(journal.open(QFile::WriteOnly));
+			journal.write(QString("FILE %1.dprec\nFOUNDER test\n").arg(idstr).toUtf8());
+
+			QFile recording(oldFile);
+			QVERIFY(recording.open(QFile::WriteOnly));
+			QJsonObject metadata;
+			metadata["version"] = protocol::ProtocolVersion::current().asString();
+			QVERIFY(recording::writeRecordingHeader(&recording, metadata));
+
+			for(const char *text : {"test1", "test2", "test3"}) {
+				protocol::Chat msg(1, 0, 0, QByteArray(text));
+				QByteArray buf(msg.length(), 0);
+				msg.serialize(buf.data());
+				recording.write(buf);
+			}
+
+			// The old recording is kept if it couldn't be read completely
+			if(truncated)
+				recording.write(QByteArray("\0\x10", 2));
+		}
+
+		for(int i=0;i<2;++i) {
+			std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(FiledHistory::journalFilename(id))) };
+			QVERIFY(fh.get());
+			QCOMPARE(QFile::exists(oldFile), truncated);
+
+			QList<protocol::MessagePtr> msgs;
+			int lastIdx;
+			std::tie(msgs, lastIdx) = fh->getBatch(-1);
+			QCOMPARE(msgs.size(), 3);
+			QCOMPARE(msgs.at(2).cast<protocol::Chat>().message(), QString("test3"));
+			QCOMPARE(lastIdx, 2);
+		}
+	}
+
+	void testInterruptedBlock_data()
+	{
+		QTest::addColumn<bool>("written");
+		QTest::newRow("interrupted") << false;
+		QTest::newRow("written") << true;
+	}
+
+	// A block whose in-place write was interrupted is completed when the session is loaded
+	void testInterruptedBlock()
+	{
+		QFETCH(bool, written);
+		using recording::BlockCompressionDevice;
+
+		QUuid id = QUuid::createUuid();
+		{
+			std::unique_ptr<FiledHistory> fh { FiledHistory::startNew(m_dir, id, QString(), protocol::ProtocolVersion::current(), "test") };
+			for(int i=0;i<100;++i)
+				fh->addMessage(protocol::MessagePtr(new protocol::Chat(1, 0, 0, QString("message number %1").arg(i))));
+			fh->closeBlock();
+			fh->addMessage(protocol::MessagePtr(new protocol::Chat(1, 0, 0, QByteArray("last"))));
+		}
+
+		QString recfile = m_dir.absoluteFilePath(FiledHistory::journalFilename(id));
+		recfile.replace(".session", ".dprecb");
+		QFile rf(recfile);
+		QVERIFY(rf.open(QFile::ReadWrite));
+
+		// Find the closed block after the recording header block
+		int compressedLen, uncompressedLen;
+		BlockCompressionDevice::Codec codec;
+		rf.seek(BlockCompressionDevice::MAGIC_LENGTH);
+		QVERIFY(BlockCompressionDevice::parseBlockHeader(rf.read(BlockCompressionDevice::BLOCK_HEADER_LENGTH), &compressedLen, &uncompressedLen, &codec));
+		const qint64 offset = rf.pos() + compressedLen;
+		rf.seek(offset);
+		QVERIFY(BlockCompressionDevice::parseBlockHeader(rf.read(BlockCompressionDevice::BLOCK_HEADER_LENGTH), &compressedLen, &uncompressedLen, &codec));
+		QVERIFY(codec != BlockCompressionDevice::Stored);
+		rf.seek(offset);
+		const QByteArray block = rf.read(BlockCompressionDevice::BLOCK_HEADER_LENGTH + compressedLen);
+
+		// Simulate a crash in the middle of writing the block
+		QFile pending(recfile + ".pending");
+		QVERIFY(pending.open(QFile::WriteOnly));
+		uchar offsetBytes[8];
+		qToBigEndian(offset, offsetBytes);
+		pending.write(reinterpret_cast<const char*>(offsetBytes), 8);
+		pending.write(block);
+		pending.close();
+
+		if(!written)
+			QVERIFY(rf.resize(offset + block.length() / 2));
+		rf.close();
+
+		std::unique_ptr<FiledHistory> fh { FiledHistory::load(m_dir.absoluteFilePath(FiledHistory::journalFilename(id))) };
+		QVERIFY(fh.get());
+		QVERIFY(!pending.exists());
+		QCOMPARE(fh->lastIndex(), written ? 100 : 99);
+
+		QList<protocol::MessagePtr> msgs;
+		int lastIdx;
+		std::tie(msgs, lastIdx) = fh->getBatch(-1);
+		QCOMPARE(msgs.size(), 100);
+		QCOMPARE(msgs.last().cast<protocol::Chat>().message(), QString("message number 99"));
+	}
+
 private:
 	// Generate a test recording containing three messages.
 	QString makeTestRecording()
@@ -53,7 +53,9 @@ private slots:
 		QTest::newRow("putimage") << (Message*)new PutImage(22, 0x1122, 0x10, 100, 200, 300, 400, QByteArray("Test"));
 		QTest::newRow("fillrect") << (Message*)new FillRect(23, 0x1122, 0x10, 3, 200, 300, 400, 0x11223344);
 		QTest::newRow("toolchange") << (Message*)new ToolChange(24, 0x1122, 1, 2, 3, 0xffbbccdd, 10, 11, 20, 21, 30, 31, 40, 41, 60);
-		QTest::newRow("penmove") << (Message*)new PenMove(25, PenPointVector() << PenPoint {-10, 10, 0x00ff} << PenPoint { -100, 100, 0xff00 });
+		QTest::newRow("penmove") << (Message*)new PenMove(25, PenPointVector() << PenPoint {-10, 10, 0x00ff} << PenPoint { -100, 100, 0xff00 }, MSG_PEN_MOVE_DELTA);
+		QTest::newRow("penmove (legacy)") << (Message*)new PenMove(25, PenPointVector() << PenPoint {-10, 10, 0x00ff} << PenPoint { -100, 100, 0xff00 }, MSG_PEN_MOVE);
+		QTest::newRow("penmove (large delta)") << (Message*)new PenMove(25, PenPointVector() << PenPoint {INT32_MIN, INT32_MAX, 0xffff} << PenPoint { INT32_MAX, INT32_MIN, 0 }, MSG_PEN_MOVE_DELTA);
 		QTest::newRow("penup") << (Message*)new PenUp(26);
 		QTest::newRow("annotationcreate") << (Message*)new AnnotationCreate(27, 0x1122, -100, -100, 200, 200);
 		QTest::newRow("annotationreshape") << (Message*)new AnnotationReshape(28, 0x1122, -100, -100, 200, 200);
@@ -87,6 +89,8 @@ private slots:
 			QStringList text = msg->toString().split('\n');
 
 			text::Parser parser;
+			if(msg->type() == MSG_PEN_MOVE_DELTA)
+				parser.setProtocolVersion(ProtocolVersion::current());
 			text::Parser::Result r { text::Parser::Result::NeedMore, nullptr };
 			for(const QString &line : text) {
 				QCOMPARE(r.status, text::Parser::Result::NeedMore);
@@ -0,0 +1,43 @@
+#include "../server/metrics.h"
+
+#include <QtTest/QtTest>
+
+using server::MetricHistogram;
+using server::ServerMetrics;
+
+class TestMetrics: public QObject
+{
+	Q_OBJECT
+private slots:
+	void testHistogramBuckets()
+	{
+		MetricHistogram h;
+		h.observe(-5); // clamped to zero
+		h.observe(100); // upper bounds are inclusive
+		h.observe(101);
+		h.observe(20000000);
+
+		QCOMPARE(h.bucket(0), quint64(2));
+		QCOMPARE(h.bucket(1), quint64(1));
+		QCOMPARE(h.bucket(MetricHistogram::BUCKETS), quint64(1));
+		QCOMPARE(h.count(), quint64(4));
+		QCOMPARE(h.sum(), quint64(20000201));
+	}
+
+	void testPrometheusText()
+	{
+		ServerMetrics &m = ServerMetrics::instance();
+		m.sessions.set(3);
+		m.setSessionTraffic({ { "abc", 10, 20, 2 } });
+
+		const QByteArray text = m.toPrometheusText();
+		QVERIFY(text.contains("# TYPE drawpile_sessions gauge\n"));
+		QVERIFY(text.contains("\ndrawpile_sessions 3\n"));
+		QVERIFY(text.contains("drawpile_session_sent_bytes_total{session=\"abc\"} 20\n"));
+		QVERIFY(text.contains("drawpile_history_batch_seconds_bucket{le=\"+Inf\"}"));
+	}
+};
+
+
+QTEST_MAIN(TestMetrics)
+#include "metrics.moc"
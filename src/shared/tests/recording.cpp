@@ -1,6 +1,7 @@
 #include "../record/reader.h"
 #include "../record/writer.h"
 #include "../record/header.h"
+#include "../record/blockcompression.h"
 
 #include "../net/control.h"
 #include "../net/meta.h"
@@ -17,15 +18,15 @@ using namespace protocol;
 
 // Hex encoded test recording.
 // Header contains one extra key: "test": "TESTING"
-// Protocol version is "dp:4.20.1"
+// Protocol version is "dp:4.20.2"
 // Body contains one message: UserJoin(1, 0, "hello", "world")
-static const char *TEST_RECORDING = "44505245430000427b2274657374223a2254455354494e47222c2276657273696f6e223a2264703a342e32302e31222c2277726974657276657273696f6e223a22322e302e306232227d000c2001000568656c6c6f776f726c64";
+static const char *TEST_RECORDING = "44505245430000427b2274657374223a2254455354494e47222c2276657273696f6e223a2264703a342e32302e32222c2277726974657276657273696f6e223a22322e302e306232227d000c2001000568656c6c6f776f726c64";
 
 // A test recording with a version number of dp:4.10.0, containing a single NewLayer message.
 static const char *TEST_RECORDING_OLD = "44505245430000317b2276657273696f6e223a2264703a342e31302e30222c2277726974657276657273696f6e223a22322e302e306232227d00098201000100000000000000";
 
 static const char *TEST_TEXTMODE =
-	"!version=dp:4.20.1\n"
+	"!version=dp:4.20.2\n"
 	"!test=TESTING\n"
 	"1 join name=hello hash=world\n";
 
@@ -108,7 +109,7 @@ private slots:
 
 			QCOMPARE(int(reader.encoding()), encoding);
 
-			QCOMPARE(reader.formatVersion().asString(), QString("dp:4.20.1"));
+			QCOMPARE(reader.formatVersion().asString(), QString("dp:4.20.2"));
 			QCOMPARE(reader.metadata()["test"].toString(), QString("TESTING"));
 
 			// No message read yet
@@ -208,6 +209,17 @@ private slots:
 		QCOMPARE(int(c), expectedCompat);
 	}
 
+	void testMinorVersionMismatch()
+	{
+		// Protocol 20.2 renders smudge strokes differently than 20.1
+		QByteArray testRecording("!version=dp:4.20.1\n1 join name=hello hash=world\n");
+		QBuffer buffer(&testRecording);
+		buffer.open(QBuffer::ReadOnly);
+
+		Reader reader("test", &buffer, false);
+		QCOMPARE(reader.open(), MINOR_INCOMPATIBILITY);
+	}
+
 	void testOpaqueBinary()
 	{
 		QByteArray testRecording = QByteArray::fromHex(TEST_RECORDING_OLD);
@@ -229,6 +241,81 @@ private slots:
 		QCOMPARE(mr.message->type(), protocol::MSG_LAYER_CREATE);
 		delete mr.message;
 	}
+
+	void testBlockCompression()
+	{
+		QBuffer buffer;
+		buffer.open(QBuffer::ReadWrite);
+
+		// Write enough messages to span several blocks
+		const int count = 20000;
+		QVector<qint64> positions;
+		qint64 uncompressedSize;
+		{
+			auto *dev = new BlockCompressionDevice(&buffer, false);
+			QVERIFY(dev->open(QIODevice::WriteOnly));
+
+			Writer writer(dev, true);
+			writer.writeHeader();
+			for(int i=0;i<count;++i) {
+				positions << dev->pos();
+				writer.writeMessage(UserJoin(1, 0, QString("user %1").arg(i)));
+			}
+			uncompressedSize = dev->size();
+		}
+
+		// Autoclose is off: the underlying device should still be open
+		QVERIFY(buffer.isOpen());
+		QVERIFY(buffer.size() < uncompressedSize);
+
+		buffer.seek(0);
+		auto *dev = new BlockCompressionDevice(&buffer, false);
+		Reader reader("test.dprecb", dev, true);
+		QCOMPARE(reader.open(), COMPATIBLE);
+		QCOMPARE(reader.filesize(), uncompressedSize);
+
+		// Sequential reading
+		for(int i=0;i<count;++i) {
+			MessageRecord mr = reader.readNext();
+			QCOMPARE(mr.status, MessageRecord::OK);
+			MessagePtr msg(mr.message);
+			QCOMPARE(msg.cast<UserJoin>().name(), QString("user %1").arg(i));
+		}
+		QCOMPARE(reader.readNext().status, MessageRecord::END_OF_RECORDING);
+
+		// Random access
+		for(const int i : {count-1, 0, count/2, 1234}) {
+			reader.seekTo(i, positions.at(i));
+			MessageRecord mr = reader.readNext();
+			QCOMPARE(mr.status, MessageRecord::OK);
+			MessagePtr msg(mr.message);
+			QCOMPARE(msg.cast<UserJoin>().name(), QString("user %1").arg(i));
+		}
+	}
+
+	void testShortBlock_data()
+	{
+		QTest::addColumn<int>("mode");
+		QTest::newRow("fast") << int(BlockCompressionDevice::Mode::Fast);
+		QTest::newRow("archival") << int(BlockCompressionDevice::Mode::Archival);
+	}
+
+	void testShortBlock()
+	{
+		QFETCH(int, mode);
+
+		QByteArray data;
+		for(int i=0;i<1000;++i)
+			data += QByteArray::number(i);
+
+		BlockCompressionDevice::Codec codec;
+		const QByteArray block = BlockCompressionDevice::compressBlock(data, BlockCompressionDevice::Mode(mode), &codec);
+
+		QCOMPARE(BlockCompressionDevice::decompressBlock(block, codec, data.length()), data);
+
+		// A block that decompresses to fewer bytes than its header says is corrupt
+		QVERIFY(BlockCompressionDevice::decompressBlock(block, codec, data.length() + 100).isNull());
+	}
 };
 
 
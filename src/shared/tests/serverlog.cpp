@@ -85,6 +85,52 @@ private slots:
 		QCOMPARE(srvlog.query().get().size(), 3);
 		QCOMPARE(srvlog.query().session(session).get().size(), 2);
 	}
+
+	void testInMemoryRingBuffer() {
+		InMemoryLog srvlog;
+		srvlog.setSilent(true);
+		srvlog.setHistoryLimit(10);
+
+		QUuid session = QUuid::createUuid();
+
+		for(int i=0;i<25;++i) {
+			Log l = Log().message(QString::number(i));
+			if(i%2)
+				l.session(session);
+			if(i%5==0)
+				l.about(Log::Level::Error, Log::Topic::Status);
+			srvlog.logMessage(l);
+		}
+
+		// Only the last 10 entries are retained, newest first
+		const QList<Log> all = srvlog.query().get();
+		QCOMPARE(all.size(), 10);
+		QCOMPARE(all.first().message(), QString("24"));
+		QCOMPARE(all.last().message(), QString("15"));
+
+		const QList<Log> sessionLog = srvlog.query().session(session).get();
+		QCOMPARE(sessionLog.size(), 5);
+		QCOMPARE(sessionLog.first().message(), QString("23"));
+
+		const QList<Log> errors = srvlog.query().atleast(Log::Level::Error).get();
+		QCOMPARE(errors.size(), 2);
+		QCOMPARE(errors.at(0).message(), QString("20"));
+		QCOMPARE(errors.at(1).message(), QString("15"));
+
+		const QList<Log> sessionErrors = srvlog.query().session(session).atleast(Log::Level::Error).get();
+		QCOMPARE(sessionErrors.size(), 1);
+		QCOMPARE(sessionErrors.first().message(), QString("15"));
+
+		const QList<Log> paged = srvlog.query().page(1, 3).get();
+		QCOMPARE(paged.size(), 3);
+		QCOMPARE(paged.first().message(), QString("21"));
+
+		// Shrinking the limit drops the oldest entries
+		srvlog.setHistoryLimit(4);
+		QCOMPARE(srvlog.query().get().size(), 4);
+		QCOMPARE(srvlog.query().get().last().message(), QString("21"));
+		QCOMPARE(srvlog.query().atleast(Log::Level::Error).get().size(), 0);
+	}
 };
 
 
@@ -0,0 +1,174 @@
+#include "../net/textmode.h"
+#include "../net/layer.h"
+#include "../net/pen.h"
+#include "../net/protover.h"
+#include "../record/reader.h"
+
+#include <QtTest/QtTest>
+#include <QTemporaryDir>
+
+using namespace protocol;
+
+class TestTextMode: public QObject
+{
+	Q_OBJECT
+private slots:
+	void testRoundtrip()
+	{
+		const QList<MessagePtr> messages = generateMessages(50);
+		const QList<MessagePtr> parsed = parseAll(toText(messages));
+
+		QCOMPARE(parsed.size(), messages.size());
+		for(int i=0;i<messages.size();++i)
+			QVERIFY(messages.at(i)->equals(*parsed.at(i)));
+	}
+
+	void testLineEndings()
+	{
+		text::Parser parser;
+		text::Parser::Result r = parser.parseLine(QByteArray("  1 penmove 1.5 -2.25 50.000\r\n"));
+		QCOMPARE(r.status, text::Parser::Result::Ok);
+		QVERIFY(r.msg);
+
+		const PenMove *pm = static_cast<const PenMove*>(r.msg);
+		QCOMPARE(pm->points().size(), 1);
+		QCOMPARE(pm->points().at(0).x, 6);
+		QCOMPARE(pm->points().at(0).y, -9);
+		QCOMPARE(pm->points().at(0).p, 0x8000);
+		delete r.msg;
+	}
+
+	void testPenMoveEncoding_data()
+	{
+		QTest::addColumn<QByteArray>("version");
+		QTest::addColumn<int>("type");
+
+		QTest::newRow("none") << QByteArray() << int(MSG_PEN_MOVE);
+		QTest::newRow("20.1") << QByteArray("!version=dp:4.20.1\n") << int(MSG_PEN_MOVE);
+		QTest::newRow("20.2") << QByteArray("!version=dp:4.20.2\n") << int(MSG_PEN_MOVE_DELTA);
+	}
+
+	void testPenMoveEncoding()
+	{
+		QFETCH(QByteArray, version);
+		QFETCH(int, type);
+
+		// Templates made for older protocol versions must produce pen moves old clients understand
+		const QList<MessagePtr> parsed = parseAll(version + "1 penmove 1 2\n");
+		QCOMPARE(parsed.size(), 1);
+		QCOMPARE(int(parsed.first()->type()), type);
+	}
+
+	void testErrors_data()
+	{
+		QTest::addColumn<QByteArray>("line");
+		QTest::newRow("one token") << QByteArray("1");
+		QTest::newRow("bad context") << QByteArray("256 penup");
+		QTest::newRow("negative context") << QByteArray("-1 penup");
+		QTest::newRow("bad point") << QByteArray("1 penmove 1 x");
+		QTest::newRow("too many coordinates") << QByteArray("1 penmove 1 2 3 4");
+		QTest::newRow("no value") << QByteArray("1 marker text");
+		QTest::newRow("unknown") << QByteArray("1 nosuchmessage");
+	}
+
+	void testErrors()
+	{
+		QFETCH(QByteArray, line);
+		text::Parser parser;
+		const text::Parser::Result r = parser.parseLine(line);
+		QCOMPARE(r.status, text::Parser::Result::Error);
+		QVERIFY(!parser.errorString().isEmpty());
+	}
+
+	void benchmarkParser()
+	{
+		const QByteArray text = toText(generateMessages(2000));
+		int count = 0;
+		QBENCHMARK {
+			count = parseAll(text).size();
+		}
+		QCOMPARE(count, 2000 * 2 + 1);
+	}
+
+	void benchmarkTemplateLoad()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+
+		const QString path = dir.filePath("template.dptxt");
+		{
+			QFile f(path);
+			QVERIFY(f.open(QFile::WriteOnly));
+			f.write("!version=" + ProtocolVersion::current().asString().toUtf8() + "\n");
+			f.write(toText(generateMessages(2000)));
+		}
+
+		int count = 0;
+		QBENCHMARK {
+			recording::Reader reader(path);
+			QCOMPARE(reader.open(), recording::COMPATIBLE);
+			count = 0;
+			while(true) {
+				const recording::MessageRecord r = reader.readNext();
+				if(r.status != recording::MessageRecord::OK)
+					break;
+				delete r.message;
+				++count;
+			}
+		}
+		QCOMPARE(count, 2000 * 2 + 1);
+	}
+
+private:
+	//! Generate a layer and a number of 64 point strokes
+	static QList<MessagePtr> generateMessages(int strokes)
+	{
+		QList<MessagePtr> messages;
+		messages << MessagePtr(new LayerCreate(1, 0x0101, 0, 0xffffffff, 0, QStringLiteral("Background")));
+
+		for(int i=0;i<strokes;++i) {
+			PenPointVector points;
+			for(int j=0;j<64;++j)
+				points << PenPoint((i * 7 + j * 13) % 4000, (i * 3 + j * 11) % 3000, (j * 1021) % 0xffff);
+
+			messages << MessagePtr(new PenMove(1, points));
+			messages << MessagePtr(new PenUp(1));
+		}
+		return messages;
+	}
+
+	static QByteArray toText(const QList<MessagePtr> &messages)
+	{
+		QByteArray text;
+		for(const MessagePtr &msg : messages) {
+			text += msg->toString().toUtf8();
+			text += '\n';
+		}
+		return text;
+	}
+
+	static QList<MessagePtr> parseAll(const QByteArray &text)
+	{
+		QList<MessagePtr> messages;
+		text::Parser parser;
+		int pos = 0;
+		while(pos < text.length()) {
+			int end = text.indexOf('\n', pos);
+			if(end<0)
+				end = text.length();
+
+			const text::Parser::Result r = parser.parseLine(QByteArray::fromRawData(text.constData() + pos, end - pos));
+			if(r.status == text::Parser::Result::Error)
+				qFatal("parse error: %s", qPrintable(parser.errorString()));
+			else if(r.status == text::Parser::Result::Ok)
+				messages << MessagePtr(r.msg);
+
+			pos = end + 1;
+		}
+		return messages;
+	}
+};
+
+
+QTEST_MAIN(TestTextMode)
+#include "textmode.moc"
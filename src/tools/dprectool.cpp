@@ -30,9 +30,209 @@
 #include <QCommandLineParser>
 #include <QTextStream>
 #include <QFile>
+#include <QBuffer>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QVector>
+
+#include <memory>
 
 using namespace recording;
 
+namespace {
+
+//! Number of messages converted as one unit of work in pipelined mode
+const int CHUNK_MESSAGES = 2048;
+
+//! A run of serialized messages read from the input
+struct Chunk {
+	QByteArray data;
+	QVector<qint64> positions; // file position of each message
+	QVector<bool> invalid;     // the message could not be parsed and has no data
+};
+
+//! The comment written in place of a message that could not be read
+QString invalidMessageComment(int type, int len, qint64 pos)
+{
+	return QStringLiteral("WARNING: Unrecognized message type %1 of length %2 at offset 0x%3")
+		.arg(type)
+		.arg(len)
+		.arg(pos);
+}
+
+/**
+ * @brief Writes converted chunks to the output file in the original order
+ *
+ * This runs in its own thread, so output compression happens in parallel
+ * with reading and conversion. The number of chunks in flight is limited
+ * to keep memory usage bounded.
+ */
+class OrderedWriter : public QThread
+{
+public:
+	OrderedWriter(Writer *writer, int maxPending)
+		: m_writer(writer), m_slots(maxPending), m_total(-1), m_failed(false)
+	{ }
+
+	//! Reserve room for a new chunk. Blocks while too many chunks are pending
+	void reserve() { m_slots.acquire(); }
+
+	//! Hand over a converted chunk. This is called from the worker threads
+	void put(int index, const QByteArray &data)
+	{
+		QMutexLocker lock(&m_mutex);
+		m_done[index] = data;
+		m_cond.wakeAll();
+	}
+
+	//! All chunks have been handed out
+	void finish(int total)
+	{
+		QMutexLocker lock(&m_mutex);
+		m_total = total;
+		m_cond.wakeAll();
+	}
+
+	bool failed() const { return m_failed; }
+
+protected:
+	void run() override
+	{
+		for(int next=0;;++next) {
+			QMutexLocker lock(&m_mutex);
+			while(!m_done.contains(next) && (m_total < 0 || next < m_total))
+				m_cond.wait(&m_mutex);
+
+			if(!m_done.contains(next))
+				return;
+
+			const QByteArray data = m_done.take(next);
+			lock.unlock();
+
+			if(!m_failed && !m_writer->writeEncoded(data)) {
+				fprintf(stderr, "Error while writing: %s\n", qPrintable(m_writer->errorString()));
+				m_failed = true;
+			}
+			m_slots.release();
+		}
+	}
+
+private:
+	Writer *m_writer;
+	QSemaphore m_slots;
+	QMutex m_mutex;
+	QWaitCondition m_cond;
+	QHash<int, QByteArray> m_done;
+	int m_total;
+	bool m_failed;
+};
+
+/**
+ * @brief Decode a chunk of messages and encode it in the output format
+ */
+class ConvertChunk : public QRunnable
+{
+public:
+	ConvertChunk(int index, const Chunk &chunk, Writer::Encoding encoding, OrderedWriter *out)
+		: m_index(index), m_chunk(chunk), m_encoding(encoding), m_out(out)
+	{ }
+
+	void run() override
+	{
+		QBuffer buffer;
+		buffer.open(QBuffer::WriteOnly);
+
+		Writer writer(&buffer);
+		writer.setEncoding(m_encoding);
+
+		const uchar *data = reinterpret_cast<const uchar*>(m_chunk.data.constData());
+		int offset = 0;
+		for(int i=0;i<m_chunk.positions.size();++i) {
+			const qint64 pos = m_chunk.positions.at(i);
+
+			// Text that couldn't be parsed is reported the same way as in sequential conversion
+			if(m_chunk.invalid.at(i)) {
+				writer.writeComment(invalidMessageComment(protocol::MSG_COMMAND, 0, pos));
+				continue;
+			}
+
+			const int len = protocol::Message::sniffLength(m_chunk.data.constData() + offset);
+			std::unique_ptr<protocol::Message> msg { protocol::Message::deserialize(data + offset, m_chunk.data.length() - offset, true) };
+
+			if(msg)
+				writer.writeMessage(*msg);
+			else
+				writer.writeComment(invalidMessageComment(data[offset+2], len, pos));
+
+			offset += len;
+		}
+
+		m_out->put(m_index, buffer.data());
+	}
+
+private:
+	int m_index;
+	Chunk m_chunk;
+	Writer::Encoding m_encoding;
+	OrderedWriter *m_out;
+};
+
+/**
+ * @brief Convert a recording using a pipeline of threads
+ *
+ * This thread reads (and decompresses) the input, a thread pool
+ * converts chunks of messages and a writer thread compresses and writes
+ * the output.
+ */
+bool convertPipelined(Reader &reader, Writer &writer, int threads)
+{
+	QThreadPool pool;
+	pool.setMaxThreadCount(threads);
+
+	OrderedWriter out(&writer, threads * 2);
+	out.start();
+
+	QByteArray buffer;
+	Chunk chunk;
+	int chunks = 0;
+
+	while(true) {
+		const bool ok = reader.readNextToBuffer(buffer);
+		if(ok) {
+			chunk.data.append(buffer.constData(), protocol::Message::sniffLength(buffer.constData()));
+			chunk.positions << reader.currentPosition();
+			chunk.invalid << false;
+
+		} else if(!reader.isEof()) {
+			// A line of a text mode recording that couldn't be parsed
+			chunk.positions << reader.currentPosition();
+			chunk.invalid << true;
+		}
+
+		if(chunk.positions.size() >= CHUNK_MESSAGES || (!ok && reader.isEof() && !chunk.positions.isEmpty())) {
+			out.reserve();
+			pool.start(new ConvertChunk(chunks++, chunk, writer.encoding(), &out));
+			chunk = Chunk();
+		}
+
+		if(!ok && reader.isEof())
+			break;
+	}
+
+	pool.waitForDone();
+	out.finish(chunks);
+	out.wait();
+
+	return !out.failed();
+}
+
+}
+
 void printVersion()
 {
 	printf("dprectool " DRAWPILE_VERSION "\n");
@@ -40,7 +240,7 @@ void printVersion()
 	printf("Qt version: %s (compiled against %s)\n", qVersion(), QT_VERSION_STR);
 }
 
-bool convertRecording(const QString &inputfilename, const QString &outputfilename, const QString &outputFormat, bool doAclFiltering)
+bool convertRecording(const QString &inputfilename, const QString &outputfilename, const QString &outputFormat, bool doAclFiltering, int threads)
 {
 	// Open input file
 	Reader reader(inputfilename);
@@ -82,6 +282,10 @@ bool convertRecording(const QString &inputfilename, const QString &outputfilenam
 
 	} else {
 		writer.reset(new Writer(outputfilename));
+
+		// Conversion is done offline, so we can afford the slower but better
+		// compression if a block compressed (.dprecb) output was requested.
+		writer->setArchivalCompression();
 	}
 
 	// Output format override
@@ -109,6 +313,11 @@ bool convertRecording(const QString &inputfilename, const QString &outputfilenam
 		return false;
 	}
 
+	// ACL filtering is stateful and must see every message in order,
+	// so only plain conversion can be done in parallel.
+	if(threads > 1 && !doAclFiltering)
+		return convertPipelined(reader, *writer, threads);
+
 	// Prepare filters
 	canvas::AclFilter aclFilter;
 	aclFilter.reset(1, false);
@@ -136,11 +345,7 @@ bool convertRecording(const QString &inputfilename, const QString &outputfilenam
 			}
 
 		case MessageRecord::INVALID:
-			writer->writeComment(QStringLiteral("WARNING: Unrecognized message type %1 of length %2 at offset 0x%3")
-				.arg(int(mr.error.type))
-				.arg(mr.error.len)
-				.arg(reader.currentPosition())
-				);
+			writer->writeComment(invalidMessageComment(mr.error.type, mr.error.len, reader.currentPosition()));
 			break;
 
 		case MessageRecord::END_OF_RECORDING:
@@ -189,6 +394,61 @@ bool printRecordingVersion(const QString &inputFilename)
 	return true;
 }
 
+/**
+ * Print the number of messages and total bytes of each message type in the recording.
+ * Messages are not decoded, except for one of each type to find out its name.
+ */
+bool printRecordingStats(const QString &inputFilename)
+{
+	Reader reader(inputFilename);
+	switch(reader.open()) {
+	case NOT_DPREC:
+		fprintf(stderr, "Not a drawpile recording!\n");
+		return false;
+	case CANNOT_READ:
+		fprintf(stderr, "Cannot read file: %s\n", qPrintable(reader.errorString()));
+		return false;
+	default: break;
+	}
+
+	quint64 counts[256] = {0};
+	quint64 bytes[256] = {0};
+	QString names[256];
+
+	QByteArray buffer;
+	while(true) {
+		if(!reader.readNextToBuffer(buffer)) {
+			if(reader.isEof())
+				break;
+			continue;
+		}
+
+		const int len = protocol::Message::sniffLength(buffer.constData());
+		const uchar type = buffer.at(2);
+
+		if(counts[type] == 0) {
+			std::unique_ptr<protocol::Message> msg { protocol::Message::deserialize(reinterpret_cast<const uchar*>(buffer.constData()), buffer.length(), true) };
+			names[type] = msg ? msg->messageName() : QStringLiteral("(unknown)");
+		}
+
+		++counts[type];
+		bytes[type] += len;
+	}
+
+	quint64 totalCount = 0, totalBytes = 0;
+	printf("%4s %-24s %12s %14s\n", "type", "name", "count", "bytes");
+	for(int i=0;i<256;++i) {
+		if(counts[i] == 0)
+			continue;
+		printf("%4d %-24s %12llu %14llu\n", i, qPrintable(names[i]), counts[i], bytes[i]);
+		totalCount += counts[i];
+		totalBytes += bytes[i];
+	}
+	printf("%4s %-24s %12llu %14llu\n", "", "total", totalCount, totalBytes);
+
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	QCoreApplication app(argc, argv);
 
@@ -219,6 +479,14 @@ int main(int argc, char *argv[]) {
 	QCommandLineOption aclOption(QStringList() << "A" << "acl", "Perform ACL filtering");
 	parser.addOption(aclOption);
 
+	// --threads, -j
+	QCommandLineOption threadsOption(QStringList() << "j" << "threads", "Number of conversion threads (1 disables pipelined conversion)", "threads", QString::number(QThread::idealThreadCount()));
+	parser.addOption(threadsOption);
+
+	// --stats, -s
+	QCommandLineOption statsOption(QStringList() << "s" << "stats", "Print message type statistics");
+	parser.addOption(statsOption);
+
 	// input file name
 	parser.addPositionalArgument("input", "recording file", "<input.dprec>");
 
@@ -241,11 +509,16 @@ int main(int argc, char *argv[]) {
 		return !printRecordingVersion(inputfiles.at(0));
 	}
 
+	if(parser.isSet(statsOption)) {
+		return !printRecordingStats(inputfiles.at(0));
+	}
+
 	if(!convertRecording(
 		inputfiles.at(0),
 		parser.value(outOption),
 		parser.value(formatOption),
-		parser.isSet(aclOption)
+		parser.isSet(aclOption),
+		parser.value(threadsOption).toInt()
 		))
 		return 1;
 